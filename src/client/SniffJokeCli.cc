@@ -31,20 +31,25 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 
-SniffJokeCli::SniffJokeCli(const char* serveraddr, uint16_t serverport, uint32_t ms_timeout) :
+SniffJokeCli::SniffJokeCli(const char* serveraddr, uint16_t serverport, uint32_t ms_timeout, const char *sockpath) :
 serveraddr(serveraddr),
 serverport(serverport),
-ms_timeout(ms_timeout)
+ms_timeout(ms_timeout),
+sockpath(sockpath)
 {
 }
 
 int32_t SniffJokeCli::send_command(const char *cmdstring)
 {
+    if (sockpath != NULL)
+        return send_stream_command(cmdstring);
+
     int sock;
     struct sockaddr_in service_sin; /* address of service */
     struct sockaddr_in from; /* address used for receiving data */
@@ -133,6 +138,283 @@ int32_t SniffJokeCli::send_command(const char *cmdstring)
     return SJ_OK;
 }
 
+/*
+ * the stream protocol has not the size limit of the datagrams: "info" and
+ * "ttlmap" are paginated by the service, and the pages are requested until
+ * the snapshot is over.
+ */
+int32_t SniffJokeCli::send_stream_command(const char *cmdstring)
+{
+    int sock;
+    struct sockaddr_un service_sun;
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        fprintf(stderr, "FATAL: unable to open unix socket for connect to SniffJoke service: %s", strerror(errno));
+        return SJ_ERROR;
+    }
+
+    memset(&service_sun, 0x00, sizeof (service_sun));
+    service_sun.sun_family = AF_UNIX;
+    snprintf(service_sun.sun_path, sizeof (service_sun.sun_path), "%s", sockpath);
+
+    if (connect(sock, (const struct sockaddr *) &service_sun, sizeof (service_sun)) == -1)
+    {
+        printf("unable to connect to %s: SniffJoke is not running, or wrong --socket: %s\n", sockpath, strerror(errno));
+        close(sock);
+        return SJ_ERROR;
+    }
+
+    char request[ADMIN_STREAM_MAXCMD];
+    uint32_t printed = 0, cursor = 0;
+    int32_t ret = SJ_OK;
+
+    snprintf(request, sizeof (request), "%s", cmdstring);
+
+    do
+    {
+        vector<uint8_t> answer;
+        struct command_ret blockInfo;
+        struct page_ret pageInfo;
+
+        if (!streamExchange(sock, request, answer))
+        {
+            ret = SJ_ERROR;
+            break;
+        }
+
+        memcpy(&blockInfo, &answer[0], sizeof (blockInfo));
+
+        if (blockInfo.cmd_type != INFOPAGE_COMMAND_TYPE && blockInfo.cmd_type != TTLMAPPAGE_COMMAND_TYPE)
+        {
+            if (!(parse_SjinternalProto(&answer[0], answer.size())))
+            {
+                fprintf(stderr, "error in parsing received message\n");
+                ret = SJ_ERROR;
+            }
+            break;
+        }
+
+        if (answer.size() < sizeof (blockInfo) + sizeof (pageInfo))
+        {
+            fprintf(stderr, "error in parsing received page\n");
+            ret = SJ_ERROR;
+            break;
+        }
+
+        memcpy(&pageInfo, &answer[sizeof (blockInfo)], sizeof (pageInfo));
+
+        const uint8_t *records = &answer[sizeof (blockInfo) + sizeof (pageInfo)];
+        const uint32_t recordslen = answer.size() - sizeof (blockInfo) - sizeof (pageInfo);
+
+        if (blockInfo.cmd_type == INFOPAGE_COMMAND_TYPE)
+        {
+            if (!printed)
+                printf("received snapshot of %u sessions\n", pageInfo.total);
+            printSJSessionInfo(records, recordslen, printed + 1);
+            printed += recordslen / sizeof (struct sex_record);
+        }
+        else
+        {
+            if (!printed)
+                printf("received snapshot of %u hosts\n", pageInfo.total);
+            printSJTTL(records, recordslen, printed + 1);
+            printed += recordslen / sizeof (struct ttl_record);
+        }
+
+        cursor = pageInfo.cursor;
+        snprintf(request, sizeof (request), "%s %u",
+                 blockInfo.cmd_type == INFOPAGE_COMMAND_TYPE ? "info" : "ttlmap", cursor);
+    }
+    while (cursor);
+
+    close(sock);
+    return ret;
+}
+
+/* send a length prefixed request and receive the whole answer */
+bool SniffJokeCli::streamExchange(int sock, const char *request, vector<uint8_t> &answer)
+{
+    uint8_t frame[sizeof (uint32_t) + ADMIN_STREAM_MAXCMD];
+    const uint32_t framelen = sizeof (uint32_t) + strlen(request);
+    uint32_t answerlen, sent = 0;
+
+    memcpy(frame, &framelen, sizeof (framelen));
+    memcpy(&frame[sizeof (framelen)], request, framelen - sizeof (framelen));
+
+    while (sent < framelen)
+    {
+        const ssize_t ret = send(sock, &frame[sent], framelen - sent, MSG_NOSIGNAL);
+        if (ret == -1)
+        {
+            fprintf(stderr, "FATAL: unable to send message [%s] via %s: %s", request, sockpath, strerror(errno));
+            return false;
+        }
+        sent += ret;
+    }
+
+    /* the answer is a command_ret block, the first uint32_t is the whole length */
+    if (!streamRead(sock, (uint8_t *) &answerlen, sizeof (answerlen)))
+        return false;
+
+    if (answerlen < sizeof (struct command_ret))
+    {
+        printf("invalid lenght (declared %u)\n", answerlen);
+        return false;
+    }
+
+    answer.resize(answerlen);
+    memcpy(&answer[0], &answerlen, sizeof (answerlen));
+
+    return streamRead(sock, &answer[sizeof (answerlen)], answerlen - sizeof (answerlen));
+}
+
+bool SniffJokeCli::streamRead(int sock, uint8_t *buf, uint32_t len)
+{
+    struct pollfd fd;
+    fd.events = POLLIN;
+    fd.fd = sock;
+
+    while (len)
+    {
+        if (poll(&fd, 1, ms_timeout) != 1)
+        {
+            printf("connection timeout: SniffJoke is not answering, or --timeout too low\n");
+            return false;
+        }
+
+        const ssize_t ret = recv(sock, buf, len, 0);
+        if (ret <= 0)
+        {
+            printf("unable to receive from unix socket: %s\n", ret ? strerror(errno) : "connection closed");
+            return false;
+        }
+
+        buf += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+/* seqlock reader: the copy is retried while the service is updating the segment */
+static void readStatsSegment(const struct sj_stats_segment *segment, struct sj_stats *stats)
+{
+    uint32_t seq;
+
+    do
+    {
+        while ((seq = segment->seq) & 1)
+            ;
+
+        __sync_synchronize();
+        memcpy(stats, (const void *) &segment->stats, sizeof (*stats));
+        __sync_synchronize();
+    }
+    while (seq != segment->seq);
+}
+
+static double elapsedRate(uint64_t now, uint64_t before, double seconds)
+{
+    return seconds > 0 ? (double) (now - before) / seconds : 0.0;
+}
+
+int32_t SniffJokeCli::top(void)
+{
+    int fd;
+    struct sj_stats_segment *segment;
+    struct sj_stats prev, cur;
+    struct timespec prev_ts, cur_ts;
+
+    if ((fd = shm_open(SJ_STATS_SHM, O_RDONLY, 0)) == -1)
+    {
+        printf("unable to open the statistics segment %s: SniffJoke is not running: %s\n", SJ_STATS_SHM, strerror(errno));
+        return SJ_ERROR;
+    }
+
+    segment = (struct sj_stats_segment *) mmap(NULL, sizeof (struct sj_stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if ((void *) segment == MAP_FAILED)
+    {
+        printf("unable to map the statistics segment %s: %s\n", SJ_STATS_SHM, strerror(errno));
+        return SJ_ERROR;
+    }
+
+    if (segment->magic != SJ_STATS_MAGIC || segment->version != SJ_STATS_VERSION)
+    {
+        printf("the statistics segment %s has an unknown format (version %u)\n", SJ_STATS_SHM, segment->version);
+        munmap(segment, sizeof (struct sj_stats_segment));
+        return SJ_ERROR;
+    }
+
+    readStatsSegment(segment, &prev);
+    clock_gettime(CLOCK_MONOTONIC, &prev_ts);
+
+    while (true)
+    {
+        usleep(SJCTL_TOP_INTERVAL * 1000);
+
+        readStatsSegment(segment, &cur);
+        clock_gettime(CLOCK_MONOTONIC, &cur_ts);
+
+        const double secs = (cur_ts.tv_sec - prev_ts.tv_sec) + (cur_ts.tv_nsec - prev_ts.tv_nsec) / 1e9;
+        char clockstr[SMALLBUF] = {0};
+        strftime(clockstr, sizeof (clockstr), "%H:%M:%S", localtime(&cur.clock));
+
+        /* clear the screen and move the cursor home */
+        printf("\033[H\033[2J");
+        printf("SniffJoke live statistics, service clock %s%s\n\n", clockstr,
+               cur.loops == prev.loops ? " (not updating)" : "");
+
+        printf("%-16s %14s %14s %14s %14s\n", "", "pkts/s", "kB/s", "pkts", "bytes");
+        printf("%-16s %14.0f %14.1f %14lu %14lu\n", "tunnel rx",
+               elapsedRate(cur.tunnel_rx_pkts, prev.tunnel_rx_pkts, secs),
+               elapsedRate(cur.tunnel_rx_bytes, prev.tunnel_rx_bytes, secs) / 1024,
+               (unsigned long) cur.tunnel_rx_pkts, (unsigned long) cur.tunnel_rx_bytes);
+        printf("%-16s %14.0f %14.1f %14lu %14lu\n", "network tx",
+               elapsedRate(cur.network_tx_pkts, prev.network_tx_pkts, secs),
+               elapsedRate(cur.network_tx_bytes, prev.network_tx_bytes, secs) / 1024,
+               (unsigned long) cur.network_tx_pkts, (unsigned long) cur.network_tx_bytes);
+        printf("%-16s %14.0f %14.1f %14lu %14lu\n", "network rx",
+               elapsedRate(cur.network_rx_pkts, prev.network_rx_pkts, secs),
+               elapsedRate(cur.network_rx_bytes, prev.network_rx_bytes, secs) / 1024,
+               (unsigned long) cur.network_rx_pkts, (unsigned long) cur.network_rx_bytes);
+        printf("%-16s %14.0f %14.1f %14lu %14lu\n\n", "tunnel tx",
+               elapsedRate(cur.tunnel_tx_pkts, prev.tunnel_tx_pkts, secs),
+               elapsedRate(cur.tunnel_tx_bytes, prev.tunnel_tx_bytes, secs) / 1024,
+               (unsigned long) cur.tunnel_tx_pkts, (unsigned long) cur.tunnel_tx_bytes);
+
+        printf("queues: YOUNG %u KEEP %u HACK %u SEND %u\n",
+               cur.queue_depth[0], cur.queue_depth[1], cur.queue_depth[2], cur.queue_depth[3]);
+        printf("tracked: sessions %u ttlfocus %u\n\n", cur.sessions, cur.ttlfocus);
+
+        printf("injected: %s %lu (%.0f/s) %s %lu (%.0f/s) %s %lu (%.0f/s) %s %lu (%.0f/s)\n",
+               SCRAMBLE_INNOCENT_STR, (unsigned long) cur.injected[0], elapsedRate(cur.injected[0], prev.injected[0], secs),
+               SCRAMBLE_TTL_STR, (unsigned long) cur.injected[1], elapsedRate(cur.injected[1], prev.injected[1], secs),
+               SCRAMBLE_CHECKSUM_STR, (unsigned long) cur.injected[2], elapsedRate(cur.injected[2], prev.injected[2], secs),
+               SCRAMBLE_MALFORMED_STR, (unsigned long) cur.injected[3], elapsedRate(cur.injected[3], prev.injected[3], secs));
+        printf("drops %lu (%.0f/s) malformed %lu PacketFilter matches %lu (%.0f/s)\n",
+               (unsigned long) cur.drops, elapsedRate(cur.drops, prev.drops, secs),
+               (unsigned long) cur.malformed,
+               (unsigned long) cur.filter_matches, elapsedRate(cur.filter_matches, prev.filter_matches, secs));
+        printf("ttl probes %lu (%.0f/s) packets to unadmitted destinations %lu (%.0f/s)\n",
+               (unsigned long) cur.ttl_probes, elapsedRate(cur.ttl_probes, prev.ttl_probes, secs),
+               (unsigned long) cur.ttl_unadmitted, elapsedRate(cur.ttl_unadmitted, prev.ttl_unadmitted, secs));
+        printf("offloaded flows %lu (%.0f/s)\n",
+               (unsigned long) cur.offloaded_flows, elapsedRate(cur.offloaded_flows, prev.offloaded_flows, secs));
+
+        fflush(stdout);
+
+        prev = cur;
+        prev_ts = cur_ts;
+    }
+
+    /* never reached: the loop is interrupted by a signal */
+    munmap(segment, sizeof (struct sj_stats_segment));
+    return SJ_OK;
+}
+
 #define SPACESIZE   20
 
 uint32_t SniffJokeCli::fillingSpaces(uint16_t p)
@@ -241,6 +523,12 @@ bool SniffJokeCli::parse_SjinternalProto(uint8_t *recvd, uint32_t rcvdlen)
     case TTLMAP_COMMAND_TYPE:
         printf("received (%d bytes) confirm of TTL MAP command\n", rcvdlen);
         return printSJTTL(&recvd[sizeof (blockInfo)], rcvdlen - sizeof (blockInfo));
+    case PLUGINSTAT_COMMAND_TYPE:
+        printf("received (%d bytes) confirm of PLUGIN STAT command\n", rcvdlen);
+        return printSJPluginStat(&recvd[sizeof (blockInfo)], rcvdlen - sizeof (blockInfo));
+    case LATENCY_COMMAND_TYPE:
+        printf("received (%d bytes) confirm of LATENCY command\n", rcvdlen);
+        return printSJLatency(&recvd[sizeof (blockInfo)], rcvdlen - sizeof (blockInfo));
     case COMMAND_ERROR_MSG:
         printf("received (%d bytes) error in command sent\n", rcvdlen);
         return printSJError(&recvd[sizeof (blockInfo)], rcvdlen - sizeof (blockInfo));
@@ -373,10 +661,10 @@ bool SniffJokeCli::printSJStat(const uint8_t *statblock, uint32_t blocklen)
     return true;
 }
 
-bool SniffJokeCli::printSJSessionInfo(const uint8_t *received, uint32_t rcvdlen)
+bool SniffJokeCli::printSJSessionInfo(const uint8_t *received, uint32_t rcvdlen, uint32_t first)
 {
     struct sex_record *sr;
-    uint32_t cnt = 1, i = 0;
+    uint32_t cnt = first, i = 0;
 
     while (i < rcvdlen)
     {
@@ -390,7 +678,7 @@ bool SniffJokeCli::printSJSessionInfo(const uint8_t *received, uint32_t rcvdlen)
         i += sizeof (struct sex_record);
     }
 
-    if (!i)
+    if (!i && first == 1)
     {
         printf("no sessions appear tracked at the moment\n");
     }
@@ -398,10 +686,10 @@ bool SniffJokeCli::printSJSessionInfo(const uint8_t *received, uint32_t rcvdlen)
     return true;
 }
 
-bool SniffJokeCli::printSJTTL(const uint8_t *received, uint32_t rcvdlen)
+bool SniffJokeCli::printSJTTL(const uint8_t *received, uint32_t rcvdlen, uint32_t first)
 {
     struct ttl_record *tr;
-    uint32_t cnt = 1, i = 0;
+    uint32_t cnt = first, i = 0;
 
     struct tm *tm;
     char access[SMALLBUF] = {0};
@@ -427,7 +715,7 @@ bool SniffJokeCli::printSJTTL(const uint8_t *received, uint32_t rcvdlen)
         i += sizeof (struct ttl_record);
     }
 
-    if (!i)
+    if (!i && first == 1)
     {
         printf("no hosts appear hop-mapped at the moment\n");
     }
@@ -435,6 +723,91 @@ bool SniffJokeCli::printSJTTL(const uint8_t *received, uint32_t rcvdlen)
     return true;
 }
 
+/* upper bound of the bucket containing the requested percentile */
+static uint64_t histogramPercentile(const uint32_t *histogram, uint32_t percent)
+{
+    uint64_t total = 0, seen = 0;
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        total += histogram[i];
+
+    if (!total)
+        return 0;
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += histogram[i];
+        if (seen * 100 >= total * percent)
+            return (uint64_t) 1 << (i + 1);
+    }
+
+    return (uint64_t) 1 << HISTOGRAM_BUCKETS;
+}
+
+bool SniffJokeCli::printSJPluginStat(const uint8_t *received, uint32_t rcvdlen)
+{
+    struct plugin_record *pr;
+    uint32_t i = 0;
+
+    printf("%-24s %10s %10s %8s %10s %12s %6s %6s %6s %10s %10s %10s %10s\n",
+           "plugin", "cond", "cond hit", "apply", "inj pkts", "inj bytes",
+           "integ", "remov", "drops", "cond avg", "cond p99", "apply avg", "apply p99");
+
+    while (i + sizeof (struct plugin_record) <= rcvdlen)
+    {
+        pr = (struct plugin_record *) &received[i];
+
+        printf("%-24s %10lu %10lu %8lu %10lu %12lu %6lu %6lu %6lu %10lu %10lu %10lu %10lu\n",
+               pr->name,
+               (unsigned long) pr->condition_calls, (unsigned long) pr->condition_hits,
+               (unsigned long) pr->apply_calls,
+               (unsigned long) pr->injected_pkts, (unsigned long) pr->injected_bytes,
+               (unsigned long) pr->integrity_failures, (unsigned long) pr->orig_removals,
+               (unsigned long) pr->fix_drops,
+               (unsigned long) (pr->condition_calls ? pr->condition_cycles / pr->condition_calls : 0),
+               (unsigned long) histogramPercentile(pr->condition_hist, 99),
+               (unsigned long) (pr->apply_calls ? pr->apply_cycles / pr->apply_calls : 0),
+               (unsigned long) histogramPercentile(pr->apply_hist, 99)
+               );
+
+        i += sizeof (struct plugin_record);
+    }
+
+    if (!i)
+        printf("no plugins appear loaded at the moment\n");
+    else
+        printf("time values are in cycles (TSC), the p99 is the upper bound of a log2 bucket\n");
+
+    return true;
+}
+
+bool SniffJokeCli::printSJLatency(const uint8_t *received, uint32_t rcvdlen)
+{
+    struct latency_record *lr;
+    uint32_t i = 0;
+
+    printf("%-16s %12s %12s %12s %12s %12s\n", "", "packets", "avg us", "p50 us", "p99 us", "max us");
+
+    while (i + sizeof (struct latency_record) <= rcvdlen)
+    {
+        lr = (struct latency_record *) &received[i];
+
+        printf("%-16s %12lu %12.1f %12.1f %12.1f %12.1f\n",
+               lr->name, (unsigned long) lr->count,
+               lr->count ? (double) lr->sum / lr->count / 1000 : 0.0,
+               (double) histogramPercentile(lr->hist, 50) / 1000,
+               (double) histogramPercentile(lr->hist, 99) / 1000,
+               (double) lr->max / 1000);
+
+        i += sizeof (struct latency_record);
+    }
+
+    printf("the first four rows are the queues residence, the others the forwarding latency by source;\n"
+           "the percentiles are the upper bound of a log2 bucket\n");
+
+    return true;
+}
+
 bool SniffJokeCli::printSJPort(const uint8_t *statblock, uint32_t blocklen)
 {
     char resolvedInfo[MEDIUMBUF];
@@ -26,6 +26,7 @@
 #include "service/Utils.h"
 
 #include <cstdio>
+#include <vector>
 #include <stdint.h>
 
 using namespace std;
@@ -33,6 +34,7 @@ using namespace std;
 #define SJCTL_VERSION           "0.4.0"
 
 #define SJCTL_DEFAULT_TIMEOUT   500
+#define SJCTL_TOP_INTERVAL      1000 /* ms between two screens of "top" */
 #define SJ_ERROR                1
 #define SJ_OK                   0
 
@@ -48,8 +50,14 @@ private:
     const char *serveraddr;
     uint16_t serverport;
     uint32_t ms_timeout;
+    const char *sockpath;
     const char *cmd_buffer;
 
+    /* stream admin protocol over the unix socket */
+    int32_t send_stream_command(const char *);
+    bool streamExchange(int, const char *, vector<uint8_t> &);
+    bool streamRead(int, uint8_t *, uint32_t);
+
     uint32_t fillingSpaces(uint16_t);
     uint32_t fillingSpace(uint16_t, uint16_t);
     void resolveWeight(char *, size_t, uint32_t);
@@ -58,13 +66,17 @@ private:
     bool printSJStat(const uint8_t *, uint32_t);
     bool printSJPort(const uint8_t *, uint32_t);
     bool printSJError(const uint8_t *, uint32_t);
-    bool printSJSessionInfo(const uint8_t *, uint32_t);
-    bool printSJTTL(const uint8_t *, uint32_t);
+    bool printSJSessionInfo(const uint8_t *, uint32_t, uint32_t first = 1);
+    bool printSJTTL(const uint8_t *, uint32_t, uint32_t first = 1);
+    bool printSJPluginStat(const uint8_t *, uint32_t);
+    bool printSJLatency(const uint8_t *, uint32_t);
 
 public:
-    SniffJokeCli(const char *, uint16_t, uint32_t);
+    SniffJokeCli(const char *, uint16_t, uint32_t, const char *);
     /* 0 on success, 1 on error */
     int32_t send_command(const char *cmdstring);
+    /* read the live statistics segment until interrupted */
+    int32_t top(void);
 };
 
 #endif /* SJ_SNIFFJOKECLI_H */
@@ -38,6 +38,7 @@ static void sjcli_version(const char *pname)
 #define SNIFFJOKECLI_HELP_FORMAT \
 	"Usage: %s [OPTIONS]... [COMMANDS]...\n"\
 	" --address <ip>[:port]\tspecify administration IP address [default: %s:%d]\n"\
+	" --socket <path>\tuse the administration unix socket, <working dir>/%s in the service\n"\
 	" --version\t\tshow sniffjoke version\n"\
 	" --timeout\t\tset milliseconds timeout when contacting SniffJoke service [default: %d]\n"\
 	" --help\t\t\tshow this help\n\n"\
@@ -49,6 +50,9 @@ static void sjcli_version(const char *pname)
 	" stat\t\t\tget statistics about sniffjoke configuration and network\n"\
 	" info\t\t\tget statistics about sniffjoke active sessions\n"\
 	" ttlmap\t\t\tshow the mapped hop count for destination\n"\
+	" pluginstat\t\tshow the per plugin performance counters\n"\
+	" latency\t\tshow the queues residence time and the forwarding latency\n"\
+	" top\t\t\tshow the live statistics, refreshed every second\n"\
 	" showport\t\tshow the running port-aggressivity configuration\n"\
 	" set start:end value\tset the injection's strogness over selected port [not supported!]\n"\
     "\t\tneed to be set in port-aggressivity.conf\n"\
@@ -60,6 +64,7 @@ static void sjcli_help(const char *pname)
     printf(SNIFFJOKECLI_HELP_FORMAT,
            pname,
            DEFAULT_ADMIN_ADDRESS, DEFAULT_ADMIN_PORT,
+           FILE_ADMINSOCKET,
            SJCTL_DEFAULT_TIMEOUT,
            SUPPRESS_LEVEL, PACKET_LEVEL
            );
@@ -98,6 +103,7 @@ int main(int argc, char **argv)
     {
         char admin_address[256];
         uint16_t admin_port;
+        char admin_socket[256];
         uint32_t ms_timeout;
         char cmd_buffer[256];
     } useropt;
@@ -115,6 +121,9 @@ int main(int argc, char **argv)
         { "saveconf", 1},
         { "info", 1},
         { "ttlmap", 1},
+        { "pluginstat", 1},
+        { "latency", 1},
+        { "top", 1},
         { "stat", 1},
         { "showport", 1},
         { "set", 3},
@@ -131,6 +140,7 @@ int main(int argc, char **argv)
 
     struct option sjcli_option[] = {
         { "address", required_argument, NULL, 'a'},
+        { "socket", required_argument, NULL, 's'},
         { "timeout", required_argument, NULL, 't'},
         { "version", no_argument, NULL, 'v'},
         { "help", no_argument, NULL, 'h'},
@@ -138,7 +148,7 @@ int main(int argc, char **argv)
     };
 
     int charopt;
-    while ((charopt = getopt_long(argc, argv, "c:a:t:vh", sjcli_option, NULL)) != -1)
+    while ((charopt = getopt_long(argc, argv, "c:a:s:t:vh", sjcli_option, NULL)) != -1)
     {
         switch (charopt)
         {
@@ -159,6 +169,9 @@ int main(int argc, char **argv)
                 useropt.admin_port = (uint16_t) checked_port;
             }
             break;
+        case 's':
+            snprintf(useropt.admin_socket, sizeof (useropt.admin_socket), "%s", optarg);
+            break;
         case 't':
             useropt.ms_timeout = atoi(optarg);
             break;
@@ -176,6 +189,11 @@ sniffjokecli_help:
         }
     }
 
-    SniffJokeCli cli(useropt.admin_address, useropt.admin_port, useropt.ms_timeout);
+    SniffJokeCli cli(useropt.admin_address, useropt.admin_port, useropt.ms_timeout,
+                     useropt.admin_socket[0] ? useropt.admin_socket : NULL);
+    /* top does not use the admin socket, it reads the shared statistics */
+    if (!strcmp(useropt.cmd_buffer, "top"))
+        return cli.top();
+
     return cli.send_command(useropt.cmd_buffer);
 }
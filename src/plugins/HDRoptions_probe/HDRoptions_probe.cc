@@ -69,7 +69,7 @@ public:
     {
         OptionPool *optPool = reinterpret_cast<OptionPool *>(sjE->instanced_itopts);
 
-        pLH = new pluginLogHandler(PLUGIN_NAME, LOGNAME);
+        pLH = new pluginLogHandler(PLUGIN_NAME, LOGNAME, ALL_LEVEL);
 
         if(pluginOption == NULL || strlen(pluginOption) == 1)
         {
@@ -121,6 +121,9 @@ public:
          * enable the single function, if disabled */
         underTestOpt->optionConfigure(CorruptionSet);
 
+        /* the recipes of the random injections follow the new configuration */
+        optPool->buildRecipes();
+
         pLH->completeLog("Option index [%d] point to %s (opcode %d) and opt string [%s]", 
                          sjOptIndex, underTestOpt->sjOptName, underTestOpt->optValue, pluginOption);
 
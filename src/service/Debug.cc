@@ -22,6 +22,8 @@
 
 #include "Debug.h"
 
+#include <pthread.h>
+
 Debug::Debug(void) :
 debuglevel(ALL_LEVEL),
 logstream(stdout),
@@ -107,6 +109,9 @@ void Debug::log(uint8_t errorlevel, const char *funcname, const char *msg, ...)
         else if (errorlevel == SESSION_LEVEL && session_logstream != NULL)
             output_flow = session_logstream;
 
+        /* the trace writer threads could share the same FILE */
+        flockfile(output_flow);
+
         /* the debug level used in development include function/pid/uid addictional infos */
         if (errorlevel == DEBUG_LEVEL)
             fprintf(output_flow, "%s %s %d/%d ", sj_clock_str, funcname, getpid(), getuid());
@@ -119,6 +124,8 @@ void Debug::log(uint8_t errorlevel, const char *funcname, const char *msg, ...)
         va_end(arguments);
 
         fprintf(output_flow, "\n");
+
+        funlockfile(output_flow);
     }
 }
 
@@ -141,9 +148,172 @@ void Debug::downgradeOpenlog(uid_t uid, gid_t gid)
             RUNTIME_EXCEPTION("unable to change privileges to %d %d: %s", uid, gid, strerror(errno));
 }
 
+/*
+ * the ring shared by the pluginLogHandler(s): single producer (the plugins
+ * run in the networkIO loop) single consumer (the writer thread)
+ */
+struct pluginlog_line
+{
+    FILE *stream;
+    time_t clock;
+    bool timestamp;
+    char text[PLUGINLOG_LINELEN];
+};
+
+class pluginLogRing
+{
+private:
+    struct pluginlog_line ring[PLUGINLOG_RINGSIZE];
+
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile bool running;
+    pthread_t writer;
+
+    /* bumped by the writer after every drain, when the streams are flushed */
+    volatile uint32_t passes;
+
+    static void* writerThread(void *);
+    bool drain(void);
+
+public:
+    volatile uint32_t dropped;
+    uint32_t reported_dropped;
+
+    pluginLogRing(void);
+    ~pluginLogRing(void);
+
+    struct pluginlog_line *reserve(void);
+    void commit(void);
+    void sync(void);
+};
+
+pluginLogRing::pluginLogRing(void) :
+head(0),
+tail(0),
+running(true),
+passes(0),
+dropped(0),
+reported_dropped(0)
+{
+    if (pthread_create(&writer, NULL, writerThread, this))
+        RUNTIME_EXCEPTION("unable to start the plugin log writer: %s", strerror(errno));
+}
+
+pluginLogRing::~pluginLogRing(void)
+{
+    running = false;
+    pthread_join(writer, NULL);
+    drain();
+
+    if (dropped)
+        LOG_ALL("plugin log: %u lines dropped because the ring was full", dropped);
+}
+
+struct pluginlog_line *pluginLogRing::reserve(void)
+{
+    if (head - tail >= PLUGINLOG_RINGSIZE)
+    {
+        ++dropped;
+        return NULL;
+    }
+
+    return &ring[head & (PLUGINLOG_RINGSIZE - 1)];
+}
+
+void pluginLogRing::commit(void)
+{
+    __sync_synchronize();
+    ++head;
+}
+
+/*
+ * used only when a handler is closing, to be sure its lines are written:
+ * tail reaches head before the writer flush the streams, so also a complete
+ * pass is waited, otherwise the stream could be closed under the fflush
+ */
+void pluginLogRing::sync(void)
+{
+    while (tail != head)
+        usleep(PLUGINLOG_FLUSH_USEC / 10);
+
+    const uint32_t pass = passes;
+
+    while (passes == pass)
+        usleep(PLUGINLOG_FLUSH_USEC / 10);
+}
+
+bool pluginLogRing::drain(void)
+{
+    /* the streams are fully buffered: they are flushed once per drain */
+    vector<FILE *> touched;
+    char timestr[SMALLBUF];
+    struct tm tm;
+
+    while (tail != head)
+    {
+        __sync_synchronize();
+
+        const struct pluginlog_line &line = ring[tail & (PLUGINLOG_RINGSIZE - 1)];
+
+        if (dropped != reported_dropped)
+        {
+            fprintf(line.stream, "[%u plugin log lines dropped]\n", dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+
+        if (line.timestamp)
+        {
+            strftime(timestr, sizeof (timestr), "%Y-%m-%d %H:%M:%S", localtime_r(&line.clock, &tm));
+            fprintf(line.stream, "%s %s\n", timestr, line.text);
+        }
+        else
+        {
+            fprintf(line.stream, "%s\n", line.text);
+        }
+
+        if (find(touched.begin(), touched.end(), line.stream) == touched.end())
+            touched.push_back(line.stream);
+
+        __sync_synchronize();
+        ++tail;
+    }
+
+    for (vector<FILE *>::iterator it = touched.begin(); it != touched.end(); ++it)
+        fflush(*it);
+
+    return !touched.empty();
+}
+
+void* pluginLogRing::writerThread(void *arg)
+{
+    pluginLogRing *self = (pluginLogRing *) arg;
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    while (self->running)
+    {
+        const bool something = self->drain();
+
+        __sync_synchronize();
+        ++self->passes;
+
+        if (!something)
+            usleep(PLUGINLOG_FLUSH_USEC);
+    }
+
+    return NULL;
+}
+
+pluginLogRing *pluginLogHandler::ring = NULL;
+uint32_t pluginLogHandler::handlers = 0;
+
 /* Class pluginLogHandler used by plugins for selective logging */
-pluginLogHandler::pluginLogHandler(const char *sN, const char *LfN) :
-selfName(sN)
+pluginLogHandler::pluginLogHandler(const char *sN, const char *LfN, uint8_t loglevel) :
+selfName(sN),
+loglevel(loglevel)
 {
     if ((logstream = fopen(LfN, "a+")) == NULL)
         RUNTIME_EXCEPTION("unable to open %s: %s", LfN, strerror(errno));
@@ -153,8 +323,12 @@ selfName(sN)
     if(fchmod(fileno(logstream),  0666) == -1)
         RUNTIME_EXCEPTION("unable to make plugin %s (%s) rw+uga: %s", selfName, LfN, strerror(errno));
 
-    /* setbuffer(logstream, logstream_buf, DEBUGBUFFER); */
-    setlinebuf(logstream);
+    /* only the writer thread touch the stream, and it flush it after every drain */
+    setvbuf(logstream, logstream_buf, _IOFBF, DEBUGBUFFER);
+
+    /* the ring and its writer live as long as there is an handler */
+    if (handlers++ == 0)
+        ring = new pluginLogRing;
 
     completeLog("opened file %s successful for handler %s", LfN, selfName);
 }
@@ -162,25 +336,49 @@ selfName(sN)
 pluginLogHandler::~pluginLogHandler(void)
 {
     completeLog("requested logfile closing %s", selfName);
+
+    ring->sync();
+
+    if (--handlers == 0)
+    {
+        delete ring;
+        ring = NULL;
+    }
+
     fclose(logstream);
 }
 
-void pluginLogHandler::completeLog(const char *msg, ...)
+uint32_t pluginLogHandler::droppedLines(void)
 {
-    fprintf(logstream, "%s ", sj_clock_str);
+    return ring != NULL ? ring->dropped : 0;
+}
+
+void pluginLogHandler::enqueue(bool timestamp, const char *msg, va_list arguments)
+{
+    struct pluginlog_line *line = ring->reserve();
+    if (line == NULL)
+        return;
 
+    line->stream = logstream;
+    line->clock = sj_clock;
+    line->timestamp = timestamp;
+    vsnprintf(line->text, sizeof (line->text), msg, arguments);
+
+    ring->commit();
+}
+
+void pluginLogHandler::completeLogEmit(const char *msg, ...)
+{
     va_list arguments;
     va_start(arguments, msg);
-    vfprintf(logstream, msg, arguments);
-    fprintf(logstream, "\n");
+    enqueue(true, msg, arguments);
     va_end(arguments);
 }
 
-void pluginLogHandler::simpleLog(const char *msg, ...)
+void pluginLogHandler::simpleLogEmit(const char *msg, ...)
 {
     va_list arguments;
     va_start(arguments, msg);
-    vfprintf(logstream, msg, arguments);
-    fprintf(logstream, "\n");
+    enqueue(false, msg, arguments);
     va_end(arguments);
 }
@@ -61,20 +61,66 @@ public:
     {
         return debuglevel;
     };
+
+    /* used by the tools without log files, the service use resetLevel */
+    void setLevel(uint8_t lvl)
+    {
+        debuglevel = lvl;
+    };
 };
 
-/* Facility to support debug and dumping by the plugins */
+/* global debug object defined into Debug.cc and exported by this module */
+extern Debug debug;
+
+/*
+ * Facility to support debug and dumping by the plugins.
+ *
+ * the lines are not written by the plugin: they are copied in a ring shared
+ * by every handler and a writer thread put them in the (fully buffered) files,
+ * so on the packet path there are neither syscalls nor waits. when the ring
+ * is full the line is dropped and counted.
+ */
+#define PLUGINLOG_RINGSIZE      2048    /* lines, MUST be a power of two */
+#define PLUGINLOG_LINELEN       512
+#define PLUGINLOG_FLUSH_USEC    50000   /* writer sleep when the ring is empty (50 ms) */
+
+class pluginLogRing;
+
 class pluginLogHandler
 {
 private:
+    static pluginLogRing *ring;
+    static uint32_t handlers;
+
     const char *selfName;
+    const uint8_t loglevel;
     FILE *logstream;
     char logstream_buf[DEBUGBUFFER];
+
+    void enqueue(bool, const char *, va_list);
+
 public:
-    pluginLogHandler(const char *, const char *);
+    /* the lines are logged only when the debug level is >= loglevel */
+    pluginLogHandler(const char *, const char *, uint8_t loglevel = PACKET_LEVEL);
     ~pluginLogHandler(void);
-    void completeLog(const char *, ...);
-    void simpleLog(const char *, ...);
+
+    /* as SELFLOG, the level check is inlined in the plugin */
+    __attribute__((always_inline)) void completeLog(const char *msg, ...)
+    {
+        if (debug.level() >= loglevel)
+            completeLogEmit(msg, __builtin_va_arg_pack());
+    }
+
+    __attribute__((always_inline)) void simpleLog(const char *msg, ...)
+    {
+        if (debug.level() >= loglevel)
+            simpleLogEmit(msg, __builtin_va_arg_pack());
+    }
+
+    void completeLogEmit(const char *, ...);
+    void simpleLogEmit(const char *, ...);
+
+    static uint32_t droppedLines(void);
 };
 
 
@@ -85,7 +131,4 @@ public:
 #define LOG_PACKET(...)  debug.log(PACKET_LEVEL, __func__, __VA_ARGS__)
 
 
-/* global debug object defined into Debug.cc and exported by this module */
-extern Debug debug;
-
 #endif /* SJ_DEBUG_H */
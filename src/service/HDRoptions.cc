@@ -76,6 +76,7 @@ corruptDone(false)
     case IPOPTS_INJECTOR:
 
         protD.protoName = "IP";
+        protD.proto = IPPROTO_IP;
         protD.firstOptIndex = FIRST_IPOPT;
         protD.lastOptIndex = LAST_IPOPT;
         protD.NOP_code = IPOPT_NOOP;
@@ -107,6 +108,7 @@ corruptDone(false)
     case TCPOPTS_INJECTOR:
 
         protD.protoName = "TCP";
+        protD.proto = IPPROTO_TCP;
         protD.firstOptIndex = FIRST_TCPOPT;
         protD.lastOptIndex = LAST_TCPOPT;
         protD.NOP_code = TCPOPT_NOP;
@@ -134,6 +136,7 @@ corruptDone(false)
 
     /* initialization of "option Descriptor" */
     memset( &oD, 0x00, sizeof(oD) );
+    memset( optCount, 0x00, sizeof(optCount) );
     oD.actual_opts_len = *protD.hdrLen - protD.hdrMinLen;
 
     pkt.SELFLOG("IP/TCP HDRoptions: free space %d actual protohdrlen %d mi/MA %d/%d actual len %d avail %d", 
@@ -147,17 +150,15 @@ corruptDone(false)
     }
 
     /* remind: MTU is 80 byte less than the maximum available for don't check freespace */
-    oD.optshdr.resize(protD.optsMaxLen, protD.EOL_code);
+    memset(oD.optshdr, protD.EOL_code, sizeof(oD.optshdr));
     if(oD.actual_opts_len > 0)
     {
-        for(uint32_t i = 0; i < *protD.hdrLen; i++)
-            oD.optshdr.push_back( *(*((uint8_t **)protD.hdrAddr) + protD.hdrMinLen + i) );
+        memcpy(oD.optshdr, *((uint8_t **)protD.hdrAddr) + protD.hdrMinLen, oD.actual_opts_len);
 
         acquirePresentOptions(pkt.SjPacketId);
     }
 
-    LOG_PACKET("? checking space of opts header: %d < %d, resizing from %d to %d", 
-               oD.actual_opts_len, protD.optsMaxLen, oD.optshdr.size(), protD.optsMaxLen);
+    LOG_PACKET("? checking space of opts header: %d < %d", oD.actual_opts_len, protD.optsMaxLen);
 }
 
 void HDRoptions::acquirePresentOptions(uint32_t PktID)
@@ -198,53 +199,12 @@ void HDRoptions::acquirePresentOptions(uint32_t PktID)
  * this is a core method inside HDRoptions, it:
  * 1) check if a requested option(selected by a random or forced by a plugin) is enabled
  * 2) check if the goal is to corrupt or not, and choose the option by the counter data
+ *
+ * the rules are in IPTCPopt::isInjectable, because OptionPool follows them too
  */
 bool HDRoptions::evaluateInjectCoherence(uint8_t sjOptIndex)
 {
-    const IPTCPopt &oDesc = *(opt_pool->get(sjOptIndex));
-    const uint8_t opt_occurrs = optTrack[sjOptIndex].size();
-
-    /*
-     * 1st global check: can we use this option ?
-     * an option could be implemented in IPTCPoptImpl.cc but could be put
-     * simply for recognize the option, without injecting them.
-     */
-    if (oDesc.enabled == false)
-        return false;
-    /*
-     * 2nd global check: at which state of the injection are we?
-     * we avoid corrupt options if we have just corrupted the packet
-     * and we also alter the probability for the first injection
-     * in favour of good injection.
-     */
-    switch (oDesc.availableUsage)
-    {
-    case NOT_CORRUPT:
-        if (corruptRequest == false && opt_occurrs == 0)
-            return true;
-        break;
-
-    case ONESHOT:
-        /* I like to corrupt only once */
-        if (corruptRequest == true && corruptDone == false)
-            return true;
-        break;
-
-    case TWOSHOT:
-        if (corruptRequest == true && corruptDone == false)
-        {
-            if (opt_occurrs <= 1)
-                return true;
-        }
-        break;
-
-    default:
-        break;
-    }
-
-    /* if the requested option doesn't fit with the goal+status, and thus the
-     * previous switch() has returned "true", the answer will be only a drop */
-    return false;
+    return opt_pool->get(sjOptIndex)->isInjectable(corruptRequest, corruptDone, optCount[sjOptIndex]);
 }
 
 /* this is called on acquiring present options and after the injection,
@@ -259,16 +219,14 @@ uint8_t HDRoptions::registerOptOccurrence(uint8_t optValue, uint8_t offset, uint
 
         if (optValue == oDesc.optValue)
         {
-            struct option_occurrence occ;
+            struct option_occurrence &occ = optTrack[sjOptIndex][optCount[sjOptIndex]];
             occ.off = offset;
             occ.len = len;
 
-            optTrack[sjOptIndex].push_back(occ);
-
             LOG_PACKET("*+ registering %s at the index of %u options length %u (actual %d avail %u)",
                        oDesc.sjOptName, offset, len, oD.actual_opts_len, oD.getAvailableOptLen() );
 
-            return optTrack[sjOptIndex].size();
+            return ++optCount[sjOptIndex];
         }
     }
 
@@ -348,17 +306,43 @@ void HDRoptions::injector(uint8_t sjOptIndex)
     }
 }
 
-void HDRoptions::randomInjector(void)
+/*
+ * a random injection is a copy of a recipe: only the random payloads are generated.
+ * the options present and the ones the option discovery has found not working
+ * for the destination (see TCPTrack::injectOptionProbe) are excluded.
+ */
+void HDRoptions::recipeInjector(void)
 {
-    vector<uint8_t> seq;
+    uint32_t presentmask = ttlfocus.opt_unworking;
 
     for (uint8_t i = protD.firstOptIndex; i <= protD.lastOptIndex; ++i)
-        seq.push_back(i);
+    {
+        if (optCount[i])
+            presentmask |= (1 << i);
+    }
+
+    const struct option_recipe *recipe = opt_pool->getRecipe(protD.proto, corruptRequest, oD.getAvailableOptLen(), presentmask);
+    if (recipe == NULL)
+        return;
+
+    const uint8_t base = oD.actual_opts_len;
 
-    random_shuffle(seq.begin(), seq.end());
+    memcpy(&oD.optshdr[base], recipe->bytes, recipe->len);
 
-    for (vector<uint8_t>::iterator it = seq.begin(); it != seq.end(); ++it)
-        injector(*it);
+    for (uint8_t i = 0; i < recipe->randoms; ++i)
+        memset_random(&oD.optshdr[base + recipe->random[i].off], recipe->random[i].len);
+
+    for (uint8_t i = 0; i < recipe->occurrences; ++i)
+    {
+        struct option_occurrence &occ = optTrack[recipe->optIndex[i]][optCount[recipe->optIndex[i]]++];
+        occ.off = base + recipe->occ[i].off;
+        occ.len = recipe->occ[i].len;
+    }
+
+    oD.actual_opts_len += recipe->len;
+
+    /* the recipes for a corruption achieve always the goal */
+    corruptDone = corruptRequest;
 }
 
 bool HDRoptions::injectSingleOpt(bool corrupt, bool strip_previous, uint8_t sjOptIndex)
@@ -398,7 +382,7 @@ bool HDRoptions::injectRandomOpts(bool corrupt, bool strip_previous)
                corruptRequest ? "CORRUPT" : "NOT CORRUPT");
 
     if (prepareInjection(corrupt, strip_previous))
-        randomInjector();
+        recipeInjector();
 
     if (!isGoalAchieved()) 
     {
@@ -427,26 +411,35 @@ bool HDRoptions::stripOption(uint8_t sjOptIndex)
 
     IPTCPopt &oDesc = *(opt_pool->get(sjOptIndex));
 
-    for (vector<option_occurrence>::iterator it = optTrack[sjOptIndex].begin(); it != optTrack[sjOptIndex].end(); it++)
+    /* from the last occurrence, so the offsets of the previous remain valid */
+    while (optCount[sjOptIndex])
     {
-        vector<unsigned char>::iterator start = oD.optshdr.begin() + it->off;
-        vector<unsigned char>::iterator end = start + it->len;
-        oD.optshdr.erase(start, end);
+        const struct option_occurrence strip = optTrack[sjOptIndex][--optCount[sjOptIndex]];
 
-        oD.actual_opts_len -= it->len;
+        memmove(&oD.optshdr[strip.off], &oD.optshdr[strip.off + strip.len], OPTHDR_MAXLEN - strip.off - strip.len);
+        memset(&oD.optshdr[OPTHDR_MAXLEN - strip.len], protD.EOL_code, strip.len);
 
-        uint16_t maxOptSpace = pkt.freespace() > protD.optsMaxLen ? protD.optsMaxLen : ((pkt.freespace() >> 4) << 4);
-        oD.optshdr.resize(maxOptSpace, protD.EOL_code);
+        oD.actual_opts_len -= strip.len;
 
-        LOG_PACKET("*- stripping single %sopt %s for %u bytes (avail %u)", 
-                  protD.protoName, oDesc.sjOptName, it->len, oD.getAvailableOptLen());
+        /* the options following the stripped one are moved back */
+        for (uint8_t sjI = protD.firstOptIndex; sjI <= protD.lastOptIndex; ++sjI)
+        {
+            for (uint8_t i = 0; i < optCount[sjI]; ++i)
+            {
+                if (optTrack[sjI][i].off > strip.off)
+                    optTrack[sjI][i].off -= strip.len;
+            }
+        }
 
-        optTrack[sjOptIndex].erase(it);
-        completeHdrEdit();
+        LOG_PACKET("*- stripping single %sopt %s for %u bytes (avail %u)", 
+                  protD.protoName, oDesc.sjOptName, strip.len, oD.getAvailableOptLen());
 
         found = true;
     }
 
+    if (found)
+        completeHdrEdit();
+
     return found;
 }
 
@@ -454,16 +447,8 @@ void HDRoptions::stripAllOptions()
 {
     LOG_PACKET("*- stripping all %s options (total of used %u)", protD.protoName, oD.actual_opts_len);
 
-    for (uint32_t sjI = protD.firstOptIndex; sjI <= protD.lastOptIndex; sjI++)
-    {
-        while(optTrack[sjI].size())
-        {
-            optTrack[sjI].pop_back();
-        }
-    }
-
-    uint16_t maxOptSpace = pkt.freespace() > protD.optsMaxLen ? protD.optsMaxLen : ((pkt.freespace() >> 4) << 4);
-    oD.optshdr.resize(maxOptSpace, protD.EOL_code);
+    memset(optCount, 0x00, sizeof(optCount));
+    memset(oD.optshdr, protD.EOL_code, sizeof(oD.optshdr));
     oD.actual_opts_len = 0;
 }
 
@@ -488,7 +473,7 @@ HDRoptions::~HDRoptions(void)
 
     for (uint8_t i = protD.firstOptIndex; i <= protD.lastOptIndex; ++i)
     {
-        if (optTrack[i].size() == false)
+        if (optCount[i] == 0)
         {
             fprintf(HDRoLog, " ~%u", i);
         }
@@ -497,8 +482,8 @@ HDRoptions::~HDRoptions(void)
             IPTCPopt *yep = opt_pool->get(i);
             fprintf(HDRoLog, " %s", yep->sjOptName);
 
-            for (vector<option_occurrence>::iterator it = optTrack[i].begin(); it != optTrack[i].end(); ++it)
-                fprintf(HDRoLog, ":%u(%u)", it->off, it->len);
+            for (uint8_t j = 0; j < optCount[i]; ++j)
+                fprintf(HDRoLog, ":%u(%u)", optTrack[i][j].off, optTrack[i][j].len);
         }
     }
     fprintf(HDRoLog, "\n");
@@ -33,9 +33,6 @@
 #define MAXIPOPTIONS 40
 #define MAXTCPOPTIONS 40
 
-#define MAXIPINJITERATIONS 5 /* max number of injected ip options / retries */
-#define MAXTCPINJITERATIONS 5 /* max number of injected tcp options / retries */
-
 /* 
  * not all options are defined in the standard library,
  * so some values are defined here.
@@ -73,6 +70,9 @@
  *
  * HDRoptions_probe.cc is plugin for option test and use those classess in a 
  * lighty different way 
+ *
+ * the random injection does not call the options implementation: it copies
+ * one of the recipes precomputed by OptionPool (see OptionPool.h)
  */
 
 enum injector_t
@@ -80,18 +80,12 @@ enum injector_t
     IPOPTS_INJECTOR = 0, TCPOPTS_INJECTOR = 1
 };
 
-/* these struct are used inside HDRoptions for an easy handling */
-struct option_occurrence
-{
-    uint8_t off;
-    uint8_t len;
-};
-
 /* protocol specification contains the difference between TCP and IP header 
  * manipoulation. is useful for make a simple code usable in both cases */
 struct protocolSpec
 {
     const char *protoName;
+    uint8_t proto;
     uint8_t firstOptIndex;
     uint8_t lastOptIndex;
     uint8_t NOP_code;
@@ -122,7 +116,9 @@ private:
      * both for IP and TCP where possible */
     struct protocolSpec protD;
 
-    vector<option_occurrence> optTrack[SUPPORTED_OPTIONS];
+    /* every occurrence of an option is tracked, in 40 bytes there are at most 40 */
+    struct option_occurrence optTrack[SUPPORTED_OPTIONS][OPTHDR_MAXLEN];
+    uint8_t optCount[SUPPORTED_OPTIONS];
 
     /* validates present option and makes a working copy */
     void acquirePresentOptions(uint32_t);
@@ -144,7 +140,7 @@ private:
     void completeHdrEdit(void);
 
     void injector(uint8_t);
-    void randomInjector(void);
+    void recipeInjector(void);
 
 public:
 
@@ -0,0 +1,55 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "HeapCounter.h"
+
+#include <malloc.h>
+#include <new>
+
+uint64_t heap_allocations;
+uint64_t heap_live_bytes;
+uint64_t heap_peak_bytes;
+
+void *operator new(size_t size) throw (std::bad_alloc)
+{
+    void *p = malloc(size ? size : 1);
+
+    if (p == NULL)
+        throw std::bad_alloc();
+
+    ++heap_allocations;
+    heap_live_bytes += malloc_usable_size(p);
+    if (heap_live_bytes > heap_peak_bytes)
+        heap_peak_bytes = heap_live_bytes;
+
+    return p;
+}
+
+/* not inlined: the callers must see a delete, not a free of a new'd pointer */
+__attribute__ ((noinline)) void operator delete(void *p) throw ()
+{
+    if (p == NULL)
+        return;
+
+    heap_live_bytes -= malloc_usable_size(p);
+    free(p);
+}
@@ -0,0 +1,38 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_HEAPCOUNTER_H
+#define SJ_HEAPCOUNTER_H
+
+#include "Utils.h"
+
+/*
+ * HeapCounter.cc is linked only in the measuring tools (sniffjoke-replay,
+ * sniffjoke-bench): it replaces the global operator new of the process,
+ * plugins included, to count the heap allocations and the bytes in use.
+ * the service is not linked with it and keeps the allocator of the C++ runtime.
+ */
+extern uint64_t heap_allocations;
+extern uint64_t heap_live_bytes;
+extern uint64_t heap_peak_bytes; /* can be reset to heap_live_bytes by the caller */
+
+#endif /* SJ_HEAPCOUNTER_H */
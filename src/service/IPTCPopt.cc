@@ -38,6 +38,36 @@ void IPTCPopt::optionConfigure(corruption_t c)
     availableUsage = c;
 }
 
+/*
+ * check if the goal is to corrupt or not, and accept the option by the counter data:
+ * we avoid corrupt options if we have just corrupted the packet
+ */
+bool IPTCPopt::isInjectable(bool corruptRequest, bool corruptDone, uint8_t occurrences) const
+{
+    /*
+     * an option could be implemented in IPTCPoptImpl.cc but could be put
+     * simply for recognize the option, without injecting them.
+     */
+    if (enabled == false)
+        return false;
+
+    switch (availableUsage)
+    {
+    case NOT_CORRUPT:
+        return (corruptRequest == false && occurrences == 0);
+
+    case ONESHOT:
+        /* I like to corrupt only once */
+        return (corruptRequest == true && corruptDone == false);
+
+    case TWOSHOT:
+        return (corruptRequest == true && corruptDone == false && occurrences <= 1);
+
+    default:
+        return false;
+    }
+}
+
 /* this is the utility function used by the single option adder to calculate the best fit size for an option */
 uint8_t IPTCPopt::getBestRandsize(struct optHdrData *oD, uint8_t fixedLen, uint8_t minRblks, uint8_t maxRblks, uint8_t blockSize)
 {
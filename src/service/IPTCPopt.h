@@ -34,18 +34,27 @@ enum corruption_t
     CORRUPTUNASSIGNED = 0, NOT_CORRUPT = 1, ONESHOT = 2, TWOSHOT = 4, BOTH = 8, TRACK_ONLY = 16
 };
 
+#define OPTHDR_MAXLEN   40  /* the options space is the same on IP and TCP */
+
+/* the options header is a fixed array: an injection never touches the heap */
 struct optHdrData
 {
-    vector<uint8_t> optshdr;
+    uint8_t optshdr[OPTHDR_MAXLEN];
     uint8_t actual_opts_len; /* max value 40 on IP and TCP too */
 
     uint8_t getAvailableOptLen()
     {
-        /* using size had cause too much fault: now fuck tha vector */
-        return 40 - /* (uint8_t)optshdr.size() - */ actual_opts_len;
+        return OPTHDR_MAXLEN - actual_opts_len;
     };
 };
 
+/* offset and length of an option inside the options header */
+struct option_occurrence
+{
+    uint8_t off;
+    uint8_t len;
+};
+
 class IPTCPopt
 {
 public:
@@ -61,6 +70,10 @@ public:
     IPTCPopt(bool, uint8_t, const char *, uint8_t, uint8_t);
 
     void optionConfigure(corruption_t);
+
+    /* the injection rules, shared by HDRoptions and the recipes of OptionPool */
+    bool isInjectable(bool, bool, uint8_t) const;
+
     virtual uint8_t optApply(struct optHdrData *) = 0;
 };
 
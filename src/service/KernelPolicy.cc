@@ -0,0 +1,792 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "KernelPolicy.h"
+#include "UserConf.h"
+
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+extern auto_ptr<UserConf> userconf;
+
+KernelPolicy::KernelPolicy(void) :
+iplist(NULL),
+blacklist(false),
+filter_iplist(false),
+routed(false),
+rp_filter(-1),
+ctnl_fd(-1),
+ctnl_seq(0),
+ctnl_pending(0),
+filter_fd(-1),
+filter_dirty(false)
+{
+    LOG_DEBUG("");
+
+    if (userconf->runcfg.use_blacklist)
+    {
+        iplist = userconf->runcfg.blacklist;
+        blacklist = true;
+    }
+    else if (userconf->runcfg.use_whitelist)
+    {
+        iplist = userconf->runcfg.whitelist;
+    }
+
+    if (iplist != NULL)
+        setupIPSet();
+
+    if (userconf->runcfg.offload)
+        setupConntrack();
+}
+
+KernelPolicy::~KernelPolicy(void)
+{
+    LOG_DEBUG("");
+
+    char cmd[MEDIUMBUF];
+
+    if (ctnl_fd != -1)
+        close(ctnl_fd);
+
+    if (getuid() || geteuid())
+    {
+        LOG_VERBOSE("this process (%d) is not root: unable to remove the kernel policy", getpid());
+        return;
+    }
+
+    if (!filter_rules.empty())
+    {
+        execRules("filter", filter_rules, "-D");
+
+        snprintf(cmd, sizeof (cmd), "iptables -X %s", KPOLICY_CHAIN);
+        execOSCmd(cmd);
+    }
+
+    execRules("mangle", mangle_rules, "-D");
+
+    if (routed)
+    {
+        snprintf(cmd, sizeof (cmd), "ip rule del fwmark 0x%x/0x%x table %u priority %u",
+                 KPOLICY_MARK, KPOLICY_MARK, KPOLICY_TABLE, KPOLICY_RULE_PRIORITY);
+        LOG_VERBOSE("deleting the rule of the excluded traffic [%s]", cmd);
+        execOSCmd(cmd);
+
+        snprintf(cmd, sizeof (cmd), "ip route flush table %u", KPOLICY_TABLE);
+        execOSCmd(cmd);
+    }
+
+    if (rp_filter != -1)
+    {
+        LOG_VERBOSE("restoring the rp_filter %d of %s", rp_filter, userconf->runcfg.net_iface_name);
+        setRPFilter(userconf->runcfg.net_iface_name, rp_filter);
+    }
+
+    /* the set is destroyed only when no rule refers to it */
+    if (iplist != NULL)
+    {
+        snprintf(cmd, sizeof (cmd), "ipset destroy %s", KPOLICY_IPSET);
+        execOSCmd(cmd);
+    }
+}
+
+void KernelPolicy::setupIPSet(void)
+{
+    const char *listname = blacklist ? "blacklist" : "whitelist";
+    char cmd[MEDIUMBUF];
+
+    /* flush: a set left by a previous instance is reused empty */
+    snprintf(cmd, sizeof (cmd), "ipset create %s hash:ip -exist && ipset flush %s && echo ok", KPOLICY_IPSET, KPOLICY_IPSET);
+    if (execOSCmd(cmd) != "ok")
+    {
+        LOG_ALL("ipset is not available: the %s is applied by sniffjoke only", listname);
+        iplist = NULL;
+        return;
+    }
+
+    FILE *restore = popen("ipset restore -exist", "w");
+    if (restore != NULL)
+    {
+        for (IPListMap::const_iterator it = iplist->begin(); it != iplist->end(); ++it)
+            fprintf(restore, "add %s %s\n", KPOLICY_IPSET, inet_ntoa(*((struct in_addr *) &(it->first))));
+    }
+
+    if (restore == NULL || pclose(restore))
+    {
+        LOG_ALL("unable to fill the ipset %s: the %s is applied by sniffjoke only", KPOLICY_IPSET, listname);
+
+        snprintf(cmd, sizeof (cmd), "ipset destroy %s", KPOLICY_IPSET);
+        execOSCmd(cmd);
+        iplist = NULL;
+        return;
+    }
+
+    filter_iplist = (iplist->size() <= KPOLICY_FILTER_MAXIPS);
+
+    LOG_VERBOSE("ipset %s filled with the %u addresses of the %s", KPOLICY_IPSET, (uint32_t) iplist->size(), listname);
+
+    if (!filter_iplist)
+        LOG_ALL("the %s has more than %u addresses: their incoming traffic is still read by sniffjoke",
+                listname, KPOLICY_FILTER_MAXIPS);
+}
+
+/*
+ * the ctnetlink socket is opened by root and inherited by the service,
+ * where CAP_NET_ADMIN is kept for it. a mark request on a connection that
+ * does not exist must fail with ENOENT: anything else means that the
+ * kernel can't change the conntrack marks, and the offload is disabled.
+ */
+void KernelPolicy::setupConntrack(void)
+{
+    struct sockaddr_nl nladdr;
+    SessionTrackKey probe;
+    vector<int> errors;
+
+    if ((ctnl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER)) == -1)
+    {
+        LOG_ALL("unable to open the ctnetlink socket: %s: the offload is disabled", strerror(errno));
+        return;
+    }
+
+    memset(&nladdr, 0x00, sizeof (nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    if (bind(ctnl_fd, (struct sockaddr *) &nladdr, sizeof (nladdr)) == -1)
+    {
+        LOG_ALL("unable to bind the ctnetlink socket: %s: the offload is disabled", strerror(errno));
+        close(ctnl_fd);
+        ctnl_fd = -1;
+        return;
+    }
+
+    /* the port 0 is never used by a connection */
+    probe.proto = IPPROTO_TCP;
+    probe.daddr = inet_addr(userconf->runcfg.gw_ip_addr);
+    probe.sport = probe.dport = 0;
+
+    ctnlAppend(IPCTNL_MSG_CT_NEW, CTA_TUPLE_ORIG, inet_addr(userconf->runcfg.net_iface_ip), probe);
+    ctnlExchange(errors, NULL);
+
+    if (errors[0] != ENOENT)
+    {
+        LOG_ALL("ctnetlink is not usable (%s): the offload is disabled", strerror(errors[0]));
+        close(ctnl_fd);
+        ctnl_fd = -1;
+        return;
+    }
+
+    LOG_VERBOSE("the finished tcp flows are offloaded to the kernel with the conntrack mark 0x%x", KPOLICY_OFFLOAD_MARK);
+}
+
+/* the rules are added in order and deleted in reverse order */
+void KernelPolicy::execRules(const char *table, const vector<string> &rules, const char *action)
+{
+    char cmd[LARGEBUF];
+
+    for (uint32_t i = 0; i < rules.size(); ++i)
+    {
+        const string &rule = (action[1] == 'D') ? rules[rules.size() - 1 - i] : rules[i];
+
+        snprintf(cmd, sizeof (cmd), "iptables -t %s %s %s", table, action, rule.c_str());
+        LOG_VERBOSE("%s the kernel policy rule [%s]", action[1] == 'D' ? "deleting" : "adding", cmd);
+        execOSCmd(cmd);
+    }
+}
+
+/* the value is written when not -1, the previous one is returned (-1 on error) */
+int KernelPolicy::setRPFilter(const char *iface, int value)
+{
+    char path[MEDIUMBUF];
+    int previous = -1;
+    FILE *conf;
+
+    snprintf(path, sizeof (path), "/proc/sys/net/ipv4/conf/%s/rp_filter", iface);
+
+    if ((conf = fopen(path, "r+")) == NULL)
+        return -1;
+
+    if (fscanf(conf, "%d", &previous) != 1)
+        previous = -1;
+    else if (value != -1)
+    {
+        rewind(conf);
+        if (fprintf(conf, "%d\n", value) < 0)
+            previous = -1;
+    }
+
+    if (fclose(conf))
+        previous = -1;
+
+    return previous;
+}
+
+string KernelPolicy::ipsetMatch(const char *direction) const
+{
+    char match[MEDIUMBUF];
+
+    if (iplist == NULL)
+        return "";
+
+    snprintf(match, sizeof (match), "-m set %s--match-set %s %s", blacklist ? "! " : "", KPOLICY_IPSET, direction);
+
+    return match;
+}
+
+string KernelPolicy::offloadMatch(void) const
+{
+    char match[MEDIUMBUF];
+
+    if (ctnl_fd == -1)
+        return "";
+
+    snprintf(match, sizeof (match), "-m connmark ! --mark 0x%x/0x%x", KPOLICY_OFFLOAD_MARK, KPOLICY_OFFLOAD_MARK);
+
+    return match;
+}
+
+void KernelPolicy::bypassRoute(void)
+{
+    char cmd[MEDIUMBUF];
+    char rule[LARGEBUF];
+
+    if (iplist == NULL && !userconf->runcfg.no_tcp && !userconf->runcfg.no_udp && ctnl_fd == -1)
+        return;
+
+    snprintf(cmd, sizeof (cmd), "ip route replace default via %s dev %s table %u",
+             userconf->runcfg.gw_ip_addr, userconf->runcfg.net_iface_name, KPOLICY_TABLE);
+    LOG_VERBOSE("the excluded traffic uses the real gateway [%s]", cmd);
+    execOSCmd(cmd);
+
+    snprintf(cmd, sizeof (cmd), "ip rule add fwmark 0x%x/0x%x table %u priority %u",
+             KPOLICY_MARK, KPOLICY_MARK, KPOLICY_TABLE, KPOLICY_RULE_PRIORITY);
+    execOSCmd(cmd);
+
+    routed = true;
+
+    /*
+     * the reverse path of the replies is the TUN, the default route: the
+     * strict mode (1) drops them, the loose one (2) accepts them. the kernel
+     * uses the higher value between "all" and the interface.
+     */
+    const char *iface = userconf->runcfg.net_iface_name;
+    const int all_mode = setRPFilter("all", -1), iface_mode = setRPFilter(iface, -1);
+
+    if ((all_mode > iface_mode ? all_mode : iface_mode) == 1)
+    {
+        if ((rp_filter = setRPFilter(iface, 2)) != -1)
+        {
+            LOG_VERBOSE("the rp_filter of %s is loose for the replies of the excluded traffic", iface);
+        }
+        else
+        {
+            LOG_ALL("unable to set the rp_filter of %s loose: the excluded traffic has no replies", iface);
+        }
+    }
+
+    /* a mark set in mangle OUTPUT makes the kernel route the packet again */
+    if (iplist != NULL)
+    {
+        snprintf(rule, sizeof (rule), "OUTPUT -o %s -m set %s--match-set %s dst -j MARK --set-xmark 0x%x/0x%x",
+                 TUN_IF_NAME, blacklist ? "" : "! ", KPOLICY_IPSET, KPOLICY_MARK, KPOLICY_MARK);
+        mangle_rules.push_back(rule);
+    }
+
+    if (userconf->runcfg.no_tcp)
+    {
+        snprintf(rule, sizeof (rule), "OUTPUT -o %s -p tcp -j MARK --set-xmark 0x%x/0x%x", TUN_IF_NAME, KPOLICY_MARK, KPOLICY_MARK);
+        mangle_rules.push_back(rule);
+    }
+
+    if (userconf->runcfg.no_udp)
+    {
+        snprintf(rule, sizeof (rule), "OUTPUT -o %s -p udp -j MARK --set-xmark 0x%x/0x%x", TUN_IF_NAME, KPOLICY_MARK, KPOLICY_MARK);
+        mangle_rules.push_back(rule);
+    }
+
+    /* the connections marked by offloadFlows leave the TUN for the same table */
+    if (ctnl_fd != -1)
+    {
+        snprintf(rule, sizeof (rule), "OUTPUT -o %s -m connmark --mark 0x%x/0x%x -j MARK --set-xmark 0x%x/0x%x",
+                 TUN_IF_NAME, KPOLICY_OFFLOAD_MARK, KPOLICY_OFFLOAD_MARK, KPOLICY_MARK, KPOLICY_MARK);
+        mangle_rules.push_back(rule);
+    }
+
+    execRules("mangle", mangle_rules, "-A");
+}
+
+void KernelPolicy::dropGateway(void)
+{
+    char cmd[MEDIUMBUF];
+    char rule[LARGEBUF];
+
+    snprintf(cmd, sizeof (cmd), "iptables -N %s", KPOLICY_CHAIN);
+    execOSCmd(cmd);
+    snprintf(cmd, sizeof (cmd), "iptables -F %s", KPOLICY_CHAIN);
+    execOSCmd(cmd);
+
+    /* RETURN: the excluded traffic continues in INPUT, under the firewall of the host */
+    if (ctnl_fd != -1)
+    {
+        snprintf(rule, sizeof (rule), "%s ! -p icmp -m connmark --mark 0x%x/0x%x -j RETURN",
+                 KPOLICY_CHAIN, KPOLICY_OFFLOAD_MARK, KPOLICY_OFFLOAD_MARK);
+        filter_rules.push_back(rule);
+    }
+
+    if (iplist != NULL && filter_iplist)
+    {
+        snprintf(rule, sizeof (rule), "%s ! -p icmp -m set %s--match-set %s src -j RETURN",
+                 KPOLICY_CHAIN, blacklist ? "" : "! ", KPOLICY_IPSET);
+        filter_rules.push_back(rule);
+    }
+
+    if (userconf->runcfg.no_tcp)
+    {
+        snprintf(rule, sizeof (rule), "%s -p tcp -j RETURN", KPOLICY_CHAIN);
+        filter_rules.push_back(rule);
+    }
+
+    if (userconf->runcfg.no_udp)
+    {
+        snprintf(rule, sizeof (rule), "%s -p udp -j RETURN", KPOLICY_CHAIN);
+        filter_rules.push_back(rule);
+    }
+
+    snprintf(rule, sizeof (rule), "%s -j DROP", KPOLICY_CHAIN);
+    filter_rules.push_back(rule);
+
+    snprintf(rule, sizeof (rule), "INPUT -m mac --mac-source %s -j %s", userconf->runcfg.gw_mac_str, KPOLICY_CHAIN);
+    filter_rules.push_back(rule);
+
+    LOG_ALL("dropping the traffic from the gateway handled by sniffjoke [%s]", rule);
+    execRules("filter", filter_rules, "-A");
+}
+
+/*
+ * the datalink socket reads what the kernel drops in the chain: a BPF
+ * program discards the excluded packets, the ones going out of the
+ * interface (with the policy, the kernel sends the excluded traffic) and
+ * the incoming packets of the offloaded flows. the program is loaded again
+ * when the offloaded flows change.
+ */
+void KernelPolicy::attachFilter(int fd)
+{
+    filter_fd = fd;
+
+    if (!loadFilter())
+        RUNTIME_EXCEPTION("unable to attach the socket filter of the kernel policy: %s", strerror(errno));
+
+    LOG_VERBOSE("socket filter attached to the datalink socket");
+}
+
+/* the socket is SOCK_DGRAM, the offsets are from the ip header */
+bool KernelPolicy::loadFilter(void)
+{
+    vector<struct sock_filter> code;
+    struct sock_fprog prog;
+
+    struct sock_filter ld_pkttype = BPF_STMT(BPF_LD | BPF_B | BPF_ABS, (uint32_t) (SKF_AD_OFF + SKF_AD_PKTTYPE));
+    struct sock_filter ld_proto = BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9);
+    struct sock_filter ld_fragoff = BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6);
+    struct sock_filter ld_saddr = BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 12);
+    struct sock_filter ld_ports = BPF_STMT(BPF_LD | BPF_W | BPF_IND, 0);
+    struct sock_filter ldx_iphdrlen = BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+    struct sock_filter ret_drop = BPF_STMT(BPF_RET | BPF_K, 0);
+    struct sock_filter ret_read = BPF_STMT(BPF_RET | BPF_K, 0xffff);
+
+    /* every jeq skips the return following it when false */
+    struct sock_filter jeq = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1);
+    struct sock_filter jset = BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, IP_OFFMASK, 0, 1);
+    struct sock_filter ja = BPF_JUMP(BPF_JMP | BPF_JA, 0, 0, 0);
+
+    code.push_back(ld_pkttype);
+    jeq.k = PACKET_OUTGOING;
+    code.push_back(jeq);
+    code.push_back(ret_drop);
+
+    code.push_back(ld_proto);
+
+    if (userconf->runcfg.no_tcp)
+    {
+        jeq.k = IPPROTO_TCP;
+        code.push_back(jeq);
+        code.push_back(ret_drop);
+    }
+
+    if (userconf->runcfg.no_udp)
+    {
+        jeq.k = IPPROTO_UDP;
+        code.push_back(jeq);
+        code.push_back(ret_drop);
+    }
+
+    /*
+     * the offloaded flows, only in tcp packets not being a following
+     * fragment: the source address, then the ports. the ja skip the whole
+     * block, to the load of the protocol at its end.
+     */
+    if (!filter_flows.empty())
+    {
+        const uint32_t block = 5 * filter_flows.size();
+
+        jeq.k = IPPROTO_TCP;
+        jeq.jt = 1;
+        jeq.jf = 0;
+        code.push_back(jeq);
+        ja.k = block + 5;
+        code.push_back(ja);
+
+        code.push_back(ld_fragoff);
+        code.push_back(jset);
+        ja.k = block + 2;
+        code.push_back(ja);
+
+        code.push_back(ldx_iphdrlen);
+        code.push_back(ld_saddr);
+
+        for (vector<pair<uint32_t, uint32_t> >::const_iterator it = filter_flows.begin(); it != filter_flows.end(); ++it)
+        {
+            /* a different address skips to the next flow, different ports reload the address */
+            jeq.k = it->first;
+            jeq.jt = 0;
+            jeq.jf = 4;
+            code.push_back(jeq);
+            code.push_back(ld_ports);
+            jeq.k = it->second;
+            jeq.jf = 1;
+            code.push_back(jeq);
+            code.push_back(ret_drop);
+            code.push_back(ld_saddr);
+        }
+
+        code.push_back(ld_proto);
+        jeq.jt = 0;
+        jeq.jf = 1;
+    }
+
+    if (iplist != NULL && filter_iplist)
+    {
+        jeq.k = IPPROTO_ICMP;
+        code.push_back(jeq);
+        code.push_back(ret_read);
+
+        code.push_back(ld_saddr);
+
+        for (IPListMap::const_iterator it = iplist->begin(); it != iplist->end(); ++it)
+        {
+            jeq.k = ntohl(it->first);
+            code.push_back(jeq);
+            code.push_back(blacklist ? ret_drop : ret_read);
+        }
+
+        code.push_back(blacklist ? ret_read : ret_drop);
+    }
+    else
+    {
+        code.push_back(ret_read);
+    }
+
+    prog.len = code.size();
+    prog.filter = &code[0];
+
+    if (setsockopt(filter_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog)) == -1)
+        return false;
+
+    LOG_DEBUG("socket filter of %u instructions, %u offloaded flows excluded", prog.len, (uint32_t) filter_flows.size());
+
+    return true;
+}
+
+/* the incoming packets of the flow: source address and ports, as loaded by the socket filter */
+pair<uint32_t, uint32_t> KernelPolicy::filterFlow(const SessionTrack &sessiontrack) const
+{
+    return pair<uint32_t, uint32_t>(ntohl(sessiontrack.daddr),
+                                    ((uint32_t) ntohs(sessiontrack.dport) << 16) | ntohs(sessiontrack.sport));
+}
+
+void KernelPolicy::ctnlAttribute(uint16_t type, const void *data, uint16_t len)
+{
+    const uint32_t offset = ctnl_buf.size();
+
+    ctnl_buf.resize(offset + NLA_ALIGN(NLA_HDRLEN + len), 0x00);
+
+    struct nlattr *nla = (struct nlattr *) &ctnl_buf[offset];
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    if (len)
+        memcpy(&ctnl_buf[offset + NLA_HDRLEN], data, len);
+}
+
+/* a nested attribute is opened by ctnlAttribute without data, and closed here */
+void KernelPolicy::ctnlNestEnd(uint32_t offset)
+{
+    ((struct nlattr *) &ctnl_buf[offset])->nla_len = ctnl_buf.size() - offset;
+}
+
+/*
+ * a ctnetlink request about the connection of the flow is appended to
+ * ctnl_buf, matched as the original direction (the connections opened by
+ * this host) or as the reply one (the connections accepted).
+ * IPCTNL_MSG_CT_NEW without NLM_F_CREATE only updates the mark,
+ * IPCTNL_MSG_CT_GET returns it. the requests are sent by ctnlExchange.
+ */
+void KernelPolicy::ctnlAppend(uint16_t type, uint16_t tuple, uint32_t saddr, const SessionTrackKey &key)
+{
+    const uint32_t offset = ctnl_buf.size();
+    uint32_t nest_tuple, nest_ip, nest_proto, value;
+
+    ctnl_buf.resize(offset + NLMSG_HDRLEN + NLMSG_ALIGN(sizeof (struct nfgenmsg)), 0x00);
+
+    nest_tuple = ctnl_buf.size();
+    ctnlAttribute(tuple | NLA_F_NESTED, NULL, 0);
+
+    nest_ip = ctnl_buf.size();
+    ctnlAttribute(CTA_TUPLE_IP | NLA_F_NESTED, NULL, 0);
+    ctnlAttribute(CTA_IP_V4_SRC, &saddr, sizeof (saddr));
+    ctnlAttribute(CTA_IP_V4_DST, &key.daddr, sizeof (key.daddr));
+    ctnlNestEnd(nest_ip);
+
+    nest_proto = ctnl_buf.size();
+    ctnlAttribute(CTA_TUPLE_PROTO | NLA_F_NESTED, NULL, 0);
+    ctnlAttribute(CTA_PROTO_NUM, &key.proto, sizeof (key.proto));
+    ctnlAttribute(CTA_PROTO_SRC_PORT, &key.sport, sizeof (key.sport));
+    ctnlAttribute(CTA_PROTO_DST_PORT, &key.dport, sizeof (key.dport));
+    ctnlNestEnd(nest_proto);
+
+    ctnlNestEnd(nest_tuple);
+
+    /* only the offload bit is set, the other bits of the mark are kept */
+    if (type == IPCTNL_MSG_CT_NEW)
+    {
+        value = htonl(KPOLICY_OFFLOAD_MARK);
+        ctnlAttribute(CTA_MARK, &value, sizeof (value));
+        ctnlAttribute(CTA_MARK_MASK, &value, sizeof (value));
+    }
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *) &ctnl_buf[offset];
+    nlh->nlmsg_len = ctnl_buf.size() - offset;
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    nlh->nlmsg_seq = ++ctnl_seq;
+
+    struct nfgenmsg *nfg = (struct nfgenmsg *) NLMSG_DATA(nlh);
+    nfg->nfgen_family = AF_INET;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = 0;
+
+    ++ctnl_pending;
+}
+
+/*
+ * the appended requests are sent together, and the kernel answers all of
+ * them in the send: errors receives the errno of every request in order,
+ * 0 on success. mark, when given, receives the mark of the connection
+ * returned by a get.
+ */
+void KernelPolicy::ctnlExchange(vector<int> &errors, uint32_t *mark)
+{
+    unsigned char reply[HUGEBUF];
+    const uint32_t first_seq = ctnl_seq - ctnl_pending + 1;
+    uint32_t answered = 0, value;
+    struct nlmsghdr *nlh;
+
+    errors.assign(ctnl_pending, -1);
+    ctnl_pending = 0;
+
+    if (send(ctnl_fd, &ctnl_buf[0], ctnl_buf.size(), 0) == -1)
+    {
+        errors.assign(errors.size(), errno);
+        ctnl_buf.clear();
+        return;
+    }
+
+    ctnl_buf.clear();
+
+    while (answered < errors.size())
+    {
+        int len = recv(ctnl_fd, reply, sizeof (reply), 0);
+
+        if (len == -1)
+        {
+            /* the acks after a failure are discarded by their seq at the next exchange */
+            replace(errors.begin(), errors.end(), -1, errno);
+            return;
+        }
+
+        for (nlh = (struct nlmsghdr *) reply; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            const uint32_t index = nlh->nlmsg_seq - first_seq;
+
+            if (index >= errors.size())
+                continue;
+
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                if (errors[index] == -1)
+                    ++answered;
+
+                errors[index] = -((const struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+                continue;
+            }
+
+            if (mark == NULL || nlh->nlmsg_type != ((NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_NEW))
+                continue;
+
+            int attrlen = nlh->nlmsg_len - NLMSG_SPACE(sizeof (struct nfgenmsg));
+            const struct nlattr *nla = (const struct nlattr *) ((const unsigned char *) NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof (struct nfgenmsg)));
+
+            while (attrlen >= (int) NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= attrlen)
+            {
+                if ((nla->nla_type & NLA_TYPE_MASK) == CTA_MARK)
+                {
+                    memcpy(&value, (const unsigned char *) nla + NLA_HDRLEN, sizeof (value));
+                    *mark = ntohl(value);
+                }
+
+                attrlen -= NLA_ALIGN(nla->nla_len);
+                nla = (const struct nlattr *) ((const unsigned char *) nla + NLA_ALIGN(nla->nla_len));
+            }
+        }
+    }
+}
+
+/* the direction of the connection in the kernel, from the first packet of the flow */
+uint16_t KernelPolicy::ctnlTuple(const SessionTrack &sessiontrack) const
+{
+    return (sessiontrack.opener == SESSIONTRACK_OPENER_REMOTE) ? CTA_TUPLE_REPLY : CTA_TUPLE_ORIG;
+}
+
+/* the marks of the selected flows, KPOLICY_CTNL_BATCH requests every send */
+void KernelPolicy::ctnlMark(const vector<SessionTrack *> &flows, const vector<uint32_t> &selected, bool reply, vector<int> &errors)
+{
+    vector<int> results;
+
+    for (uint32_t i = 0; i < selected.size(); i += KPOLICY_CTNL_BATCH)
+    {
+        const uint32_t last = min(i + KPOLICY_CTNL_BATCH, (uint32_t) selected.size());
+
+        for (uint32_t j = i; j < last; ++j)
+        {
+            const SessionTrack &sessiontrack = *flows[selected[j]];
+            ctnlAppend(IPCTNL_MSG_CT_NEW, reply ? CTA_TUPLE_REPLY : ctnlTuple(sessiontrack), sessiontrack.saddr, sessiontrack.key());
+        }
+
+        ctnlExchange(results, NULL);
+
+        for (uint32_t j = i; j < last; ++j)
+            errors[selected[j]] = results[j - i];
+    }
+}
+
+/*
+ * the flows finished in a cycle are marked together, in the direction known
+ * by their first packet. a flow already open when sniffjoke has seen it is
+ * tried as opened by this host, and as accepted when the kernel does not
+ * find it: the direction found is kept for flowOffloaded.
+ */
+void KernelPolicy::offloadFlows(const vector<SessionTrack *> &flows, vector<int> &errors)
+{
+    vector<uint32_t> selected;
+
+    if (ctnl_fd == -1)
+    {
+        errors.assign(flows.size(), ENOTCONN);
+        return;
+    }
+
+    errors.assign(flows.size(), 0);
+
+    for (uint32_t i = 0; i < flows.size(); ++i)
+        selected.push_back(i);
+
+    ctnlMark(flows, selected, false, errors);
+
+    selected.clear();
+    for (uint32_t i = 0; i < flows.size(); ++i)
+    {
+        if (flows[i]->opener != SESSIONTRACK_OPENER_UNKNOWN)
+            continue;
+
+        if (errors[i] == ENOENT)
+            selected.push_back(i);
+        else if (!errors[i])
+            flows[i]->opener = SESSIONTRACK_OPENER_LOCAL;
+    }
+
+    if (!selected.empty())
+    {
+        ctnlMark(flows, selected, true, errors);
+
+        for (vector<uint32_t>::iterator it = selected.begin(); it != selected.end(); ++it)
+        {
+            if (!errors[*it])
+                flows[*it]->opener = SESSIONTRACK_OPENER_REMOTE;
+        }
+    }
+
+    for (uint32_t i = 0; i < flows.size(); ++i)
+    {
+        /* over the capacity of the filter, the copies are dropped by TCPTrack */
+        if (!errors[i] && filter_fd != -1 && filter_flows.size() < KPOLICY_FILTER_MAXFLOWS)
+        {
+            filter_flows.push_back(filterFlow(*flows[i]));
+            filter_dirty = true;
+        }
+    }
+}
+
+/* the connection is still in the kernel, and still marked: a new one on the same tuple is not */
+bool KernelPolicy::flowOffloaded(const SessionTrack &sessiontrack)
+{
+    vector<int> errors;
+    uint32_t mark = 0;
+
+    ctnlAppend(IPCTNL_MSG_CT_GET, ctnlTuple(sessiontrack), sessiontrack.saddr, sessiontrack.key());
+    ctnlExchange(errors, &mark);
+
+    return (mark & KPOLICY_OFFLOAD_MARK);
+}
+
+void KernelPolicy::releaseFlow(const SessionTrack &sessiontrack)
+{
+    vector<pair<uint32_t, uint32_t> >::iterator it = find(filter_flows.begin(), filter_flows.end(), filterFlow(sessiontrack));
+
+    if (it == filter_flows.end())
+        return;
+
+    filter_flows.erase(it);
+    filter_dirty = true;
+}
+
+/* called once every cycle: the offloads and the releases of the cycle are a single load */
+void KernelPolicy::updateFilter(void)
+{
+    if (!filter_dirty)
+        return;
+
+    filter_dirty = false;
+
+    if (!loadFilter())
+        LOG_ALL("unable to update the socket filter of the kernel policy: %s", strerror(errno));
+}
@@ -0,0 +1,148 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SJ_KERNELPOLICY_H
+#define SJ_KERNELPOLICY_H
+
+#include "Utils.h"
+#include "IPList.h"
+#include "SessionTrack.h"
+
+/*
+ * KernelPolicy moves in the kernel the decisions that do not require
+ * sniffjoke: the traffic excluded by the blacklist, by the whitelist or by
+ * no_tcp/no_udp never reaches the service.
+ *
+ * the IP list is an ipset, filled from the loaded list. with the TUN:
+ *   - the excluded outgoing packets are marked in mangle OUTPUT, and the
+ *     mark is routed by an ip rule to a table with the real gateway;
+ *   - the gateway traffic goes through a chain that lets the excluded one
+ *     to the local stack and drops the rest, read by the datalink socket;
+ *   - a socket filter keeps the same excluded traffic out of the datalink
+ *     socket, so nothing arrives twice.
+ * the inline backends use only the ipset, in the match of their rules.
+ *
+ * the replies of the excluded traffic arrive on the interface while the
+ * default route is the TUN: a strict rp_filter drops them, so it's made
+ * loose on the interface while the policy exists, and restored after.
+ *
+ * the icmp from the gateway is never excluded: the time exceeded of the
+ * routers are the answers to the ttl probes.
+ *
+ * the lists are read once at the start, as the configuration: the policy
+ * is built with the mitm and removed with it, so it is always in sync.
+ *
+ * with --offload the policy is the fast path of the finished tcp flows too:
+ * the service sets a conntrack mark on them by ctnetlink (this is why it
+ * keeps CAP_NET_ADMIN), and the static rules skip the marked connections:
+ *   - with the TUN, mangle OUTPUT routes them to the real gateway, as the
+ *     excluded traffic, the chain lets their replies to the local stack and
+ *     the socket filter drops them from the datalink socket;
+ *   - the inline backends don't queue them, see offloadMatch.
+ */
+
+#define KPOLICY_IPSET           "sniffjoke"
+#define KPOLICY_CHAIN           "sniffjoke"
+#define KPOLICY_MARK            0x20000000  /* fwmark bit of the excluded outgoing packets */
+#define KPOLICY_TABLE           2700        /* routing table of the marked packets */
+#define KPOLICY_RULE_PRIORITY   2700        /* before the main table, 32766 */
+#define KPOLICY_FILTER_MAXIPS   1000        /* two BPF instructions every address, BPF_MAXINSNS is 4096 */
+#define KPOLICY_OFFLOAD_MARK    0x10000000  /* conntrack mark bit of the offloaded flows */
+#define KPOLICY_FILTER_MAXFLOWS 256         /* five BPF instructions every offloaded flow */
+#define KPOLICY_CTNL_BATCH      64          /* ctnetlink requests in a single send, their acks fit the socket buffer */
+
+class KernelPolicy
+{
+private:
+
+    /* the list used, NULL without blacklist and whitelist or without ipset */
+    const IPListMap *iplist;
+    bool blacklist;
+
+    /* when the list is too large for the socket filter, the incoming traffic is not excluded */
+    bool filter_iplist;
+
+    bool routed;
+
+    /* the rp_filter of the interface before bypassRoute, -1 when not changed */
+    int rp_filter;
+
+    /* the rules added in the mangle and filter tables, deleted in reverse order */
+    vector<string> mangle_rules;
+    vector<string> filter_rules;
+
+    /* the ctnetlink socket, -1 without --offload */
+    int ctnl_fd;
+    uint32_t ctnl_seq;
+    uint32_t ctnl_pending;
+    vector<unsigned char> ctnl_buf;
+
+    /* the datalink socket with the filter, and the offloaded flows excluded by it */
+    int filter_fd;
+    bool filter_dirty;
+    vector<pair<uint32_t, uint32_t> > filter_flows;
+
+    void setupIPSet(void);
+    void setupConntrack(void);
+    void execRules(const char *, const vector<string> &, const char *);
+    int setRPFilter(const char *, int);
+
+    void ctnlAttribute(uint16_t, const void *, uint16_t);
+    void ctnlNestEnd(uint32_t);
+    void ctnlAppend(uint16_t, uint16_t, uint32_t, const SessionTrackKey &);
+    void ctnlExchange(vector<int> &, uint32_t *);
+    void ctnlMark(const vector<SessionTrack *> &, const vector<uint32_t> &, bool, vector<int> &);
+    uint16_t ctnlTuple(const SessionTrack &) const;
+    bool loadFilter(void);
+    pair<uint32_t, uint32_t> filterFlow(const SessionTrack &) const;
+
+public:
+
+    KernelPolicy(void);
+    ~KernelPolicy(void);
+
+    /* the iptables match of the traffic handled by sniffjoke, "src" or "dst" */
+    string ipsetMatch(const char *) const;
+
+    /* the iptables match of the connections not offloaded, used by the inline backends */
+    string offloadMatch(void) const;
+
+    /* used by NetIOTun */
+    void bypassRoute(void);
+    void dropGateway(void);
+    void attachFilter(int);
+
+    /* used by SessionTrackMap, from the service process */
+    void offloadFlows(const vector<SessionTrack *> &, vector<int> &);
+    bool flowOffloaded(const SessionTrack &);
+    void releaseFlow(const SessionTrack &);
+    void updateFilter(void);
+
+    /* when true the kernel delivers also the incoming packets of the offloaded flows */
+    bool deliversOffloaded(void) const
+    {
+        return filter_fd != -1;
+    };
+};
+
+#endif /* SJ_KERNELPOLICY_H */
@@ -25,46 +25,56 @@
 
 #include "Utils.h"
 #include "TCPTrack.h"
+#include "KernelPolicy.h"
 
-#include <poll.h>
-#include <netpacket/packet.h>
-
+/*
+ * NetIO is the packet I/O between the kernel (or a capture) and TCPTrack:
+ * every backend moves the packets in with TCPTrack::writepacket, runs
+ * TCPTrack::analyzePacketQueue and moves out what TCPTrack::readpacket returns.
+ *
+ * networkIO is called once every loop of the service.
+ */
 class NetIO
 {
-private:
+protected:
 
     TCPTrack *conntrack;
 
-    /* tunfd/netfd: file descriptor for I/O purpose */
-    int tunfd;
-    int netfd;
+    /* the kernel side of the configuration, NULL when the backend has none */
+    KernelPolicy *policy;
 
-    /*
-     * these data are required for handle
-     * tunnel/ethernet man in the middle
-     */
-    struct sockaddr_ll send_ll;
+public:
 
-    /* poll variables, two file descriptors */
-    struct pollfd fds[2];
-    int nfds;
+    NetIO(void) :
+    conntrack(NULL),
+    policy(NULL)
+    {
+    };
 
-    int size;
+    virtual ~NetIO(void)
+    {
+    };
 
-    void setupTUN();
-    void setupNET();
+    void prepareConntrack(TCPTrack *ct)
+    {
+        conntrack = ct;
+    };
 
-public:
+    KernelPolicy *getPolicy(void)
+    {
+        return policy;
+    };
 
     /*
-     * networkdown_condition express if the network is down and sniffjoke must be interrupted
-     *       --- but not killed!
+     * called once in the service child after the fork, before the jail and the
+     * privileges downgrade: here are created the resources of the packet path
+     * that the root process must not share.
      */
+    virtual void setupService(void)
+    {
+    };
 
-    NetIO(void);
-    ~NetIO(void);
-    void prepareConntrack(TCPTrack *);
-    void networkIO(void);
+    virtual void networkIO(void) = 0;
 };
 
 #endif /* SJ_NETIO_H */
@@ -0,0 +1,545 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "NetIONfqueue.h"
+#include "UserConf.h"
+
+#include <endian.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <linux/netfilter.h>
+
+#ifndef IP_NODEFRAG
+#define IP_NODEFRAG 22
+#endif
+
+extern auto_ptr<UserConf> userconf;
+
+NetIONfqueue::NetIONfqueue(void) :
+nlfd(-1),
+rawfd(-1),
+linkfd(-1),
+recvbuf(0xffff + getpagesize()),
+tunnel_pending(false),
+tunnel_last_id(0)
+{
+    LOG_DEBUG("");
+
+    if (getuid() || geteuid())
+        RUNTIME_EXCEPTION("required root privileges");
+
+    if (strlen(userconf->runcfg.gw_mac_str) != 17)
+        RUNTIME_EXCEPTION("invalid mac address [%s] is not a MAC, check the config", userconf->runcfg.gw_mac_str);
+
+    setupSockets();
+
+    setupQueue(NFQUEUE_TUNNEL);
+    setupQueue(NFQUEUE_NETWORK);
+
+    fds[0].fd = nlfd;
+    fds[0].events = POLLIN;
+
+    /* the queues are bound: from now the packets can be sent to them */
+    policy = new KernelPolicy;
+    setupRules();
+    applyRules("-I");
+}
+
+NetIONfqueue::~NetIONfqueue(void)
+{
+    LOG_DEBUG("");
+
+    if (getuid() || geteuid())
+        LOG_VERBOSE("this process (%d) is not root: unable to delete the netfilter rules", getpid());
+    else
+        applyRules("-D");
+
+    delete policy;
+
+    close(nlfd);
+    close(rawfd);
+    close(linkfd);
+}
+
+void NetIONfqueue::setupSockets(void)
+{
+    struct sockaddr_nl nladdr;
+    struct ifreq tmpifr;
+    int tmpval;
+
+    if ((nlfd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER)) != -1)
+        LOG_DEBUG("nfnetlink socket opened successfully");
+    else
+        RUNTIME_EXCEPTION("unable to open the nfnetlink socket: %s", strerror(errno));
+
+    /* the socket is bound to an automatic port id and talks only with the kernel */
+    memset(&nladdr, 0x00, sizeof (nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    if (bind(nlfd, (struct sockaddr *) &nladdr, sizeof (nladdr)) == -1 ||
+            connect(nlfd, (struct sockaddr *) &nladdr, sizeof (nladdr)) == -1)
+        RUNTIME_EXCEPTION("unable to bind the nfnetlink socket: %s", strerror(errno));
+
+    /* a burst larger than the buffer is lost by the kernel, without an ENOBUFS for every miss */
+    tmpval = NFQUEUE_RCVBUF;
+    if (setsockopt(nlfd, SOL_SOCKET, SO_RCVBUFFORCE, &tmpval, sizeof (tmpval)) == -1)
+        LOG_DEBUG("unable to set the nfnetlink receive buffer to %u (SO_RCVBUFFORCE): %s", NFQUEUE_RCVBUF, strerror(errno));
+
+    tmpval = 1;
+    if (setsockopt(nlfd, SOL_NETLINK, NETLINK_NO_ENOBUFS, &tmpval, sizeof (tmpval)) == -1)
+        LOG_DEBUG("unable to set NETLINK_NO_ENOBUFS on the nfnetlink socket: %s", strerror(errno));
+
+    /* IPPROTO_RAW implies IP_HDRINCL: the ip header is written by sniffjoke */
+    if ((rawfd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW)) != -1)
+        LOG_DEBUG("raw socket opened successfully");
+    else
+        RUNTIME_EXCEPTION("unable to open the raw socket: %s", strerror(errno));
+
+    tmpval = NFQUEUE_REINJECT_MARK;
+    if (setsockopt(rawfd, SOL_SOCKET, SO_MARK, &tmpval, sizeof (tmpval)) == -1)
+        RUNTIME_EXCEPTION("unable to set the mark 0x%x on the raw socket (SO_MARK): %s", NFQUEUE_REINJECT_MARK, strerror(errno));
+
+    /* the fragments built by the plugins must not be reassembled by conntrack */
+    tmpval = 1;
+    if (setsockopt(rawfd, SOL_IP, IP_NODEFRAG, &tmpval, sizeof (tmpval)) == -1)
+        LOG_DEBUG("unable to set IP_NODEFRAG on the raw socket: %s", strerror(errno));
+
+    /* protocol 0: the datalink socket is used only to send */
+    if ((linkfd = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) != -1)
+        LOG_DEBUG("datalink layer socket packet opened successfully");
+    else
+        RUNTIME_EXCEPTION("unable to open datalink layer packet: %s", strerror(errno));
+
+    memset(&tmpifr, 0x00, sizeof (tmpifr));
+    snprintf(tmpifr.ifr_name, sizeof (tmpifr.ifr_name), "%s", userconf->runcfg.net_iface_name);
+    if (ioctl(linkfd, SIOCGIFINDEX, &tmpifr) != -1)
+        LOG_DEBUG("ioctl(SIOCGIFINDEX) executed successfully on interface %s", userconf->runcfg.net_iface_name);
+    else
+        RUNTIME_EXCEPTION("unable to execute ioctl(SIOCGIFINDEX) on interface %s: %s", userconf->runcfg.net_iface_name, strerror(errno));
+
+    memset(&send_ll, 0x00, sizeof (send_ll));
+    send_ll.sll_family = PF_PACKET;
+    send_ll.sll_protocol = htons(ETH_P_IP);
+    send_ll.sll_ifindex = tmpifr.ifr_ifindex;
+    send_ll.sll_halen = ETH_ALEN;
+    memcpy(send_ll.sll_addr, userconf->runcfg.gw_mac_addr, ETH_ALEN);
+
+    if (ioctl(rawfd, SIOCGIFMTU, &tmpifr) != -1)
+        LOG_DEBUG("interface mtu correctly read %u (SIOCGIFMTU)", tmpifr.ifr_mtu);
+    else
+        RUNTIME_EXCEPTION("unable to get the interface mtu (SIOCGIFMTU): %s", strerror(errno));
+
+    /* without the TUN the local stack uses the whole mtu */
+    userconf->runcfg.net_iface_mtu = tmpifr.ifr_mtu;
+}
+
+void NetIONfqueue::setupQueue(uint16_t queue)
+{
+    struct nfqnl_msg_config_cmd cmd;
+    struct nfqnl_msg_config_params params;
+    uint32_t start, value;
+
+    memset(&cmd, 0x00, sizeof (cmd));
+    cmd.command = NFQNL_CFG_CMD_BIND;
+    cmd.pf = htons(AF_INET);
+
+    start = beginMessage(NFQNL_MSG_CONFIG, queue, NLM_F_ACK);
+    addAttribute(start, NFQA_CFG_CMD, &cmd, sizeof (cmd));
+
+    memset(&params, 0x00, sizeof (params));
+    params.copy_range = htonl(0xffff);
+    params.copy_mode = NFQNL_COPY_PACKET;
+
+    start = beginMessage(NFQNL_MSG_CONFIG, queue, NLM_F_ACK);
+    addAttribute(start, NFQA_CFG_PARAMS, &params, sizeof (params));
+
+    value = htonl(NFQUEUE_MAXLEN);
+    addAttribute(start, NFQA_CFG_QUEUE_MAXLEN, &value, sizeof (value));
+
+    /* when the queue is full the packets pass untouched, instead of being dropped */
+    value = htonl(NFQA_CFG_F_FAIL_OPEN);
+    addAttribute(start, NFQA_CFG_FLAGS, &value, sizeof (value));
+    addAttribute(start, NFQA_CFG_MASK, &value, sizeof (value));
+
+    flushMessages(true);
+
+    LOG_VERBOSE("bound to the nfqueue %u (max %u packets, fail-open)", queue, NFQUEUE_MAXLEN);
+}
+
+void NetIONfqueue::setupRules(void)
+{
+    const char *protos[] = { "tcp", "udp", "icmp" };
+    char rule[LARGEBUF];
+
+    /*
+     * the protocols and the addresses excluded from the configuration are not
+     * queued at all, as the tcp connections offloaded by KernelPolicy
+     */
+    for (uint8_t i = 0; i < sizeof (protos) / sizeof (protos[0]); ++i)
+    {
+        if ((i == 0 && userconf->runcfg.no_tcp) || (i == 1 && userconf->runcfg.no_udp))
+            continue;
+
+        /* the outgoing icmp is never hacked, the incoming one carries the ttl informations */
+        if (i != 2)
+        {
+            snprintf(rule, sizeof (rule), "POSTROUTING -o %s -p %s %s %s -m mark ! --mark 0x%x/0x%x -j NFQUEUE --queue-num %u --queue-bypass",
+                     userconf->runcfg.net_iface_name, protos[i], policy->ipsetMatch("dst").c_str(),
+                     (i == 0) ? policy->offloadMatch().c_str() : "",
+                     NFQUEUE_REINJECT_MARK, NFQUEUE_REINJECT_MARK, NFQUEUE_TUNNEL);
+            rules.push_back(rule);
+        }
+
+        snprintf(rule, sizeof (rule), "PREROUTING -i %s -m mac --mac-source %s -p %s %s %s -j NFQUEUE --queue-num %u --queue-bypass",
+                 userconf->runcfg.net_iface_name, userconf->runcfg.gw_mac_str, protos[i],
+                 (i != 2) ? policy->ipsetMatch("src").c_str() : "",
+                 (i == 0) ? policy->offloadMatch().c_str() : "", NFQUEUE_NETWORK);
+        rules.push_back(rule);
+    }
+}
+
+void NetIONfqueue::applyRules(const char *action)
+{
+    char cmd[LARGEBUF];
+
+    for (vector<string>::iterator it = rules.begin(); it != rules.end(); ++it)
+    {
+        snprintf(cmd, sizeof (cmd), "iptables -t mangle %s %s", action, it->c_str());
+        LOG_VERBOSE("%s the queueing rule [%s]", action[1] == 'I' ? "adding" : "deleting", cmd);
+        execOSCmd(cmd);
+    }
+}
+
+/* a message is appended in nlbuf, returning its offset for the attributes */
+uint32_t NetIONfqueue::beginMessage(uint16_t type, uint16_t queue, uint16_t flags)
+{
+    const uint32_t start = nlbuf.size();
+
+    nlbuf.resize(start + NLMSG_HDRLEN + NLMSG_ALIGN(sizeof (struct nfgenmsg)), 0x00);
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *) &nlbuf[start];
+    nlh->nlmsg_len = nlbuf.size() - start;
+    nlh->nlmsg_type = (NFNL_SUBSYS_QUEUE << 8) | type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+
+    struct nfgenmsg *nfg = (struct nfgenmsg *) NLMSG_DATA(nlh);
+    nfg->nfgen_family = AF_UNSPEC;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(queue);
+
+    return start;
+}
+
+void NetIONfqueue::addAttribute(uint32_t start, uint16_t type, const void *data, uint16_t len)
+{
+    const uint32_t offset = nlbuf.size();
+
+    nlbuf.resize(offset + NLA_ALIGN(NLA_HDRLEN + len), 0x00);
+
+    struct nlattr *nla = (struct nlattr *) &nlbuf[offset];
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy(&nlbuf[offset + NLA_HDRLEN], data, len);
+
+    ((struct nlmsghdr *) &nlbuf[start])->nlmsg_len = nlbuf.size() - start;
+}
+
+/* the payload is sent back only with a packet: TCPTrack could have changed it */
+void NetIONfqueue::addVerdict(uint16_t type, uint16_t queue, uint32_t verdict, uint32_t id, const Packet *pkt)
+{
+    struct nfqnl_msg_verdict_hdr vhdr;
+
+    /* the verdicts are sent together, but a send is limited by the socket buffer */
+    if (nlbuf.size() > NFQUEUE_RCVBUF / 64)
+        flushMessages(false);
+
+    vhdr.verdict = htonl(verdict);
+    vhdr.id = htonl(id);
+
+    const uint32_t start = beginMessage(type, queue, 0);
+    addAttribute(start, NFQA_VERDICT_HDR, &vhdr, sizeof (vhdr));
+
+    if (pkt != NULL)
+        addAttribute(start, NFQA_PAYLOAD, &(pkt->pbuf[0]), pkt->pbuf.size());
+}
+
+/* when acked, every message must be confirmed by the kernel */
+void NetIONfqueue::flushMessages(bool acked)
+{
+    uint32_t messages = 0;
+
+    if (nlbuf.empty())
+        return;
+
+    if (send(nlfd, &nlbuf[0], nlbuf.size(), 0) == -1)
+        RUNTIME_EXCEPTION("unable to send to nfnetlink_queue: %s", strerror(errno));
+
+    if (acked)
+    {
+        int len = nlbuf.size();
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *) &nlbuf[0]; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+            ++messages;
+    }
+
+    nlbuf.clear();
+
+    while (messages)
+    {
+        int len = recv(nlfd, &recvbuf[0], recvbuf.size(), 0);
+
+        if (len == -1)
+            RUNTIME_EXCEPTION("unable to receive from nfnetlink_queue: %s", strerror(errno));
+
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *) &recvbuf[0]; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type != NLMSG_ERROR)
+                continue;
+
+            const struct nlmsgerr *err = (const struct nlmsgerr *) NLMSG_DATA(nlh);
+            if (err->error)
+                RUNTIME_EXCEPTION("nfnetlink_queue refused the configuration: %s", strerror(-err->error));
+
+            --messages;
+        }
+    }
+}
+
+void NetIONfqueue::receive(void)
+{
+    for (uint32_t i = 0; i < NFQUEUE_BURST; ++i)
+    {
+        int len = recv(nlfd, &recvbuf[0], recvbuf.size(), MSG_DONTWAIT);
+
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+
+            if (errno == ENOBUFS)
+            {
+                LOG_VERBOSE("nfqueue messages lost: the netlink receive buffer is full");
+                continue;
+            }
+
+            RUNTIME_EXCEPTION("error reading from nfnetlink_queue: %s", strerror(errno));
+        }
+
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *) &recvbuf[0]; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+            parseMessage(nlh);
+    }
+}
+
+void NetIONfqueue::parseMessage(const struct nlmsghdr *nlh)
+{
+    const struct nfqnl_msg_packet_hdr *phdr = NULL;
+    const struct nfqnl_msg_packet_timestamp *ts = NULL;
+    const unsigned char *payload = NULL;
+    int paylen = 0;
+
+    if (nlh->nlmsg_type == NLMSG_ERROR)
+    {
+        const struct nlmsgerr *err = (const struct nlmsgerr *) NLMSG_DATA(nlh);
+
+        /* the kernel checks CAP_NET_ADMIN of the process sending the verdicts */
+        if (err->error == -EPERM)
+            RUNTIME_EXCEPTION("the nfqueue verdicts are refused: CAP_NET_ADMIN is required");
+
+        if (err->error)
+            LOG_DEBUG("nfqueue verdict refused: %s", strerror(-err->error));
+
+        return;
+    }
+
+    if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_QUEUE || NFNL_MSG_TYPE(nlh->nlmsg_type) != NFQNL_MSG_PACKET)
+        return;
+
+    const struct nfgenmsg *nfg = (const struct nfgenmsg *) NLMSG_DATA(nlh);
+    const uint16_t queue = ntohs(nfg->res_id);
+
+    int remain = nlh->nlmsg_len - NLMSG_HDRLEN - NLMSG_ALIGN(sizeof (struct nfgenmsg));
+    const struct nlattr *nla = (const struct nlattr *) ((const unsigned char *) nfg + NLMSG_ALIGN(sizeof (struct nfgenmsg)));
+
+    while (remain >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= remain)
+    {
+        const unsigned char *data = (const unsigned char *) nla + NLA_HDRLEN;
+
+        switch (nla->nla_type & NLA_TYPE_MASK)
+        {
+        case NFQA_PACKET_HDR:
+            phdr = (const struct nfqnl_msg_packet_hdr *) data;
+            break;
+        case NFQA_TIMESTAMP:
+            ts = (const struct nfqnl_msg_packet_timestamp *) data;
+            break;
+        case NFQA_PAYLOAD:
+            payload = data;
+            paylen = nla->nla_len - NLA_HDRLEN;
+            break;
+        }
+
+        remain -= NLA_ALIGN(nla->nla_len);
+        nla = (const struct nlattr *) ((const unsigned char *) nla + NLA_ALIGN(nla->nla_len));
+    }
+
+    if (phdr == NULL)
+        return;
+
+    const uint32_t id = ntohl(phdr->packet_id);
+
+    if (queue == NFQUEUE_TUNNEL)
+    {
+        /* the packet is copied in TCPTrack, the original is consumed by the next batch verdict */
+        if (payload != NULL)
+            conntrack->writepacket(TUNNEL, payload, paylen, sj_monotonic_ns());
+
+        tunnel_pending = true;
+        tunnel_last_id = id;
+    }
+    else
+    {
+        const uint32_t SjPacketId = (payload != NULL) ? conntrack->writepacket(NETWORK, payload, paylen, ingressTimestamp(ts)) : 0;
+
+        /* a malformed packet is dropped, as in the other backends */
+        if (SjPacketId)
+            network_ids[SjPacketId] = id;
+        else
+            addVerdict(NFQNL_MSG_VERDICT, NFQUEUE_NETWORK, NF_DROP, id, NULL);
+    }
+}
+
+/* the nfqueue timestamp is CLOCK_REALTIME: the time elapsed in the kernel is subtracted to the monotonic now */
+uint64_t NetIONfqueue::ingressTimestamp(const struct nfqnl_msg_packet_timestamp *ts)
+{
+    const uint64_t now = sj_monotonic_ns();
+
+    if (ts == NULL)
+        return now;
+
+    struct timespec real_ts;
+    clock_gettime(CLOCK_REALTIME, &real_ts);
+
+    const int64_t inkernel = (int64_t) (real_ts.tv_sec - (time_t) be64toh(ts->sec)) * 1000000000
+            + (real_ts.tv_nsec - (int64_t) be64toh(ts->usec) * 1000);
+
+    if (inkernel > 0 && (uint64_t) inkernel < now)
+        return now - inkernel;
+
+    return now;
+}
+
+void NetIONfqueue::sendRaw(const Packet *pkt)
+{
+    struct sockaddr_in dst;
+
+    memset(&dst, 0x00, sizeof (dst));
+    dst.sin_family = AF_INET;
+    dst.sin_addr.s_addr = pkt->ip->daddr;
+
+    /* the kernel policy applies: a packet refused by the firewall is not an error of sniffjoke */
+    if (sendto(rawfd, &(pkt->pbuf[0]), pkt->pbuf.size(), 0x00, (struct sockaddr *) &dst, sizeof (dst)) == -1)
+        LOG_DEBUG("packet refused by the raw socket: %s", strerror(errno));
+}
+
+void NetIONfqueue::sendPacket(Packet *pkt)
+{
+    /*
+     * the real traffic goes back in the kernel path, where conntrack and the
+     * firewall see it as the connection it belongs; the fakes and the probes
+     * must not alter the conntrack state, and are written on the datalink.
+     */
+    if (pkt->source != TRACEROUTE && pkt->wtf == INNOCENT)
+        sendRaw(pkt);
+    else if (sendto(linkfd, &(pkt->pbuf[0]), pkt->pbuf.size(), 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll)) == -1)
+    {
+        RUNTIME_EXCEPTION("error writing in network: %s", strerror(errno));
+    }
+
+    delete pkt;
+}
+
+void NetIONfqueue::networkIO(void)
+{
+    /*
+     * the same timing of NetIOTun: NETIOBURSTSIZE cycles waiting at most
+     * 1 ms each, then the analysis. the packets going out are consumed at
+     * every cycle, the ones coming in are judged after the analysis.
+     */
+    uint32_t max_cycle = NETIOBURSTSIZE;
+    Packet *pkt;
+    int nfds;
+
+    while (max_cycle--)
+    {
+        timespec timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = 1000000;
+
+        nfds = ppoll(fds, 1, &timeout, NULL);
+
+        if (nfds == -1)
+            RUNTIME_EXCEPTION("strange and dangerous error in ppoll: %s", strerror(errno));
+
+        if (!nfds)
+            continue;
+
+        receive();
+
+        if (tunnel_pending)
+        {
+            addVerdict(NFQNL_MSG_VERDICT_BATCH, NFQUEUE_TUNNEL, NF_DROP, tunnel_last_id, NULL);
+            tunnel_pending = false;
+        }
+
+        flushMessages(false);
+    }
+
+    conntrack->analyzePacketQueue();
+
+    while ((pkt = conntrack->readpacket(TUNNEL)) != NULL)
+        sendPacket(pkt);
+
+    while ((pkt = conntrack->readpacket(NETWORK)) != NULL)
+    {
+        map<uint32_t, uint32_t>::iterator it = network_ids.find(pkt->SjPacketId);
+
+        if (it != network_ids.end())
+        {
+            addVerdict(NFQNL_MSG_VERDICT, NFQUEUE_NETWORK, NF_ACCEPT, it->second, pkt);
+            network_ids.erase(it);
+        }
+        else
+        {
+            /* created by a plugin for the local host: it's not in the queue, the raw socket delivers it */
+            sendRaw(pkt);
+        }
+
+        delete pkt;
+    }
+
+    /* an incoming packet not returned by TCPTrack has been removed during the analysis */
+    for (map<uint32_t, uint32_t>::iterator it = network_ids.begin(); it != network_ids.end(); ++it)
+        addVerdict(NFQNL_MSG_VERDICT, NFQUEUE_NETWORK, NF_DROP, it->second, NULL);
+
+    network_ids.clear();
+
+    flushMessages(false);
+}
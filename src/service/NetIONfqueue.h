@@ -0,0 +1,115 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SJ_NETIONFQUEUE_H
+#define SJ_NETIONFQUEUE_H
+
+#include "NetIO.h"
+
+#include <poll.h>
+#include <netpacket/packet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_queue.h>
+
+/*
+ * the inline backend: no TUN and no change of the default route. the
+ * netfilter rules queue to sniffjoke only the selected protocols and the
+ * addresses allowed by the IP list (the ipset of KernelPolicy) of the
+ * network interface, in mangle POSTROUTING the packets going out and in
+ * mangle PREROUTING the ones coming from the gateway mac address. the
+ * excluded traffic never leaves the kernel.
+ *
+ *   - a packet going out is consumed at once (a batch of NF_DROP verdicts)
+ *     and what sniffjoke sends in its place goes out by two sockets: the
+ *     real traffic (INNOCENT) by a IPPROTO_RAW socket, marked to skip the
+ *     queue but seen by conntrack and by the firewall as before; the fakes
+ *     and the ttl probes by the PF_PACKET socket, straight to the gateway
+ *     like in NetIOTun, invisible to conntrack.
+ *   - a packet coming in waits in the kernel: after analyzePacketQueue it
+ *     receives NF_ACCEPT with the payload left by the plugins, or NF_DROP
+ *     when sniffjoke removed it. the verdicts of a cycle are a single send.
+ *
+ * the queues are fail-open: --queue-bypass when sniffjoke is not bound,
+ * NFQA_CFG_F_FAIL_OPEN when a queue is full.
+ */
+
+#define NFQUEUE_TUNNEL          2700        /* queue of the packets going out */
+#define NFQUEUE_NETWORK         2701        /* queue of the packets from the gateway */
+#define NFQUEUE_MAXLEN          4096        /* packets waiting in every kernel queue */
+#define NFQUEUE_BURST           64          /* messages received in a cycle */
+#define NFQUEUE_REINJECT_MARK   0x40000000  /* fwmark bit of the packets sent by the raw socket */
+#define NFQUEUE_RCVBUF          4194304     /* receive buffer of the netlink socket */
+
+class NetIONfqueue : public NetIO
+{
+private:
+
+    /* nlfd: the nfnetlink_queue socket, bound to both the queues */
+    int nlfd;
+    int rawfd;
+    int linkfd;
+
+    struct sockaddr_ll send_ll;
+
+    struct pollfd fds[1];
+
+    vector<unsigned char> recvbuf;
+
+    /* the netlink messages waiting to be sent, config or verdicts */
+    vector<unsigned char> nlbuf;
+
+    /* the tunnel queue is consumed in order: a batch verdict reaches the last id */
+    bool tunnel_pending;
+    uint32_t tunnel_last_id;
+
+    /* SjPacketId of the network packets in TCPTrack -> their id in the queue */
+    map<uint32_t, uint32_t> network_ids;
+
+    /* the iptables rules, added by the constructor and deleted by the destructor */
+    vector<string> rules;
+
+    void setupSockets(void);
+    void setupQueue(uint16_t);
+    void setupRules(void);
+    void applyRules(const char *);
+
+    uint32_t beginMessage(uint16_t, uint16_t, uint16_t);
+    void addAttribute(uint32_t, uint16_t, const void *, uint16_t);
+    void addVerdict(uint16_t, uint16_t, uint32_t, uint32_t, const Packet *);
+    void flushMessages(bool);
+
+    void receive(void);
+    void parseMessage(const struct nlmsghdr *);
+    uint64_t ingressTimestamp(const struct nfqnl_msg_packet_timestamp *);
+    void sendRaw(const Packet *);
+    void sendPacket(Packet *);
+
+public:
+
+    NetIONfqueue(void);
+    ~NetIONfqueue(void);
+    void networkIO(void);
+};
+
+#endif /* SJ_NETIONFQUEUE_H */
@@ -0,0 +1,196 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NetIOReplay.h"
+
+#include <sys/time.h>
+
+NetIOReplay::NetIOReplay(const char *inputfile, const char *outprefix, const char *localnet, bool simulated) :
+input(inputfile, localnet),
+eof(false),
+held_ip(NULL),
+held_iplen(0),
+held_source(SOURCEUNASSIGNED),
+simulated(simulated),
+virtual_ns(0)
+{
+    LOG_DEBUG("");
+
+    memset(output, 0, sizeof (output));
+    memset(&counters, 0, sizeof (counters));
+
+    if (outprefix != NULL)
+    {
+        output[0] = openOutput(outprefix, "network");
+        output[1] = openOutput(outprefix, "tunnel");
+    }
+
+    LOG_VERBOSE("replaying %s capture %s (%s)", input.isPcapng() ? "pcapng" : "pcap", inputfile,
+                outprefix != NULL ? "writing the output captures" : "without output captures");
+
+    /* the virtual clock starts at the first packet, before the maps record their reference time */
+    if (simulated && fetch())
+        setClock(input.timestamp);
+}
+
+NetIOReplay::~NetIOReplay(void)
+{
+    LOG_DEBUG("");
+
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        if (output[i] != NULL)
+            fclose(output[i]);
+    }
+}
+
+bool NetIOReplay::fetch(void)
+{
+    held_ip = input.next(held_iplen, held_source);
+
+    if (held_ip == NULL)
+    {
+        LOG_VERBOSE("end of the capture after %lu records", (unsigned long) input.records);
+        eof = true;
+    }
+
+    return held_ip != NULL;
+}
+
+/* the virtual clock never goes back, also when the capture is not ordered */
+void NetIOReplay::setClock(uint64_t ns)
+{
+    if (ns <= virtual_ns)
+        return;
+
+    virtual_ns = ns;
+    sj_clock = ns / PCAP_NSEC_PER_SEC;
+    strftime(sj_clock_str, sizeof (sj_clock_str), "%Y-%m-%d %H:%M:%S", localtime(&sj_clock));
+}
+
+void NetIOReplay::advanceClock(uint32_t seconds)
+{
+    setClock(virtual_ns + (uint64_t) seconds * PCAP_NSEC_PER_SEC);
+}
+
+/* the output captures are raw IP, so the packets are written as TCPTrack returns them */
+FILE *NetIOReplay::openOutput(const char *outprefix, const char *direction)
+{
+    char outfile[LARGEBUF];
+    struct pcap_global_header gh;
+    FILE *out;
+
+    snprintf(outfile, sizeof (outfile), "%s-%s.pcap", outprefix, direction);
+
+    if ((out = fopen(outfile, "wb")) == NULL)
+        RUNTIME_EXCEPTION("unable to open output capture %s: %s", outfile, strerror(errno));
+
+    gh.magic = PCAP_MAGIC_USEC;
+    gh.version_major = 2;
+    gh.version_minor = 4;
+    gh.thiszone = 0;
+    gh.sigfigs = 0;
+    gh.snaplen = 65535;
+    gh.linktype = LINKTYPE_RAW;
+
+    if (fwrite(&gh, sizeof (gh), 1, out) != 1)
+        RUNTIME_EXCEPTION("unable to write output capture %s: %s", outfile, strerror(errno));
+
+    return out;
+}
+
+void NetIOReplay::writeOutput(uint8_t direction, const Packet &pkt)
+{
+    ++counters.out_pkts[direction];
+    counters.out_bytes[direction] += pkt.pbuf.size();
+
+    if (output[direction] == NULL)
+        return;
+
+    struct pcap_record_header rh;
+
+    if (simulated)
+    {
+        rh.ts_sec = virtual_ns / PCAP_NSEC_PER_SEC;
+        rh.ts_frac = (virtual_ns % PCAP_NSEC_PER_SEC) / 1000;
+    }
+    else
+    {
+        struct timeval now;
+
+        gettimeofday(&now, NULL);
+        rh.ts_sec = now.tv_sec;
+        rh.ts_frac = now.tv_usec;
+    }
+    rh.caplen = rh.origlen = pkt.pbuf.size();
+
+    if (fwrite(&rh, sizeof (rh), 1, output[direction]) != 1 ||
+            fwrite(&(pkt.pbuf[0]), pkt.pbuf.size(), 1, output[direction]) != 1)
+        RUNTIME_EXCEPTION("unable to write output capture: %s", strerror(errno));
+}
+
+void NetIOReplay::networkIO(void)
+{
+    Packet *pkt;
+
+    for (uint32_t i = 0; i < NETIOBURSTSIZE && !eof; ++i)
+    {
+        if (held_ip == NULL && !fetch())
+            break;
+
+        if (simulated)
+        {
+            /* TCPTrack see a single clock value for every burst, as in the service */
+            if (i && input.timestamp / PCAP_NSEC_PER_SEC > (uint64_t) sj_clock)
+                break;
+
+            setClock(input.timestamp);
+        }
+
+        const uint8_t direction = (held_source == NETWORK);
+
+        ++counters.in_pkts[direction];
+        counters.in_bytes[direction] += held_iplen;
+
+        conntrack->writepacket(held_source, held_ip, held_iplen, sj_monotonic_ns());
+        held_ip = NULL;
+    }
+
+    counters.records = input.records;
+    counters.skipped = input.skipped;
+    counters.foreign = input.foreign;
+
+    conntrack->analyzePacketQueue();
+
+    /* readpacket(TUNNEL) returns what goes in the network, readpacket(NETWORK) what goes in the tunnel */
+    while ((pkt = conntrack->readpacket(TUNNEL)) != NULL)
+    {
+        writeOutput(0, *pkt);
+        delete pkt;
+    }
+
+    while ((pkt = conntrack->readpacket(NETWORK)) != NULL)
+    {
+        writeOutput(1, *pkt);
+        delete pkt;
+    }
+}
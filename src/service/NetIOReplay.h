@@ -0,0 +1,99 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_NETIOREPLAY_H
+#define SJ_NETIOREPLAY_H
+
+#include "NetIO.h"
+#include "PcapReader.h"
+
+/*
+ * the offline backend used by sniffjoke-replay: the packets are read from a
+ * pcap or pcapng capture by PcapReader, that tags them TUNNEL or NETWORK,
+ * and what TCPTrack returns is written in two raw IP pcaps, one for every
+ * direction.
+ *
+ * no TUN, datalink socket, route or firewall change is done, so root is not
+ * required; only IPv4 packets are replayed, the others are counted and skipped.
+ *
+ * in simulation mode sj_clock is a virtual clock driven by the timestamps of
+ * the capture, and the output captures are stamped with it: together with a
+ * fixed random seed two runs of the same capture produce the same output.
+ */
+
+struct replay_counters
+{
+    uint64_t records; /* every record read in the capture */
+    uint64_t skipped; /* not IPv4 or truncated */
+    uint64_t foreign; /* not to/from the local network */
+    uint64_t in_pkts[2]; /* [0] TUNNEL, [1] NETWORK */
+    uint64_t in_bytes[2];
+    uint64_t out_pkts[2]; /* [0] written in the network, [1] written in the tunnel */
+    uint64_t out_bytes[2];
+};
+
+class NetIOReplay : public NetIO
+{
+private:
+
+    PcapReader input;
+    FILE *output[2];
+
+    bool eof;
+
+    /* the next record, already read: a simulated burst stops on a new second */
+    const unsigned char *held_ip;
+    uint32_t held_iplen;
+    source_t held_source;
+
+    const bool simulated;
+    uint64_t virtual_ns;
+
+    bool fetch(void);
+    void setClock(uint64_t);
+    FILE *openOutput(const char *, const char *);
+    void writeOutput(uint8_t, const Packet &);
+
+public:
+
+    struct replay_counters counters;
+
+    NetIOReplay(const char *, const char *, const char *, bool);
+    ~NetIOReplay(void);
+    void networkIO(void);
+
+    /* move the virtual clock forward, used when the capture is over */
+    void advanceClock(uint32_t);
+
+    bool isSimulated(void) const
+    {
+        return simulated;
+    };
+
+    /* true when the capture is over */
+    bool inputEnded(void) const
+    {
+        return eof;
+    };
+};
+
+#endif /* SJ_NETIOREPLAY_H */
@@ -20,7 +20,7 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "NetIO.h"
+#include "NetIOTun.h"
 #include "UserConf.h"
 
 #include <fcntl.h>
@@ -31,10 +31,9 @@
 
 extern auto_ptr<UserConf> userconf;
 
-void NetIO::setupNET()
+void NetIOTun::setupPacketSocket()
 {
     int tmpflags;
-    int tmpfd;
     struct ifreq tmpifr;
 
     memset(&tmpifr, 0x00, sizeof (tmpifr));
@@ -49,7 +48,7 @@ void NetIO::setupNET()
     else
         RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on netfd (F_SETFD): %s", strerror(errno));
 
-    strncpy(tmpifr.ifr_name, userconf->runcfg.net_iface_name, sizeof (tmpifr.ifr_name));
+    snprintf(tmpifr.ifr_name, sizeof (tmpifr.ifr_name), "%s", userconf->runcfg.net_iface_name);
     if (ioctl(netfd, SIOCGIFINDEX, &tmpifr) != -1)
         LOG_DEBUG("ioctl(SIOCGIFINDEX) executed successfully on interface %s", userconf->runcfg.net_iface_name);
     else
@@ -69,6 +68,28 @@ void NetIO::setupNET()
     else
         RUNTIME_EXCEPTION("unable to bind datalink layer interface: %s", strerror(errno));
 
+    /* the kernel receive timestamp is the ingress time of the network packets */
+    tmpflags = 1;
+    if (setsockopt(netfd, SOL_SOCKET, SO_TIMESTAMPNS, &tmpflags, sizeof (tmpflags)) != -1)
+        LOG_DEBUG("kernel receive timestamps enabled on netfd (SO_TIMESTAMPNS)");
+    else
+        LOG_DEBUG("unable to enable kernel receive timestamps on netfd (SO_TIMESTAMPNS): %s", strerror(errno));
+}
+
+void NetIOTun::setupNET()
+{
+    int tmpfd;
+    struct ifreq tmpifr;
+
+    /* the AF_XDP socket is created by setupService, in the service child */
+    if (!strncmp(userconf->runcfg.io_backend, "xdp", 3))
+        netfd = -1;
+    else
+        setupPacketSocket();
+
+    memset(&tmpifr, 0x00, sizeof (tmpifr));
+    snprintf(tmpifr.ifr_name, sizeof (tmpifr.ifr_name), "%s", userconf->runcfg.net_iface_name);
+
     tmpfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
 
     if (ioctl(tmpfd, SIOCGIFMTU, &tmpifr) != -1)
@@ -80,7 +101,36 @@ void NetIO::setupNET()
     close(tmpfd);
 }
 
-void NetIO::setupTUN()
+/*
+ * SO_TIMESTAMPNS gives a CLOCK_REALTIME stamp, while the queues use CLOCK_MONOTONIC:
+ * the time elapsed in the kernel is subtracted to the monotonic now.
+ */
+uint64_t NetIOTun::ingressTimestamp(struct msghdr &msg)
+{
+    const uint64_t now = sj_monotonic_ns();
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+            continue;
+
+        struct timespec kernel_ts, real_ts;
+        memcpy(&kernel_ts, CMSG_DATA(cmsg), sizeof (kernel_ts));
+        clock_gettime(CLOCK_REALTIME, &real_ts);
+
+        const int64_t inkernel = (int64_t) (real_ts.tv_sec - kernel_ts.tv_sec) * 1000000000
+                + (real_ts.tv_nsec - kernel_ts.tv_nsec);
+
+        if (inkernel > 0 && (uint64_t) inkernel < now)
+            return now - inkernel;
+
+        break;
+    }
+
+    return now;
+}
+
+void NetIOTun::setupTUN()
 {
     const char *tundev = "/dev/net/tun";
 
@@ -146,7 +196,8 @@ void NetIO::setupTUN()
     close(tmpfd);
 }
 
-NetIO::NetIO(void)
+NetIOTun::NetIOTun(void) :
+xdp(NULL)
 {
     LOG_DEBUG("");
 
@@ -176,12 +227,20 @@ NetIO::NetIO(void)
     LOG_VERBOSE("setting default gateway our fake TUN endpoint ip address: %s", DEFAULT_FAKE_IPADDR);
     execOSCmd(cmd);
 
-    snprintf(cmd, sizeof (cmd), "iptables -A INPUT -m mac --mac-source %s -j DROP", userconf->runcfg.gw_mac_str);
-    LOG_ALL("dropping all traffic from the gateway [%s]", cmd);
-    execOSCmd(cmd);
+    policy = new KernelPolicy;
+    policy->bypassRoute();
+    policy->dropGateway();
+
+    /*
+     * with the xdp backend there is no packet socket yet (the AF_XDP one is
+     * created by setupService) and its program already redirects only the
+     * frames of the gateway; --offload is refused with it
+     */
+    if (netfd != -1)
+        policy->attachFilter(netfd);
 }
 
-NetIO::~NetIO(void)
+NetIOTun::~NetIOTun(void)
 {
     LOG_DEBUG("");
 
@@ -202,22 +261,36 @@ NetIO::~NetIO(void)
         snprintf(cmd, sizeof (cmd), "route add default gw %s", userconf->runcfg.gw_ip_addr);
         LOG_VERBOSE("restoring previous default gateway [%s]", cmd);
         execOSCmd(cmd);
-
-        snprintf(cmd, sizeof (cmd), "iptables -D INPUT -m mac --mac-source %s -j DROP", userconf->runcfg.gw_mac_str);
-        LOG_VERBOSE("deleting the filtering rule: [%s]", cmd);
-        execOSCmd(cmd);
     }
 
+    /* the policy checks the privileges itself */
+    delete policy;
+
     close(tunfd);
-    close(netfd);
+
+    if (xdp != NULL)
+        delete xdp;
+    else if (netfd != -1)
+        close(netfd);
 }
 
-void NetIO::prepareConntrack(TCPTrack *ct)
+/*
+ * the UMEM registered by the root process would be shared with the child
+ * only until the fork: the AF_XDP socket, its UMEM and the XDP program are
+ * created in the child, still with the privileges that they require.
+ */
+void NetIOTun::setupService(void)
 {
-    conntrack = ct;
+    if (strncmp(userconf->runcfg.io_backend, "xdp", 3))
+        return;
+
+    xdp = new XdpSocket(userconf->runcfg.net_iface_name, userconf->runcfg.gw_mac_addr,
+                        !strcmp(userconf->runcfg.io_backend, "xdp-generic"));
+
+    netfd = fds[1].fd = xdp->getFd();
 }
 
-void NetIO::networkIO(void)
+void NetIOTun::networkIO(void)
 {
     /*
      * This is a critical function for sniffjoke operativity.
@@ -294,7 +367,7 @@ void NetIO::networkIO(void)
             if (ret == -1)
                 RUNTIME_EXCEPTION("error reading from tunnel: %s", strerror(errno));
 
-            conntrack->writepacket(TUNNEL, &(pktbuf[0]), ret);
+            conntrack->writepacket(TUNNEL, &(pktbuf[0]), ret, sj_monotonic_ns());
         }
 
         if (fds[0].revents & POLLOUT) /* it's possibile to write in tunfd */
@@ -309,17 +382,51 @@ void NetIO::networkIO(void)
             pkt_net = conntrack->readpacket(NETWORK);
         }
 
-        if (fds[1].revents & POLLIN) /* it's possible to read from netfd */
+        if ((fds[1].revents & POLLIN) && xdp != NULL) /* AF_XDP frames in the rx ring */
         {
-            ret = recv(netfd, &(pktbuf[0]), userconf->runcfg.net_iface_mtu, 0);
+            const unsigned char *frame;
+            uint32_t framelen;
+
+            /* the whole rx ring is consumed: the frames return to the kernel together */
+            while ((frame = xdp->receive(framelen)) != NULL)
+                conntrack->writepacket(NETWORK, frame, framelen, sj_monotonic_ns());
+
+            xdp->release();
+        }
+        else if (fds[1].revents & POLLIN) /* it's possible to read from netfd */
+        {
+            struct iovec iov;
+            struct msghdr msg;
+            char cmsgbuf[CMSG_SPACE(sizeof (struct timespec))];
+
+            iov.iov_base = &(pktbuf[0]);
+            iov.iov_len = userconf->runcfg.net_iface_mtu;
+            memset(&msg, 0, sizeof (msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = cmsgbuf;
+            msg.msg_controllen = sizeof (cmsgbuf);
+
+            ret = recvmsg(netfd, &msg, 0);
 
             if (ret == -1)
                 RUNTIME_EXCEPTION("error reading from network: %s", strerror(errno));
 
-            conntrack->writepacket(NETWORK, &(pktbuf[0]), ret);
+            conntrack->writepacket(NETWORK, &(pktbuf[0]), ret, ingressTimestamp(msg));
         }
 
-        if (fds[1].revents & POLLOUT) /* it's possibile to write in netfd */
+        if ((fds[1].revents & POLLOUT) && xdp != NULL) /* free slots in the AF_XDP tx ring */
+        {
+            /* every packet ready is queued in the tx ring, then a single wakeup */
+            while (pkt_tun != NULL && xdp->send(&(pkt_tun->pbuf[0]), pkt_tun->pbuf.size()))
+            {
+                delete pkt_tun;
+                pkt_tun = conntrack->readpacket(TUNNEL);
+            }
+
+            xdp->flush();
+        }
+        else if (fds[1].revents & POLLOUT) /* it's possibile to write in netfd */
         {
             ret = sendto(netfd, &(pkt_tun->pbuf[0]), pkt_tun->pbuf.size(), 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll));
 
@@ -0,0 +1,521 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "NetIOUring.h"
+#include "UserConf.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+extern auto_ptr<UserConf> userconf;
+
+NetIOUring::NetIOUring(void) :
+ringfd(-1),
+sqes(NULL),
+sq_map(NULL),
+cq_map(NULL),
+enters(0),
+packets(0)
+{
+    LOG_DEBUG("");
+
+    /* the multishot recvmsg writes its header and the control data before the packet */
+    if (userconf->runcfg.net_iface_mtu + sizeof (struct io_uring_recvmsg_out) + URING_CONTROL > URING_BUFSIZE)
+        RUNTIME_EXCEPTION("the mtu %u is too large for the io_uring buffers of %u bytes",
+                          userconf->runcfg.net_iface_mtu, URING_BUFSIZE);
+
+    writing[0] = writing[1] = 0;
+    memset(reads, 0x00, sizeof (reads));
+}
+
+NetIOUring::~NetIOUring(void)
+{
+    LOG_DEBUG("");
+
+    if (ringfd == -1)
+        return;
+
+    if (packets)
+        LOG_VERBOSE("io_uring: %u io_uring_enter for %u packets read or written", enters, packets);
+
+    drainWrites();
+
+    /* the ring is closed first: the kernel does not use the buffers anymore */
+    close(ringfd);
+
+    munmap(sqes, sqes_maplen);
+    if (cq_map != sq_map)
+        munmap(cq_map, cq_maplen);
+    munmap(sq_map, sq_maplen);
+
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        munmap(reads[i].bufring, URING_BUFFERS * sizeof (struct io_uring_buf));
+
+        for (vector<Packet *>::iterator it = pending[i].begin(); it != pending[i].end(); ++it)
+            delete *it;
+    }
+
+    /* the Packet of a write not completed in drainWrites is still there */
+    for (vector<uring_write *>::iterator it = writes.begin(); it != writes.end(); ++it)
+    {
+        delete (*it)->pkt;
+        delete *it;
+    }
+}
+
+void NetIOUring::setupRing(void)
+{
+    struct io_uring_params params;
+
+    /* the flags reducing the task work are tried first, they require a recent kernel */
+    memset(&params, 0x00, sizeof (params));
+    params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+
+    if ((ringfd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) == -1 && errno == EINVAL)
+    {
+        memset(&params, 0x00, sizeof (params));
+        ringfd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+
+    if (ringfd == -1)
+        RUNTIME_EXCEPTION("unable to create the io_uring: %s", strerror(errno));
+
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+        RUNTIME_EXCEPTION("the kernel io_uring does not support the wait timeout (IORING_FEAT_EXT_ARG)");
+
+    sq_maplen = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+    cq_maplen = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_maplen = cq_maplen = (sq_maplen > cq_maplen) ? sq_maplen : cq_maplen;
+
+    sq_map = mmap(NULL, sq_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED)
+        RUNTIME_EXCEPTION("unable to map the io_uring submission ring: %s", strerror(errno));
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cq_map = sq_map;
+    else if ((cq_map = mmap(NULL, cq_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        RUNTIME_EXCEPTION("unable to map the io_uring completion ring: %s", strerror(errno));
+
+    sqes_maplen = params.sq_entries * sizeof (struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(NULL, sqes_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        RUNTIME_EXCEPTION("unable to map the io_uring submission entries: %s", strerror(errno));
+
+    sq_head = (volatile uint32_t *) ((unsigned char *) sq_map + params.sq_off.head);
+    sq_tail = (volatile uint32_t *) ((unsigned char *) sq_map + params.sq_off.tail);
+    sq_mask = *(uint32_t *) ((unsigned char *) sq_map + params.sq_off.ring_mask);
+    sq_array = (uint32_t *) ((unsigned char *) sq_map + params.sq_off.array);
+    sq_local_tail = sq_submitted = *sq_tail;
+
+    cq_head = (volatile uint32_t *) ((unsigned char *) cq_map + params.cq_off.head);
+    cq_tail = (volatile uint32_t *) ((unsigned char *) cq_map + params.cq_off.tail);
+    cq_mask = *(uint32_t *) ((unsigned char *) cq_map + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((unsigned char *) cq_map + params.cq_off.cqes);
+
+    buffers.resize(2 * URING_BUFFERS * URING_BUFSIZE);
+
+    setupBuffers(reads[0], TUNNEL, tunfd, 0);
+    setupBuffers(reads[1], NETWORK, netfd, 1);
+
+    LOG_ALL("io_uring backend ready: %u entries, %u buffers of %u bytes for each fd",
+            params.sq_entries, URING_BUFFERS, URING_BUFSIZE);
+}
+
+void NetIOUring::setupBuffers(struct uring_read &read, source_t source, int fd, uint16_t bgid)
+{
+    struct io_uring_buf_reg reg;
+    int tmpflags;
+
+    read.source = source;
+    read.fd = fd;
+    read.bgid = bgid;
+    read.multishot = true;
+    read.armed = false;
+
+    /* the retries of the kernel are driven by its poll, never by a blocked worker */
+    if ((tmpflags = fcntl(fd, F_GETFL)) == -1 || fcntl(fd, F_SETFL, tmpflags | O_NONBLOCK) == -1)
+        RUNTIME_EXCEPTION("unable to set O_NONBLOCK for io_uring: %s", strerror(errno));
+
+    read.bufring = (struct io_uring_buf_ring *) mmap(NULL, URING_BUFFERS * sizeof (struct io_uring_buf),
+                                                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (read.bufring == MAP_FAILED)
+        RUNTIME_EXCEPTION("unable to allocate the io_uring buffer ring: %s", strerror(errno));
+
+    memset(&reg, 0x00, sizeof (reg));
+    reg.ring_addr = (uint64_t) (unsigned long) read.bufring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = bgid;
+
+    if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+        RUNTIME_EXCEPTION("unable to register the io_uring buffer ring: %s", strerror(errno));
+
+    read.buftail = 0;
+    for (uint16_t bid = 0; bid < URING_BUFFERS; ++bid)
+        recycleBuffer(read, bid);
+
+    __sync_synchronize();
+    read.bufring->tail = read.buftail;
+}
+
+/* the tail of the buffer ring is published by reap, once for all the batch */
+void NetIOUring::recycleBuffer(struct uring_read &read, uint16_t bid)
+{
+    /*
+     * only the three fields: the resv of the first entry is the tail of the ring.
+     * the entries are not reached with bufs[]: in C++ the empty struct before the
+     * flexible array of the kernel header is one byte, and moves them of 8 bytes.
+     */
+    struct io_uring_buf &buf = ((struct io_uring_buf *) read.bufring)[read.buftail & (URING_BUFFERS - 1)];
+
+    buf.addr = (uint64_t) (unsigned long) &buffers[(read.bgid * URING_BUFFERS + bid) * URING_BUFSIZE];
+    buf.len = URING_BUFSIZE;
+    buf.bid = bid;
+
+    ++read.buftail;
+}
+
+/*
+ * a packet of netfd, with the kernel timestamp of its control data. the
+ * multishot recvmsg puts in the buffer a header, the name (none: the length
+ * requested is 0), the control data with the requested length, the packet.
+ */
+void NetIOUring::writeReceived(struct uring_read &read, unsigned char *buf, int len)
+{
+    if (!read.multishot)
+    {
+        conntrack->writepacket(NETWORK, buf, len, ingressTimestamp(read.msg));
+        return;
+    }
+
+    const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *) buf;
+    unsigned char *control = buf + sizeof (*out);
+    struct msghdr msg;
+
+    if ((uint32_t) len < sizeof (*out) + URING_CONTROL + out->payloadlen || (out->flags & MSG_TRUNC))
+    {
+        LOG_DEBUG("truncated packet of %u bytes from the network, discarded", out->payloadlen);
+        return;
+    }
+
+    memset(&msg, 0x00, sizeof (msg));
+    msg.msg_control = control;
+    msg.msg_controllen = out->controllen;
+
+    conntrack->writepacket(NETWORK, control + URING_CONTROL, out->payloadlen, ingressTimestamp(msg));
+}
+
+struct io_uring_sqe *NetIOUring::getSQE(void)
+{
+    /* full submission ring: what is queued is submitted now */
+    if (sq_local_tail - *sq_head > sq_mask)
+        enter(false);
+
+    const uint32_t index = sq_local_tail & sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+
+    memset(sqe, 0x00, sizeof (*sqe));
+    sq_array[index] = index;
+    ++sq_local_tail;
+
+    return sqe;
+}
+
+void NetIOUring::armRead(struct uring_read &read)
+{
+    struct io_uring_sqe *sqe = getSQE();
+
+    sqe->fd = read.fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = read.bgid;
+    sqe->user_data = read.source;
+
+    if (read.source == NETWORK)
+    {
+        /* the single iovec is replaced by the provided buffer, its length is the limit */
+        memset(&read.msg, 0x00, sizeof (read.msg));
+        read.iov.iov_base = NULL;
+        read.iov.iov_len = URING_BUFSIZE;
+        read.msg.msg_iov = &read.iov;
+        read.msg.msg_iovlen = 1;
+        read.msg.msg_control = read.control;
+        read.msg.msg_controllen = sizeof (read.control);
+
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = (uint64_t) (unsigned long) &read.msg;
+        sqe->len = 1;
+        if (read.multishot)
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+    }
+    else if (!read.multishot)
+    {
+        sqe->opcode = IORING_OP_READ;
+        sqe->len = URING_BUFSIZE;
+    }
+    else
+    {
+        sqe->opcode = URING_OP_READ_MULTISHOT;
+    }
+
+    read.armed = true;
+}
+
+void NetIOUring::queueWrites(uint8_t dest)
+{
+    if (writing[dest] || pending[dest].empty())
+        return;
+
+    /* a chain is never split between two submissions */
+    const uint32_t room = sq_mask + 1 - (sq_local_tail - *sq_head);
+    const uint32_t chain = (pending[dest].size() < room) ? pending[dest].size() : room;
+
+    for (uint32_t i = 0; i < chain; ++i)
+    {
+        Packet *pkt = pending[dest][i];
+        uring_write *write;
+
+        if (!free_writes.empty())
+        {
+            write = free_writes.back();
+            free_writes.pop_back();
+        }
+        else
+        {
+            write = new uring_write;
+            writes.push_back(write);
+        }
+
+        write->pkt = pkt;
+        write->dest = dest;
+        write->iov.iov_base = &(pkt->pbuf[0]);
+        write->iov.iov_len = pkt->pbuf.size();
+
+        struct io_uring_sqe *sqe = getSQE();
+
+        if (dest == 0)
+        {
+            memset(&write->msg, 0x00, sizeof (write->msg));
+            write->msg.msg_name = &send_ll;
+            write->msg.msg_namelen = sizeof (send_ll);
+            write->msg.msg_iov = &write->iov;
+            write->msg.msg_iovlen = 1;
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = netfd;
+            sqe->addr = (uint64_t) (unsigned long) &write->msg;
+            sqe->len = 1;
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = tunfd;
+            sqe->addr = (uint64_t) (unsigned long) write->iov.iov_base;
+            sqe->len = write->iov.iov_len;
+        }
+
+        if (i + 1 != chain)
+            sqe->flags = IOSQE_IO_LINK;
+
+        sqe->user_data = (uint64_t) (unsigned long) write;
+        ++writing[dest];
+    }
+
+    pending[dest].erase(pending[dest].begin(), pending[dest].begin() + chain);
+}
+
+/* submits the queued entries; when wait, until a completion or URING_WAIT_NSEC */
+void NetIOUring::enter(bool wait)
+{
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = URING_WAIT_NSEC;
+
+    memset(&arg, 0x00, sizeof (arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t) (unsigned long) &timeout;
+
+    const uint32_t to_submit = sq_local_tail - sq_submitted;
+
+    __sync_synchronize();
+    *sq_tail = sq_local_tail;
+
+    const int ret = syscall(__NR_io_uring_enter, ringfd, to_submit, wait ? 1 : 0,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof (arg));
+    ++enters;
+
+    if (ret >= 0)
+        sq_submitted += ret;
+    else if (errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        RUNTIME_EXCEPTION("strange and dangerous error in io_uring_enter: %s", strerror(errno));
+}
+
+void NetIOUring::reap(void)
+{
+    uint32_t head = *cq_head;
+    const uint32_t tail = *cq_tail;
+
+    /* the entries are read after the index */
+    __sync_synchronize();
+
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe &cqe = cqes[head & cq_mask];
+
+        if (cqe.user_data == TUNNEL || cqe.user_data == NETWORK)
+        {
+            struct uring_read &read = reads[cqe.user_data == TUNNEL ? 0 : 1];
+
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+                read.armed = false;
+
+            if (cqe.flags & IORING_CQE_F_BUFFER)
+            {
+                const uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+                if (cqe.res > 0)
+                {
+                    unsigned char *buf = &buffers[(read.bgid * URING_BUFFERS + bid) * URING_BUFSIZE];
+
+                    if (read.source == TUNNEL)
+                        conntrack->writepacket(TUNNEL, buf, cqe.res, sj_monotonic_ns());
+                    else
+                        writeReceived(read, buf, cqe.res);
+                    ++packets;
+                }
+
+                recycleBuffer(read, bid);
+            }
+            else if (cqe.res == -EINVAL && read.multishot)
+            {
+                LOG_VERBOSE("io_uring multishot %s not supported by the kernel, using single shot",
+                            read.source == TUNNEL ? "read" : "recvmsg");
+                read.multishot = false;
+            }
+            else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -EAGAIN && cqe.res != -EINTR)
+            {
+                RUNTIME_EXCEPTION("error reading from %s: %s", read.source == TUNNEL ? "tunnel" : "network", strerror(-cqe.res));
+            }
+
+            continue;
+        }
+
+        uring_write *write = (uring_write *) (unsigned long) cqe.user_data;
+
+        if (cqe.res < 0)
+            RUNTIME_EXCEPTION("error writing in %s: %s", write->dest ? "tunnel" : "network", strerror(-cqe.res));
+
+        --writing[write->dest];
+        delete write->pkt;
+        write->pkt = NULL;
+        free_writes.push_back(write);
+        ++packets;
+    }
+
+    __sync_synchronize();
+    *cq_head = head;
+
+    reads[0].bufring->tail = reads[0].buftail;
+    reads[1].bufring->tail = reads[1].buftail;
+}
+
+/*
+ * at the end the kernel may still be using the Packets of the writes in flight:
+ * their completions are waited before the ring is closed. the reads are not
+ * passed to TCPTrack anymore, and an error is not an exception here.
+ */
+void NetIOUring::drainWrites(void)
+{
+    for (uint32_t waits = 0; (writing[0] || writing[1]) && waits < URING_DRAIN_WAITS; ++waits)
+    {
+        enter(true);
+
+        uint32_t head = *cq_head;
+        const uint32_t tail = *cq_tail;
+
+        __sync_synchronize();
+
+        for (; head != tail; ++head)
+        {
+            const struct io_uring_cqe &cqe = cqes[head & cq_mask];
+
+            if (cqe.user_data == TUNNEL || cqe.user_data == NETWORK)
+                continue;
+
+            uring_write *write = (uring_write *) (unsigned long) cqe.user_data;
+
+            --writing[write->dest];
+            delete write->pkt;
+            write->pkt = NULL;
+        }
+
+        __sync_synchronize();
+        *cq_head = head;
+    }
+
+    if (writing[0] || writing[1])
+        LOG_VERBOSE("io_uring: %u writes still in flight at the end", writing[0] + writing[1]);
+}
+
+void NetIOUring::networkIO(void)
+{
+    /*
+     * every cycle posts the reads not armed, chains the packets ready to go
+     * out and does a single io_uring_enter: it returns with at least a
+     * completion or after 1 ms, so the cycles are NETIOBURSTSIZE at most,
+     * 10 ms when idle, as in the poll backend.
+     */
+    uint32_t max_cycle = NETIOBURSTSIZE;
+    Packet *pkt;
+
+    if (ringfd == -1)
+        setupRing();
+
+    while (max_cycle--)
+    {
+        for (uint8_t i = 0; i < 2; ++i)
+        {
+            if (!reads[i].armed)
+                armRead(reads[i]);
+        }
+
+        while ((pkt = conntrack->readpacket(TUNNEL)) != NULL)
+            pending[0].push_back(pkt);
+
+        while ((pkt = conntrack->readpacket(NETWORK)) != NULL)
+            pending[1].push_back(pkt);
+
+        queueWrites(0);
+        queueWrites(1);
+
+        enter(true);
+        reap();
+    }
+
+    conntrack->analyzePacketQueue();
+}
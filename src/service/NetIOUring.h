@@ -0,0 +1,139 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SJ_NETIOURING_H
+#define SJ_NETIOURING_H
+
+#include "NetIOTun.h"
+
+#include <linux/io_uring.h>
+
+/*
+ * the io_uring variant of NetIOTun: same TUN and PF_PACKET setup, but no
+ * poll-then-read/write. a multishot read is kept posted on tunfd and a
+ * multishot recvmsg on netfd, both taking their buffers from a ring of
+ * provided buffers; the control data of recvmsg carry the kernel timestamp
+ * of the network packets, as in NetIOTun. the writes are submitted without waiting. every cycle of
+ * networkIO is a single io_uring_enter, submitting the new writes and
+ * reaping all the completions in a batch.
+ *
+ * the ring is created at the first networkIO, in the process that uses it:
+ * the constructor runs before the fork and the privileges downgrade.
+ */
+
+#define URING_ENTRIES           256     /* submission queue, the completion one is double */
+#define URING_BUFFERS           256     /* provided buffers for each fd, MUST be a power of two */
+#define URING_BUFSIZE           2048    /* larger than the mtu of the network interface */
+#define URING_WAIT_NSEC         1000000 /* max wait for a completion (1 ms), as the poll backend */
+#define URING_DRAIN_WAITS       100     /* URING_WAIT_NSEC waited at most for the writes in flight at the end */
+#define URING_CONTROL           CMSG_SPACE(sizeof (struct timespec)) /* the SCM_TIMESTAMPNS of recvmsg */
+
+/* not in the headers of the kernels before 6.7 */
+#define URING_OP_READ_MULTISHOT 49
+
+struct uring_read
+{
+    source_t source;
+    int fd;
+    uint16_t bgid;
+    bool multishot;
+    bool armed;
+    struct io_uring_buf_ring *bufring;
+    uint16_t buftail;
+
+    /* the recvmsg of netfd: in single shot the kernel writes the control data here */
+    struct msghdr msg;
+    struct iovec iov;
+    unsigned char control[URING_CONTROL];
+};
+
+/* a write in flight: the Packet is deleted at its completion, then pkt is NULL */
+struct uring_write
+{
+    Packet *pkt;
+    uint8_t dest; /* index in NetIOUring::pending and writing */
+    struct msghdr msg;
+    struct iovec iov;
+};
+
+class NetIOUring : public NetIOTun
+{
+private:
+    int ringfd;
+
+    /* submission ring */
+    volatile uint32_t *sq_head;
+    volatile uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    uint32_t sq_local_tail;
+    uint32_t sq_submitted;
+
+    /* completion ring */
+    volatile uint32_t *cq_head;
+    volatile uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_maplen;
+    void *cq_map;
+    size_t cq_maplen;
+    size_t sqes_maplen;
+
+    vector<unsigned char> buffers;
+    struct uring_read reads[2];
+
+    /*
+     * the writes to the same fd are a linked chain, executed in order; a new
+     * chain starts only when the previous is completed, so an asynchronous
+     * retry never reorders the packets. [0] is netfd, [1] is tunfd.
+     */
+    vector<Packet *> pending[2];
+    uint32_t writing[2];
+    vector<uring_write *> writes; /* every one allocated, free or in flight */
+    vector<uring_write *> free_writes;
+
+    /* accounting of the syscalls, reported at the end */
+    uint32_t enters;
+    uint32_t packets;
+
+    void setupRing(void);
+    void setupBuffers(struct uring_read &, source_t, int, uint16_t);
+    struct io_uring_sqe *getSQE(void);
+    void armRead(struct uring_read &);
+    void recycleBuffer(struct uring_read &, uint16_t);
+    void writeReceived(struct uring_read &, unsigned char *, int);
+    void queueWrites(uint8_t);
+    void enter(bool);
+    void reap(void);
+    void drainWrites(void);
+
+public:
+    NetIOUring(void);
+    ~NetIOUring(void);
+    void networkIO(void);
+};
+
+#endif /* SJ_NETIOURING_H */
@@ -155,6 +155,8 @@ OptionPool::OptionPool()
         /* testing modality - all options are loaded without a corruption definitions */
         LOG_ALL("option configuration not supplied! Initializing in testing mode");
     }
+
+    buildRecipes();
 }
 
 OptionPool::~OptionPool()
@@ -175,6 +177,212 @@ void OptionPool::disableAllOptions(void)
     }
 
     LOG_VERBOSE("%d options implementation was 'enabled', now all %d has been disabled", enabledcnt, pool.size());
+
+    buildRecipes();
+}
+
+/*
+ * the bytes changing between two injections of the same size are the random
+ * payload of the option: optApply is repeated in the space of the written size
+ * and every byte that differs at least once is marked, to be refreshed at every
+ * use. an injection of another size says nothing about the written one, so it
+ * is skipped and not counted.
+ */
+void OptionPool::markRandomBytes(IPTCPopt &oDesc, const uint8_t *written, uint8_t off, struct option_recipe &r)
+{
+    const uint8_t len = r.occ[r.occurrences - 1].len;
+    bool differs[OPTHDR_MAXLEN];
+    struct optHdrData probe;
+    uint8_t compared = 0;
+
+    memset(differs, 0, sizeof (differs));
+
+    for (uint8_t t = 0; t < OPTRECIPE_PROBES * 4 && compared < OPTRECIPE_PROBES; ++t)
+    {
+        memset(&probe, 0, sizeof (probe));
+        probe.actual_opts_len = OPTHDR_MAXLEN - len;
+
+        if (oDesc.optApply(&probe) != len)
+            continue;
+
+        for (uint8_t j = 0; j < len; ++j)
+        {
+            if (probe.optshdr[probe.actual_opts_len + j] != written[j])
+                differs[j] = true;
+        }
+
+        ++compared;
+    }
+
+    for (uint8_t j = 0; j < len;)
+    {
+        if (!differs[j])
+        {
+            ++j;
+            continue;
+        }
+
+        r.random[r.randoms].off = off + j;
+        while (j < len && differs[j])
+            ++j;
+        r.random[r.randoms].len = off + j - r.random[r.randoms].off;
+        ++r.randoms;
+    }
+}
+
+/* one injection done like HDRoptions option by option, in a shuffled order, in avail bytes */
+bool OptionPool::simulateInjection(uint8_t proto, bool corrupt, uint8_t avail, struct option_recipe &r)
+{
+    const uint8_t first = (proto == IPPROTO_TCP) ? FIRST_TCPOPT : FIRST_IPOPT;
+    const uint8_t last = (proto == IPPROTO_TCP) ? LAST_TCPOPT : LAST_IPOPT;
+    const uint8_t EOL_code = (proto == IPPROTO_TCP) ? TCPOPT_EOL : IPOPT_END;
+    const uint8_t base = OPTHDR_MAXLEN - avail;
+
+    uint8_t seq[SUPPORTED_OPTIONS];
+    uint8_t count[SUPPORTED_OPTIONS];
+    uint8_t n = 0;
+    bool corruptDone = false;
+    struct optHdrData oD;
+
+    memset(&r, 0, sizeof (r));
+    memset(count, 0, sizeof (count));
+    memset(&oD, 0, sizeof (oD));
+    oD.actual_opts_len = base;
+
+    for (uint8_t i = first; i <= last; ++i)
+        seq[n++] = i;
+
+    for (uint8_t i = n - 1; i > 0; --i)
+    {
+        const uint8_t j = random() % (i + 1);
+        const uint8_t swap = seq[i];
+        seq[i] = seq[j];
+        seq[j] = swap;
+    }
+
+    for (uint8_t k = 0; k < n; ++k)
+    {
+        const uint8_t sjOptIndex = seq[k];
+        IPTCPopt &oDesc = *pool[sjOptIndex];
+
+        while (oDesc.isInjectable(corrupt, corruptDone, count[sjOptIndex]))
+        {
+            const uint8_t off = oD.actual_opts_len;
+            const uint8_t writtedLen = oDesc.optApply(&oD);
+
+            /* no space is available, or the option is only tracked */
+            if (writtedLen == 0)
+                break;
+
+            r.optIndex[r.occurrences] = sjOptIndex;
+            r.occ[r.occurrences].off = off - base;
+            r.occ[r.occurrences].len = writtedLen;
+            ++r.occurrences;
+            r.optmask |= (1 << sjOptIndex);
+
+            markRandomBytes(oDesc, &oD.optshdr[off], off - base, r);
+
+            oD.actual_opts_len += writtedLen;
+            ++count[sjOptIndex];
+
+            if ((oDesc.availableUsage == ONESHOT && count[sjOptIndex] == 1) ||
+                (oDesc.availableUsage == TWOSHOT && count[sjOptIndex] == 2))
+                corruptDone = true;
+        }
+    }
+
+    if (r.occurrences == 0 || corrupt != corruptDone)
+        return false;
+
+    r.len = oD.actual_opts_len - base;
+    memcpy(r.bytes, &oD.optshdr[base], r.len);
+
+    /* avail is a multiple of 4: the alignment always fits */
+    while (r.len % 4)
+        r.bytes[r.len++] = EOL_code;
+
+    return true;
+}
+
+static bool sameRecipe(const struct option_recipe &a, const struct option_recipe &b)
+{
+    return (a.len == b.len && a.occurrences == b.occurrences &&
+            !memcmp(a.optIndex, b.optIndex, a.occurrences) &&
+            !memcmp(a.occ, b.occ, a.occurrences * sizeof (struct option_occurrence)));
+}
+
+static bool recipeShorter(const struct option_recipe &a, const struct option_recipe &b)
+{
+    return a.len < b.len;
+}
+
+void OptionPool::buildRecipes(void)
+{
+    const uint8_t protos[2] = { IPPROTO_IP, IPPROTO_TCP };
+    struct option_recipe r;
+
+    for (uint8_t p = 0; p < 2; ++p)
+    {
+        for (uint8_t c = 0; c < 2; ++c)
+        {
+            struct recipe_table &t = recipes[p][c];
+
+            t.recipes.clear();
+
+            /* the options header length is always a multiple of 4 */
+            for (uint8_t avail = 4; avail <= OPTHDR_MAXLEN; avail += 4)
+            {
+                for (uint32_t s = 0; s < OPTRECIPE_SAMPLES && t.recipes.size() < OPTRECIPE_MAX; ++s)
+                {
+                    if (!simulateInjection(protos[p], c, avail, r))
+                        continue;
+
+                    vector<option_recipe>::iterator it = t.recipes.begin();
+                    while (it != t.recipes.end() && !sameRecipe(*it, r))
+                        ++it;
+
+                    if (it == t.recipes.end())
+                        t.recipes.push_back(r);
+                }
+            }
+
+            sort(t.recipes.begin(), t.recipes.end(), recipeShorter);
+
+            uint16_t n = 0;
+            for (uint8_t len = 0; len <= OPTHDR_MAXLEN; ++len)
+            {
+                while (n < t.recipes.size() && t.recipes[n].len <= len)
+                    ++n;
+
+                t.fits[len] = n;
+            }
+
+            LOG_DEBUG("%s options: %u recipes for the %s injection", p ? "TCP" : "IP",
+                      (uint32_t) t.recipes.size(), c ? "corrupt" : "not corrupt");
+        }
+    }
+}
+
+const struct option_recipe *OptionPool::getRecipe(uint8_t proto, bool corrupt, uint8_t avail, uint32_t presentmask) const
+{
+    const struct recipe_table &t = recipes[proto == IPPROTO_TCP][corrupt];
+    const uint16_t candidates = t.fits[avail > OPTHDR_MAXLEN ? OPTHDR_MAXLEN : avail];
+
+    if (candidates == 0)
+        return NULL;
+
+    /* a random start, the first recipe not repeating a present option */
+    const uint16_t start = random() % candidates;
+
+    for (uint16_t i = 0; i < candidates; ++i)
+    {
+        const struct option_recipe &r = t.recipes[(start + i) % candidates];
+
+        if (!(r.optmask & presentmask))
+            return &r;
+    }
+
+    return NULL;
 }
 
 IPTCPopt *OptionPool::get(uint32_t sjOptIndex)
@@ -26,6 +26,38 @@
 #include "IPTCPopt.h"
 #include "IPTCPoptImpl.h"
 
+/*
+ * the option recipes are the injections HDRoptions::injectRandomOpts can do,
+ * computed when the options configuration is loaded: a recipe is the options
+ * header ready to be copied, with the position of the random payloads that
+ * need to be refreshed at every use.
+ *
+ * for every protocol and goal (corrupt or not) the recipes are collected
+ * simulating OPTRECIPE_SAMPLES random injections for every free space, with
+ * the same rules of the injection done option by option.
+ */
+#define OPTRECIPE_MAX       128 /* distinct recipes kept for protocol and goal */
+#define OPTRECIPE_SAMPLES   16  /* simulated injections for every free space */
+#define OPTRECIPE_PROBES    3   /* injections of the same size compared to find the random bytes */
+
+struct option_recipe
+{
+    uint8_t len; /* aligned to 4, the padding is EOL */
+    uint8_t occurrences;
+    uint8_t randoms;
+    uint32_t optmask; /* bit (1 << sjOptIndex) for every option present */
+    uint8_t bytes[OPTHDR_MAXLEN];
+    uint8_t optIndex[OPTHDR_MAXLEN];
+    struct option_occurrence occ[OPTHDR_MAXLEN];
+    struct option_occurrence random[OPTHDR_MAXLEN];
+};
+
+struct recipe_table
+{
+    vector<option_recipe> recipes; /* sorted by length */
+    uint16_t fits[OPTHDR_MAXLEN + 1]; /* number of recipes long at most the index */
+};
+
 class OptionPool
 {
 private:
@@ -36,6 +68,13 @@ private:
     uint8_t counter;
 
     vector<IPTCPopt *> pool;
+
+    /* [IP/TCP][corrupt] */
+    struct recipe_table recipes[2][2];
+
+    bool simulateInjection(uint8_t, bool, uint8_t, struct option_recipe &);
+    void markRandomBytes(IPTCPopt &, const uint8_t *, uint8_t, struct option_recipe &);
+
 public:
 
     /* loadedOption is the main struct where the implementation are stored: HDRoptions
@@ -56,6 +95,12 @@ public:
     const char *getCorruptionStr(corruption_t);
 
     void disableAllOptions(void);
+
+    /* to be called again when the options configuration is changed at runtime */
+    void buildRecipes(void);
+
+    /* a random recipe long at most the available space, without the present options */
+    const struct option_recipe *getRecipe(uint8_t, bool, uint8_t, uint32_t) const;
 };
 
 #endif /* SJ_OPTIONPOOL_H */
@@ -28,6 +28,7 @@
 #endif
 
 #include "Packet.h"
+#include "PacketTrace.h"
 #include "HDRoptions.h"
 #include "UserConf.h"
 
@@ -48,6 +49,8 @@ choosableScramble(0),
 chainflag(HACKUNASSIGNED),
 fragment(false),
 fragFakeMTU(0),
+ingress_ts(0),
+queue_ts(0),
 pbuf(size)
 {
     memcpy(&(pbuf[0]), buff, size);
@@ -67,6 +70,8 @@ choosableScramble(0),
 chainflag(pkt.chainflag),
 fragment(false),
 fragFakeMTU(0),
+ingress_ts(0),
+queue_ts(0),
 pbuf(pkt.pbuf)
 {
     updatePacketMetadata(0, 0);
@@ -86,6 +91,8 @@ choosableScramble(0),
 chainflag(pkt.chainflag),
 fragment(true),
 fragFakeMTU(fakeMTU),
+ingress_ts(0),
+queue_ts(0),
 pbuf(fragdatalen + sizeof(struct iphdr))
 {
     /* copy of the IP header */
@@ -577,13 +584,71 @@ void Packet::payloadRandomFill(void)
     }
 }
 
-void Packet::selflog(const char *func, const char *format, ...) const
+void Packet::selflogEmit(const char *func, const char *format, ...) const
 {
-    if (debug.level() == SUPPRESS_LEVEL)
+    va_list arguments;
+
+    /* when the trace writer is running only the raw fields and arguments are copied */
+    if (pkttrace.isRunning())
+    {
+        struct packet_trace *rec = pkttrace.reserve();
+        if (rec == NULL)
+            return;
+
+        struct trace_packet &hdr = rec->hdr.packet;
+
+        rec->kind = TRACE_PACKET;
+        rec->clock = sj_clock;
+        rec->func = func;
+        hdr.sourcestr = getSourceStr(source);
+        hdr.wtfstr = getWtfStr(wtf);
+        hdr.chainstr = getChainStr(chainflag);
+        hdr.SjPacketId = SjPacketId;
+        hdr.saddr = ip->saddr;
+        hdr.daddr = ip->daddr;
+        hdr.pktlen = pbuf.size();
+        hdr.iptotlen = ntohs(ip->tot_len);
+        hdr.ippayloadlen = ippayloadlen;
+        hdr.iphdrlen = iphdrlen;
+        hdr.frag_off = ip->frag_off;
+        hdr.proto = proto;
+        hdr.ipproto = ip->protocol;
+        hdr.ttl = ip->ttl;
+        hdr.fragment = fragment;
+
+        if (!fragment)
+        {
+            switch (proto)
+            {
+            case TCP:
+                hdr.sport = ntohs(tcp->source);
+                hdr.dport = ntohs(tcp->dest);
+                hdr.l4hdrlen = tcp->doff * 4;
+                hdr.tcpflags = (tcp->syn << 3) | (tcp->ack << 2) | (tcp->fin << 1) | tcp->rst;
+                break;
+            case UDP:
+                hdr.sport = ntohs(udp->source);
+                hdr.dport = ntohs(udp->dest);
+                hdr.l4hdrlen = udphdrlen;
+                break;
+            case ICMP:
+                hdr.icmp_type = icmp->type;
+                hdr.icmp_code = icmp->code;
+                break;
+            default:
+                break;
+            }
+        }
+
+        va_start(arguments, format);
+        PacketTrace::capture(rec->msg, format, arguments);
+        va_end(arguments);
+
+        pkttrace.commit();
         return;
+    }
 
     char loginfo[LARGEBUF] = {0};
-    va_list arguments;
     va_start(arguments, format);
     vsnprintf(loginfo, sizeof (loginfo), format, arguments);
     va_end(arguments);
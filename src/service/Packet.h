@@ -118,6 +118,11 @@ public:
     bool fragment;
     uint16_t fragFakeMTU;
 
+    /* residence time instrumentation (ns, CLOCK_MONOTONIC): the time of
+     * arrival from the kernel and the time of the last queue transition */
+    uint64_t ingress_ts;
+    uint64_t queue_ts;
+
     struct iphdr *ip;
     uint8_t iphdrlen; /* [20 - 60] bytes */
     unsigned char *ippayload;
@@ -195,8 +200,14 @@ public:
     bool injectIPOpts(bool, bool);
     bool injectTCPOpts(bool, bool);
 
-    /* utilities */
-    void selflog(const char *, const char *, ...) const;
+    /* utilities: selflog is only the level check, inlined in the caller with
+     * the arguments forwarded untouched, so a disabled packet log cost a branch */
+    __attribute__((always_inline)) void selflog(const char *func, const char *format, ...) const
+    {
+        if (debug.level() >= PACKET_LEVEL)
+            selflogEmit(func, format, __builtin_va_arg_pack());
+    }
+    void selflogEmit(const char *, const char *, ...) const;
     const char *getWtfStr(judge_t) const;
     const char *getSourceStr(source_t) const;
     const char *getChainStr(chaining_t) const;
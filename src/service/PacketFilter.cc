@@ -23,6 +23,7 @@
 #include "PacketFilter.h"
 
 FilterEntry::FilterEntry(uint16_t id, uint16_t totallen, uint32_t saddr, uint32_t daddr) :
+owner(NULL),
 ip_id(id),
 ip_totallen(totallen),
 ip_saddr(saddr),
@@ -31,6 +32,7 @@ ip_daddr(daddr)
 }
 
 FilterEntry::FilterEntry(const Packet &pkt) :
+owner(NULL),
 ip_id(pkt.ip->id),
 ip_totallen(pkt.ip->tot_len),
 ip_saddr(pkt.ip->saddr),
@@ -38,7 +40,7 @@ ip_daddr(pkt.ip->daddr)
 {
 }
 
-bool FilterEntry::operator<(FilterEntry comp) const
+bool FilterEntry::operator<(const FilterEntry &comp) const
 {
     if (ip_id < comp.ip_id)
         return true;
@@ -67,18 +69,21 @@ bool FilterEntry::operator<(FilterEntry comp) const
     }
 }
 
+time_t FilterEntry::expired(void)
+{
+    owner->expire(*this);
+    return 0;
+}
+
 FilterMultiset::FilterMultiset(void) :
-timeout_len(PLUGINHASH_EXPIRYTIME),
-manage_timeout(sj_clock + timeout_len),
-first(&fm[0]),
-second(&fm[1])
+timeout_len(PLUGINHASH_EXPIRYTIME)
 {
 }
 
+/* the destructor of every entry disarms it */
 FilterMultiset::~FilterMultiset(void)
 {
-    first->clear();
-    second->clear();
+    filters.clear();
 }
 
 /*
@@ -93,9 +98,7 @@ FilterMultiset::~FilterMultiset(void)
  */
 bool FilterMultiset::check(const FilterEntry &hash)
 {
-    manage();
-
-    if (first->erase(hash) || second->erase(hash))
+    if (filters.erase(hash))
         return true;
 
     return false;
@@ -110,20 +113,25 @@ bool FilterMultiset::check(const FilterEntry &hash)
  */
 void FilterMultiset::add(const FilterEntry &hash)
 {
-    second->insert(hash);
+    /* the stored copy is armed: the ordering fields are not touched */
+    FilterEntry &entry = const_cast<FilterEntry &> (*filters.insert(hash));
+    entry.owner = this;
+    timer_wheel.arm(entry, sj_clock + timeout_len);
 }
 
-void FilterMultiset::manage(void)
+/* removes exactly the expired entry, not its duplicates */
+void FilterMultiset::expire(FilterEntry &entry)
 {
-    if (manage_timeout > sj_clock - timeout_len)
-        return;
-
-    multiset<FilterEntry> *tmp = first;
-    first = second;
-    second = tmp;
-    second->clear();
+    pair<multiset<FilterEntry>::iterator, multiset<FilterEntry>::iterator> range = filters.equal_range(entry);
 
-    manage_timeout = sj_clock + timeout_len;
+    for (multiset<FilterEntry>::iterator it = range.first; it != range.second; ++it)
+    {
+        if (&(*it) == &entry)
+        {
+            filters.erase(it);
+            return;
+        }
+    }
 }
 
 bool PacketFilter::filterICMPErrors(const Packet &pkt)
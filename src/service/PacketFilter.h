@@ -22,9 +22,17 @@
 
 #include "Utils.h"
 #include "Packet.h"
+#include "TimerWheel.h"
 
-class FilterEntry
+class FilterMultiset;
+
+class FilterEntry : public TimerEntry
 {
+    friend class FilterMultiset;
+
+private:
+    FilterMultiset *owner; /* set when the copy is inserted in the multiset */
+
 public:
     const uint16_t ip_id;
     const uint16_t ip_totallen;
@@ -33,20 +41,21 @@ public:
 
     FilterEntry(uint16_t, uint16_t, uint32_t, uint32_t);
     FilterEntry(const Packet &);
-    bool operator<(FilterEntry) const;
+    bool operator<(const FilterEntry &) const;
+
+    /* a filter is never refreshed: at the deadline it is removed, see TimerWheel */
+    time_t expired(void);
 };
 
 class FilterMultiset
 {
+    friend class FilterEntry;
+
 private:
     const uint32_t timeout_len;
-    uint32_t manage_timeout;
-    multiset<FilterEntry> fm[2];
-    multiset<FilterEntry> *first;
-    multiset<FilterEntry> *second;
+    multiset<FilterEntry> filters;
 
-    /* called automagically */
-    void manage(void);
+    void expire(FilterEntry &);
 
 public:
     FilterMultiset(void);
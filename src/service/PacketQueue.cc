@@ -26,12 +26,24 @@ PacketQueue::PacketQueue(void) :
 pkt_count(0),
 cur_queue(FIRST_QUEUE),
 cur_pkt(NULL),
-next_pkt(NULL)
+next_pkt(NULL),
+dropped(0)
 {
     LOG_DEBUG("");
 
     memset(front, 0, sizeof (Packet*)*(QUEUE_NUM));
     memset(back, 0, sizeof (Packet*)*(QUEUE_NUM));
+    memset(queue_count, 0, sizeof (queue_count));
+
+    memset(latency, 0, sizeof (latency));
+
+    const char *names[LATENCY_RECORDS] = {
+        "YOUNG", "KEEP", "HACK", "SEND",
+        "from tunnel", "from network", "injected hacks", "ttl probes"
+    };
+
+    for (uint8_t i = 0; i < LATENCY_RECORDS; ++i)
+        snprintf(latency[i].name, sizeof (latency[i].name), "%s", names[i]);
 }
 
 PacketQueue::~PacketQueue(void)
@@ -48,6 +60,8 @@ PacketQueue::~PacketQueue(void)
 
 void PacketQueue::insert(Packet &pkt, queue_t queue)
 {
+    stamp(pkt);
+
     if (pkt.queue != QUEUEUNASSIGNED)
         extract(pkt);
 
@@ -58,6 +72,7 @@ void PacketQueue::insert(Packet &pkt, queue_t queue)
      */
 
     ++pkt_count;
+    ++queue_count[queue];
     pkt.queue = queue;
     if (front[queue] == NULL)
     {
@@ -75,6 +90,8 @@ void PacketQueue::insert(Packet &pkt, queue_t queue)
 
 void PacketQueue::insertBefore(Packet &pkt, Packet &ref)
 {
+    stamp(pkt);
+
     if (pkt.queue != QUEUEUNASSIGNED)
         extract(pkt);
 
@@ -85,6 +102,7 @@ void PacketQueue::insertBefore(Packet &pkt, Packet &ref)
      */
 
     ++pkt_count;
+    ++queue_count[ref.queue];
     pkt.queue = ref.queue;
 
     if (front[ref.queue] == &ref)
@@ -108,6 +126,8 @@ void PacketQueue::insertBefore(Packet &pkt, Packet &ref)
 
 void PacketQueue::insertAfter(Packet &pkt, Packet &ref)
 {
+    stamp(pkt);
+
     if (pkt.queue != QUEUEUNASSIGNED)
         extract(pkt);
 
@@ -118,6 +138,7 @@ void PacketQueue::insertAfter(Packet &pkt, Packet &ref)
      */
 
     ++pkt_count;
+    ++queue_count[ref.queue];
     pkt.queue = ref.queue;
 
     if (back[ref.queue] == &ref)
@@ -142,6 +163,7 @@ void PacketQueue::extract(Packet &pkt)
 {
     --pkt_count;
     queue_t queue = pkt.queue;
+    --queue_count[queue];
 
     if (front[queue] == &pkt)
     {
@@ -191,9 +213,53 @@ void PacketQueue::drop(Packet &pkt)
     if (pkt.queue != QUEUEUNASSIGNED)
         extract(pkt);
 
+    ++dropped;
     delete &pkt;
 }
 
+/*
+ * every queue transition account the residence time in the previous queue;
+ * the packets not coming from the kernel (hacks, probes) get their ingress
+ * time in the first insert.
+ */
+void PacketQueue::stamp(Packet &pkt)
+{
+    const uint64_t now = sj_monotonic_ns();
+
+    if (pkt.queue != QUEUEUNASSIGNED)
+        account(latency[__builtin_ctz(pkt.queue)], now - pkt.queue_ts);
+
+    if (!pkt.ingress_ts)
+        pkt.ingress_ts = now;
+
+    pkt.queue_ts = now;
+}
+
+/* called on the packets extracted from SEND to be written */
+void PacketQueue::departure(Packet &pkt)
+{
+    const uint64_t now = sj_monotonic_ns();
+
+    account(latency[__builtin_ctz(SEND)], now - pkt.queue_ts);
+
+    if (pkt.source != SOURCEUNASSIGNED)
+        account(latency[LATENCY_QUEUE_RECORDS + __builtin_ctz(pkt.source)], now - pkt.ingress_ts);
+}
+
+void PacketQueue::account(struct latency_record &record, uint64_t elapsed)
+{
+    /* the kernel timestamps could be slightly ahead of the converted clock */
+    if ((int64_t) elapsed < 0)
+        elapsed = 0;
+
+    ++record.count;
+    record.sum += elapsed;
+    if (elapsed > record.max)
+        record.max = elapsed;
+
+    histogramAdd(record.hist, elapsed);
+}
+
 void PacketQueue::select(queue_t queue)
 {
     cur_queue = queue;
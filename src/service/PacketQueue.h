@@ -25,22 +25,36 @@
 
 #include "Utils.h"
 #include "Packet.h"
+#include "internalProtocol.h"
 
 #define FIRST_QUEUE (YOUNG)
 #define LAST_QUEUE  (SEND)
 #define QUEUE_NUM   (LAST_QUEUE + 1)
 
+/* latency records: the residence time in YOUNG, KEEP, HACK and SEND, followed
+ * by the forwarding latency of the packets from TUNNEL, NETWORK, PLUGIN and TRACEROUTE */
+#define LATENCY_QUEUE_RECORDS   4
+#define LATENCY_SOURCE_RECORDS  4
+#define LATENCY_RECORDS         (LATENCY_QUEUE_RECORDS + LATENCY_SOURCE_RECORDS)
+
 class PacketQueue
 {
 private:
     uint32_t pkt_count;
+    uint32_t queue_count[QUEUE_NUM];
     Packet *front[QUEUE_NUM];
     Packet *back[QUEUE_NUM];
     queue_t cur_queue;
     Packet *cur_pkt;
     Packet *next_pkt;
 
+    void stamp(Packet &);
+    void account(struct latency_record &, uint64_t);
+
 public:
+    struct latency_record latency[LATENCY_RECORDS];
+    uint64_t dropped;
+
     PacketQueue(void);
     ~PacketQueue(void);
     void insert(Packet &, queue_t);
@@ -48,6 +62,7 @@ public:
     void insertAfter(Packet &, Packet &);
     void extract(Packet &);
     void drop(Packet &);
+    void departure(Packet &);
     void select(queue_t);
     Packet* get(void);
     Packet* getSource(source_t);
@@ -56,6 +71,11 @@ public:
     {
         return pkt_count;
     };
+
+    uint32_t size(queue_t queue)
+    {
+        return queue_count[queue];
+    };
 };
 
 #endif /* SJ_PACKET_QUEUE_H */
@@ -0,0 +1,332 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PacketTrace.h"
+#include "Packet.h"
+
+PacketTrace::PacketTrace(void) :
+ring(NULL),
+head(0),
+tail(0),
+dropped(0),
+reported_dropped(0),
+running(false),
+out(NULL)
+{
+}
+
+PacketTrace::~PacketTrace(void)
+{
+    stop();
+}
+
+void PacketTrace::start(FILE *stream)
+{
+    stop();
+
+    if (stream == NULL)
+        return;
+
+    if (ring == NULL && (ring = (struct packet_trace *) calloc(PKTTRACE_RINGSIZE, sizeof (struct packet_trace))) == NULL)
+        RUNTIME_EXCEPTION("unable to allocate the trace ring: %s", strerror(errno));
+
+    head = tail = 0;
+    dropped = reported_dropped = 0;
+    out = stream;
+    running = true;
+
+    if (pthread_create(&writer, NULL, writerThread, this))
+    {
+        running = false;
+        RUNTIME_EXCEPTION("unable to start the trace writer: %s", strerror(errno));
+    }
+
+    LOG_DEBUG("trace writer started with a ring of %u records", PKTTRACE_RINGSIZE);
+}
+
+void PacketTrace::stop(void)
+{
+    if (!running)
+        return;
+
+    running = false;
+    pthread_join(writer, NULL);
+
+    /* the writer is dead: what remains is flushed by the caller thread */
+    drain();
+    fflush(out);
+
+    if (dropped)
+        LOG_ALL("trace: %u records dropped because the ring was full", dropped);
+
+    out = NULL;
+}
+
+struct packet_trace *PacketTrace::reserve(void)
+{
+    if (head - tail >= PKTTRACE_RINGSIZE)
+    {
+        ++dropped;
+        return NULL;
+    }
+
+    return &ring[head & (PKTTRACE_RINGSIZE - 1)];
+}
+
+void PacketTrace::commit(void)
+{
+    /* the record must be visible before the index */
+    __sync_synchronize();
+    ++head;
+}
+
+bool PacketTrace::drain(void)
+{
+    char line[HUGEBUF];
+    bool something = false;
+
+    while (tail != head)
+    {
+        __sync_synchronize();
+
+        format(ring[tail & (PKTTRACE_RINGSIZE - 1)], line, sizeof (line));
+        fputs(line, out);
+
+        /* the slot is released only after being formatted */
+        __sync_synchronize();
+        ++tail;
+
+        something = true;
+    }
+
+    if (dropped != reported_dropped)
+    {
+        fprintf(out, "trace: %u records dropped\n", dropped - reported_dropped);
+        reported_dropped = dropped;
+        something = true;
+    }
+
+    return something;
+}
+
+void* PacketTrace::writerThread(void *arg)
+{
+    PacketTrace *self = (PacketTrace *) arg;
+
+    /* the signals are handled by the main thread only */
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    while (self->running)
+    {
+        if (self->drain())
+            fflush(self->out);
+        else
+            usleep(PKTTRACE_FLUSH_USEC);
+    }
+
+    return NULL;
+}
+
+/*
+ * only the conversions used by the selflog calls are kept raw: d i u x X c s
+ * with flags, width and precision. anything else (a length modifier, a '*',
+ * too many arguments) is formatted here, as the synchronous log would do.
+ */
+void PacketTrace::capture(struct trace_message &msg, const char *format, va_list arguments)
+{
+    const char *p;
+    size_t speclen, len, room;
+    uint16_t textlen = 0;
+
+    msg.argc = 0;
+
+    for (p = format; *p != '\0'; ++p)
+    {
+        if (*p != '%' || *++p == '%')
+            continue;
+
+        speclen = strspn(p, "-+ #0123456789.");
+        p += speclen;
+
+        if (*p == '\0' || strchr("diuxXcs", *p) == NULL || speclen > SMALLBUF / 2 || ++msg.argc > PKTTRACE_MAXARGS)
+        {
+            msg.format = NULL;
+            vsnprintf(msg.text, sizeof (msg.text), format, arguments);
+            return;
+        }
+    }
+
+    msg.format = format;
+    msg.text[sizeof (msg.text) - 1] = '\0';
+
+    for (p = format, msg.argc = 0; *p != '\0'; ++p)
+    {
+        if (*p != '%' || *++p == '%')
+            continue;
+
+        p += strspn(p, "-+ #0123456789.");
+
+        if (*p != 's')
+        {
+            msg.argv[msg.argc++] = va_arg(arguments, unsigned int);
+            continue;
+        }
+
+        const char *str = va_arg(arguments, const char *);
+        if (str == NULL)
+            str = "(null)";
+
+        /* when the text is full the last strings are truncated to its final terminator */
+        room = sizeof (msg.text) - 1 - textlen;
+        len = strlen(str);
+        if (len > room)
+            len = room;
+
+        memcpy(&msg.text[textlen], str, len);
+        msg.text[textlen + len] = '\0';
+        msg.argv[msg.argc++] = textlen;
+        textlen += (len < room) ? len + 1 : len;
+    }
+}
+
+void PacketTrace::render(const struct trace_message &msg, char *line, size_t len)
+{
+    char spec[SMALLBUF];
+    const char *p, *start;
+    size_t used = 0;
+    uint8_t argi = 0;
+    int ret;
+
+    if (msg.format == NULL)
+    {
+        snprintf(line, len, "%s", msg.text);
+        return;
+    }
+
+    for (p = msg.format; *p != '\0' && used < len - 1; ++p)
+    {
+        if (*p != '%')
+        {
+            line[used++] = *p;
+            continue;
+        }
+
+        start = p++;
+        if (*p == '%')
+        {
+            line[used++] = '%';
+            continue;
+        }
+
+        p += strspn(p, "-+ #0123456789.");
+        memcpy(spec, start, p - start + 1);
+        spec[p - start + 1] = '\0';
+
+        if (*p == 's')
+            ret = snprintf(&line[used], len - used, spec, &msg.text[msg.argv[argi++]]);
+        else
+            ret = snprintf(&line[used], len - used, spec, msg.argv[argi++]);
+
+        if (ret > 0)
+            used += ((size_t) ret < len - used) ? (size_t) ret : len - used - 1;
+    }
+
+    line[used] = '\0';
+}
+
+void PacketTrace::format(const struct packet_trace &rec, char *line, size_t len) const
+{
+    char timestr[SMALLBUF], protoinfo[MEDIUMBUF], message[LARGEBUF], saddr[INET_ADDRSTRLEN], daddr[INET_ADDRSTRLEN];
+    struct tm tm;
+
+    strftime(timestr, sizeof (timestr), "%Y-%m-%d %H:%M:%S", localtime_r(&rec.clock, &tm));
+    render(rec.msg, message, sizeof (message));
+
+    if (rec.kind == TRACE_SESSION)
+    {
+        const struct trace_session &session = rec.hdr.session;
+
+        inet_ntop(AF_INET, &session.daddr, daddr, sizeof (daddr));
+        snprintf(line, len, "%s %s %s S|-:%u D|%s:%u #pkts|%u #injs|%u %s\n",
+                 timestr, rec.func, session.proto == IPPROTO_TCP ? "TCP" : "UDP",
+                 session.sport, daddr, session.dport,
+                 session.packet_number, session.injected_pktnumber, message);
+        return;
+    }
+
+    if (rec.kind == TRACE_TTLFOCUS)
+    {
+        const struct trace_ttlfocus &ttlfocus = rec.hdr.ttlfocus;
+
+        inet_ntop(AF_INET, &ttlfocus.daddr, daddr, sizeof (daddr));
+        snprintf(line, len, "%s %s daddr(%s) %s sent(%u) recv(%u) ttl_estimate(%u) ttl_synack(%u) %s\n",
+                 timestr, rec.func, daddr, ttlfocus.status,
+                 ttlfocus.sent_probe, ttlfocus.received_probe,
+                 ttlfocus.ttl_estimate, ttlfocus.ttl_synack, message);
+        return;
+    }
+
+    const struct trace_packet &pkt = rec.hdr.packet;
+
+    inet_ntop(AF_INET, &pkt.saddr, saddr, sizeof (saddr));
+    inet_ntop(AF_INET, &pkt.daddr, daddr, sizeof (daddr));
+
+    if (pkt.fragment)
+    {
+        snprintf(line, len, "%s %s: i%u s'%s w'%s c'%s %s->%s FRAG:%u '%s' ttl:%u %s\n",
+                 timestr, rec.func, pkt.SjPacketId, pkt.sourcestr, pkt.wtfstr, pkt.chainstr,
+                 saddr, daddr, ntohs(pkt.frag_off & IP_OFFMASK),
+                 ntohs(pkt.frag_off & IP_MF) ? "MF" : "!MF",
+                 pkt.ttl, message);
+        return;
+    }
+
+    switch (pkt.proto)
+    {
+    case TCP:
+        snprintf(protoinfo, sizeof (protoinfo), "TCP %u:%u SAFR{%u%u%u%u} L %u = %u+%u+%u",
+                 pkt.sport, pkt.dport,
+                 (pkt.tcpflags >> 3) & 1, (pkt.tcpflags >> 2) & 1, (pkt.tcpflags >> 1) & 1, pkt.tcpflags & 1,
+                 pkt.pktlen, pkt.iptotlen - pkt.ippayloadlen,
+                 pkt.l4hdrlen, pkt.iptotlen - pkt.iphdrlen - pkt.l4hdrlen
+                 );
+        break;
+    case UDP:
+        snprintf(protoinfo, sizeof (protoinfo), "UDP %u->%u len|%u(%u)",
+                 pkt.sport, pkt.dport, pkt.pktlen, pkt.pktlen - pkt.iphdrlen - pkt.l4hdrlen);
+        break;
+    case ICMP:
+        snprintf(protoinfo, sizeof (protoinfo), "ICMP type|%d code|%d len|%u(%u)",
+                 pkt.icmp_type, pkt.icmp_code,
+                 pkt.pktlen, (unsigned int) (pkt.pktlen - pkt.iphdrlen - sizeof (struct icmphdr)));
+        break;
+    default:
+        snprintf(protoinfo, sizeof (protoinfo), "other proto: %d", pkt.ipproto);
+        break;
+    }
+
+    snprintf(line, len, "%s %s: i%u s'%s w'%s c'%s %s->%s [%s] ttl:%u %s\n",
+             timestr, rec.func, pkt.SjPacketId, pkt.sourcestr, pkt.wtfstr, pkt.chainstr,
+             saddr, daddr, protoinfo, pkt.ttl, message);
+}
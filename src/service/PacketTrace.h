@@ -0,0 +1,171 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_PACKETTRACE_H
+#define SJ_PACKETTRACE_H
+
+#include "Utils.h"
+
+#include <pthread.h>
+
+/*
+ * the trace is the deferred backend of the selflog of Packet, SessionTrack
+ * and TTLFocus: the caller only copies the raw fields of its header and the
+ * arguments of the message in a fixed size record, the formatting
+ * (inet_ntop, protocol description, message, timestamp) is done by a writer
+ * thread. pkttrace writes the packet log, sesstrace the session log.
+ *
+ * the ring is single producer (the networkIO loop) single consumer (the writer)
+ * and lock-free: when it's full the record is dropped and counted.
+ */
+
+#define PKTTRACE_RINGSIZE       4096    /* records, MUST be a power of two */
+#define PKTTRACE_MSGLEN         160     /* bytes of the %s arguments, or of a preformatted message */
+#define PKTTRACE_MAXARGS        8       /* arguments of a message */
+#define PKTTRACE_FLUSH_USEC     20000   /* writer sleep when the ring is empty (20 ms) */
+
+/* the owner of the record, and of the header printed before the message */
+#define TRACE_PACKET            0
+#define TRACE_SESSION           1
+#define TRACE_TTLFOCUS          2
+
+/*
+ * the message is the format literal with its arguments: the integers are
+ * kept raw, the strings are copied in text and referred by their offset.
+ * format is NULL when the message was formatted by the caller, in text.
+ */
+struct trace_message
+{
+    const char *format;
+    uint8_t argc;
+    uint32_t argv[PKTTRACE_MAXARGS];
+    char text[PKTTRACE_MSGLEN];
+};
+
+/* the headers of the three owners: the raw fields, printed by the writer */
+struct trace_packet
+{
+    const char *sourcestr;  /* the three strings are literals returned by */
+    const char *wtfstr;     /* Packet::get*Str(), so only the pointer is copied */
+    const char *chainstr;
+    uint32_t SjPacketId;
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t pktlen;
+    uint16_t iptotlen;
+    uint16_t ippayloadlen;
+    uint16_t l4hdrlen;
+    uint16_t frag_off;
+    uint8_t proto; /* proto_t */
+    uint8_t ipproto;
+    uint8_t iphdrlen;
+    uint8_t ttl;
+    uint8_t fragment;
+    uint8_t tcpflags; /* SAFR bitmask */
+    uint8_t icmp_type;
+    uint8_t icmp_code;
+};
+
+struct trace_session
+{
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t packet_number;
+    uint32_t injected_pktnumber;
+    uint8_t proto; /* IPPROTO_* */
+};
+
+struct trace_ttlfocus
+{
+    const char *status; /* a literal, as the strings of the packet */
+    uint32_t daddr;
+    uint32_t sent_probe;
+    uint32_t received_probe;
+    uint8_t ttl_estimate;
+    uint8_t ttl_synack;
+};
+
+struct packet_trace
+{
+    uint8_t kind;
+    time_t clock;
+    const char *func;       /* __func__ of the caller: static storage */
+
+    union
+    {
+        struct trace_packet packet;
+        struct trace_session session;
+        struct trace_ttlfocus ttlfocus;
+    } hdr;
+
+    struct trace_message msg;
+};
+
+class PacketTrace
+{
+private:
+    struct packet_trace *ring;
+
+    /* head is written only by the producer, tail only by the consumer */
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    volatile uint32_t dropped;
+    uint32_t reported_dropped;
+
+    volatile bool running;
+    pthread_t writer;
+    FILE *out;
+
+    static void* writerThread(void *);
+    bool drain(void);
+    void format(const struct packet_trace &, char *, size_t) const;
+    static void render(const struct trace_message &, char *, size_t);
+
+public:
+    PacketTrace(void);
+    ~PacketTrace(void);
+
+    /* start(NULL) or stop() flush the pending records and join the writer */
+    void start(FILE *);
+    void stop(void);
+
+    bool isRunning(void) const
+    {
+        return running;
+    };
+
+    /* reserve/commit avoid a copy of the record: the producer fill the slot in place */
+    struct packet_trace *reserve(void);
+    void commit(void);
+
+    /* copies the arguments of the message, called between va_start and va_end */
+    static void capture(struct trace_message &, const char *, va_list);
+};
+
+extern PacketTrace pkttrace;
+extern PacketTrace sesstrace;
+
+#endif /* SJ_PACKETTRACE_H */
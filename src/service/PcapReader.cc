@@ -0,0 +1,396 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PcapReader.h"
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+
+PcapReader::PcapReader(const char *inputfile, const char *localnet) :
+input(NULL),
+pcapng(false),
+swapped(false),
+linktype(0),
+tsunits(1000000),
+record(LARGEBUF * 2),
+local_net(0),
+local_mask(0),
+records(0),
+skipped(0),
+foreign(0),
+timestamp(0)
+{
+    uint32_t magic;
+
+    if ((input = fopen(inputfile, "rb")) == NULL)
+        RUNTIME_EXCEPTION("unable to open capture %s: %s", inputfile, strerror(errno));
+
+    if (fread(&magic, sizeof (magic), 1, input) != 1)
+        RUNTIME_EXCEPTION("unable to read capture %s: empty or unreadable", inputfile);
+
+    if (magic == PCAPNG_SHB_TYPE)
+    {
+        /* the section header is read again as the first block */
+        pcapng = true;
+        rewind(input);
+    }
+    else
+    {
+        struct pcap_global_header gh;
+
+        if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC)
+            swapped = false;
+        else if (swap32(magic) == PCAP_MAGIC_USEC || swap32(magic) == PCAP_MAGIC_NSEC)
+            swapped = true;
+        else
+            RUNTIME_EXCEPTION("%s is not a pcap or pcapng capture (magic %08x)", inputfile, magic);
+
+        rewind(input);
+        if (fread(&gh, sizeof (gh), 1, input) != 1)
+            RUNTIME_EXCEPTION("unable to read the pcap header of %s", inputfile);
+
+        linktype = swapped ? swap32(gh.linktype) : gh.linktype;
+        if (magic == PCAP_MAGIC_NSEC || swap32(magic) == PCAP_MAGIC_NSEC)
+            tsunits = PCAP_NSEC_PER_SEC;
+    }
+
+    if (localnet != NULL)
+    {
+        char addr[SMALLBUF] = {0};
+        char *slash;
+        uint32_t bits = 32;
+        struct in_addr in;
+
+        snprintf(addr, sizeof (addr), "%s", localnet);
+        if ((slash = strchr(addr, '/')) != NULL)
+        {
+            *slash = 0x00;
+            bits = atoi(slash + 1);
+        }
+
+        if (!inet_aton(addr, &in) || bits < 1 || bits > 32)
+            RUNTIME_EXCEPTION("invalid local network %s: a.b.c.d[/bits] expected", localnet);
+
+        local_mask = htonl(0xffffffff << (32 - bits));
+        local_net = in.s_addr & local_mask;
+    }
+}
+
+PcapReader::~PcapReader(void)
+{
+    if (input != NULL)
+        fclose(input);
+}
+
+uint32_t PcapReader::swap32(uint32_t value) const
+{
+    return ((value & 0xff) << 24) | ((value & 0xff00) << 8) | ((value >> 8) & 0xff00) | (value >> 24);
+}
+
+uint16_t PcapReader::swap16(uint16_t value) const
+{
+    return (value << 8) | (value >> 8);
+}
+
+/* if_tsresol: negative power of 10, or of 2 when the high bit is set */
+uint64_t PcapReader::tsresol(uint32_t bodylen) const
+{
+    uint32_t offset = 8; /* linktype, reserved and snaplen */
+
+    while (offset + 4 <= bodylen)
+    {
+        uint16_t code, len;
+
+        memcpy(&code, &record[offset], sizeof (code));
+        memcpy(&len, &record[offset + 2], sizeof (len));
+        code = swapped ? swap16(code) : code;
+        len = swapped ? swap16(len) : len;
+
+        if (!code || offset + 4 + len > bodylen)
+            break;
+
+        if (code == PCAPNG_OPT_TSRESOL && len == 1)
+        {
+            const uint8_t resol = record[offset + 4];
+            uint64_t units = 1;
+
+            for (uint8_t i = 0; i < (resol & 0x7f) && units < PCAP_NSEC_PER_SEC; ++i)
+                units *= (resol & 0x80) ? 2 : 10;
+
+            return units;
+        }
+
+        offset += 4 + ((len + 3) & ~3);
+    }
+
+    return 1000000;
+}
+
+void PcapReader::setTimestamp(uint64_t ts, uint64_t units)
+{
+    timestamp = (ts / units) * PCAP_NSEC_PER_SEC + ((ts % units) * PCAP_NSEC_PER_SEC) / units;
+}
+
+/* read a whole pcapng block: type and body, the lengths are verified and removed */
+bool PcapReader::readBlock(uint32_t &type, uint32_t &bodylen)
+{
+    uint32_t hdr[2], trailer;
+
+    if (fread(hdr, sizeof (hdr), 1, input) != 1)
+        return false;
+
+    type = hdr[0];
+
+    /* the section header carries the byte order of the following blocks */
+    if (type == PCAPNG_SHB_TYPE)
+    {
+        uint32_t byteorder;
+
+        if (fread(&byteorder, sizeof (byteorder), 1, input) != 1)
+            return false;
+
+        if (byteorder == PCAPNG_BYTEORDER_MAGIC)
+            swapped = false;
+        else if (swap32(byteorder) == PCAPNG_BYTEORDER_MAGIC)
+            swapped = true;
+        else
+            RUNTIME_EXCEPTION("invalid pcapng section header byte order %08x", byteorder);
+
+        fseek(input, -(long) sizeof (byteorder), SEEK_CUR);
+    }
+    else if (swapped)
+        type = swap32(type);
+
+    const uint32_t blocklen = swapped ? swap32(hdr[1]) : hdr[1];
+
+    if (blocklen < 12 || blocklen > PCAP_MAX_RECORD || (blocklen % 4))
+        RUNTIME_EXCEPTION("invalid pcapng block length %u", blocklen);
+
+    bodylen = blocklen - 12;
+    if (record.size() < bodylen)
+        record.resize(bodylen);
+
+    if ((bodylen && fread(&record[0], bodylen, 1, input) != 1) || fread(&trailer, sizeof (trailer), 1, input) != 1)
+        return false;
+
+    return true;
+}
+
+/* return the offset of the link layer frame in the record, its length and linktype */
+bool PcapReader::nextRecord(uint32_t &offset, uint32_t &caplen, uint32_t &link)
+{
+    if (!pcapng)
+    {
+        struct pcap_record_header rh;
+
+        if (fread(&rh, sizeof (rh), 1, input) != 1)
+            return false;
+
+        caplen = swapped ? swap32(rh.caplen) : rh.caplen;
+        if (caplen > PCAP_MAX_RECORD)
+            RUNTIME_EXCEPTION("invalid pcap record length %u", caplen);
+
+        if (record.size() < caplen)
+            record.resize(caplen);
+
+        if (caplen && fread(&record[0], caplen, 1, input) != 1)
+            return false;
+
+        if (swapped)
+        {
+            rh.ts_sec = swap32(rh.ts_sec);
+            rh.ts_frac = swap32(rh.ts_frac);
+        }
+        setTimestamp((uint64_t) rh.ts_sec * tsunits + rh.ts_frac, tsunits);
+
+        offset = 0;
+        link = linktype;
+        return true;
+    }
+
+    uint32_t type, bodylen;
+
+    while (readBlock(type, bodylen))
+    {
+        uint32_t field, ts_high, ts_low;
+
+        switch (type)
+        {
+        case PCAPNG_SHB_TYPE:
+            ng_linktypes.clear();
+            ng_tsunits.clear();
+            break;
+        case PCAPNG_IDB_TYPE:
+            if (bodylen >= 2)
+            {
+                uint16_t lt;
+                memcpy(&lt, &record[0], sizeof (lt));
+                ng_linktypes.push_back(swapped ? swap16(lt) : lt);
+                ng_tsunits.push_back(tsresol(bodylen));
+            }
+            break;
+        case PCAPNG_EPB_TYPE:
+            if (bodylen < 20)
+                break;
+
+            memcpy(&field, &record[0], sizeof (field));
+            field = swapped ? swap32(field) : field;
+            if (field >= ng_linktypes.size())
+                RUNTIME_EXCEPTION("pcapng packet for the undeclared interface %u", field);
+            link = ng_linktypes[field];
+
+            memcpy(&ts_high, &record[4], sizeof (ts_high));
+            memcpy(&ts_low, &record[8], sizeof (ts_low));
+            if (swapped)
+            {
+                ts_high = swap32(ts_high);
+                ts_low = swap32(ts_low);
+            }
+            setTimestamp(((uint64_t) ts_high << 32) | ts_low, ng_tsunits[field]);
+
+            memcpy(&caplen, &record[12], sizeof (caplen));
+            caplen = swapped ? swap32(caplen) : caplen;
+            if (caplen > bodylen - 20)
+                RUNTIME_EXCEPTION("invalid pcapng packet length %u", caplen);
+
+            offset = 20;
+            return true;
+        case PCAPNG_SPB_TYPE:
+            if (bodylen < 4 || ng_linktypes.empty())
+                break;
+
+            memcpy(&field, &record[0], sizeof (field));
+            field = swapped ? swap32(field) : field;
+            link = ng_linktypes[0];
+            caplen = (field < bodylen - 4) ? field : bodylen - 4;
+            offset = 4;
+            return true;
+        default:
+            /* statistics, name resolution and custom blocks are ignored */
+            break;
+        }
+    }
+
+    return false;
+}
+
+/* return the IPv4 header inside the frame, NULL when it's not a complete IPv4 packet */
+const unsigned char *PcapReader::stripLink(uint32_t offset, uint32_t caplen, uint32_t link, uint32_t &iplen) const
+{
+    const unsigned char *p = &record[offset];
+    uint32_t len = caplen;
+    uint16_t ethertype;
+
+    switch (link)
+    {
+    case LINKTYPE_ETHERNET:
+        if (len < 14)
+            return NULL;
+        ethertype = (p[12] << 8) | p[13];
+        p += 14;
+        len -= 14;
+        /* 802.1Q and 802.1ad tags */
+        while (ethertype == 0x8100 || ethertype == 0x88a8)
+        {
+            if (len < 4)
+                return NULL;
+            ethertype = (p[2] << 8) | p[3];
+            p += 4;
+            len -= 4;
+        }
+        if (ethertype != ETH_P_IP)
+            return NULL;
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len < 16)
+            return NULL;
+        ethertype = (p[14] << 8) | p[15];
+        p += 16;
+        len -= 16;
+        if (ethertype != ETH_P_IP)
+            return NULL;
+        break;
+    case LINKTYPE_NULL:
+    case LINKTYPE_LOOP:
+        if (len < 4)
+            return NULL;
+        p += 4;
+        len -= 4;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_RAW_BSD:
+    case LINKTYPE_IPV4:
+        break;
+    default:
+        return NULL;
+    }
+
+    if (len < sizeof (struct iphdr) || (p[0] >> 4) != 4)
+        return NULL;
+
+    /* the ethernet padding is removed, a truncated capture is skipped */
+    iplen = (p[2] << 8) | p[3];
+    if (iplen < sizeof (struct iphdr) || iplen > len)
+        return NULL;
+
+    return p;
+}
+
+const unsigned char *PcapReader::next(uint32_t &iplen, source_t &source)
+{
+    uint32_t offset, caplen, link;
+
+    while (nextRecord(offset, caplen, link))
+    {
+        ++records;
+
+        const unsigned char *ip = stripLink(offset, caplen, link, iplen);
+        if (ip == NULL)
+        {
+            ++skipped;
+            continue;
+        }
+
+        const struct iphdr *iph = (const struct iphdr *) ip;
+
+        if (!local_mask)
+        {
+            local_net = iph->saddr;
+            local_mask = 0xffffffff;
+            LOG_VERBOSE("local address learned from the first packet: %s", inet_ntoa(*((struct in_addr *) &local_net)));
+        }
+
+        if ((iph->saddr & local_mask) == local_net)
+            source = TUNNEL;
+        else if ((iph->daddr & local_mask) == local_net)
+            source = NETWORK;
+        else
+        {
+            ++foreign;
+            continue;
+        }
+
+        return ip;
+    }
+
+    return NULL;
+}
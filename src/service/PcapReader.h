@@ -0,0 +1,130 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_PCAPREADER_H
+#define SJ_PCAPREADER_H
+
+#include "Utils.h"
+#include "Packet.h"
+
+/*
+ * PcapReader returns the IPv4 packets of a pcap or pcapng capture, used by
+ * the offline tools (sniffjoke-replay, sniffjoke-bench --plugin): a packet
+ * is TUNNEL when its source is in the local network, NETWORK when its
+ * destination is, and it's skipped otherwise. without a local network the
+ * source of the first packet is the local host.
+ *
+ * classic pcap (usec and nsec, both byte orders) and pcapng (SHB, IDB, EPB
+ * and SPB blocks) are supported over ethernet with VLAN tags, linux cooked,
+ * loopback and raw IP link types; the other records are counted and skipped.
+ */
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAPNG_SHB_TYPE         0x0a0d0d0a
+#define PCAPNG_BYTEORDER_MAGIC  0x1a2b3c4d
+#define PCAPNG_IDB_TYPE         1
+#define PCAPNG_SPB_TYPE         3
+#define PCAPNG_EPB_TYPE         6
+
+#define LINKTYPE_NULL           0
+#define LINKTYPE_ETHERNET       1
+#define LINKTYPE_RAW_BSD        12
+#define LINKTYPE_RAW            101
+#define LINKTYPE_LOOP           108
+#define LINKTYPE_LINUX_SLL      113
+#define LINKTYPE_IPV4           228
+
+#define PCAP_MAX_RECORD         262144  /* bigger records are a corrupted capture */
+
+#define PCAPNG_OPT_TSRESOL      9
+#define PCAP_NSEC_PER_SEC       1000000000
+
+/* the classic pcap headers, also used to write the captures; the pcapng blocks are parsed in place */
+struct pcap_global_header
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header
+{
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t origlen;
+};
+
+class PcapReader
+{
+private:
+
+    FILE *input;
+
+    bool pcapng;
+    bool swapped;
+    uint32_t linktype;
+    vector<uint16_t> ng_linktypes; /* pcapng has a linktype for every interface */
+    vector<uint64_t> ng_tsunits; /* and a timestamp resolution, in units per second */
+    uint64_t tsunits;
+    vector<unsigned char> record;
+
+    uint32_t local_net;
+    uint32_t local_mask;
+
+    uint32_t swap32(uint32_t) const;
+    uint16_t swap16(uint16_t) const;
+    uint64_t tsresol(uint32_t) const;
+    void setTimestamp(uint64_t, uint64_t);
+    bool readBlock(uint32_t &, uint32_t &);
+    bool nextRecord(uint32_t &, uint32_t &, uint32_t &);
+    const unsigned char *stripLink(uint32_t, uint32_t, uint32_t, uint32_t &) const;
+
+public:
+
+    uint64_t records; /* every record read in the capture */
+    uint64_t skipped; /* not IPv4 or truncated */
+    uint64_t foreign; /* not to/from the local network */
+
+    /* capture time of the last packet returned, ns since the epoch; the
+     * pcapng simple packets have no timestamp and keep the previous one */
+    uint64_t timestamp;
+
+    /* the capture and the local network, a.b.c.d[/bits] or NULL */
+    PcapReader(const char *, const char *);
+    ~PcapReader(void);
+
+    /* the next IPv4 packet, its length and source, NULL at the end of the capture */
+    const unsigned char *next(uint32_t &, source_t &);
+
+    bool isPcapng(void) const
+    {
+        return pcapng;
+    };
+};
+
+#endif /* SJ_PCAPREADER_H */
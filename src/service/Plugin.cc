@@ -22,11 +22,19 @@
 
 #include "Plugin.h"
 
+uint32_t PluginCache::live_records;
+
+time_t cacheRecord::expired(void)
+{
+    if (access_timestamp + owner->timeout_len >= sj_clock)
+        return access_timestamp + owner->timeout_len + 1;
+
+    owner->expire(*this);
+    return 0;
+}
+
 PluginCache::PluginCache(time_t timeout) :
-timeout_len(timeout),
-manage_timeout(sj_clock + timeout),
-first(&fm[0]),
-second(&fm[1])
+timeout_len(timeout)
 {
     LOG_DEBUG("");
 }
@@ -35,88 +43,58 @@ PluginCache::~PluginCache()
 {
     LOG_DEBUG("");
 
-    for (vector<cacheRecord *>::iterator it = first->begin(); it != first->end(); it = first->erase(it))
-        delete *it;
+    live_records -= records.size();
 
-    for (vector<cacheRecord *>::iterator it = second->begin(); it != second->end(); it = second->erase(it))
+    /* the destructor of the record disarms it */
+    for (list<cacheRecord *>::iterator it = records.begin(); it != records.end(); it = records.erase(it))
         delete *it;
 }
 
 cacheRecord* PluginCache::check(bool(*filter)(const cacheRecord &, const Packet &), const Packet &pkt)
 {
-    manage();
-
-    for (vector<cacheRecord *>::iterator it = first->begin(); it != first->end(); ++it)
+    for (list<cacheRecord *>::iterator it = records.begin(); it != records.end(); ++it)
     {
         if (filter(**it, pkt))
         {
-            cacheRecord *record = *it;
-            /* update entry timeout moving it to the freshest vector */
-            first->erase(it);
-            second->push_back(record);
-            return record;
-        }
-    }
-
-    for (vector<cacheRecord *>::iterator it = second->begin(); it != second->end(); ++it)
-    {
-        if (filter(**it, pkt))
+            /* the deadline is checked against it when the record expires */
+            (*it)->access_timestamp = sj_clock;
             return *it;
+        }
     }
 
     return NULL;
 }
 
-cacheRecord* PluginCache::add(const Packet &pkt)
+cacheRecord* PluginCache::insert(cacheRecord *newrecord)
 {
-    cacheRecord *newrecord = new cacheRecord(pkt);
-    second->push_back(newrecord);
+    newrecord->owner = this;
+    newrecord->self = records.insert(records.end(), newrecord);
+    timer_wheel.arm(*newrecord, sj_clock + timeout_len + 1);
+    ++live_records;
     return newrecord;
 }
 
-cacheRecord* PluginCache::add(const Packet &pkt, const unsigned char *data, size_t data_size)
+cacheRecord* PluginCache::add(const Packet &pkt)
 {
-    cacheRecord *newrecord = new cacheRecord(pkt, data, data_size);
-    second->push_back(newrecord);
-    return newrecord;
+    return insert(new cacheRecord(pkt));
 }
 
-void PluginCache::explicitDelete(struct cacheRecord *record)
+cacheRecord* PluginCache::add(const Packet &pkt, const unsigned char *data, size_t data_size)
 {
-    for (vector<cacheRecord *>::iterator it = first->begin(); it != first->end(); ++it)
-    {
-        if (*it == record)
-        {
-            delete *it;
-            first->erase(it);
-            return;
-        }
-    }
-
-    for (vector<cacheRecord *>::iterator it = second->begin(); it != second->end(); ++it)
-    {
-        if (*it == record)
-        {
-            delete *it;
-            second->erase(it);
-            return;
-        }
-    }
+    return insert(new cacheRecord(pkt, data, data_size));
 }
 
-void PluginCache::manage(void)
+void PluginCache::expire(cacheRecord &record)
 {
-    if (manage_timeout > sj_clock - timeout_len)
-        return;
-
-    for (vector<cacheRecord *>::iterator it = first->begin(); it != first->end(); it = first->erase(it))
-        delete *it;
-
-    vector<struct cacheRecord *> *tmp = first;
-    first = second;
-    second = tmp;
+    records.erase(record.self);
+    --live_records;
+    delete &record;
+}
 
-    manage_timeout = sj_clock + timeout_len;
+void PluginCache::explicitDelete(struct cacheRecord *record)
+{
+    if (record->owner == this)
+        expire(*record);
 }
 
 Plugin::Plugin(const char* pluginName, uint16_t pluginFrequency) :
@@ -25,6 +25,7 @@
 
 #include "Utils.h"
 #include "Packet.h"
+#include "TimerWheel.h"
 
 /* 
  *
@@ -38,43 +39,61 @@
  *
  */
 
-class cacheRecord
+class PluginCache;
+
+class cacheRecord : public TimerEntry
 {
+    friend class PluginCache;
+
+private:
+    PluginCache *owner;
+    time_t access_timestamp; /* updated on every hit by PluginCache::check */
+    list<cacheRecord*>::iterator self; /* position in the list of the owner */
+
 public:
     const Packet cached_packet;
     vector<unsigned char>cached_data;
 
     cacheRecord(const Packet& pkt) :
+    owner(NULL),
+    access_timestamp(sj_clock),
     cached_packet(pkt)
     {
     };
 
     cacheRecord(const Packet& pkt, const unsigned char* data, size_t data_size) :
+    owner(NULL),
+    access_timestamp(sj_clock),
     cached_packet(pkt),
     cached_data(data, data + data_size)
     {
     };
+
+    /* the record unused for the timeout of the cache is deleted, see TimerWheel */
+    time_t expired(void);
 };
 
 class PluginCache
 {
+    friend class cacheRecord;
+
     time_t timeout_len;
-    time_t manage_timeout;
-    vector<cacheRecord*> fm[2];
-    vector<cacheRecord*> *first;
-    vector<cacheRecord*> *second;
+    list<cacheRecord*> records;
 
-    /* called automagically */
-    void manage(void);
+    cacheRecord* insert(cacheRecord *);
+    void expire(cacheRecord &);
 
 public:
 
+    /* the records alive in all the caches, reported by sniffjoke-bench --plugin */
+    static uint32_t live_records;
+
     PluginCache(time_t = PLUGINCACHE_EXPIRYTIME);
     ~PluginCache();
 
     /*
       we export the iterator as return to permit explicit cache removal;
-      this is not a requirement for plugins, due to the mangage routine included in cacheCheck
+      this is not a requirement for plugins, the unused records are expired by the timer wheel
      */
     cacheRecord* check(bool(*)(const cacheRecord &, const Packet &), const Packet &);
     cacheRecord* add(const Packet &);
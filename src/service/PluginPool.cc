@@ -75,6 +75,9 @@ PluginTrack::PluginTrack(const char *plugabspath, uint8_t enabledScrambles, char
 
     declaredScramble = enabledScrambles;
 
+    memset(&stats, 0x00, sizeof (stats));
+    snprintf(stats.name, sizeof (stats.name), "%s", selfObj->pluginName);
+
     if(plugOpt != NULL)
         declaredOpt = strdup(plugOpt);
     else
@@ -135,9 +138,14 @@ void PluginPool::initializeAll(struct sjEnviron *autoptrList)
  *
  * (class TCPTrack).plugin_pool is the name of the unique PluginPool element
  */
-PluginPool::PluginPool(void) :
+PluginPool::PluginPool(const char *dir) :
 globalEnabledScrambles(0)
 {
+    /* the plugin name is appended directly, so the trailing '/' is required */
+    if (dir == NULL)
+        dir = INSTALL_LIBDIR;
+    snprintf(plugindir, sizeof (plugindir), "%s%s", dir, dir[strlen(dir) - 1] == '/' ? "" : "/");
+
     /* globalEnabledScrambles is set from the sum of each plugin configuration */
     if (userconf->runcfg.onlyplugin[0])
         parseOnlyPlugin();
@@ -272,7 +280,7 @@ void PluginPool::parseOnlyPlugin(void)
     *comma = 0x00;
     comma++;
 
-    snprintf(plugabspath, sizeof (plugabspath), "%s%s.so", INSTALL_LIBDIR, onlyplugin_cpy);
+    snprintf(plugabspath, sizeof (plugabspath), "%s%s.so", plugindir, onlyplugin_cpy);
 
     if (!parseScrambleOpt(comma, &pluginEnabledScrambles, &pluginOpt))
         RUNTIME_EXCEPTION("invalid use of --only-plugin: (%s)", userconf->runcfg.onlyplugin);
@@ -332,7 +340,7 @@ void PluginPool::parseEnablerFile(void)
         *comma = 0x00;
         comma++;
 
-        snprintf(plugabspath, sizeof (plugabspath), "%s%s.so", INSTALL_LIBDIR, enablerentry);
+        snprintf(plugabspath, sizeof (plugabspath), "%s%s.so", plugindir, enablerentry);
 
         if (!parseScrambleOpt(comma, &enabledScrambles, &pluginOpt))
         {
@@ -45,6 +45,9 @@ public:
     uint8_t declaredScramble;
     char *declaredOpt;
 
+    /* performance counters, updated by TCPTrack and dumped by "pluginstat" */
+    struct plugin_record stats;
+
     PluginTrack(const char *, uint8_t, char *);
 private:
     void *forcedSymbolCopy( const char *, const char *);
@@ -54,13 +57,15 @@ class PluginPool
 {
 private:
     uint8_t globalEnabledScrambles;
+    char plugindir[MEDIUMBUF];
     void importPlugin(const char *, const char *, uint8_t, char *);
     void parseOnlyPlugin(void);
     void parseEnablerFile(void);
     bool parseScrambleOpt(char *, uint8_t *, char **);
 
 public:
-    PluginPool();
+    /* plugindir NULL means INSTALL_LIBDIR, the directory used by the service */
+    PluginPool(const char *plugindir = NULL);
     ~PluginPool(void);
     uint8_t enabledScrambles();
     void initializeAll(struct sjEnviron *);
@@ -24,6 +24,9 @@
 #include "UserConf.h"
 
 #include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/capability.h>
 
 extern auto_ptr<UserConf> userconf;
 
@@ -134,11 +137,34 @@ void Process::jail(void)
 
 void Process::privilegesDowngrade(void)
 {
+    /* the nfqueue verdicts and the conntrack marks of the offload require CAP_NET_ADMIN */
+    const bool keep_netadmin = !strcmp(userconf->runcfg.io_backend, "nfqueue") || userconf->runcfg.offload;
+
     debug.downgradeOpenlog(userinfo.pw_uid, groupinfo.gr_gid);
 
+    if (keep_netadmin && prctl(PR_SET_KEEPCAPS, 1, 0, 0, 0))
+        RUNTIME_EXCEPTION("unable to keep the capabilities across setuid: %s", strerror(errno));
+
     if (setgid(groupinfo.gr_gid) || setuid(userinfo.pw_uid))
         RUNTIME_EXCEPTION("error loosing root privileges");
 
+    if (keep_netadmin)
+    {
+        struct __user_cap_header_struct caphdr;
+        struct __user_cap_data_struct capdata[_LINUX_CAPABILITY_U32S_3];
+
+        memset(&caphdr, 0x00, sizeof (caphdr));
+        memset(capdata, 0x00, sizeof (capdata));
+        caphdr.version = _LINUX_CAPABILITY_VERSION_3;
+        capdata[0].effective = capdata[0].permitted = 1 << CAP_NET_ADMIN;
+
+        /* every other capability kept by PR_SET_KEEPCAPS is dropped here */
+        if (syscall(SYS_capset, &caphdr, capdata))
+            RUNTIME_EXCEPTION("unable to keep CAP_NET_ADMIN: %s", strerror(errno));
+
+        LOG_VERBOSE("process %d keeps only CAP_NET_ADMIN, for the nfqueue verdicts and the offload", getpid());
+    }
+
     if (!getuid() && !geteuid())
         RUNTIME_EXCEPTION("SniffJoke user process can't be runned with root privileges");
 
@@ -28,24 +28,35 @@
 #endif
 
 #include "SessionTrack.h"
+#include "PacketTrace.h"
+#include "KernelPolicy.h"
 
-SessionTrack::SessionTrack(const Packet &pkt) :
+SessionTrack::SessionTrack(SessionTrackMap &owner, const Packet &pkt) :
 access_timestamp(0),
+owner(owner),
+saddr(pkt.ip->saddr),
 daddr(pkt.ip->daddr),
 packet_number(0),
-injected_pktnumber(0)
+injected_pktnumber(0),
+opener(SESSIONTRACK_OPENER_UNKNOWN),
+finished(false),
+offloaded(false),
+offload_ts(0)
 {
     if (pkt.proto == TCP)
     {
         proto = IPPROTO_TCP;
         sport = pkt.tcp->source;
         dport = pkt.tcp->dest;
+
+        if (pkt.tcp->syn)
+            opener = pkt.tcp->ack ? SESSIONTRACK_OPENER_REMOTE : SESSIONTRACK_OPENER_LOCAL;
     }
     else /* pkt.proto == UDP */
     {
         proto = IPPROTO_UDP;
         sport = pkt.udp->source;
-        dport = pkt.udp->source;
+        dport = pkt.udp->dest;
     }
 
     SELFLOG("New session created from Packet ID #%d", pkt.SjPacketId);
@@ -76,13 +87,60 @@ SessionTrack::~SessionTrack(void)
 #endif
 }
 
-void SessionTrack::selflog(const char *func, const char *format, ...) const
+SessionTrackKey SessionTrack::key(void) const
 {
-    if (debug.level() == SUPPRESS_LEVEL)
+    SessionTrackKey key;
+    key.proto = proto;
+    key.daddr = daddr;
+    key.sport = sport;
+    key.dport = dport;
+
+    return key;
+}
+
+time_t SessionTrack::expired(void)
+{
+    if (access_timestamp + SESSIONTRACK_EXPIRYTIME >= sj_clock)
+        return access_timestamp + SESSIONTRACK_EXPIRYTIME + 1;
+
+    /* an offloaded flow is not seen anymore: it lives as long as its connection in the kernel */
+    if (offloaded && owner.stillOffloaded(*this))
+        return sj_clock + SESSIONTRACK_EXPIRYTIME + 1;
+
+    owner.expire(*this);
+    return 0;
+}
+
+void SessionTrack::selflogEmit(const char *func, const char *format, ...) const
+{
+    va_list arguments;
+
+    /* as Packet::selflogEmit, the session log is deferred to its trace writer */
+    if (sesstrace.isRunning())
+    {
+        struct packet_trace *rec = sesstrace.reserve();
+        if (rec == NULL)
+            return;
+
+        rec->kind = TRACE_SESSION;
+        rec->clock = sj_clock;
+        rec->func = func;
+        rec->hdr.session.proto = proto;
+        rec->hdr.session.sport = ntohs(sport);
+        rec->hdr.session.daddr = daddr;
+        rec->hdr.session.dport = ntohs(dport);
+        rec->hdr.session.packet_number = packet_number;
+        rec->hdr.session.injected_pktnumber = injected_pktnumber;
+
+        va_start(arguments, format);
+        PacketTrace::capture(rec->msg, format, arguments);
+        va_end(arguments);
+
+        sesstrace.commit();
         return;
+    }
 
     char loginfo[LARGEBUF];
-    va_list arguments;
     va_start(arguments, format);
     vsnprintf(loginfo, sizeof (loginfo), format, arguments);
     va_end(arguments);
@@ -126,7 +184,8 @@ bool SessionTrackKey::operator<(SessionTrackKey comp) const
 }
 
 SessionTrackMap::SessionTrackMap(void) :
-manage_timeout(sj_clock)
+policy(NULL),
+offloaded(0)
 {
     LOG_DEBUG("");
 }
@@ -168,7 +227,10 @@ SessionTrack& SessionTrackMap::get(const Packet &pkt)
     if (it != end()) /* on hit: return the sessiontrack object. */
         sessiontrack = it->second;
     else /* on miss: create a new sessiontrack and insert it into the map */
-        sessiontrack = insert(pair<SessionTrackKey, SessionTrack*>(key, new SessionTrack(pkt))).first->second;
+    {
+        sessiontrack = insert(pair<SessionTrackKey, SessionTrack*>(key, new SessionTrack(*this, pkt))).first->second;
+        timer_wheel.arm(*sessiontrack, sj_clock + SESSIONTRACK_EXPIRYTIME + 1);
+    }
 
     /* update access timestamp using global clock */
     sessiontrack->access_timestamp = sj_clock;
@@ -176,26 +238,20 @@ SessionTrack& SessionTrackMap::get(const Packet &pkt)
     return *sessiontrack;
 }
 
-void SessionTrackMap::manage(void)
+/* called by the timer wheel: the session is not used since SESSIONTRACK_EXPIRYTIME */
+void SessionTrackMap::expire(SessionTrack &sessiontrack)
 {
-    /* timeout check */
-    if (manage_timeout < sj_clock - SESSIONTRACKMAP_MANAGE_ROUTINE_TIMER)
-    {
-        manage_timeout = sj_clock; /* update the next manage timeout */
-        for (SessionTrackMap::iterator it = begin(); it != end();)
-        {
-            if ((*it).second->access_timestamp + SESSIONTRACK_EXPIRYTIME < sj_clock)
-            {
-                delete &(*it->second);
-                erase(it++);
-            }
-            else
-            {
-                it++;
-            }
-        }
-    }
+    release(sessiontrack);
+    erase(sessiontrack.key());
+    delete &sessiontrack;
+}
 
+/*
+ * the expiry is done by the timer wheel, here only the memory threshold is
+ * checked; the offloads and the releases of the cycle reach the socket filter.
+ */
+void SessionTrackMap::manage(void)
+{
     /* size check */
     uint32_t map_size = size();
     uint32_t index;
@@ -223,15 +279,152 @@ void SessionTrackMap::manage(void)
         index = 0;
         do
         {
-            const SessionTrackKey key = {tmp[index]->daddr, tmp[index]->sport, tmp[index]->dport};
-            insert(pair<SessionTrackKey, SessionTrack *>(key, tmp[index]));
+            insert(pair<SessionTrackKey, SessionTrack *>(tmp[index]->key(), tmp[index]));
         }
         while (++index != SESSIONTRACKMAP_MEMORY_THRESHOLD / 2);
 
         do
+        {
+            release(*tmp[index]);
             delete tmp[index];
+        }
         while (++index != map_size);
 
         delete[] tmp;
     }
+
+    if (policy != NULL)
+        policy->updateFilter();
+}
+
+void SessionTrackMap::prepareOffload(KernelPolicy *kernelpolicy)
+{
+    policy = kernelpolicy;
+}
+
+/*
+ * the flow is finished, TCPTrack has checked that no hack will be applied
+ * anymore: the kernel will be asked to forward the next packets by itself.
+ * the request is only queued, the packet path doesn't wait for ctnetlink.
+ */
+void SessionTrackMap::offload(SessionTrack &sessiontrack)
+{
+    sessiontrack.finished = true;
+
+    if (policy != NULL)
+        offload_queue.push_back(sessiontrack.key());
+}
+
+/*
+ * called once every cycle, before manage: the flows finished in the cycle
+ * are marked with a single exchange. a flow reclaimed or expired meanwhile
+ * is skipped; when the kernel refuses, the flow stays in sniffjoke and is
+ * not proposed again. returns the flows offloaded.
+ */
+uint32_t SessionTrackMap::flushOffloads(void)
+{
+    vector<SessionTrack *> flows;
+    vector<int> errors;
+    uint32_t marked = 0;
+
+    if (offload_queue.empty())
+        return 0;
+
+    for (vector<SessionTrackKey>::iterator it = offload_queue.begin(); it != offload_queue.end(); ++it)
+    {
+        SessionTrackMap::iterator session = find(*it);
+        if (session == end() || !session->second->finished || session->second->offloaded)
+            continue;
+
+        /* a flow queued twice in the cycle (reclaimed, then finished again) */
+        if (std::find(flows.begin(), flows.end(), session->second) == flows.end())
+            flows.push_back(session->second);
+    }
+
+    offload_queue.clear();
+
+    policy->offloadFlows(flows, errors);
+
+    const uint64_t now = sj_monotonic_ns();
+
+    for (uint32_t i = 0; i < flows.size(); ++i)
+    {
+        SessionTrack &sessiontrack = *flows[i];
+
+        if (errors[i])
+        {
+            sessiontrack.selflog(__func__, "the conntrack mark has not been set: %s", strerror(errors[i]));
+            continue;
+        }
+
+        sessiontrack.offloaded = true;
+        sessiontrack.offload_ts = now;
+        ++offloaded;
+        ++marked;
+
+        sessiontrack.selflog(__func__, "offloaded to the kernel");
+    }
+
+    return marked;
+}
+
+bool SessionTrackMap::stillOffloaded(SessionTrack &sessiontrack)
+{
+    return policy->flowOffloaded(sessiontrack);
+}
+
+void SessionTrackMap::release(SessionTrack &sessiontrack)
+{
+    if (!sessiontrack.offloaded)
+        return;
+
+    policy->releaseFlow(sessiontrack);
+    sessiontrack.offloaded = false;
+    --offloaded;
+}
+
+/*
+ * a packet of a finished flow has reached sniffjoke. a SYN is a new
+ * connection on the same ports, and is hacked again from the start; any
+ * other packet, after the ones still in flight at the offload, means that
+ * the kernel has lost the connection (e.g. a conntrack flush): the flow is
+ * offloaded again by TCPTrack, if still finished.
+ */
+void SessionTrackMap::reclaim(SessionTrack &sessiontrack, const Packet &pkt)
+{
+    const bool syn = (pkt.tcp->syn && !pkt.tcp->ack);
+
+    if (!syn && (!sessiontrack.offloaded || pkt.ingress_ts <= sessiontrack.offload_ts + SESSIONTRACK_OFFLOAD_GRACE))
+        return;
+
+    release(sessiontrack);
+    sessiontrack.finished = false;
+
+    if (syn)
+    {
+        sessiontrack.packet_number = 0;
+        sessiontrack.opener = SESSIONTRACK_OPENER_LOCAL;
+    }
+}
+
+/*
+ * with the datalink socket the kernel delivers the incoming packets of an
+ * offloaded flow, and the socket filter excludes them from sniffjoke; what
+ * is read anyway (before the filter update, or over its capacity) after the
+ * offload is a copy and must not be written in the tunnel.
+ */
+bool SessionTrackMap::offloadedCopy(const Packet &pkt)
+{
+    if (!offloaded || pkt.proto != TCP || !policy->deliversOffloaded())
+        return false;
+
+    SessionTrackKey key;
+    key.proto = IPPROTO_TCP;
+    key.daddr = pkt.ip->saddr;
+    key.sport = pkt.tcp->dest;
+    key.dport = pkt.tcp->source;
+
+    SessionTrackMap::iterator it = find(key);
+
+    return (it != end() && it->second->offloaded && pkt.ingress_ts > it->second->offload_ts);
 }
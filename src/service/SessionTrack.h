@@ -25,17 +25,40 @@
 
 #include "Utils.h"
 #include "Packet.h"
+#include "TimerWheel.h"
 
-class SessionTrack
+class SessionTrackMap;
+class KernelPolicy;
+
+/* who opened the connection, as seen by its first packet in the tunnel */
+#define SESSIONTRACK_OPENER_UNKNOWN     0
+#define SESSIONTRACK_OPENER_LOCAL       1       /* a SYN: the conntrack original direction */
+#define SESSIONTRACK_OPENER_REMOTE      2       /* a SYN/ACK: the conntrack reply direction */
+
+class SessionTrackKey
+{
+public:
+    uint8_t proto;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+
+    bool operator<(SessionTrackKey) const;
+
+};
+
+class SessionTrack : public TimerEntry
 {
     friend class SessionTrackMap;
 
 private:
     time_t access_timestamp; /* access timestamp used to decretee expiry */
+    SessionTrackMap &owner;
 
 public:
 
     uint8_t proto;
+    uint32_t saddr;
     uint32_t daddr;
     uint16_t sport;
     uint16_t dport;
@@ -43,30 +66,37 @@ public:
     uint32_t packet_number;
     uint32_t injected_pktnumber;
 
-    SessionTrack(const Packet &);
-    ~SessionTrack(void);
+    uint8_t opener;
 
-    /* utilities */
-    void selflog(const char *func, const char *format, ...) const;
-};
+    /*
+     * finished: no hack will be applied to the next packets, decided once.
+     * offloaded: the kernel forwards the flow by itself since offload_ts
+     * (monotonic ns), see SessionTrackMap::flushOffloads.
+     */
+    bool finished;
+    bool offloaded;
+    uint64_t offload_ts;
 
-class SessionTrackKey
-{
-public:
-    uint8_t proto;
-    uint32_t daddr;
-    uint16_t sport;
-    uint16_t dport;
+    SessionTrack(SessionTrackMap &, const Packet &);
+    ~SessionTrack(void);
 
-    bool operator<(SessionTrackKey) const;
+    SessionTrackKey key(void) const;
+
+    /* the access_timestamp is checked at the deadline, see TimerWheel */
+    time_t expired(void);
 
+    /* utilities: the level check is inlined in the caller, as in Packet */
+    __attribute__((always_inline)) void selflog(const char *func, const char *format, ...) const
+    {
+        if (debug.level() >= SESSION_LEVEL)
+            selflogEmit(func, format, __builtin_va_arg_pack());
+    }
+    void selflogEmit(const char *func, const char *format, ...) const;
 };
 
 class SessionTrackMap : public map<const SessionTrackKey, SessionTrack*>
 {
 private:
-    time_t manage_timeout;
-
     struct sessiontrack_timestamp_comparison
     {
 
@@ -77,12 +107,29 @@ private:
 
     } sessiontrackTimestampComparison;
 
+    /* the kernel fast path of the finished flows, NULL without --offload */
+    KernelPolicy *policy;
+    uint32_t offloaded;
+
+    /* the flows finished in the cycle, offloaded together by flushOffloads */
+    vector<SessionTrackKey> offload_queue;
+
+    void release(SessionTrack &);
+
 public:
     SessionTrackMap(void);
     ~SessionTrackMap(void);
 
     SessionTrack& get(const Packet &);
+    void expire(SessionTrack &);
     void manage(void);
+
+    void prepareOffload(KernelPolicy *);
+    void offload(SessionTrack &);
+    uint32_t flushOffloads(void);
+    bool stillOffloaded(SessionTrack &);
+    void reclaim(SessionTrack &, const Packet &);
+    bool offloadedCopy(const Packet &);
 };
 
 #endif /* SJ_SESSIONTRACK_H */
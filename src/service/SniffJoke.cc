@@ -23,12 +23,19 @@
 
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
 /* global variables */
 time_t sj_clock;
 char sj_clock_str[MEDIUMBUF];
 Debug debug;
+PacketTrace pkttrace;
+PacketTrace sesstrace;
+
+/* defined before the containers of its entries, so it is destroyed after them */
+TimerWheel timer_wheel;
 
 auto_ptr<UserConf> userconf;
 auto_ptr<TTLFocusMap> ttlfocus_map;
@@ -42,7 +49,8 @@ void sigtrap(int);
 SniffJoke::SniffJoke(const struct sj_cmdline_opts &opts) :
 alive(true),
 opts(opts),
-service_pid(0)
+service_pid(0),
+admin_stream_socket(-1)
 {
     updateClock();
 
@@ -113,7 +121,12 @@ void SniffJoke::run(void)
     userconf->networkSetup();
 
     /* the code flow reach here, SniffJoke is ready to instance network environment */
-    mitm = auto_ptr<NetIO > (new NetIO);
+    if (!strcmp(userconf->runcfg.io_backend, "uring"))
+        mitm = auto_ptr<NetIO > (new NetIOUring);
+    else if (!strcmp(userconf->runcfg.io_backend, "nfqueue"))
+        mitm = auto_ptr<NetIO > (new NetIONfqueue);
+    else
+        mitm = auto_ptr<NetIO > (new NetIOTun);
 
     /* sigtrap handler mapped the same in both Sj processes */
     proc->sigtrapSetup(sigtrap);
@@ -150,14 +163,21 @@ void SniffJoke::run(void)
 
         setupDebug();
 
+        /* the packet path resources not shared with the root process */
+        mitm->setupService();
+
         /* loading the plugins used for tcp hacking, MUST be done before proc->jail() */
         plugin_pool = auto_ptr<PluginPool > (new PluginPool);
         opt_pool = auto_ptr<OptionPool > (new OptionPool);
 
+        /* the shared memory is not reachable from the chroot */
+        stats_segment = auto_ptr<StatsSegment > (new StatsSegment);
+
         proc->jail();
         proc->privilegesDowngrade();
 
         sessiontrack_map = auto_ptr<SessionTrackMap > (new SessionTrackMap);
+        sessiontrack_map->prepareOffload(mitm->getPolicy());
         ttlfocus_map = auto_ptr<TTLFocusMap > (new TTLFocusMap);
         conntrack = auto_ptr<TCPTrack > (new TCPTrack);
 
@@ -170,6 +190,7 @@ void SniffJoke::run(void)
         plugin_pool->initializeAll(&autoptrList);
 
         setupAdminSocket();
+        setupAdminStream();
 
         /* main block */
         while (alive)
@@ -180,8 +201,12 @@ void SniffJoke::run(void)
 
             mitm->networkIO();
 
+            publishStats();
+
             handleAdminSocket();
 
+            handleAdminStream();
+
             proc->sigtrapEnable();
         }
     }
@@ -211,6 +236,26 @@ void SniffJoke::setupDebug(void)
 
     if (!debug.resetLevel())
         RUNTIME_EXCEPTION("executing debug resetLevel");
+
+    setupPacketTrace();
+}
+
+/* the packet and session logs are written by the trace writer threads, started only when needed */
+void SniffJoke::setupPacketTrace(void)
+{
+    FILE *stream = debug.packet_logstream != NULL ? debug.packet_logstream : debug.logstream;
+
+    if (debug.debuglevel >= PACKET_LEVEL)
+        pkttrace.start(stream != NULL ? stream : stderr);
+    else
+        pkttrace.stop();
+
+    stream = debug.session_logstream != NULL ? debug.session_logstream : debug.logstream;
+
+    if (debug.debuglevel >= SESSION_LEVEL)
+        sesstrace.start(stream != NULL ? stream : stderr);
+    else
+        sesstrace.stop();
 }
 
 /* this function must not close the FILE *desc, because in the destructor of the
@@ -218,6 +263,9 @@ void SniffJoke::setupDebug(void)
  * and the descriptor are closed with the process, after. */
 void SniffJoke::cleanDebug(void)
 {
+    pkttrace.stop();
+    sesstrace.stop();
+
     if (debug.logstream != NULL && debug.logstream != stdout)
         fflush(debug.logstream);
     if (debug.packet_logstream != NULL && debug.packet_logstream != stdout)
@@ -233,6 +281,8 @@ void SniffJoke::cleanServerRoot(void)
         LOG_VERBOSE("found server root pid %d (from %d)", service_pid, getpid());
         kill(service_pid, SIGTERM);
         waitpid(service_pid, NULL, WUNTRACED);
+
+        StatsSegment::unlink();
     }
 
     proc->unlinkPidfile(false);
@@ -241,6 +291,20 @@ void SniffJoke::cleanServerRoot(void)
 void SniffJoke::cleanServerUser(void)
 {
     LOG_DEBUG("");
+
+    for (vector<struct admin_stream *>::iterator it = admin_streams.begin(); it != admin_streams.end(); ++it)
+    {
+        close((*it)->fd);
+        delete *it;
+    }
+    admin_streams.clear();
+
+    if (admin_stream_socket != -1)
+    {
+        close(admin_stream_socket);
+        /* still in the chroot: the path is relative to the working directory */
+        unlink("/" FILE_ADMINSOCKET);
+    }
 }
 
 void SniffJoke::setupAdminSocket(void)
@@ -290,6 +354,61 @@ void SniffJoke::setupAdminSocket(void)
     admin_socket = tmp;
 }
 
+/* the unix socket is created after the chroot, so it's in the working directory */
+void SniffJoke::setupAdminStream(void)
+{
+    int tmp;
+
+    struct sockaddr_un un_service;
+
+    if ((tmp = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        RUNTIME_EXCEPTION("unable to open unix socket: %s",
+                          strerror(errno));
+    }
+
+    memset(&un_service, 0x00, sizeof (un_service));
+    un_service.sun_family = AF_UNIX;
+    snprintf(un_service.sun_path, sizeof (un_service.sun_path), "/%s", FILE_ADMINSOCKET);
+
+    /* a socket left by a previous instance is removed */
+    unlink(un_service.sun_path);
+
+    if (bind(tmp, (struct sockaddr *) &un_service, sizeof (un_service)) == -1)
+    {
+        close(tmp);
+        RUNTIME_EXCEPTION("unable to bind unix socket %s/%s: %s",
+                          userconf->runcfg.working_dir, FILE_ADMINSOCKET, strerror(errno));
+    }
+
+    /* only root and the SniffJoke user could connect */
+    chmod(un_service.sun_path, S_IRUSR | S_IWUSR);
+
+    if (listen(tmp, ADMIN_STREAM_CLIENTS) == -1 || fcntl(tmp, F_SETFL, fcntl(tmp, F_GETFL) | O_NONBLOCK) == -1)
+    {
+        close(tmp);
+        RUNTIME_EXCEPTION("unable to setup the listening unix socket: %s",
+                          strerror(errno));
+    }
+
+    LOG_VERBOSE("listening in %s/%s unix socket for administration",
+                userconf->runcfg.working_dir, FILE_ADMINSOCKET);
+
+    admin_stream_socket = tmp;
+}
+
+void SniffJoke::publishStats(void)
+{
+    struct sj_stats &stats = conntrack->getStats();
+
+    stats.clock = sj_clock;
+    stats.loops++;
+    stats.sessions = sessiontrack_map->size();
+    stats.ttlfocus = ttlfocus_map->size();
+
+    stats_segment->publish(stats);
+}
+
 void SniffJoke::createSjEnvironment(void)
 {
     autoptrList.instanced_proc = reinterpret_cast<void *> (proc.get());
@@ -342,17 +461,171 @@ void SniffJoke::handleAdminSocket(void)
     else
         RUNTIME_EXCEPTION("BUG: command handling of [%s] doesn't return any answer", r_buf);
 
-    /* delayed execution of requested commands (only debug level change ATM) */
+    handleDelayedCmd();
+}
+
+/* delayed execution of requested commands (only debug level change ATM) */
+void SniffJoke::handleDelayedCmd(void)
+{
     if (debug.debuglevel != userconf->runcfg.debug_level)
     {
         LOG_ALL("changing log level since %u to %u\n", debug.debuglevel, userconf->runcfg.debug_level);
         debug.debuglevel = userconf->runcfg.debug_level;
 
+        /* the writers must not use the logfiles while they are reopened */
+        pkttrace.stop();
+        sesstrace.stop();
+
         if (!debug.resetLevel())
             RUNTIME_EXCEPTION("changing logfile settings");
+
+        setupPacketTrace();
     }
 }
 
+void SniffJoke::handleAdminStream(void)
+{
+    int fd;
+
+    while ((fd = accept(admin_stream_socket, NULL, NULL)) != -1)
+    {
+        if (admin_streams.size() >= ADMIN_STREAM_CLIENTS)
+        {
+            LOG_ALL("refused administration client: %u are already connected", ADMIN_STREAM_CLIENTS);
+            close(fd);
+            continue;
+        }
+
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+        {
+            LOG_ALL("unable to set non blocking administration client: %s", strerror(errno));
+            close(fd);
+            continue;
+        }
+
+        struct admin_stream *as = new struct admin_stream;
+        as->fd = fd;
+        as->out_sent = 0;
+        as->snapshot_type = 0;
+        admin_streams.push_back(as);
+
+        LOG_DEBUG("accepted administration client (fd %d)", fd);
+    }
+
+    /* a failed accept (aborted connection, no more descriptors) is not fatal */
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        LOG_DEBUG("unable to accept from unix socket: %s", strerror(errno));
+
+    for (vector<struct admin_stream *>::iterator it = admin_streams.begin(); it != admin_streams.end();)
+    {
+        if (readAdminStream(**it) && writeAdminStream(**it))
+        {
+            ++it;
+            continue;
+        }
+
+        LOG_DEBUG("closed administration client (fd %d)", (*it)->fd);
+        close((*it)->fd);
+        delete *it;
+        it = admin_streams.erase(it);
+    }
+}
+
+/* return false when the client must be closed */
+bool SniffJoke::readAdminStream(struct admin_stream &as)
+{
+    uint8_t r_buf[LARGEBUF];
+    char cmd[ADMIN_STREAM_MAXCMD] = {0};
+    uint32_t framelen;
+
+    /* a slow client has to read the pending answer before sending another command */
+    if (as.out_sent < as.out.size())
+        return true;
+
+    const ssize_t ret = recv(as.fd, r_buf, sizeof (r_buf), 0);
+
+    if (ret == 0)
+        return false;
+
+    if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+
+    if (ret > 0)
+        as.in.insert(as.in.end(), r_buf, r_buf + ret);
+
+    if (as.in.size() < sizeof (framelen))
+        return true;
+
+    memcpy(&framelen, &as.in[0], sizeof (framelen));
+    if (framelen <= sizeof (framelen) || framelen >= sizeof (framelen) + sizeof (cmd))
+    {
+        LOG_ALL("invalid frame length %u from administration client", framelen);
+        return false;
+    }
+
+    if (as.in.size() < framelen)
+        return true;
+
+    memcpy(cmd, &as.in[sizeof (framelen)], framelen - sizeof (framelen));
+    as.in.erase(as.in.begin(), as.in.begin() + framelen);
+
+    LOG_VERBOSE("received command from the stream client: %s", cmd);
+
+    const uint8_t *output_buf = handleStreamCmd(as, cmd);
+    as.out.assign(output_buf, output_buf + ((uint32_t *) output_buf)[0]);
+    as.out_sent = 0;
+
+    handleDelayedCmd();
+
+    return true;
+}
+
+bool SniffJoke::writeAdminStream(struct admin_stream &as)
+{
+    while (as.out_sent < as.out.size())
+    {
+        const ssize_t ret = send(as.fd, &as.out[as.out_sent], as.out.size() - as.out_sent, MSG_NOSIGNAL);
+
+        if (ret == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+
+        as.out_sent += ret;
+    }
+
+    return true;
+}
+
+/* the dumps of the maps are paginated, the other commands are the datagram ones */
+uint8_t * SniffJoke::handleStreamCmd(struct admin_stream &as, const char *cmd)
+{
+    uint32_t cursor = 0;
+
+    if (!memcmp(cmd, "info", strlen("info")))
+    {
+        sscanf(cmd, "info %u", &cursor);
+        if (!cursor || as.snapshot_type != INFOPAGE_COMMAND_TYPE)
+        {
+            takeSJSessionSnapshot(as);
+            cursor = 0;
+        }
+    }
+    else if (!memcmp(cmd, "ttlmap", strlen("ttlmap")))
+    {
+        sscanf(cmd, "ttlmap %u", &cursor);
+        if (!cursor || as.snapshot_type != TTLMAPPAGE_COMMAND_TYPE)
+        {
+            takeSJTTLSnapshot(as);
+            cursor = 0;
+        }
+    }
+    else
+        return handleCmd(cmd);
+
+    writeSJSnapshotPage(io_buf, sizeof (io_buf), as, cursor);
+
+    return io_buf;
+}
+
 uint8_t * SniffJoke::handleCmd(const char *cmd)
 {
     memset(io_buf, 0x00, sizeof (io_buf));
@@ -394,6 +667,14 @@ uint8_t * SniffJoke::handleCmd(const char *cmd)
     {
         handleCmdTTL();
     }
+    else if (!memcmp(cmd, "pluginstat", strlen("pluginstat")))
+    {
+        handleCmdPluginStat();
+    }
+    else if (!memcmp(cmd, "latency", strlen("latency")))
+    {
+        handleCmdLatency();
+    }
     else if (!memcmp(cmd, "showport", strlen("showport")))
     {
         handleCmdShowport();
@@ -497,6 +778,18 @@ void SniffJoke::handleCmdTTL(void)
     writeSJTTLmap(TTLMAP_COMMAND_TYPE);
 }
 
+void SniffJoke::handleCmdPluginStat(void)
+{
+    LOG_VERBOSE("pluginstat command requested: dumping plugins performance counters");
+    writeSJPluginStat(PLUGINSTAT_COMMAND_TYPE);
+}
+
+void SniffJoke::handleCmdLatency(void)
+{
+    LOG_VERBOSE("latency command requested: dumping queues residence and forwarding latency");
+    writeSJLatency(LATENCY_COMMAND_TYPE);
+}
+
 void SniffJoke::handleCmdShowport(void)
 {
     LOG_VERBOSE("showport command requested: dumping port aggressivity and frequency");
@@ -670,6 +963,47 @@ void SniffJoke::writeSJInfoDump(uint8_t type)
     memcpy(io_buf, &retInfo, sizeof (retInfo));
 }
 
+void SniffJoke::writeSJPluginStat(uint8_t type)
+{
+    struct command_ret retInfo;
+    uint32_t accumulen = sizeof (retInfo);
+
+    /* clean the buffer and fix the starting pointer */
+    memset(io_buf, 0x00, sizeof (io_buf));
+
+    for (vector<PluginTrack *>::iterator it = plugin_pool->pool.begin(); it != plugin_pool->pool.end(); ++it)
+    {
+        if (accumulen > sizeof (io_buf) - sizeof (struct plugin_record))
+        {
+            LOG_ALL("overflow trapped! io_buf %u bytes are not enought!", sizeof (io_buf));
+            break;
+        }
+
+        memcpy(&io_buf[accumulen], &(*it)->stats, sizeof (struct plugin_record));
+        accumulen += sizeof (struct plugin_record);
+    }
+
+    retInfo.cmd_len = accumulen;
+    retInfo.cmd_type = type;
+    memcpy(io_buf, &retInfo, sizeof (retInfo));
+}
+
+void SniffJoke::writeSJLatency(uint8_t type)
+{
+    struct command_ret retInfo;
+    uint32_t accumulen = sizeof (retInfo);
+
+    /* clean the buffer and fix the starting pointer */
+    memset(io_buf, 0x00, sizeof (io_buf));
+
+    memcpy(&io_buf[accumulen], conntrack->getLatency(), sizeof (struct latency_record) * LATENCY_RECORDS);
+    accumulen += sizeof (struct latency_record) * LATENCY_RECORDS;
+
+    retInfo.cmd_len = accumulen;
+    retInfo.cmd_type = type;
+    memcpy(io_buf, &retInfo, sizeof (retInfo));
+}
+
 void SniffJoke::writeSJProtoError(void)
 {
     struct command_ret retInfo;
@@ -679,6 +1013,76 @@ void SniffJoke::writeSJProtoError(void)
     memcpy(io_buf, &retInfo, sizeof (retInfo));
 }
 
+void SniffJoke::writeSJSnapshotPage(uint8_t *buf, uint32_t buflen, struct admin_stream &as, uint32_t cursor)
+{
+    struct command_ret retInfo;
+    struct page_ret pageInfo;
+    uint32_t accumulen = sizeof (retInfo) + sizeof (pageInfo);
+
+    const uint8_t type = as.snapshot_type;
+    const uint32_t reclen = (type == INFOPAGE_COMMAND_TYPE) ? sizeof (struct sex_record) : sizeof (struct ttl_record);
+    const uint32_t total = as.snapshot.size() / reclen;
+    const uint32_t perpage = (buflen - accumulen) / reclen;
+
+    /* clean the buffer and fix the starting pointer */
+    memset(buf, 0x00, buflen);
+
+    if (cursor > total)
+        cursor = total;
+
+    const uint32_t count = (total - cursor) > perpage ? perpage : (total - cursor);
+
+    if (count)
+        memcpy(&buf[accumulen], &as.snapshot[cursor * reclen], count * reclen);
+    accumulen += count * reclen;
+
+    pageInfo.cursor = (cursor + count < total) ? cursor + count : 0;
+    pageInfo.total = total;
+
+    LOG_VERBOSE("serving %u records since %u of a %u records snapshot", count, cursor, total);
+
+    /* the last page release the snapshot */
+    if (!pageInfo.cursor)
+    {
+        vector<uint8_t>().swap(as.snapshot);
+        as.snapshot_type = 0;
+    }
+
+    retInfo.cmd_len = accumulen;
+    retInfo.cmd_type = type;
+    memcpy(buf, &retInfo, sizeof (retInfo));
+    memcpy(&buf[sizeof (retInfo)], &pageInfo, sizeof (pageInfo));
+}
+
+/*
+ * the snapshot is a flat copy of the records, so a dump bigger than io_buf
+ * is not truncated and the pages after the first don't walk the map again
+ */
+void SniffJoke::takeSJSessionSnapshot(struct admin_stream &as)
+{
+    uint32_t accumulen = 0;
+
+    as.snapshot.resize(sessiontrack_map->size() * sizeof (struct sex_record));
+    as.snapshot_type = INFOPAGE_COMMAND_TYPE;
+
+    for (SessionTrackMap::iterator it = sessiontrack_map->begin(); it != sessiontrack_map->end(); ++it)
+        accumulen += appendSJSessionInfo(&as.snapshot[accumulen], *((*it).second));
+
+    /* the sessions without packets are not dumped */
+    as.snapshot.resize(accumulen);
+}
+
+void SniffJoke::takeSJTTLSnapshot(struct admin_stream &as)
+{
+    uint32_t accumulen = 0;
+
+    as.snapshot.resize(ttlfocus_map->size() * sizeof (struct ttl_record));
+    as.snapshot_type = TTLMAPPAGE_COMMAND_TYPE;
+
+    for (TTLFocusMap::iterator it = ttlfocus_map->begin(); it != ttlfocus_map->end(); ++it)
+        accumulen += appendSJTTLInfo(&as.snapshot[accumulen], *((*it).second));
+}
+
 /* follow the most "internal" method for io_buf creation, called from the methods before  */
 uint32_t SniffJoke::appendSJStatus(uint8_t *p, int32_t WHO, uint32_t len, uint16_t value)
 {
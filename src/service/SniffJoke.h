@@ -26,12 +26,17 @@
 #include "Utils.h"
 #include "UserConf.h"
 #include "Process.h"
-#include "NetIO.h"
+#include "NetIOTun.h"
+#include "NetIOUring.h"
+#include "NetIONfqueue.h"
 #include "TCPTrack.h"
 #include "TTLFocus.h"
 #include "SessionTrack.h"
 #include "OptionPool.h"
 #include "PluginPool.h"
+#include "PacketTrace.h"
+#include "TimerWheel.h"
+#include "StatsSegment.h"
 #include "config.h"
 
 class SniffJoke
@@ -42,12 +47,29 @@ public:
     ~SniffJoke(void);
     void run(void);
 
+    /* the stream admin clients, served by the main loop with non blocking I/O:
+     * one answer at time is kept for every client, and the paginated dumps
+     * are served from a per client snapshot of the map */
+    struct admin_stream
+    {
+        int fd;
+        vector<uint8_t> in;
+        vector<uint8_t> out;
+        uint32_t out_sent;
+        uint8_t snapshot_type;
+        vector<uint8_t> snapshot;
+    };
+
+    /* a page of the snapshot in the answer format, public for sniffjoke-check */
+    static void writeSJSnapshotPage(uint8_t *, uint32_t, struct admin_stream &, uint32_t);
+
 private:
     const sj_cmdline_opts &opts;
 
     auto_ptr<Process> proc;
     auto_ptr<NetIO> mitm;
     auto_ptr<TCPTrack> conntrack;
+    auto_ptr<StatsSegment> stats_segment;
 
     /* after detach:
      *     service_pid in the root process [the pid of the user process]
@@ -59,6 +81,9 @@ private:
     int admin_socket_flags_blocking;
     int admin_socket_flags_nonblocking;
 
+    int admin_stream_socket;
+    vector<struct admin_stream *> admin_streams;
+
     /* used to copy structs for command I/O */
     uint8_t io_buf[HUGEBUF * 4];
 
@@ -67,15 +92,23 @@ private:
 
     void updateClock(void);
     void setupDebug(void);
+    void setupPacketTrace(void);
     void cleanDebug(void);
     void cleanServerRoot(void);
     void cleanServerUser(void);
     void setupAdminSocket(void);
     void handleAdminSocket(void);
+    void setupAdminStream(void);
+    void handleAdminStream(void);
+    bool readAdminStream(struct admin_stream &);
+    bool writeAdminStream(struct admin_stream &);
+    void handleDelayedCmd(void);
     void createSjEnvironment(void);
+    void publishStats(void);
 
     /* internalProtocol handling */
     uint8_t* handleCmd(const char *);
+    uint8_t* handleStreamCmd(struct admin_stream &, const char *);
 
     /* single command management */
     void handleCmdStart(void);
@@ -85,6 +118,8 @@ private:
     void handleCmdStat(void);
     void handleCmdInfo(void);
     void handleCmdTTL(void);
+    void handleCmdPluginStat(void);
+    void handleCmdLatency(void);
     void handleCmdShowport(void);
     void handleCmdSet(const char *);
     void handleCmdDebuglevel(uint8_t);
@@ -94,6 +129,8 @@ private:
     void writeSJPortStat(uint8_t);
     void writeSJInfoDump(uint8_t);
     void writeSJTTLmap(uint8_t);
+    void writeSJPluginStat(uint8_t);
+    void writeSJLatency(uint8_t);
     void writeSJProtoError(void);
 
     /* called by writeSJ* functions = answer building */
@@ -103,6 +140,8 @@ private:
     uint32_t appendSJPortBlock(uint8_t *, uint16_t, uint16_t, uint16_t);
     uint32_t appendSJSessionInfo(uint8_t *, const SessionTrack &);
     uint32_t appendSJTTLInfo(uint8_t *, const TTLFocus &);
+    void takeSJSessionSnapshot(struct admin_stream &);
+    void takeSJTTLSnapshot(struct admin_stream &);
 };
 
 #endif /* SJ_SNIFFJOKE_H */
@@ -0,0 +1,84 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StatsSegment.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+StatsSegment::StatsSegment(void) :
+segment(NULL)
+{
+    int fd;
+
+    /* readable by everybody, like the output of sniffjokectl stat */
+    if ((fd = shm_open(SJ_STATS_SHM, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+        RUNTIME_EXCEPTION("unable to create the statistics segment %s: %s", SJ_STATS_SHM, strerror(errno));
+
+    /* the umask could have removed the read permission */
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if (ftruncate(fd, sizeof (struct sj_stats_segment)) == -1)
+    {
+        close(fd);
+        RUNTIME_EXCEPTION("unable to size the statistics segment %s: %s", SJ_STATS_SHM, strerror(errno));
+    }
+
+    void *map = mmap(NULL, sizeof (struct sj_stats_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        RUNTIME_EXCEPTION("unable to map the statistics segment %s: %s", SJ_STATS_SHM, strerror(errno));
+
+    segment = (struct sj_stats_segment *) map;
+    memset(segment, 0, sizeof (struct sj_stats_segment));
+    segment->version = SJ_STATS_VERSION;
+
+    /* the magic is written last: a reader seeing it will find a consistent segment */
+    __sync_synchronize();
+    segment->magic = SJ_STATS_MAGIC;
+
+    LOG_VERBOSE("live statistics published in the shared memory segment %s", SJ_STATS_SHM);
+}
+
+StatsSegment::~StatsSegment(void)
+{
+    if (segment != NULL)
+        munmap(segment, sizeof (struct sj_stats_segment));
+}
+
+void StatsSegment::publish(const struct sj_stats &stats)
+{
+    /* an odd sequence number marks an update in progress */
+    ++segment->seq;
+    __sync_synchronize();
+
+    memcpy((void *) &segment->stats, &stats, sizeof (stats));
+
+    __sync_synchronize();
+    ++segment->seq;
+}
+
+void StatsSegment::unlink(void)
+{
+    shm_unlink(SJ_STATS_SHM);
+}
@@ -0,0 +1,53 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_STATSSEGMENT_H
+#define SJ_STATSSEGMENT_H
+
+#include "Utils.h"
+#include "internalProtocol.h"
+
+/*
+ * the live statistics are published in a shared memory segment, so
+ * "sniffjokectl top" could read them at any frequency without passing
+ * by the admin socket served in the packet processing loop.
+ *
+ * the segment is created by the user process before the chroot, when
+ * /dev/shm is still reachable and the privileges are not dropped, and it's
+ * removed by the root process at the shutdown.
+ */
+class StatsSegment
+{
+private:
+    struct sj_stats_segment *segment;
+
+public:
+    StatsSegment(void);
+    ~StatsSegment(void);
+
+    /* seqlock writer: the service is the only one */
+    void publish(const struct sj_stats &);
+
+    static void unlink(void);
+};
+
+#endif /* SJ_STATSSEGMENT_H */
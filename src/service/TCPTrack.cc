@@ -27,16 +27,22 @@
 #include "SessionTrack.h"
 #include "TTLFocus.h"
 #include "PluginPool.h"
+#include "OptionPool.h"
 
 extern auto_ptr<UserConf> userconf;
 extern auto_ptr<SessionTrackMap> sessiontrack_map;
 extern auto_ptr<TTLFocusMap> ttlfocus_map;
 extern auto_ptr<PluginPool> plugin_pool;
+extern auto_ptr<OptionPool> opt_pool;
 
-TCPTrack::TCPTrack()
+TCPTrack::TCPTrack() :
+probe_budget(0),
+probe_budget_clock(0)
 {
     LOG_DEBUG("");
 
+    memset(&stats, 0, sizeof (stats));
+
     mangled_proto_mask = ICMP;
 
     if (!userconf->runcfg.no_tcp)
@@ -185,6 +191,34 @@ uint16_t TCPTrack::getUserFrequency(const Packet &pkt)
     return AGG_COMMON;
 }
 
+/*
+ * a flow is finished when no hack can be applied to its next packets: the
+ * percentage is 0 forever for a port configured NONE, or HANDSHAKE after the
+ * first packets, and no plugin bypasses it (AGG_ALWAYS, --only-plugin). the
+ * UDP frequency is never lower than COMMON, so only TCP flows finish.
+ *
+ * an offloaded flow loses the ttl and options mystification of lastPktFix
+ * too: without hacks there is nothing left to confuse its packets with.
+ */
+bool TCPTrack::flowFinished(const SessionTrack &sessiontrack, const Packet &pkt)
+{
+    if (pkt.proto != TCP || userconf->runcfg.onlyplugin[0])
+        return false;
+
+    const uint16_t userFrequency = getUserFrequency(pkt);
+
+    if (!(userFrequency & AGG_NONE) && !((userFrequency & AGG_HANDSHAKE) && sessiontrack.packet_number >= 4))
+        return false;
+
+    for (vector<PluginTrack*>::iterator it = plugin_pool->pool.begin(); it != plugin_pool->pool.end(); ++it)
+    {
+        if ((*it)->selfObj->pluginFrequency & AGG_ALWAYS)
+            return false;
+    }
+
+    return true;
+}
+
 uint8_t TCPTrack::discernAvailScramble(const Packet &pkt)
 {
     /*
@@ -201,6 +235,47 @@ uint8_t TCPTrack::discernAvailScramble(const Packet &pkt)
     return retval;
 }
 
+/*
+ * the ttl search costs up to max-ttl-probe probes and keeps the TCP packets
+ * of the destination waiting: it is started only where the estimate is used.
+ *
+ *  - the TTL scramble (PRESCRIPTION and the ttl mystification) is enabled;
+ *  - the port aggressivity still permits hacks in this flow: never for a
+ *    port configured NONE, or for a HANDSHAKE one after the first packets;
+ *  - a SYN is admitted at once, its SYN/ACK gives the passive estimate; any
+ *    other packet when its flow has reached TTLADMIT_PACKETS and the probe
+ *    budget of this second is not exhausted.
+ *
+ * the packets of the destinations not admitted go to HACK with the scrambles
+ * not requiring the ttl, and the check is repeated at the next packet.
+ */
+void TCPTrack::admitTTLFocus(TTLFocus &ttlfocus, const Packet &pkt, uint32_t packet_number)
+{
+    const bool syn = (pkt.proto == TCP && pkt.tcp->syn && !pkt.tcp->ack);
+
+    if (ISSET_TTL(plugin_pool->enabledScrambles())
+            && derivePercentage(packet_number, getUserFrequency(pkt))
+            && (syn || (packet_number >= TTLADMIT_PACKETS && probeBudget())))
+    {
+        ttlfocus_map->admit(ttlfocus, pkt);
+        return;
+    }
+
+    ++stats.ttl_unadmitted;
+}
+
+/* the budget is refilled every second: the probes not sent wait the next one */
+uint32_t TCPTrack::probeBudget(void)
+{
+    if (probe_budget_clock != sj_clock)
+    {
+        probe_budget_clock = sj_clock;
+        probe_budget = TTLPROBE_BUDGET;
+    }
+
+    return probe_budget;
+}
+
 /*
  * this function is responsable of the ttl bruteforce stage used
  * to detect the hop distance between us and the remote peer.
@@ -218,13 +293,82 @@ uint8_t TCPTrack::discernAvailScramble(const Packet &pkt)
  *  - tcp->seq ..... same reason of ip->id, but used for check the SYN+ACK
  *                   having this univoke random seq as +1 in the ack_seq
  *
+ * the probes are not sent one per ttl and cycle: all of them are in flight
+ * at once, paced TTLPROBE_BURST for cycle, and the answers are matched by the
+ * markers above. the first SYN+ACK resolves the bruteforce in about one RTT,
+ * the following ones can only lower the estimate.
+ *
+ * a destination reached by a SYN starts PASSIVE: the SYN/ACK of the connection
+ * gives a PROVISIONAL estimate (see TTLFocus::passiveEstimate), confirmed by
+ * two probes only, ttl_estimate - 1 expected to expire and ttl_estimate
+ * expected to be answered. the bruteforce runs when the SYN/ACK is not seen
+ * in TTLPASSIVE_TIMEOUT or when the probes contradict the estimate.
+ *
+ * the same two probes revalidate a KNOWN estimate every TTLREVALIDATE_INTERVAL
+ * of use, or TTLREVALIDATE_DRIFT after the SYN/ACK ttl has changed: the status
+ * stays KNOWN, and only a disagreement restarts the bruteforce.
  */
-void TCPTrack::injectTTLProbe(TTLFocus &ttlfocus)
+void TCPTrack::sendTTLProbe(TTLFocus &ttlfocus, uint8_t ttl)
+{
+    Packet *injpkt = new Packet(ttlfocus.probe_dummy, sizeof (ttlfocus.probe_dummy));
+    injpkt->source = TRACEROUTE;
+    injpkt->wtf = INNOCENT;
+    injpkt->ip->id = htons((ttlfocus.rand_key % 64) + ttl);
+    injpkt->ip->ttl = ttl;
+    injpkt->tcp->seq = htonl(ttlfocus.rand_key + ttl);
+
+    injpkt->fixIPTCPSum();
+    p_queue.insert(*injpkt, SEND);
+
+    --probe_budget;
+    ++stats.ttl_probes;
+
+    injpkt->SELFLOG("TTL probe ttl|%u #sent|%u ttl_estimate|%u", ttl, ttlfocus.sent_probe, ttlfocus.ttl_estimate);
+}
+
+bool TCPTrack::sendCheckProbes(TTLFocus &ttlfocus)
 {
-    Packet *injpkt;
+    if (probeBudget() < 2)
+        return false;
+
+    if (ttlfocus.ttl_estimate > 1)
+        sendTTLProbe(ttlfocus, ttlfocus.ttl_estimate - 1);
+
+    sendTTLProbe(ttlfocus, ttlfocus.ttl_estimate);
+
+    /* sent_probe is the highest ttl used, as in the bruteforce */
+    ttlfocus.sent_probe = ttlfocus.ttl_estimate;
+    ttlfocus.probe_timeout = sj_clock + 2;
+
+    return true;
+}
 
+void TCPTrack::injectTTLProbe(TTLFocus &ttlfocus)
+{
     switch (ttlfocus.status)
     {
+    case TTL_PASSIVE:
+        /* the SYN/ACK has not been seen: the bruteforce is the fallback */
+        if (ttlfocus.probe_timeout < sj_clock)
+        {
+            ttlfocus.SELFLOG("no SYN/ACK in %u seconds: starting the ttl bruteforce", TTLPASSIVE_TIMEOUT);
+            ttlfocus.startBruteforce();
+        }
+        break;
+
+    case TTL_PROVISIONAL:
+        if (ttlfocus.sent_probe == 0)
+        {
+            sendCheckProbes(ttlfocus);
+        }
+        else if (ttlfocus.probe_timeout < sj_clock)
+        {
+            /* nothing has contradicted the estimate: it's the best we have */
+            ttlfocus.setKnown();
+            ttlfocus.SELFLOG("confirmation probes not answered: passive ttl_estimate|%u accepted", ttlfocus.ttl_estimate);
+        }
+        break;
+
     case TTL_UNKNOWN:
         ttlfocus.status = TTL_BRUTEFORCE;
         /* do not break, continue inside TTL_BRUTEFORCE */
@@ -248,44 +392,234 @@ void TCPTrack::injectTTLProbe(TTLFocus &ttlfocus)
         }
         else
         {
-            ++ttlfocus.sent_probe;
-            injpkt = new Packet(ttlfocus.probe_dummy, sizeof (ttlfocus.probe_dummy));
-            injpkt->source = TRACEROUTE;
-            injpkt->wtf = INNOCENT;
-            injpkt->ip->id = htons((ttlfocus.rand_key % 64) + ttlfocus.sent_probe);
-            injpkt->ip->ttl = ttlfocus.sent_probe;
-            injpkt->tcp->seq = htonl(ttlfocus.rand_key + ttlfocus.sent_probe);
-
-            injpkt->fixIPTCPSum();
-            p_queue.insert(*injpkt, SEND);
-
-            /* the next ttl probe schedule is forced in the next cycle */
-            ttlfocus.next_probe_time = sj_clock;
+            for (uint8_t burst = 0; burst < TTLPROBE_BURST && ttlfocus.sent_probe < userconf->runcfg.max_ttl_probe && probeBudget(); ++burst)
+            {
+                ++ttlfocus.sent_probe;
+                sendTTLProbe(ttlfocus, ttlfocus.sent_probe);
+            }
 
-            injpkt->SELFLOG("TTL_BRUTEFORCE #sent|%u ttl_estimate|%u",
-                            ttlfocus.sent_probe, ttlfocus.ttl_estimate);
+            /* the next burst, or the timeout check, is forced in the next cycle */
+            ttlfocus.next_probe_time = sj_clock;
             break;
         }
+    case TTL_UNADMITTED:
+        break;
     case TTL_KNOWN:
-        /* TODO: Handle the KNOWN status; find a way to detect network topology changes. */
+        if (!ttlfocus.revalidating)
+        {
+            if (sendCheckProbes(ttlfocus))
+                ttlfocus.revalidating = true;
+        }
+        else if (ttlfocus.probe_timeout < sj_clock)
+        {
+            /* no answer is not a disagreement: the estimate is kept */
+            ttlfocus.SELFLOG("revalidation probes not answered: ttl_estimate|%u kept", ttlfocus.ttl_estimate);
+            ttlfocus.setKnown();
+        }
         break;
     }
 }
 
 /*
- * verifies the need of ttl probes for active destinations
+ * the option discovery follows the ttl bruteforce: when the hop distance is
+ * KNOWN, every IP/TCP option enabled in iptcp-options.conf is tested toward
+ * the destination, one at time, with two copies of the ttl probe carrying it:
+ *
+ *  - the first with ttl_estimate - 1, expiring at the last hop before the
+ *    destination: the ICMP time exceeded says that the path does not drop it;
+ *  - the second with the original ttl: a SYN/ACK says the destination accepts it.
+ *
+ * a NOT_CORRUPT option works when is accepted, a corrupting one when reaches
+ * the last hop and is not accepted. the options not working are excluded by
+ * HDRoptions for this destination.
+ *
+ * the probes of an option use the port puppet_port + 1 + index and the seq
+ * rand_key + OPTPROBE_SEQ_BASE + index: the answers are recognized by them.
+ */
+bool TCPTrack::sendOptionProbe(TTLFocus &ttlfocus, uint8_t sjOptIndex)
+{
+    const IPTCPopt &oDesc = *(opt_pool->get(sjOptIndex));
+
+    if (oDesc.enabled == false || !(oDesc.availableUsage & (NOT_CORRUPT | ONESHOT | TWOSHOT)))
+        return false;
+
+    Packet *injpkt = new Packet(ttlfocus.probe_dummy, sizeof (ttlfocus.probe_dummy));
+
+    try
+    {
+        HDRoptions injector(oDesc.optProto == IPPROTO_IP ? IPOPTS_INJECTOR : TCPOPTS_INJECTOR, *injpkt, ttlfocus);
+
+        /* a NOT_CORRUPT injection achieves the goal also when nothing is injected */
+        if (!injector.injectSingleOpt(oDesc.availableUsage != NOT_CORRUPT, true, sjOptIndex) ||
+            injpkt->iphdrlen + injpkt->tcphdrlen == sizeof (ttlfocus.probe_dummy))
+        {
+            delete injpkt;
+            return false;
+        }
+    }
+    catch (exception &e)
+    {
+        LOG_DEBUG("option probe %s not possible: %s", oDesc.sjOptName, e.what());
+        delete injpkt;
+        return false;
+    }
+
+    injpkt->source = TRACEROUTE;
+    injpkt->wtf = INNOCENT;
+    injpkt->randomizeID();
+    injpkt->tcp->source = htons(ttlfocus.puppet_port + 1 + sjOptIndex);
+    injpkt->tcp->seq = htonl(ttlfocus.rand_key + OPTPROBE_SEQ_BASE + sjOptIndex);
+
+    /* a destination one hop away has not an hop before */
+    if (ttlfocus.ttl_estimate > 1)
+    {
+        Packet *reachpkt = new Packet(*injpkt);
+        reachpkt->source = TRACEROUTE;
+        reachpkt->wtf = INNOCENT;
+        reachpkt->ip->ttl = ttlfocus.ttl_estimate - 1;
+        reachpkt->fixIPTCPSum();
+        p_queue.insert(*reachpkt, SEND);
+
+        --probe_budget;
+        ++stats.ttl_probes;
+    }
+    else
+    {
+        ttlfocus.OptMap[sjOptIndex].reached = true;
+    }
+
+    injpkt->fixIPTCPSum();
+    p_queue.insert(*injpkt, SEND);
+
+    --probe_budget;
+    ++stats.ttl_probes;
+
+    injpkt->SELFLOG("OPTION PROBE %s ttl_estimate|%u", oDesc.sjOptName, ttlfocus.ttl_estimate);
+
+    return true;
+}
+
+void TCPTrack::injectOptionProbe(TTLFocus &ttlfocus)
+{
+    struct option_discovery &od = ttlfocus.OptMap[ttlfocus.opt_probe_index];
+
+    if (od.underTesting)
+    {
+        if (ttlfocus.opt_probe_timeout >= sj_clock)
+            return;
+
+        const IPTCPopt &oDesc = *(opt_pool->get(ttlfocus.opt_probe_index));
+
+        od.underTesting = false;
+        od.confirmed = true;
+        od.defaultWorking = (oDesc.availableUsage == NOT_CORRUPT) ? od.accepted : (od.reached && !od.accepted);
+
+        if (!od.defaultWorking)
+            ttlfocus.opt_unworking |= (1 << ttlfocus.opt_probe_index);
+
+        ttlfocus.SELFLOG("option %s reached|%u accepted|%u: %s", oDesc.sjOptName,
+                         od.reached, od.accepted, od.defaultWorking ? "WORKING" : "NOT WORKING");
+
+        ++ttlfocus.opt_probe_index;
+    }
+
+    /* the two copies of the next probe */
+    if (probeBudget() < 2)
+        return;
+
+    /* the options that can't be injected are confirmed without probes */
+    for (; ttlfocus.opt_probe_index < SUPPORTED_OPTIONS; ++ttlfocus.opt_probe_index)
+    {
+        struct option_discovery &next = ttlfocus.OptMap[ttlfocus.opt_probe_index];
+
+        if (sendOptionProbe(ttlfocus, ttlfocus.opt_probe_index))
+        {
+            next.underTesting = true;
+            ttlfocus.opt_probe_timeout = sj_clock + OPTPROBE_TIMEOUT;
+            return;
+        }
+
+        next.confirmed = true;
+        next.defaultWorking = false;
+        ttlfocus.opt_unworking |= (1 << ttlfocus.opt_probe_index);
+    }
+}
+
+/*
+ * the next event of a destination in the probe schedule: the time when the
+ * ttl or option search can progress. an event due too early is harmless, the
+ * destination is only rescheduled. with nothing to do no event is added,
+ * handleYoungPackets schedules again the destinations used.
+ */
+void TCPTrack::scheduleProbes(TTLFocus &ttlfocus)
+{
+    time_t when;
+
+    switch (ttlfocus.status)
+    {
+    case TTL_PASSIVE:
+        when = ttlfocus.probe_timeout + 1;
+        break;
+    case TTL_PROVISIONAL:
+        when = ttlfocus.sent_probe ? ttlfocus.probe_timeout + 1 : ttlfocus.next_probe_time;
+        break;
+    case TTL_UNKNOWN:
+    case TTL_BRUTEFORCE:
+        when = ttlfocus.next_probe_time;
+        if (ttlfocus.probe_timeout && ttlfocus.probe_timeout + 1 > when)
+            when = ttlfocus.probe_timeout + 1;
+        break;
+    case TTL_KNOWN:
+        when = ttlfocus.revalidating ? ttlfocus.probe_timeout + 1 : ttlfocus.next_probe_time;
+
+        /* the options are probed only when they are used */
+        if (ISSET_MALFORMED(plugin_pool->enabledScrambles()) && ttlfocus.opt_probe_index < SUPPORTED_OPTIONS)
+        {
+            const time_t optwhen = ttlfocus.OptMap[ttlfocus.opt_probe_index].underTesting ?
+                    ttlfocus.opt_probe_timeout + 1 : sj_clock;
+
+            if (optwhen < when)
+                when = optwhen;
+        }
+        break;
+    default:
+        return;
+    }
+
+    ttlfocus_map->schedule(ttlfocus, when);
+}
+
+/*
+ * runs the ttl and option probes of the destinations due: the events in the
+ * past are consumed before any is added, an event rescheduled at sj_clock
+ * (the next burst) is handled in the next cycle.
  */
 void TCPTrack::execTTLBruteforces(void)
 {
-    for (TTLFocusMap::iterator it = ttlfocus_map->begin(); it != ttlfocus_map->end(); ++it)
+    due_probes.clear();
+    ttlfocus_map->dueProbes(due_probes);
+
+    for (vector<TTLFocus *>::iterator it = due_probes.begin(); it != due_probes.end(); ++it)
     {
-        TTLFocus &ttlfocus = *((*it).second);
-        if ((ttlfocus.status != TTL_KNOWN) /* 1) the ttl is BRUTEFORCE or UNKNOWN */
-                && (ttlfocus.access_timestamp > (sj_clock - 30)) /* 2) the destination it's used in the last 30 seconds */
-                && (ttlfocus.next_probe_time <= sj_clock)) /* 3) the next probe time it's passed */
+        TTLFocus &ttlfocus = **it;
+
+        /* the destination not used in the last 30 seconds waits the next packet */
+        if (ttlfocus.access_timestamp <= (sj_clock - 30))
+            continue;
+
+        if ((ttlfocus.status != TTL_UNADMITTED) /* 1) the ttl is under search or revalidation */
+                && (ttlfocus.next_probe_time <= sj_clock)) /* 2) the next probe time it's passed */
+        {
+            injectTTLProbe(ttlfocus);
+        }
+
+        if (ttlfocus.status == TTL_KNOWN && ISSET_MALFORMED(plugin_pool->enabledScrambles())
+                && (ttlfocus.opt_probe_index < SUPPORTED_OPTIONS)) /* some option is not confirmed */
         {
-            injectTTLProbe(*(*it).second);
+            injectOptionProbe(ttlfocus);
         }
+
+        scheduleProbes(ttlfocus);
     }
 }
 
@@ -324,6 +658,17 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
 
         ttlfocus = it->second;
 
+        /* an option probe has reached the hop before the destination */
+        const uint32_t expired_opt = ntohl(badtcph->seq) - ttlfocus->rand_key - OPTPROBE_SEQ_BASE;
+        if (expired_opt < SUPPORTED_OPTIONS && ntohs(badtcph->source) == ttlfocus->puppet_port + 1 + expired_opt)
+        {
+            if (ttlfocus->OptMap[expired_opt].underTesting)
+                ttlfocus->OptMap[expired_opt].reached = true;
+
+            incompkt.SELFLOG("incoming ICMP EXPIRED for the option probe #%u", expired_opt);
+            return true;
+        }
+
         const uint8_t expired_ttl = ntohs(badiph->id) - (ttlfocus->rand_key % 64);
         const uint8_t exp_double_check = ntohl(badtcph->seq) - ttlfocus->rand_key;
 
@@ -355,6 +700,14 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
                     ttlfocus->ttl_estimate = expired_ttl + 1;
                 }
             }
+            else if ((ttlfocus->status == TTL_PROVISIONAL || ttlfocus->revalidating) && expired_ttl >= ttlfocus->ttl_estimate)
+            {
+                /* the destination is farther than estimated */
+                incompkt.SELFLOG("incoming ICMP EXPIRED puppet|%d expired|%d contradicts the ttl_estimate|%u",
+                                 ttlfocus->puppet_port, expired_ttl, ttlfocus->ttl_estimate);
+                ttlfocus->startBruteforce();
+                ttlfocus_map->schedule(*ttlfocus, sj_clock);
+            }
 
             /* the expired icmp scattered due to our ttl probes,
              * so we can trasparently remove it. */
@@ -368,9 +721,69 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
 
     ttlfocus = it->second;
 
+    /* the SYN ACK of an option probe: the destination has accepted the option */
+    if (incompkt.tcp->syn && incompkt.tcp->ack)
+    {
+        const uint32_t accepted_opt = ntohl(incompkt.tcp->ack_seq) - ttlfocus->rand_key - 1 - OPTPROBE_SEQ_BASE;
+        if (accepted_opt < SUPPORTED_OPTIONS && ntohs(incompkt.tcp->dest) == ttlfocus->puppet_port + 1 + accepted_opt)
+        {
+            if (ttlfocus->OptMap[accepted_opt].underTesting)
+            {
+                ttlfocus->OptMap[accepted_opt].reached = true;
+                ttlfocus->OptMap[accepted_opt].accepted = true;
+            }
+
+            incompkt.SELFLOG("incoming SYN/ACK for the option probe #%u", accepted_opt);
+            return true;
+        }
+    }
+
     /* a SYN ACK will be the answer at our probe! */
     if (incompkt.tcp->syn && incompkt.tcp->ack && (incompkt.tcp->dest == htons(ttlfocus->puppet_port)))
     {
+        if (ttlfocus->status == TTL_PROVISIONAL || ttlfocus->revalidating)
+        {
+            const uint8_t answered_ttl = ntohl(incompkt.tcp->ack_seq) - ttlfocus->rand_key - 1;
+
+            ++ttlfocus->received_probe;
+
+            if (answered_ttl == ttlfocus->ttl_estimate)
+            {
+                if (ttlfocus->status == TTL_PROVISIONAL)
+                    ttlfocus_map->learnPrefix(*ttlfocus);
+
+                ttlfocus->ttl_synack = incompkt.ip->ttl;
+                ttlfocus->setKnown();
+                ttlfocus_map->schedule(*ttlfocus, ttlfocus->next_probe_time);
+            }
+            else if (answered_ttl < ttlfocus->ttl_estimate)
+            {
+                /* the destination is nearer than estimated */
+                ttlfocus->startBruteforce();
+                ttlfocus_map->schedule(*ttlfocus, sj_clock);
+            }
+
+            incompkt.SELFLOG("incoming SYN/ACK puppet|%d ttl|%u checking the ttl_estimate|%u",
+                             ttlfocus->puppet_port, answered_ttl, ttlfocus->ttl_estimate);
+            return true;
+        }
+
+        if (ttlfocus->status == TTL_KNOWN && ttlfocus->sent_probe)
+        {
+            /* the probes were in flight together: a late answer can only lower the estimate */
+            const uint8_t late_ttl = ntohl(incompkt.tcp->ack_seq) - ttlfocus->rand_key - 1;
+
+            if (late_ttl && late_ttl <= ttlfocus->sent_probe && late_ttl < ttlfocus->ttl_estimate)
+            {
+                ttlfocus->ttl_estimate = late_ttl;
+                ttlfocus->ttl_synack = incompkt.ip->ttl;
+            }
+
+            incompkt.SELFLOG("incoming late SYN/ACK puppet|%d ttl|%u ttl_estimate|%d",
+                             ttlfocus->puppet_port, late_ttl, ttlfocus->ttl_estimate);
+            return true;
+        }
+
         if (ttlfocus->status != TTL_BRUTEFORCE)
         {
             incompkt.SELFLOG("incoming SYN/ACK weird: puppet port in a session outside ttl bruteforce");
@@ -389,6 +802,18 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
          */
         uint8_t discern_ttl = ntohl(incompkt.tcp->ack_seq) - ttlfocus->rand_key - 1;
 
+        /*
+         * a ttl not yet sent is the answer to a probe of before the bruteforce:
+         * when the check probes restart it, the answer to ttl_estimate can arrive
+         * after the nearer one, and it would be accepted one hop too far.
+         */
+        if (discern_ttl > ttlfocus->sent_probe)
+        {
+            incompkt.SELFLOG("incoming SYN/ACK puppet|%d ttl|%u not yet probed: ignored",
+                             ttlfocus->puppet_port, discern_ttl);
+            return true;
+        }
+
         ++ttlfocus->received_probe;
 
         if (discern_ttl < ttlfocus->ttl_estimate)
@@ -397,7 +822,8 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
             ttlfocus->ttl_synack = incompkt.ip->ttl;
         }
 
-        ttlfocus->status = TTL_KNOWN;
+        ttlfocus->setKnown();
+        ttlfocus_map->learnPrefix(*ttlfocus);
 
         incompkt.SELFLOG("incoming SYN/ACK puppet|%d ttl_estimate|%d ttl_synack|%d",
                          ttlfocus->puppet_port, ttlfocus->ttl_estimate, ttlfocus->ttl_synack);
@@ -408,12 +834,39 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
     }
     else
     {
-        if (ttlfocus->status == TTL_KNOWN && ttlfocus->ttl_synack != incompkt.ip->ttl)
+        /* the SYN/ACK of the connection that has created the destination */
+        if (ttlfocus->status == TTL_PASSIVE && incompkt.tcp->syn && incompkt.tcp->ack)
+        {
+            ttlfocus->ttl_synack = incompkt.ip->ttl;
+            ttlfocus->ttl_estimate = TTLFocus::passiveEstimate(incompkt.ip->ttl);
+            ttlfocus->status = TTL_PROVISIONAL;
+            ttlfocus->sent_probe = 0;
+            ttlfocus->next_probe_time = sj_clock;
+            ttlfocus_map->schedule(*ttlfocus, sj_clock);
+
+            incompkt.SELFLOG("incoming SYN/ACK ttl|%u: passive ttl_estimate|%u",
+                             ttlfocus->ttl_synack, ttlfocus->ttl_estimate);
+            return false;
+        }
+
+        /* an estimate inherited from the prefix: there is no drift until the host's own SYN/ACK */
+        if (ttlfocus->status == TTL_KNOWN && ttlfocus->ttl_synack == 0)
         {
+            if (incompkt.tcp->syn && incompkt.tcp->ack)
+                ttlfocus->ttl_synack = incompkt.ip->ttl;
+
+            return false;
+        }
 
-            /* probably a topology change has happened - we need a solution wtf!!  */
+        if (ttlfocus->status == TTL_KNOWN && ttlfocus->ttl_synack != incompkt.ip->ttl
+                && !ttlfocus->revalidating && ttlfocus->next_probe_time > sj_clock + TTLREVALIDATE_DRIFT)
+        {
+            /* probably a topology change has happened: the estimate is revalidated soon */
             incompkt.SELFLOG("probable net topology change! ttl_estimate|%u synack ttl|%u received_ttl|%u]",
                              ttlfocus->ttl_estimate, ttlfocus->ttl_synack, incompkt.ip->ttl);
+
+            ttlfocus->next_probe_time = sj_clock + TTLREVALIDATE_DRIFT;
+            ttlfocus_map->schedule(*ttlfocus, ttlfocus->next_probe_time);
         }
         return false;
     }
@@ -450,6 +903,8 @@ bool TCPTrack::notifyIncoming(Packet &origpkt)
 
             if (!injpkt.selfIntegrityCheck(pt->selfObj->pluginName))
             {
+                pt->stats.integrity_failures++;
+
                 LOG_ALL("%s: invalid pkt generated", pt->selfObj->pluginName);
                 injpkt.SELFLOG("%s: bad integrity", pt->selfObj->pluginName);
 
@@ -464,7 +919,14 @@ bool TCPTrack::notifyIncoming(Packet &origpkt)
 
             /* lastPktFix is called because the checksum will not be correct */
             if (!lastPktFix(injpkt))
+            {
+                pt->stats.fix_drops++;
                 continue;
+            }
+
+            pt->stats.injected_pkts++;
+            pt->stats.injected_bytes += injpkt.pbuf.size();
+            stats.injected[__builtin_ctz(injpkt.wtf)]++;
 
 #ifdef ENABLE_INCOMING_DEBUG
             injpkt.SELFLOG("%s: generated packet, the original (i%u) will be %s",
@@ -480,7 +942,10 @@ bool TCPTrack::notifyIncoming(Packet &origpkt)
         }
 
         if (pt->selfObj->removeOrigPkt == true)
+        {
+            pt->stats.orig_removals++;
             removeOrig = true;
+        }
 
         pt->selfObj->reset();
     }
@@ -541,7 +1006,16 @@ bool TCPTrack::injectHack(Packet &origpkt)
 
         bool applicable = true;
 
+        const uint64_t condition_start = sj_cycles();
         applicable &= pt->selfObj->condition(origpkt, availableScrambles);
+        const uint64_t condition_cycles = sj_cycles() - condition_start;
+
+        pt->stats.condition_calls++;
+        pt->stats.condition_cycles += condition_cycles;
+        histogramAdd(pt->stats.condition_hist, condition_cycles);
+        if (applicable)
+            pt->stats.condition_hits++;
+
         applicable &= percentage(sessiontrack.packet_number, pt->selfObj->pluginFrequency, getUserFrequency(origpkt));
 
         if (applicable)
@@ -563,7 +1037,13 @@ bool TCPTrack::injectHack(Packet &origpkt)
         origpkt.SELFLOG("from %d avail plugins, %d has been selected: applying plugin [%s]", 
                         plugin_pool->pool.size(), applicable_hacks.size(), pt->selfObj->pluginName);
 
+        const uint64_t apply_start = sj_cycles();
         pt->selfObj->apply(origpkt, availableScrambles);
+        const uint64_t apply_cycles = sj_cycles() - apply_start;
+
+        pt->stats.apply_calls++;
+        pt->stats.apply_cycles += apply_cycles;
+        histogramAdd(pt->stats.apply_hist, apply_cycles);
 
         for (vector<Packet*>::iterator hack_it = pt->selfObj->pktVector.begin(); hack_it < pt->selfObj->pktVector.end(); ++hack_it)
         {
@@ -574,6 +1054,8 @@ bool TCPTrack::injectHack(Packet &origpkt)
              */
             if (!injpkt.selfIntegrityCheck(pt->selfObj->pluginName))
             {
+                pt->stats.integrity_failures++;
+
                 injpkt.SELFLOG("%s: invalid pkt generated: bad integrity", pt->selfObj->pluginName);
 
                 /* if you are running with --debug 6, I suppose you are the developing the plugins */
@@ -587,9 +1069,14 @@ bool TCPTrack::injectHack(Packet &origpkt)
 
             if (!lastPktFix(injpkt))
             {
+                pt->stats.fix_drops++;
                 continue;
             }
 
+            pt->stats.injected_pkts++;
+            pt->stats.injected_bytes += injpkt.pbuf.size();
+            stats.injected[__builtin_ctz(injpkt.wtf)]++;
+
             /* setting for debug pourpose: sniffjokectl info will show this value */
             sessiontrack.injected_pktnumber++;
 
@@ -619,7 +1106,10 @@ bool TCPTrack::injectHack(Packet &origpkt)
         }
 
         if (pt->selfObj->removeOrigPkt == true)
+        {
+            pt->stats.orig_removals++;
             removeOrig = true;
+        }
 
         pt->selfObj->reset();
     }
@@ -865,11 +1355,19 @@ void TCPTrack::handleYoungPackets(void)
 
             if (packet_filter.match(*pkt))
             {
+                ++stats.filter_matches;
                 pkt->SELFLOG("removal requested by PacketFilter");
                 p_queue.drop(*pkt);
                 continue;
             }
 
+            if (sessiontrack_map->offloadedCopy(*pkt))
+            {
+                pkt->SELFLOG("removal of an offloaded flow packet, delivered by the kernel");
+                p_queue.drop(*pkt);
+                continue;
+            }
+
             /* here we notify each plugin of the arrival of a packet */
             if (notifyIncoming(*pkt))
             {
@@ -887,14 +1385,30 @@ void TCPTrack::handleYoungPackets(void)
             /* SniffJoke ATM does apply to TCP/UDP traffic only */
             if (pkt->proto & (TCP | UDP))
             {
-                ++(sessiontrack_map->get(*pkt).packet_number);
+                SessionTrack &sessiontrack = sessiontrack_map->get(*pkt);
+                TTLFocus &ttlfocus = ttlfocus_map->get(*pkt);
+
+                if (sessiontrack.finished)
+                    sessiontrack_map->reclaim(sessiontrack, *pkt);
+
+                ++sessiontrack.packet_number;
+
+                /* the packets following this one will be forwarded by the kernel */
+                if (userconf->runcfg.offload && !sessiontrack.finished && flowFinished(sessiontrack, *pkt))
+                    sessiontrack_map->offload(sessiontrack);
+
+                if (ttlfocus.status == TTL_UNADMITTED)
+                    admitTTLFocus(ttlfocus, *pkt, sessiontrack.packet_number);
+
+                if (!ttlfocus.probe_event)
+                    scheduleProbes(ttlfocus);
 
                 /*
                  * ATM we can put TCP only in KEEP status because
                  * due to the actual ttl bruteforce implementation a
                  * pure UDP flaw could go in starvation.
                  */
-                if (pkt->proto == TCP && ttlfocus_map->get(*pkt).status == TTL_BRUTEFORCE)
+                if (pkt->proto == TCP && ttlfocus.status == TTL_BRUTEFORCE)
                 {
                     p_queue.insert(*pkt, KEEP);
                 }
@@ -988,17 +1502,37 @@ void TCPTrack::handleHackPackets(void)
         p_queue.insert(*pkt, SEND);
 }
 
-/* the packet is added in the packet queue here to be analyzed in a second time */
-void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte)
+/*
+ * the packet is added in the packet queue here to be analyzed in a second time:
+ * the SjPacketId is returned, 0 when the packet is malformed and dropped
+ */
+uint32_t TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte, uint64_t ingress_ts)
 {
     try
     {
         Packet * const pkt = new Packet(buff, nbyte);
         pkt->source = source;
+        pkt->ingress_ts = ingress_ts;
+
+        if (source == TUNNEL)
+        {
+            stats.tunnel_rx_pkts++;
+            stats.tunnel_rx_bytes += nbyte;
+        }
+        else
+        {
+            stats.network_rx_pkts++;
+            stats.network_rx_bytes += nbyte;
+        }
+
         pkt->wtf = INNOCENT;
         pkt->choosableScramble = INNOCENT; /* on innocent pkts this variable is meaningless */
 
-        /* Sniffjoke does handle only TCP, UDP and ICMP */
+        /*
+         * Sniffjoke does handle only TCP, UDP and ICMP. the KernelPolicy keeps
+         * most of the excluded traffic out of the service, the lists are
+         * checked again for what it can't exclude (AF_XDP, no ipset).
+         */
         if (userconf->runcfg.active && (pkt->proto & mangled_proto_mask))
         {
             if (userconf->runcfg.use_blacklist)
@@ -1007,7 +1541,7 @@ void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte
                         userconf->runcfg.blacklist->isPresent(pkt->ip->saddr))
                 {
                     p_queue.insert(*pkt, SEND);
-                    return;
+                    return pkt->SjPacketId;
                 }
             }
             else if (userconf->runcfg.use_whitelist)
@@ -1016,22 +1550,26 @@ void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte
                         !userconf->runcfg.whitelist->isPresent(pkt->ip->saddr))
                 {
                     p_queue.insert(*pkt, SEND);
-                    return;
+                    return pkt->SjPacketId;
                 }
             }
 
             p_queue.insert(*pkt, YOUNG);
-            return;
+            return pkt->SjPacketId;
         }
 
         p_queue.insert(*pkt, SEND);
 
+        return pkt->SjPacketId;
     }
     catch (exception &e)
     {
         /* anomalous/malformed packets are flushed bypassing the queue */
+        stats.malformed++;
         LOG_ALL("malformed orig pkt dropped: %s", e.what());
     }
+
+    return 0;
 }
 
 /*
@@ -1051,6 +1589,20 @@ Packet * TCPTrack::readpacket(source_t destsource)
         if (pkt->source & mask)
         {
             p_queue.extract(*pkt);
+            p_queue.departure(*pkt);
+
+            /* the packets from the network are written in the tunnel */
+            if (destsource == NETWORK)
+            {
+                stats.tunnel_tx_pkts++;
+                stats.tunnel_tx_bytes += pkt->pbuf.size();
+            }
+            else
+            {
+                stats.network_tx_pkts++;
+                stats.network_tx_bytes += pkt->pbuf.size();
+            }
+
             return pkt;
         }
     }
@@ -1058,6 +1610,18 @@ Packet * TCPTrack::readpacket(source_t destsource)
     return NULL;
 }
 
+/* the counters not incremented in the packet path are read here */
+struct sj_stats &TCPTrack::getStats(void)
+{
+    stats.queue_depth[0] = p_queue.size(YOUNG);
+    stats.queue_depth[1] = p_queue.size(KEEP);
+    stats.queue_depth[2] = p_queue.size(HACK);
+    stats.queue_depth[3] = p_queue.size(SEND);
+    stats.drops = p_queue.dropped;
+
+    return stats;
+}
+
 void TCPTrack::analyzePacketQueue(void)
 {
     /* if all queues are empy we have nothing to do */
@@ -1070,8 +1634,12 @@ void TCPTrack::analyzePacketQueue(void)
 
 bypass_queue_analysis:
 
+    /* the flows finished in the cycle are offloaded with a single ctnetlink exchange */
+    stats.offloaded_flows += sessiontrack_map->flushOffloads();
+
     /*
-     * here we call sessiontrack_map and ttlfocus_map manage routines.
+     * here the timer wheel expires the unused sessions, ttlfocus, plugin
+     * caches and filters, then the manage routines check the memory thresholds.
      * it's fundamental to do this here after HACK last_packet_HACK()
      * and before ttl probes injections.
      * In fact the two routine, in case that their respective memory threshold
@@ -1081,6 +1649,8 @@ bypass_queue_analysis:
      * KEEP packets will scatter a new ttlfocus at the next.
      */
 
+    timer_wheel.advance(sj_clock);
+
     sessiontrack_map->manage();
     ttlfocus_map->manage();
 
@@ -43,13 +43,31 @@ private:
     PacketFilter packet_filter;
     PacketQueue p_queue;
 
+    /* the counters published in the live statistics segment */
+    struct sj_stats stats;
+
     uint32_t derivePercentage(uint32_t, uint16_t);
     bool percentage(uint32_t, uint16_t, uint16_t);
     uint16_t getUserFrequency(const Packet &);
+    bool flowFinished(const SessionTrack &, const Packet &);
     uint8_t discernAvailScramble(const Packet &);
 
+    /* ttl and option probes still sendable in the current second */
+    uint32_t probe_budget;
+    time_t probe_budget_clock;
+    uint32_t probeBudget(void);
+    void admitTTLFocus(TTLFocus &, const Packet &, uint32_t);
+
+    void sendTTLProbe(TTLFocus &, uint8_t);
+    bool sendCheckProbes(TTLFocus &);
     void injectTTLProbe(TTLFocus &);
+    bool sendOptionProbe(TTLFocus &, uint8_t);
+    void injectOptionProbe(TTLFocus &);
+    void scheduleProbes(TTLFocus &);
     void execTTLBruteforces(void);
+
+    /* the destinations due in the current cycle, kept to reuse the storage */
+    vector<TTLFocus *> due_probes;
     bool extractTTLinfo(const Packet &);
 
     bool notifyIncoming(Packet &);
@@ -65,9 +83,17 @@ public:
     TCPTrack(void);
     ~TCPTrack(void);
 
-    void writepacket(source_t, const unsigned char *, int);
+    uint32_t writepacket(source_t, const unsigned char *, int, uint64_t);
     Packet* readpacket(source_t);
     void analyzePacketQueue(void);
+
+    struct sj_stats &getStats(void);
+
+    /* residence time and forwarding latency, dumped by the "latency" command */
+    const struct latency_record *getLatency(void) const
+    {
+        return p_queue.latency;
+    };
 };
 
 #endif /* SJ_TCPTRACK_H */
@@ -21,23 +21,36 @@
  */
 
 #include "TTLFocus.h"
+#include "PacketTrace.h"
 
-TTLFocus::TTLFocus(const Packet &pkt) :
+#include <functional>
+
+TTLFocus::TTLFocus(const Packet &pkt, TTLFocusMap *owner) :
+owner(owner),
 access_timestamp(sj_clock),
 next_probe_time(sj_clock),
 probe_timeout(0),
-status(TTL_BRUTEFORCE),
+probe_event(0),
+status(TTL_UNADMITTED),
 rand_key(random()),
 puppet_port(0),
+revalidating(false),
 sent_probe(0),
 received_probe(0),
 daddr(pkt.ip->daddr),
 ttl_estimate(0xff),
-ttl_synack(0)
+ttl_synack(0),
+opt_probe_index(0),
+opt_probe_timeout(0),
+opt_unworking(0)
 {
+    memset(OptMap, 0, sizeof (OptMap));
+
     struct iphdr *newip = (struct iphdr *) probe_dummy;
     struct tcphdr *newtcp = (struct tcphdr *) (probe_dummy + sizeof (struct iphdr));
 
+    /* the bytes not copied are part of every probe: they must not be random */
+    memset(probe_dummy, 0, sizeof (probe_dummy));
     memcpy(newip, &pkt.pbuf[0], sizeof (struct iphdr) + 4); /* 4 byte for the two port TCP/UDP =) */
 
     newip->ihl = 5; /* 20 >> 4 */
@@ -61,19 +74,31 @@ ttl_synack(0)
     pkt.SELFLOG("This packet has made a new Session");
 }
 
-TTLFocus::TTLFocus(const struct ttlfocus_cache_record& cpy) :
+TTLFocus::TTLFocus(const struct ttlfocus_cache_record& cpy, TTLFocusMap *owner) :
+owner(owner),
 access_timestamp(cpy.access_timestamp),
 next_probe_time(sj_clock),
+probe_timeout(0),
+probe_event(0),
 status(TTL_KNOWN),
 rand_key(random()),
 puppet_port(0),
+revalidating(false),
 sent_probe(0),
 received_probe(0),
 daddr(cpy.daddr),
 ttl_estimate(cpy.ttl_estimate),
-ttl_synack(cpy.ttl_synack)
+ttl_synack(cpy.ttl_synack),
+opt_probe_index(0),
+opt_probe_timeout(0),
+opt_unworking(0)
 {
+    /* next_probe_time is sj_clock: a cached estimate is revalidated at the first use */
     memcpy(probe_dummy, cpy.probe_dummy, 40);
+    memset(OptMap, 0, sizeof (OptMap));
+
+    /* the puppet port is kept in the dummy, the option probes are derived from it */
+    puppet_port = ntohs(((struct tcphdr *) (probe_dummy + sizeof (struct iphdr)))->source);
 
     SELFLOG("Construct from cache record");
 }
@@ -83,6 +108,53 @@ TTLFocus::~TTLFocus(void)
     SELFLOG("");
 }
 
+time_t TTLFocus::expired(void)
+{
+    if (access_timestamp + TTLFOCUS_EXPIRYTIME >= sj_clock)
+        return access_timestamp + TTLFOCUS_EXPIRYTIME + 1;
+
+    owner->expire(*this);
+    return 0;
+}
+
+/*
+ * the initial ttl of the operating systems are 64, 128 or 255: the hop count is
+ * the distance from the first of them not lower than the received ttl, +1
+ * because ttl_estimate is the minimum ttl reaching the destination.
+ */
+uint8_t TTLFocus::passiveEstimate(uint8_t synack_ttl)
+{
+    const uint16_t initial_ttl = (synack_ttl <= 64) ? 64 : (synack_ttl <= 128) ? 128 : 255;
+
+    return initial_ttl - synack_ttl + 1;
+}
+
+void TTLFocus::startBruteforce(void)
+{
+    /*
+     * the probes are sent in bursts, so sent_probe doesn't filter the answers
+     * to the probes of before: with the key moved of 128 their ttl is beyond
+     * the bruteforce, as long as the estimates and max_ttl_probe are < 128
+     */
+    rand_key += 128;
+
+    status = TTL_BRUTEFORCE;
+    revalidating = false;
+    sent_probe = 0;
+    received_probe = 0;
+    ttl_estimate = 0xFF;
+    ttl_synack = 0;
+    probe_timeout = 0;
+    next_probe_time = sj_clock;
+}
+
+void TTLFocus::setKnown(void)
+{
+    status = TTL_KNOWN;
+    revalidating = false;
+    next_probe_time = sj_clock + TTLREVALIDATE_INTERVAL;
+}
+
 uint16_t TTLFocus::selectPuppetPort(uint16_t realport)
 {
     uint16_t puppet_port;
@@ -97,17 +169,9 @@ uint16_t TTLFocus::selectPuppetPort(uint16_t realport)
     return puppet_port;
 }
 
-void TTLFocus::selflog(const char *func, const char *format, ...) const
+void TTLFocus::selflogEmit(const char *func, const char *format, ...) const
 {
-    if (debug.level() == SUPPRESS_LEVEL)
-        return;
-
-    char loginfo[LARGEBUF];
     va_list arguments;
-    va_start(arguments, format);
-    vsnprintf(loginfo, sizeof (loginfo), format, arguments);
-    va_end(arguments);
-
     const char *status_name = "";
 
     switch (status)
@@ -119,29 +183,67 @@ void TTLFocus::selflog(const char *func, const char *format, ...) const
         break;
     case TTL_UNKNOWN: status_name = "UNKNOWN";
         break;
+    case TTL_PROVISIONAL: status_name = "PROVISIONAL";
+        break;
+    case TTL_PASSIVE: status_name = "PASSIVE";
+        break;
+    case TTL_UNADMITTED: status_name = "UNADMITTED";
+        break;
     default:
         RUNTIME_EXCEPTION("FATAL CODE [G0ATS3] please send a notification to the developers");
     }
 
+    /* as Packet::selflogEmit, the session log is deferred to its trace writer */
+    if (sesstrace.isRunning())
+    {
+        struct packet_trace *rec = sesstrace.reserve();
+        if (rec == NULL)
+            return;
+
+        rec->kind = TRACE_TTLFOCUS;
+        rec->clock = sj_clock;
+        rec->func = func;
+        rec->hdr.ttlfocus.status = status_name;
+        rec->hdr.ttlfocus.daddr = daddr;
+        rec->hdr.ttlfocus.sent_probe = sent_probe;
+        rec->hdr.ttlfocus.received_probe = received_probe;
+        rec->hdr.ttlfocus.ttl_estimate = ttl_estimate;
+        rec->hdr.ttlfocus.ttl_synack = ttl_synack;
+
+        va_start(arguments, format);
+        PacketTrace::capture(rec->msg, format, arguments);
+        va_end(arguments);
+
+        sesstrace.commit();
+        return;
+    }
+
+    char loginfo[LARGEBUF];
+    va_start(arguments, format);
+    vsnprintf(loginfo, sizeof (loginfo), format, arguments);
+    va_end(arguments);
+
     LOG_SESSION("%s daddr(%s) %s sent(%d) recv(%d) ttl_estimate(%u) ttl_synack(%u) %s",
                 func, inet_ntoa(*((struct in_addr *) &(daddr))), status_name, sent_probe,
                 received_probe, ttl_estimate, ttl_synack, loginfo
                 );
 }
 
-TTLFocusMap::TTLFocusMap(void) :
-manage_timeout(sj_clock)
+TTLFocusMap::TTLFocusMap(bool persistent) :
+persistent(persistent)
 {
     LOG_DEBUG("with reference time (seconds) %u", uint32_t(sj_clock));
 
-    load();
+    if (persistent)
+        load();
 }
 
 TTLFocusMap::~TTLFocusMap(void)
 {
     uint32_t counter = 0;
 
-    dump();
+    if (persistent)
+        dump();
 
     for (TTLFocusMap::iterator it = begin(); it != end();)
     {
@@ -167,27 +269,141 @@ TTLFocus& TTLFocusMap::get(const Packet &pkt)
         ttlfocus = &(*it->second);
 
     else /* on miss: create a new ttlfocus and insert it into the map */
-        ttlfocus = &(*insert(pair<uint32_t, TTLFocus*>(pkt.ip->daddr, new TTLFocus(pkt))).first->second);
+    {
+        ttlfocus = &(*insert(pair<uint32_t, TTLFocus*>(pkt.ip->daddr, new TTLFocus(pkt, this))).first->second);
+        timer_wheel.arm(*ttlfocus, sj_clock + TTLFOCUS_EXPIRYTIME + 1);
+    }
 
     /* update access timestamp using global clock */
     ttlfocus->access_timestamp = sj_clock;
     return *ttlfocus;
 }
 
-void TTLFocusMap::manage(void)
+void TTLFocusMap::admit(TTLFocus &ttlfocus, const Packet &pkt)
 {
-    /* timeout check */
-    if (manage_timeout < sj_clock - TTLFOCUSMAP_MANAGE_ROUTINE_TIMER)
+    ttlfocus.next_probe_time = sj_clock;
+
+    if (pkt.proto == TCP && pkt.tcp->syn && !pkt.tcp->ack)
     {
-        manage_timeout = sj_clock; /* update the next manage timeout */
-        for (TTLFocusMap::iterator it = begin(); it != end();)
-        {
-            if ((*it).second->access_timestamp + TTLFOCUS_EXPIRYTIME < sj_clock)
-                erase(it++);
-            else
-                ++it;
-        }
+        /* without the SYN/ACK of the connection the bruteforce will start */
+        ttlfocus.status = TTL_PASSIVE;
+        ttlfocus.probe_timeout = sj_clock + TTLPASSIVE_TIMEOUT;
+    }
+    else
+    {
+        ttlfocus.status = TTL_BRUTEFORCE;
+    }
+
+    inheritPrefix(ttlfocus);
+
+    pkt.SELFLOG("destination admitted to the ttl search");
+}
+
+void TTLFocusMap::schedule(TTLFocus &ttlfocus, time_t when)
+{
+    if (ttlfocus.probe_event && ttlfocus.probe_event <= when)
+        return;
+
+    ttlfocus.probe_event = when;
+
+    probe_events.push_back(pair<time_t, uint32_t>(when, ttlfocus.daddr));
+    push_heap(probe_events.begin(), probe_events.end(), greater< pair<time_t, uint32_t> >());
+}
+
+void TTLFocusMap::dueProbes(vector<TTLFocus *> &due)
+{
+    while (!probe_events.empty() && probe_events.front().first <= sj_clock)
+    {
+        const pair<time_t, uint32_t> event = probe_events.front();
+
+        pop_heap(probe_events.begin(), probe_events.end(), greater< pair<time_t, uint32_t> >());
+        probe_events.pop_back();
+
+        TTLFocusMap::iterator it = find(event.second);
+        if (it == end() || it->second->probe_event != event.first)
+            continue;
+
+        it->second->probe_event = 0;
+        due.push_back(it->second);
+    }
+}
+
+void TTLFocusMap::inheritPrefix(TTLFocus &ttlfocus)
+{
+    map<uint32_t, struct ttlprefix_model>::const_iterator it = prefixes.find(ntohl(ttlfocus.daddr) & TTLPREFIX_NETMASK);
+
+    if (it == prefixes.end() || it->second.inconsistent)
+        return;
+
+    const struct ttlprefix_model &model = it->second;
+
+    /* the SYN/ACK ttl depends by the host OS: only its own SYN/ACK sets it */
+    ttlfocus.ttl_estimate = model.ttl_estimate;
+    ttlfocus.ttl_synack = 0;
+    ttlfocus.sent_probe = 0;
+    ttlfocus.next_probe_time = sj_clock;
+
+    /* few agreeing destinations: the two confirmation probes are sent */
+    if (model.hosts >= TTLPREFIX_TRUSTED_HOSTS)
+        ttlfocus.setKnown();
+    else
+        ttlfocus.status = TTL_PROVISIONAL;
+
+    ttlfocus.SELFLOG("hop count inherited from the prefix, hosts|%u", model.hosts);
+}
+
+void TTLFocusMap::learnPrefix(const TTLFocus &ttlfocus)
+{
+    const uint32_t prefix = ntohl(ttlfocus.daddr) & TTLPREFIX_NETMASK;
+    map<uint32_t, struct ttlprefix_model>::iterator it = prefixes.find(prefix);
+
+    if (it == prefixes.end())
+    {
+        struct ttlprefix_model model;
+        model.ttl_estimate = ttlfocus.ttl_estimate;
+        model.hosts = 1;
+        model.inconsistent = false;
+
+        prefixes.insert(pair<uint32_t, struct ttlprefix_model>(prefix, model));
+        return;
+    }
+
+    struct ttlprefix_model &model = it->second;
+
+    if (model.inconsistent)
+        return;
+
+    if (model.ttl_estimate == ttlfocus.ttl_estimate)
+    {
+        if (model.hosts != 0xFFFF)
+            ++model.hosts;
+    }
+    else if (model.hosts == 1)
+    {
+        /* a single destination is not yet a model: the last one is taken */
+        model.ttl_estimate = ttlfocus.ttl_estimate;
     }
+    else
+    {
+        model.inconsistent = true;
+        ttlfocus.SELFLOG("disagrees with the prefix estimate|%u of %u hosts: prefix disabled",
+                         model.ttl_estimate, model.hosts);
+    }
+}
+
+/* called by the timer wheel: the destination is not used since TTLFOCUS_EXPIRYTIME */
+void TTLFocusMap::expire(TTLFocus &ttlfocus)
+{
+    erase(ttlfocus.daddr);
+    delete &ttlfocus;
+}
+
+/* the expiry is done by the timer wheel, here only the memory thresholds are checked */
+void TTLFocusMap::manage(void)
+{
+    /* the models are rebuilt by the next confirmations */
+    if (prefixes.size() > TTLPREFIX_MEMORY_THRESHOLD)
+        prefixes.clear();
 
     /* size check */
     uint32_t map_size = size();
@@ -246,8 +462,16 @@ void TTLFocusMap::load(void)
     while (fread(&tmp, sizeof (struct ttlfocus_cache_record), 1, loadstream) == 1)
     {
         ++records_num;
-        TTLFocus *ttlfocus = new TTLFocus(tmp);
-        insert(pair<uint32_t, TTLFocus*>(ttlfocus->daddr, ttlfocus));
+        TTLFocus *ttlfocus = new TTLFocus(tmp, this);
+        if (!insert(pair<uint32_t, TTLFocus*>(ttlfocus->daddr, ttlfocus)).second)
+        {
+            /* a duplicated record of a corrupted cache */
+            delete ttlfocus;
+            continue;
+        }
+
+        timer_wheel.arm(*ttlfocus, ttlfocus->access_timestamp + TTLFOCUS_EXPIRYTIME + 1);
+        learnPrefix(*ttlfocus);
     }
 
     fclose(loadstream);
@@ -25,34 +25,53 @@
 
 #include "Utils.h"
 #include "Packet.h"
+#include "TimerWheel.h"
 
 /* IT'S FUNDAMENTAL TO HAVE ALL THIS ENUMS VALUES AS POWERS OF TWO TO PERMIT OR MASKS */
 
+/*
+ * TTL_PASSIVE: a new destination reached by a SYN, the hop count will be
+ * estimated from the ttl of its SYN/ACK; TTL_PROVISIONAL: the estimate is
+ * under confirmation. in both the packets are not kept waiting.
+ * TTL_UNADMITTED: no search is done, see TCPTrack::admitTTLFocus.
+ */
 enum ttlsearch_t
 {
-    TTL_KNOWN = 1, TTL_BRUTEFORCE = 2, TTL_UNKNOWN = 4
+    TTL_KNOWN = 1, TTL_BRUTEFORCE = 2, TTL_UNKNOWN = 4, TTL_PROVISIONAL = 8, TTL_PASSIVE = 16,
+    TTL_UNADMITTED = 32
 };
 
 struct option_discovery
 {
-    bool underTesting;
-    bool confirmed;
-    bool defaultWorking;
+    bool underTesting; /* the probes are in flight */
+    bool confirmed; /* the test is completed */
+    bool defaultWorking; /* the option does on this path what iptcp-options.conf declares */
+    bool reached; /* ICMP time exceeded from the hop before the destination */
+    bool accepted; /* SYN/ACK from the destination */
 };
 
-class TTLFocus
+class TTLFocusMap;
+
+class TTLFocus : public TimerEntry
 {
+private:
+    TTLFocusMap *owner; /* NULL for the detached ttlfocus of the option tests, never armed */
+
 public:
     /* timing variables */
     time_t access_timestamp; /* access timestamp used to decretee expiry */
-    time_t next_probe_time; /* timeout value used for ttlprobe schedule */
+    time_t next_probe_time; /* timeout value used for ttlprobe schedule;
+                               on status KNOWN: the next revalidation */
     time_t probe_timeout;
+    time_t probe_event; /* time of the event in the probe schedule, 0 if none */
 
     /* status variables */
     ttlsearch_t status; /* status of the traceroute */
     uint8_t rand_key; /* random key used as try to discriminate traceroute packet */
     uint16_t puppet_port; /* random port used with the aim to not disturbe a session */
 
+    bool revalidating; /* a KNOWN estimate is under check */
+
     uint8_t sent_probe; /* number of sent probes */
     uint8_t received_probe; /* number of received probes */
 
@@ -65,26 +84,71 @@ public:
 
     /* per-dest tracking of which IP|TCP options will be effective or became dropped */
     struct option_discovery OptMap[SUPPORTED_OPTIONS];
+    uint8_t opt_probe_index; /* option under discovery, SUPPORTED_OPTIONS when all are confirmed */
+    time_t opt_probe_timeout;
+    uint32_t opt_unworking; /* (1 << sjOptIndex) for every option confirmed not working */
 
     unsigned char probe_dummy[40]; /* dummy ttlprobe packet generated from the packet
                                       that scattered the ttlfocus creation.
                                       the packet size is always 40 bytes long,
                                       (sizeof(struct iphdr) + sizeof(struct tcphdr)) */
 
-    TTLFocus(void);
-    TTLFocus(const Packet &pkt);
-    TTLFocus(const struct ttlfocus_cache_record &);
+    TTLFocus(const Packet &pkt, TTLFocusMap * = NULL);
+    TTLFocus(const struct ttlfocus_cache_record &, TTLFocusMap *);
     ~TTLFocus(void);
+
+    /* the access_timestamp is checked at the deadline, see TimerWheel */
+    time_t expired(void);
     uint16_t selectPuppetPort(uint16_t);
 
-    /* utilities */
-    void selflog(const char *func, const char *format, ...) const;
+    /* the hop count derived from the ttl of a SYN/ACK */
+    static uint8_t passiveEstimate(uint8_t);
+
+    /* forget the estimate and restart the active search */
+    void startBruteforce(void);
+
+    /* the estimate is confirmed: the next revalidation is scheduled */
+    void setKnown(void);
+
+    /* utilities: the level check is inlined in the caller, as in Packet */
+    __attribute__((always_inline)) void selflog(const char *func, const char *format, ...) const
+    {
+        if (debug.level() >= SESSION_LEVEL)
+            selflogEmit(func, format, __builtin_va_arg_pack());
+    }
+    void selflogEmit(const char *func, const char *format, ...) const;
+};
+
+/*
+ * the destinations of the same /24 (CDN nodes, cloud regions) are almost always
+ * at the same hop count: the confirmed estimates are aggregated per prefix and
+ * a new destination inherits them, PROVISIONAL while few destinations agree,
+ * KNOWN after TTLPREFIX_TRUSTED_HOSTS. a disagreement disables the prefix.
+ */
+struct ttlprefix_model
+{
+    uint8_t ttl_estimate; /* the hop count shared by the destinations */
+    uint16_t hosts; /* destinations confirmed with this estimate */
+    bool inconsistent; /* two destinations have disagreed: every new one is probed */
 };
 
 class TTLFocusMap : public map<const uint32_t, TTLFocus*>
 {
 private:
-    time_t manage_timeout;
+    /* keyed by the prefix in host byte order */
+    map<uint32_t, struct ttlprefix_model> prefixes;
+
+    /*
+     * min-heap of the probe events (time, daddr): only the destinations due
+     * are touched. an event is never removed, when it does not match the
+     * probe_event of its destination (rescheduled or deleted) is skipped.
+     */
+    vector< pair<time_t, uint32_t> > probe_events;
+
+    void inheritPrefix(TTLFocus &);
+
+    /* false when the cache file of the location is neither loaded nor dumped */
+    const bool persistent;
 
     struct ttlfocus_timestamp_comparison
     {
@@ -97,9 +161,22 @@ private:
     } ttlfocusTimestampComparison;
 
 public:
-    TTLFocusMap(void);
+    TTLFocusMap(bool persistent = true);
     ~TTLFocusMap(void);
     TTLFocus& get(const Packet &);
+    void expire(TTLFocus &);
+
+    /* the search of an UNADMITTED destination starts, from the given packet */
+    void admit(TTLFocus &, const Packet &);
+
+    /* an earlier event replaces the pending one, a later is ignored */
+    void schedule(TTLFocus &, time_t);
+
+    /* consumes the events due, appending their destinations to the vector */
+    void dueProbes(vector<TTLFocus *> &);
+
+    /* a confirmed estimate of a destination, added to the model of its prefix */
+    void learnPrefix(const TTLFocus &);
     void manage(void);
     void load(void);
     void dump(void);
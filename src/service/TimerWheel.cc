@@ -0,0 +1,208 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "TimerWheel.h"
+
+static void linkInit(struct timer_link &head)
+{
+    head.prev = head.next = &head;
+}
+
+static void linkRemove(struct timer_link &link)
+{
+    link.prev->next = link.next;
+    link.next->prev = link.prev;
+    link.prev = link.next = NULL;
+}
+
+static void linkAppend(struct timer_link &head, struct timer_link &link)
+{
+    link.prev = head.prev;
+    link.next = &head;
+    head.prev->next = &link;
+    head.prev = &link;
+}
+
+/* moves the whole list of src in the empty dst */
+static void linkSplice(struct timer_link &src, struct timer_link &dst)
+{
+    if (src.next == &src)
+    {
+        linkInit(dst);
+        return;
+    }
+
+    dst.next = src.next;
+    dst.prev = src.prev;
+    dst.next->prev = &dst;
+    dst.prev->next = &dst;
+    linkInit(src);
+}
+
+TimerEntry::TimerEntry(void) :
+deadline(0)
+{
+    prev = next = NULL;
+}
+
+/* a copy is never armed: the links belong to the original */
+TimerEntry::TimerEntry(const TimerEntry &) :
+timer_link(),
+deadline(0)
+{
+    prev = next = NULL;
+}
+
+TimerEntry::~TimerEntry(void)
+{
+    if (armed())
+        timer_wheel.disarm(*this);
+}
+
+TimerWheel::TimerWheel(void) :
+started(false),
+current(0),
+entries(0)
+{
+    for (uint8_t level = 0; level < TIMERWHEEL_LEVELS; ++level)
+        for (uint32_t slot = 0; slot < TIMERWHEEL_SLOTS; ++slot)
+            linkInit(slots[level][slot]);
+}
+
+/* the entries still armed are detached: their owners may be destroyed later */
+TimerWheel::~TimerWheel(void)
+{
+    for (uint8_t level = 0; level < TIMERWHEEL_LEVELS; ++level)
+        for (uint32_t slot = 0; slot < TIMERWHEEL_SLOTS; ++slot)
+            while (slots[level][slot].next != &slots[level][slot])
+                linkRemove(*slots[level][slot].next);
+
+    entries = 0;
+}
+
+void TimerWheel::hook(TimerEntry &entry)
+{
+    const time_t delta = entry.deadline - current;
+    time_t deadline = entry.deadline;
+    uint8_t level;
+
+    if (delta < 0)
+    {
+        /* in the past: expired in the next second */
+        linkAppend(slots[0][current & (TIMERWHEEL_SLOTS - 1)], entry);
+        return;
+    }
+
+    for (level = 0; level < TIMERWHEEL_LEVELS - 1; ++level)
+    {
+        if (delta < ((time_t) 1 << (TIMERWHEEL_BITS * (level + 1))))
+            break;
+    }
+
+    /* over the last wheel: the entry is anticipated and will be armed again */
+    if (delta >= ((time_t) 1 << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)))
+        deadline = current + ((time_t) 1 << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)) - 1;
+
+    linkAppend(slots[level][(deadline >> (TIMERWHEEL_BITS * level)) & (TIMERWHEEL_SLOTS - 1)], entry);
+}
+
+/* spreads a slot of the given level in the lower ones; returns its index */
+uint32_t TimerWheel::cascade(uint8_t level)
+{
+    const uint32_t index = (current >> (TIMERWHEEL_BITS * level)) & (TIMERWHEEL_SLOTS - 1);
+    struct timer_link moving;
+
+    linkSplice(slots[level][index], moving);
+
+    while (moving.next != &moving)
+    {
+        TimerEntry &entry = *static_cast<TimerEntry *> (moving.next);
+        linkRemove(entry);
+        hook(entry);
+    }
+
+    return index;
+}
+
+void TimerWheel::arm(TimerEntry &entry, time_t deadline)
+{
+    if (!started)
+    {
+        current = sj_clock;
+        started = true;
+    }
+
+    if (entry.armed())
+        linkRemove(entry);
+    else
+        ++entries;
+
+    entry.deadline = deadline;
+    hook(entry);
+}
+
+void TimerWheel::disarm(TimerEntry &entry)
+{
+    if (!entry.armed())
+        return;
+
+    linkRemove(entry);
+    --entries;
+}
+
+void TimerWheel::advance(time_t now)
+{
+    struct timer_link expiring;
+
+    if (!started || !entries)
+    {
+        current = now + 1;
+        started = true;
+        return;
+    }
+
+    while (current <= now)
+    {
+        const uint32_t index = current & (TIMERWHEEL_SLOTS - 1);
+
+        if (!index && !cascade(1) && !cascade(2))
+            cascade(3);
+
+        linkSplice(slots[0][index], expiring);
+
+        /* before the calls: a deadline armed again in the past goes in the next second */
+        ++current;
+
+        /* the entry is out of the wheel during the call: the owner can delete it */
+        while (expiring.next != &expiring)
+        {
+            TimerEntry &entry = *static_cast<TimerEntry *> (expiring.next);
+            linkRemove(entry);
+            --entries;
+
+            const time_t later = entry.expired();
+            if (later)
+                arm(entry, later);
+        }
+    }
+}
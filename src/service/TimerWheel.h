@@ -0,0 +1,107 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SJ_TIMERWHEEL_H
+#define SJ_TIMERWHEEL_H
+
+#include "Utils.h"
+
+/*
+ * the hierarchical timing wheel shared by all the expirations (sessions,
+ * ttlfocus, plugin caches, packet filters): TIMERWHEEL_LEVELS wheels of
+ * TIMERWHEEL_SLOTS slots, the first with the resolution of a second, every
+ * next one of a whole turn of the previous. an entry is hooked in the slot of
+ * its deadline; when a wheel completes a turn the next slot of the upper one
+ * is spread in the lower ones, so every entry is moved at most
+ * TIMERWHEEL_LEVELS times and no expiry scans a whole table.
+ *
+ * the owners refresh their entries lazily: at the deadline TimerEntry::expired
+ * returns a later one to stay armed, so the packet path updates a timestamp only.
+ */
+
+#define TIMERWHEEL_BITS         6
+#define TIMERWHEEL_SLOTS        (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_LEVELS       4       /* 64^4 seconds, the farther deadlines are anticipated */
+
+struct timer_link
+{
+    struct timer_link *prev;
+    struct timer_link *next;
+};
+
+class TimerEntry : private timer_link
+{
+    friend class TimerWheel;
+
+private:
+    time_t deadline;
+
+public:
+    TimerEntry(void);
+    TimerEntry(const TimerEntry &);
+    virtual ~TimerEntry(void);
+
+    bool armed(void) const
+    {
+        return next != NULL;
+    };
+
+    /*
+     * called at the deadline, when the entry is no more in the wheel:
+     * returns a later deadline to be armed again, or 0. in the latter case
+     * the owner is free to delete the entry inside the call.
+     */
+    virtual time_t expired(void) = 0;
+};
+
+class TimerWheel
+{
+private:
+    struct timer_link slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+
+    bool started;
+    time_t current; /* the next second to expire */
+    uint32_t entries;
+
+    void hook(TimerEntry &);
+    uint32_t cascade(uint8_t);
+
+public:
+    TimerWheel(void);
+    ~TimerWheel(void);
+
+    void arm(TimerEntry &, time_t);
+    void disarm(TimerEntry &);
+
+    /* expires the entries with a deadline up to the given time */
+    void advance(time_t);
+
+    uint32_t size(void) const
+    {
+        return entries;
+    };
+};
+
+extern TimerWheel timer_wheel;
+
+#endif /* SJ_TIMERWHEEL_H */
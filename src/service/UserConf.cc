@@ -130,6 +130,15 @@ cmdline_opts(cmdline_opts)
     if (runcfg.use_blacklist && runcfg.use_whitelist)
         RUNTIME_EXCEPTION("configuration conflict: both blacklist and whitelist seem to be enabled");
 
+    if (strcmp(runcfg.io_backend, "poll") && strcmp(runcfg.io_backend, "uring") &&
+            strcmp(runcfg.io_backend, "xdp") && strcmp(runcfg.io_backend, "xdp-generic") &&
+            strcmp(runcfg.io_backend, "nfqueue"))
+        RUNTIME_EXCEPTION("invalid io backend [%s]: poll, uring, xdp, xdp-generic and nfqueue are supported", runcfg.io_backend);
+
+    /* the AF_XDP program takes all the traffic of the gateway: the kernel can't forward the incoming half */
+    if (runcfg.offload && !strncmp(runcfg.io_backend, "xdp", 3))
+        RUNTIME_EXCEPTION("configuration conflict: offload is not supported with the %s io backend", runcfg.io_backend);
+
     if (runcfg.onlyplugin[0])
     {
         LOG_VERBOSE("plugin %s override the plugins settings in %s", runcfg.onlyplugin,
@@ -417,6 +426,8 @@ bool UserConf::loadDiskConfiguration(void)
     parseMatch(runcfg.onlyplugin, "only-plugin", loadstream, cmdline_opts.onlyplugin, DEFAULT_ONLYPLUGIN);
     parseMatch(runcfg.max_ttl_probe, "max-ttl-probe", loadstream, cmdline_opts.max_ttl_probe, DEFAULT_MAX_TTLPROBE);
     parseMatch(runcfg.gw_mac_str, "gw-mac-addr", loadstream, cmdline_opts.gw_mac_str, DEFAULT_GW_MAC_ADDR);
+    parseMatch(runcfg.io_backend, "io-backend", loadstream, cmdline_opts.io_backend, DEFAULT_IO_BACKEND);
+    parseMatch(runcfg.offload, "offload", loadstream, cmdline_opts.offload, DEFAULT_OFFLOAD);
 
     /* loading of IP lists, in future also the source IP address should be useful */
     if (runcfg.use_blacklist)
@@ -564,6 +575,8 @@ bool UserConf::syncDiskConfiguration(void)
     written += dumpIfPresent(out, "foreground", runcfg.go_foreground, DEFAULT_GO_FOREGROUND);
     written += dumpIfPresent(out, "debug", runcfg.debug_level, DEFAULT_DEBUG_LEVEL);
     written += dumpIfPresent(out, "max-ttl-probe", runcfg.max_ttl_probe, DEFAULT_MAX_TTLPROBE);
+    written += dumpIfPresent(out, "io-backend", runcfg.io_backend, DEFAULT_IO_BACKEND);
+    written += dumpIfPresent(out, "offload", runcfg.offload, DEFAULT_OFFLOAD);
 
     if (!syncPortsFiles() || !syncIPListsFiles())
     {
@@ -57,6 +57,8 @@ struct sj_cmdline_opts
     char onlyplugin[MEDIUMBUF];
     uint16_t max_ttl_probe;
     char gw_mac_str[SMALLBUF];
+    char io_backend[MEDIUMBUF];
+    bool offload;
     /* END OF COMMON PART WITH sj_config THAT WILL BE SAVED IN CONF FILE */
 
     bool force_restart;
@@ -91,6 +93,8 @@ struct sj_config
     char onlyplugin[MEDIUMBUF];
     uint16_t max_ttl_probe;
     char gw_mac_str[SMALLBUF];
+    char io_backend[MEDIUMBUF];
+    bool offload;
     /* END OF COMMON PART WITH sj_cmdline_opts THAT WILL BE SAVED IN CONF FILE */
 
     /* mangling policies */
@@ -67,8 +67,15 @@ string execOSCmd(string cmd)
     return data;
 }
 
-void init_random()
+/* a seed makes the random sequence repeatable, 0 means seeded by the clock */
+void init_random(uint32_t seed)
 {
+    if (seed)
+    {
+        srandom(seed);
+        return;
+    }
+
     /* random pool initialization */
     srandom(time(NULL));
     for (uint8_t i = 0; i < ((uint8_t) random() % 10); ++i)
@@ -42,6 +42,7 @@
 #include <algorithm>
 #include <map>
 #include <memory>
+#include <list>
 #include <set>
 #include <vector>
 
@@ -73,13 +74,43 @@ extern char sj_clock_str[MEDIUMBUF];
 std::runtime_error runtime_exception(const char *, const char *, ...);
 
 string execOSCmd(string cmd);
-void init_random(void);
+void init_random(uint32_t seed = 0);
 void* memset_random(void *, size_t);
 int snprintfScramblesList(char *str, size_t size, uint8_t scramblesList);
 bool random_percent(int32_t percent);
 
 #define SELFLOG(...) selflog(__func__, __VA_ARGS__)
 
+/* cheap timestamp used by the performance counters: TSC cycles on x86, nanoseconds elsewhere */
+inline uint64_t sj_cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* timestamp used by the residence time instrumentation */
+inline uint64_t sj_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+inline void histogramAdd(uint32_t *histogram, uint64_t value)
+{
+    uint32_t bucket = 0;
+
+    while ((value >>= 1) && bucket < HISTOGRAM_BUCKETS - 1)
+        ++bucket;
+
+    ++histogram[bucket];
+}
+
 /* #define RUNTIME_EXCEPTION(...) throw runtime_exception(__func__, __FILE__, __LINE__, __VA_ARGS__) */
 #define RUNTIME_EXCEPTION(...) throw runtime_exception(__func__, __VA_ARGS__)
 
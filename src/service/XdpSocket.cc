@@ -0,0 +1,469 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "XdpSocket.h"
+
+#include <cstddef>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+
+static int sysBPF(int cmd, union bpf_attr &attr)
+{
+    return syscall(__NR_bpf, cmd, &attr, sizeof (attr));
+}
+
+static struct bpf_insn bpfInsn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    struct bpf_insn insn;
+
+    memset(&insn, 0x00, sizeof (insn));
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+
+    return insn;
+}
+
+XdpSocket::XdpSocket(const char *ifname, const char *gw_mac, bool generic) :
+xskfd(-1),
+progfd(-1),
+mapfd(-1),
+linkfd(-1),
+umem(NULL)
+{
+    struct ifreq tmpifr;
+    int tmpfd;
+    uint32_t queues = 0;
+
+    const uint32_t ifindex = if_nametoindex(ifname);
+    if (!ifindex)
+        RUNTIME_EXCEPTION("unable to find the interface %s: %s", ifname, strerror(errno));
+
+    memset(&tmpifr, 0x00, sizeof (tmpifr));
+    strncpy(tmpifr.ifr_name, ifname, sizeof (tmpifr.ifr_name) - 1);
+
+    tmpfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+
+    if (ioctl(tmpfd, SIOCGIFHWADDR, &tmpifr) == -1)
+    {
+        close(tmpfd);
+        RUNTIME_EXCEPTION("unable to get the mac address of %s (SIOCGIFHWADDR): %s", ifname, strerror(errno));
+    }
+
+    memcpy(&eth_header[0], gw_mac, ETH_ALEN);
+    memcpy(&eth_header[ETH_ALEN], tmpifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    *(uint16_t *) &eth_header[2 * ETH_ALEN] = htons(ETH_P_IP);
+
+    if (ioctl(tmpfd, SIOCGIFMTU, &tmpifr) == -1)
+    {
+        close(tmpfd);
+        RUNTIME_EXCEPTION("unable to get the mtu of %s (SIOCGIFMTU): %s", ifname, strerror(errno));
+    }
+
+    close(tmpfd);
+
+    if (tmpifr.ifr_mtu + ETH_HLEN > XDP_FRAME_SIZE - XDP_PACKET_HEADROOM)
+        RUNTIME_EXCEPTION("the mtu %d of %s is too large for the AF_XDP frames of %u bytes", tmpifr.ifr_mtu, ifname, XDP_FRAME_SIZE);
+
+    /* only the queue XDP_QUEUE_ID is bound: the gateway packets received by the others would be lost */
+    char queuesdir[MEDIUMBUF];
+    snprintf(queuesdir, sizeof (queuesdir), "/sys/class/net/%s/queues", ifname);
+
+    DIR *dir = opendir(queuesdir);
+    if (dir != NULL)
+    {
+        for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+        {
+            if (!strncmp(entry->d_name, "rx-", 3))
+                ++queues;
+        }
+        closedir(dir);
+    }
+
+    if (queues > 1)
+        LOG_ALL("warning: %s has %u rx queues, AF_XDP uses only the queue %u: reduce them with \"ethtool -L %s combined 1\"",
+                ifname, queues, XDP_QUEUE_ID, ifname);
+
+    if ((xskfd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) != -1)
+        LOG_DEBUG("AF_XDP socket opened successfully");
+    else
+        RUNTIME_EXCEPTION("unable to open an AF_XDP socket: %s", strerror(errno));
+
+    setupUMEM();
+    setupProgram(gw_mac);
+    attachProgram(ifindex, generic);
+
+    union bpf_attr attr;
+    const uint32_t key = XDP_QUEUE_ID;
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.map_fd = mapfd;
+    attr.key = (uint64_t) (unsigned long) &key;
+    attr.value = (uint64_t) (unsigned long) &xskfd;
+    attr.flags = BPF_ANY;
+
+    if (sysBPF(BPF_MAP_UPDATE_ELEM, attr) == -1)
+        RUNTIME_EXCEPTION("unable to register the AF_XDP socket in the XDP program: %s", strerror(errno));
+
+    LOG_ALL("AF_XDP datalink ready on %s queue %u", ifname, XDP_QUEUE_ID);
+}
+
+XdpSocket::~XdpSocket(void)
+{
+    if (fill.map != NULL)
+        munmap(fill.map, fill.maplen);
+    if (comp.map != NULL)
+        munmap(comp.map, comp.maplen);
+    if (rx.map != NULL)
+        munmap(rx.map, rx.maplen);
+    if (tx.map != NULL)
+        munmap(tx.map, tx.maplen);
+
+    if (linkfd != -1)
+        close(linkfd);
+    if (progfd != -1)
+        close(progfd);
+    if (mapfd != -1)
+        close(mapfd);
+    if (xskfd != -1)
+        close(xskfd);
+
+    if (umem != NULL)
+        munmap(umem, XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+}
+
+void XdpSocket::mapRing(struct xdp_ring &ring, const struct xdp_ring_offset &off, off_t pgoff, size_t descsize)
+{
+    ring.maplen = off.desc + XDP_RING_SIZE * descsize;
+    ring.map = mmap(NULL, ring.maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xskfd, pgoff);
+
+    if (ring.map == MAP_FAILED)
+    {
+        ring.map = NULL;
+        RUNTIME_EXCEPTION("unable to map an AF_XDP ring: %s", strerror(errno));
+    }
+
+    ring.producer = (volatile uint32_t *) ((unsigned char *) ring.map + off.producer);
+    ring.consumer = (volatile uint32_t *) ((unsigned char *) ring.map + off.consumer);
+    ring.flags = (volatile uint32_t *) ((unsigned char *) ring.map + off.flags);
+    ring.descs = (unsigned char *) ring.map + off.desc;
+}
+
+void XdpSocket::setupUMEM(void)
+{
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    socklen_t offlen = sizeof (off);
+    int ringsize = XDP_RING_SIZE;
+
+    memset(&fill, 0x00, sizeof (fill));
+    memset(&comp, 0x00, sizeof (comp));
+    memset(&rx, 0x00, sizeof (rx));
+    memset(&tx, 0x00, sizeof (tx));
+
+    /* shared: a private mapping would be copied on write, leaving the kernel the pinned pages */
+    umem = (unsigned char *) mmap(NULL, XDP_NUM_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED)
+    {
+        umem = NULL;
+        RUNTIME_EXCEPTION("unable to allocate the AF_XDP UMEM: %s", strerror(errno));
+    }
+
+    memset(&reg, 0x00, sizeof (reg));
+    reg.addr = (uint64_t) (unsigned long) umem;
+    reg.len = XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    reg.headroom = 0;
+
+    if (setsockopt(xskfd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof (reg)) == -1)
+        RUNTIME_EXCEPTION("unable to register the AF_XDP UMEM: %s", strerror(errno));
+
+    if (setsockopt(xskfd, SOL_XDP, XDP_UMEM_FILL_RING, &ringsize, sizeof (ringsize)) == -1 ||
+            setsockopt(xskfd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringsize, sizeof (ringsize)) == -1 ||
+            setsockopt(xskfd, SOL_XDP, XDP_RX_RING, &ringsize, sizeof (ringsize)) == -1 ||
+            setsockopt(xskfd, SOL_XDP, XDP_TX_RING, &ringsize, sizeof (ringsize)) == -1)
+        RUNTIME_EXCEPTION("unable to size the AF_XDP rings: %s", strerror(errno));
+
+    if (getsockopt(xskfd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offlen) == -1)
+        RUNTIME_EXCEPTION("unable to get the AF_XDP ring offsets: %s", strerror(errno));
+
+    mapRing(fill, off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof (uint64_t));
+    mapRing(comp, off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof (uint64_t));
+    mapRing(rx, off.rx, XDP_PGOFF_RX_RING, sizeof (struct xdp_desc));
+    mapRing(tx, off.tx, XDP_PGOFF_TX_RING, sizeof (struct xdp_desc));
+
+    /* the receiving half of the frames is given to the kernel */
+    for (uint32_t i = 0; i < XDP_RING_SIZE; ++i)
+        ((uint64_t *) fill.descs)[i] = (uint64_t) i * XDP_FRAME_SIZE;
+
+    fill.cached = XDP_RING_SIZE;
+    __sync_synchronize();
+    *fill.producer = fill.cached;
+
+    tx_frames.reserve(XDP_NUM_FRAMES - XDP_RING_SIZE);
+    for (uint32_t i = XDP_RING_SIZE; i < XDP_NUM_FRAMES; ++i)
+        tx_frames.push_back((uint64_t) i * XDP_FRAME_SIZE);
+
+    rx_done.reserve(XDP_RING_SIZE);
+
+    comp.cached = *comp.consumer;
+    rx.cached = *rx.consumer;
+    tx.cached = *tx.producer;
+}
+
+/*
+ * the XDP program, in a C equivalent:
+ *
+ *   if (data + ETH_HLEN > data_end || eth->h_proto != htons(ETH_P_IP) ||
+ *       memcmp(eth->h_source, gw_mac, ETH_ALEN))
+ *       return XDP_PASS;
+ *
+ *   return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+ *
+ * it is assembled here to avoid a dependency from libbpf and clang.
+ */
+void XdpSocket::setupProgram(const char *gw_mac)
+{
+    union bpf_attr attr;
+    uint32_t mac_hi;
+    uint16_t mac_lo;
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof (uint32_t);
+    attr.value_size = sizeof (uint32_t);
+    attr.max_entries = XDP_QUEUE_ID + 1;
+
+    if ((mapfd = sysBPF(BPF_MAP_CREATE, attr)) == -1)
+        RUNTIME_EXCEPTION("unable to create the XSKMAP: %s", strerror(errno));
+
+    /* the packet loads are in host byte order, as the comparison values */
+    memcpy(&mac_hi, &gw_mac[0], sizeof (mac_hi));
+    memcpy(&mac_lo, &gw_mac[sizeof (mac_hi)], sizeof (mac_lo));
+
+    const uint8_t pass = 20; /* index of the XDP_PASS exit */
+    const struct bpf_insn prog[] = {
+        bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0),
+        bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0),
+        bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        bpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, ETH_HLEN),
+        bpfInsn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, pass - 6, 0),
+        bpfInsn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 2 * ETH_ALEN, 0),
+        bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass - 8, htons(ETH_P_IP)),
+        bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, ETH_ALEN, 0),
+        bpfInsn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_4, 0, 0, (int32_t) mac_hi),
+        bpfInsn(0, 0, 0, 0, 0),
+        bpfInsn(BPF_JMP | BPF_JNE | BPF_X, BPF_REG_5, BPF_REG_4, pass - 12, 0),
+        bpfInsn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, ETH_ALEN + sizeof (mac_hi), 0),
+        bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass - 14, mac_lo),
+        bpfInsn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),
+        bpfInsn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, mapfd),
+        bpfInsn(0, 0, 0, 0, 0),
+        bpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+        bpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        bpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        bpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        bpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof (prog) / sizeof (prog[0]);
+    attr.insns = (uint64_t) (unsigned long) prog;
+    attr.license = (uint64_t) (unsigned long) "GPL";
+
+    if ((progfd = sysBPF(BPF_PROG_LOAD, attr)) != -1)
+    {
+        LOG_DEBUG("XDP program loaded successfully");
+        return;
+    }
+
+    /* the verifier log is requested only to explain a failure */
+    char log[HUGEBUF];
+    memset(log, 0x00, sizeof (log));
+    attr.log_level = 1;
+    attr.log_size = sizeof (log);
+    attr.log_buf = (uint64_t) (unsigned long) log;
+
+    if ((progfd = sysBPF(BPF_PROG_LOAD, attr)) == -1)
+        RUNTIME_EXCEPTION("unable to load the XDP program: %s\n%s", strerror(errno), log);
+}
+
+void XdpSocket::attachProgram(uint32_t ifindex, bool generic)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.link_create.prog_fd = progfd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+
+    if (!generic)
+    {
+        attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+        if ((linkfd = sysBPF(BPF_LINK_CREATE, attr)) != -1)
+        {
+            LOG_VERBOSE("XDP program attached in native mode");
+            bindSocket(ifindex, false);
+            return;
+        }
+
+        LOG_VERBOSE("native XDP not supported (%s), using the generic mode", strerror(errno));
+    }
+
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    if ((linkfd = sysBPF(BPF_LINK_CREATE, attr)) == -1)
+        RUNTIME_EXCEPTION("unable to attach the XDP program: %s", strerror(errno));
+
+    LOG_VERBOSE("XDP program attached in generic mode");
+    bindSocket(ifindex, true);
+}
+
+void XdpSocket::bindSocket(uint32_t ifindex, bool generic)
+{
+    struct sockaddr_xdp sxdp;
+
+    memset(&sxdp, 0x00, sizeof (sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = XDP_QUEUE_ID;
+
+    /* with no mode the kernel uses the zero copy when the driver supports it */
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | (generic ? XDP_COPY : 0);
+
+    if (bind(xskfd, (struct sockaddr *) &sxdp, sizeof (sxdp)) == -1)
+        RUNTIME_EXCEPTION("unable to bind the AF_XDP socket: %s", strerror(errno));
+}
+
+const unsigned char *XdpSocket::receive(uint32_t &len)
+{
+    for (;;)
+    {
+        if (rx.cached == *rx.producer)
+            return NULL;
+
+        /* the descriptor is read after the index */
+        __sync_synchronize();
+
+        const struct xdp_desc &desc = ((struct xdp_desc *) rx.descs)[rx.cached & (XDP_RING_SIZE - 1)];
+        ++rx.cached;
+
+        rx_done.push_back(desc.addr);
+
+        /* the program redirects only ethernet IPv4 frames, anything shorter is dropped */
+        if (desc.len <= ETH_HLEN)
+            continue;
+
+        len = desc.len - ETH_HLEN;
+        return umem + desc.addr + ETH_HLEN;
+    }
+}
+
+void XdpSocket::release(void)
+{
+    if (rx_done.empty())
+        return;
+
+    /* the fill ring has a slot for every receiving frame: never full */
+    for (vector<uint64_t>::iterator it = rx_done.begin(); it != rx_done.end(); ++it)
+        ((uint64_t *) fill.descs)[fill.cached++ & (XDP_RING_SIZE - 1)] = *it;
+
+    rx_done.clear();
+
+    __sync_synchronize();
+    *fill.producer = fill.cached;
+    *rx.consumer = rx.cached;
+}
+
+void XdpSocket::reapCompletions(void)
+{
+    const uint32_t producer = *comp.producer;
+
+    if (comp.cached == producer)
+        return;
+
+    __sync_synchronize();
+
+    while (comp.cached != producer)
+        tx_frames.push_back(((uint64_t *) comp.descs)[comp.cached++ & (XDP_RING_SIZE - 1)]);
+
+    __sync_synchronize();
+    *comp.consumer = comp.cached;
+}
+
+bool XdpSocket::send(const unsigned char *pkt, uint32_t len)
+{
+    if (len + ETH_HLEN > XDP_FRAME_SIZE)
+    {
+        LOG_DEBUG("packet of %u bytes too large for an AF_XDP frame: dropped", len);
+        return true;
+    }
+
+    if (tx_frames.empty())
+        reapCompletions();
+
+    if (tx_frames.empty() || tx.cached - *tx.consumer >= XDP_RING_SIZE)
+        return false;
+
+    const uint64_t addr = tx_frames.back();
+    tx_frames.pop_back();
+
+    memcpy(umem + addr, eth_header, ETH_HLEN);
+    memcpy(umem + addr + ETH_HLEN, pkt, len);
+
+    struct xdp_desc &desc = ((struct xdp_desc *) tx.descs)[tx.cached++ & (XDP_RING_SIZE - 1)];
+    desc.addr = addr;
+    desc.len = len + ETH_HLEN;
+    desc.options = 0;
+
+    return true;
+}
+
+void XdpSocket::flush(void)
+{
+    if (tx.cached == *tx.producer)
+        return;
+
+    __sync_synchronize();
+    *tx.producer = tx.cached;
+
+    /* in copy mode the kernel transmits only inside a syscall */
+    if (*tx.flags & XDP_RING_NEED_WAKEUP)
+    {
+        if (sendto(xskfd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 &&
+                errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+            RUNTIME_EXCEPTION("error waking up the AF_XDP transmission: %s", strerror(errno));
+    }
+
+    reapCompletions();
+}
@@ -0,0 +1,114 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SJ_XDPSOCKET_H
+#define SJ_XDPSOCKET_H
+
+#include "Utils.h"
+
+#include <net/ethernet.h>
+#include <linux/if_xdp.h>
+
+/*
+ * the AF_XDP datalink of NetIOTun, alternative to the PF_PACKET socket:
+ * an XDP program attached to the network interface redirects in the socket
+ * only the IPv4 frames coming from the gateway mac address, everything else
+ * goes to the kernel as usual. the frames are received and transmitted
+ * directly in the UMEM, a memory area shared with the kernel:
+ *
+ *   - the first XDP_RING_SIZE frames are given to the kernel by the fill
+ *     ring, received by the rx ring and given back after the copy in a Packet;
+ *   - the others are the transmission pool: a Packet is copied in a free
+ *     frame after the ethernet header, sent by the tx ring, and the frame
+ *     returns in the pool by the completion ring.
+ *
+ * the native mode is used where the driver supports it, otherwise the generic
+ * (SKB) one, that works on every interface and so on veth too.
+ */
+
+#define XDP_FRAME_SIZE          2048    /* MUST be a power of two */
+#define XDP_NUM_FRAMES          4096
+#define XDP_RING_SIZE           2048    /* MUST be a power of two, half of the frames */
+#define XDP_QUEUE_ID            0       /* the single rx queue bound */
+
+struct xdp_ring
+{
+    volatile uint32_t *producer;
+    volatile uint32_t *consumer;
+    volatile uint32_t *flags;
+    void *descs;
+
+    /* the local copy of our index: the kernel sees it only after a publish */
+    uint32_t cached;
+
+    void *map;
+    size_t maplen;
+};
+
+class XdpSocket
+{
+private:
+    int xskfd;
+    int progfd;
+    int mapfd;
+    int linkfd; /* the program is detached when the last copy is closed */
+
+    unsigned char *umem;
+    struct xdp_ring fill, comp, rx, tx;
+
+    vector<uint64_t> tx_frames; /* the free frames of the transmission pool */
+    vector<uint64_t> rx_done; /* received and copied, waiting the fill ring */
+
+    unsigned char eth_header[ETH_HLEN]; /* gateway, interface, ETH_P_IP */
+
+    void setupUMEM(void);
+    void mapRing(struct xdp_ring &, const struct xdp_ring_offset &, off_t, size_t);
+    void setupProgram(const char *);
+    void attachProgram(uint32_t, bool);
+    void bindSocket(uint32_t, bool);
+    void reapCompletions(void);
+
+public:
+    XdpSocket(const char *, const char *, bool);
+    ~XdpSocket(void);
+
+    int getFd(void) const
+    {
+        return xskfd;
+    };
+
+    /*
+     * the next received IP packet, without the ethernet header, or NULL when
+     * the rx ring is empty. the data is valid until release()
+     */
+    const unsigned char *receive(uint32_t &);
+    void release(void);
+
+    /* copies the packet in a free frame; false when the frames or the ring are full */
+    bool send(const unsigned char *, uint32_t);
+
+    /* publishes the sent frames, waking up the kernel when required */
+    void flush(void);
+};
+
+#endif /* SJ_XDPSOCKET_H */
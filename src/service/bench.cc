@@ -0,0 +1,1117 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * sniffjoke-bench measures the core primitives of the packet path in
+ * isolation: every case runs over a synthetic corpus (packet sizes or map
+ * populations), is calibrated to run for --time milliseconds and reports
+ * the nanoseconds and the heap allocations per operation.
+ *
+ * --json prints one record per line, to be archived and compared between
+ * two releases; the setup of every case is excluded from the measure.
+ *
+ * with --plugin the microbenchmarks are replaced by the plugin harness.
+ * the configuration and the dumps of the maps live in a temporary location.
+ */
+
+#include "Utils.h"
+#include "UserConf.h"
+#include "Packet.h"
+#include "HDRoptions.h"
+#include "TTLFocus.h"
+#include "SessionTrack.h"
+#include "OptionPool.h"
+#include "PacketFilter.h"
+#include "PacketQueue.h"
+#include "IPList.h"
+#include "PluginPool.h"
+#include "PcapReader.h"
+#include "HeapCounter.h"
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#define BENCH_DEFAULT_TIME      200     /* milliseconds for every case */
+#define BENCH_MAX_ITERATIONS    (1 << 28)
+#define BENCH_MTU               1500
+#define BENCH_LOCAL_ADDR        0x0200000a /* 10.0.0.2 in network order */
+
+extern auto_ptr<UserConf> userconf;
+extern auto_ptr<OptionPool> opt_pool;
+extern auto_ptr<TTLFocusMap> ttlfocus_map;
+extern auto_ptr<SessionTrackMap> sessiontrack_map;
+extern auto_ptr<PluginPool> plugin_pool;
+
+/* defined here, is needed by SniffJoke.cc */
+void sigtrap(int signal)
+{
+}
+
+/* the results are written here, so the compiler can't remove the measured code */
+static volatile uint32_t bench_sink;
+
+struct bench_measure
+{
+    uint64_t ns;
+    uint64_t allocations;
+    uint64_t start_ns;
+    uint64_t start_allocations;
+};
+
+static inline void benchStart(struct bench_measure &m)
+{
+    m.start_allocations = heap_allocations;
+    m.start_ns = sj_monotonic_ns();
+}
+
+static inline void benchStop(struct bench_measure &m)
+{
+    m.ns += sj_monotonic_ns() - m.start_ns;
+    m.allocations += heap_allocations - m.start_allocations;
+}
+
+typedef void bench_f(struct bench_measure &, uint32_t, uint32_t);
+
+struct bench_case
+{
+    const char *name;
+    bench_f *fn;
+    const uint32_t *params; /* zero terminated: packet sizes or map populations */
+};
+
+/* the corpora: IP total length of the packets, and number of entries in the maps */
+static const uint32_t packet_sizes[] = {40, 128, 576, 1500, 0};
+static const uint32_t populations[] = {64, 1024, 0};
+static const uint32_t queue_depths[] = {16, 1024, 0};
+static const uint32_t map_thresholds[] = {SESSIONTRACKMAP_MEMORY_THRESHOLD, 0};
+
+/* a TCP/IPv4 segment with a random payload and correct checksums */
+static void buildSegment(vector<unsigned char> &buf, uint16_t totlen, uint32_t saddr, uint32_t daddr,
+                         uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack, uint8_t flags)
+{
+    buf.assign(totlen, 0);
+
+    struct iphdr *ip = (struct iphdr *) &buf[0];
+    struct tcphdr *tcp = (struct tcphdr *) &buf[sizeof (struct iphdr)];
+    const uint16_t hdrlen = sizeof (struct iphdr) + sizeof (struct tcphdr);
+
+    ip->version = 4;
+    ip->ihl = sizeof (struct iphdr) / 4;
+    ip->tot_len = htons(totlen);
+    ip->id = htons(random());
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->saddr = saddr;
+    ip->daddr = daddr;
+
+    tcp->source = htons(sport);
+    tcp->dest = htons(dport);
+    tcp->seq = htonl(seq);
+    tcp->ack_seq = htonl(ack);
+    tcp->doff = sizeof (struct tcphdr) / 4;
+    tcp->fin = (flags & TH_FIN) != 0;
+    tcp->syn = (flags & TH_SYN) != 0;
+    tcp->rst = (flags & TH_RST) != 0;
+    tcp->psh = (flags & TH_PUSH) != 0;
+    tcp->ack = (flags & TH_ACK) != 0;
+    tcp->window = htons(65535);
+
+    if (totlen > hdrlen)
+        memset_random(&buf[hdrlen], totlen - hdrlen);
+
+    Packet pkt(&buf[0], totlen);
+    pkt.fixSum();
+    buf = pkt.pbuf;
+}
+
+/* a segment of an established flow from the local host */
+static void buildTCP(vector<unsigned char> &buf, uint16_t totlen, uint32_t daddr, uint16_t sport)
+{
+    const uint16_t hdrlen = sizeof (struct iphdr) + sizeof (struct tcphdr);
+
+    buildSegment(buf, totlen, BENCH_LOCAL_ADDR, daddr, sport, 80, random(), random(),
+                 (totlen > hdrlen) ? (TH_ACK | TH_PUSH) : TH_ACK);
+}
+
+static uint32_t benchDaddr(uint32_t i)
+{
+    /* 93.0.0.0/8 plus the index: a distinct destination for every entry */
+    return htonl(0x5d000000 | (i + 1));
+}
+
+/* restore a packet without reallocate: the vector keeps its capacity */
+static void resetPacket(Packet &pkt, const vector<unsigned char> &buf)
+{
+    pkt.pbuf = buf;
+    pkt.updatePacketMetadata(0, 0);
+}
+
+static void benchPacketConstruct(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, size, benchDaddr(0), 1024);
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        Packet pkt(&buf[0], buf.size());
+        bench_sink += pkt.tcppayloadlen;
+    }
+    benchStop(m);
+}
+
+static void benchPacketParse(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        pkt.updatePacketMetadata(0, 0);
+        bench_sink += pkt.tcppayloadlen;
+    }
+    benchStop(m);
+}
+
+static void benchPacketFixSum(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        pkt.fixSum();
+        bench_sink += pkt.tcp->check;
+    }
+    benchStop(m);
+}
+
+static void benchPacketCorruptSum(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        pkt.corruptSum();
+        bench_sink += pkt.tcp->check;
+    }
+    benchStop(m);
+}
+
+/* one operation is a grow and a shrink back to the original size */
+static void benchPacketIphdrResize(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, (size + 20 > BENCH_MTU) ? size - 20 : size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        pkt.iphdrResize(sizeof (struct iphdr) + 20);
+        pkt.iphdrResize(sizeof (struct iphdr));
+        bench_sink += pkt.iphdrlen;
+    }
+    benchStop(m);
+}
+
+static void benchPacketTcphdrResize(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, (size + 20 > BENCH_MTU) ? size - 20 : size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        pkt.tcphdrResize(sizeof (struct tcphdr) + 20);
+        pkt.tcphdrResize(sizeof (struct tcphdr));
+        bench_sink += pkt.tcphdrlen;
+    }
+    benchStop(m);
+}
+
+static void benchPacketPayloadResize(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+
+    const uint16_t original = pkt.tcppayloadlen;
+    const uint16_t resized = (original >= 64) ? original / 2 : original + 64;
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        pkt.tcppayloadResize(resized);
+        pkt.tcppayloadResize(original);
+        bench_sink += pkt.tcppayloadlen;
+    }
+    benchStop(m);
+}
+
+static void benchMemsetRandom(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    vector<unsigned char> buf(size);
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        memset_random(&buf[0], size);
+        bench_sink += buf[0];
+    }
+    benchStop(m);
+}
+
+/* every operation restores the original packet: the restore is part of the measure */
+static void benchRandomOpts(struct bench_measure &m, uint32_t iterations, uint32_t size, injector_t type, bool corrupt)
+{
+    vector<unsigned char> buf;
+    buildTCP(buf, size, benchDaddr(0), 1024);
+    Packet pkt(&buf[0], buf.size());
+    TTLFocus ttlfocus(pkt);
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        resetPacket(pkt, buf);
+        HDRoptions injector(type, pkt, ttlfocus);
+        bench_sink += injector.injectRandomOpts(corrupt, corrupt);
+    }
+    benchStop(m);
+}
+
+static void benchIPRandomOpts(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    benchRandomOpts(m, iterations, size, IPOPTS_INJECTOR, false);
+}
+
+static void benchIPRandomOptsCorrupt(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    benchRandomOpts(m, iterations, size, IPOPTS_INJECTOR, true);
+}
+
+static void benchTCPRandomOpts(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    benchRandomOpts(m, iterations, size, TCPOPTS_INJECTOR, false);
+}
+
+static void benchTCPRandomOptsCorrupt(struct bench_measure &m, uint32_t iterations, uint32_t size)
+{
+    benchRandomOpts(m, iterations, size, TCPOPTS_INJECTOR, true);
+}
+
+/* the corpus used by the maps: a packet for every distinct flow or destination */
+static void buildFlows(vector<Packet *> &flows, uint32_t population, bool distinct_daddr)
+{
+    vector<unsigned char> buf;
+
+    for (uint32_t i = 0; i < population; ++i)
+    {
+        buildTCP(buf, 40, benchDaddr(distinct_daddr ? i : 0), 1024 + i);
+        flows.push_back(new Packet(&buf[0], buf.size()));
+    }
+}
+
+static void deleteFlows(vector<Packet *> &flows)
+{
+    for (vector<Packet *>::iterator it = flows.begin(); it != flows.end(); ++it)
+        delete *it;
+    flows.clear();
+}
+
+static void benchSessionTrackGet(struct bench_measure &m, uint32_t iterations, uint32_t population)
+{
+    SessionTrackMap map;
+    vector<Packet *> flows;
+    buildFlows(flows, population, false);
+
+    for (uint32_t i = 0; i < population; ++i)
+        map.get(*flows[i]);
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+        bench_sink += map.get(*flows[i % population]).packet_number;
+    benchStop(m);
+
+    deleteFlows(flows);
+}
+
+static void benchTTLFocusGet(struct bench_measure &m, uint32_t iterations, uint32_t population)
+{
+    TTLFocusMap map;
+    vector<Packet *> flows;
+    buildFlows(flows, population, true);
+
+    for (uint32_t i = 0; i < population; ++i)
+        map.get(*flows[i]);
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+        bench_sink += map.get(*flows[i % population]).ttl_estimate;
+    benchStop(m);
+
+    deleteFlows(flows);
+}
+
+/* one operation is the eviction of half map when the threshold is exceeded */
+static void benchSessionTrackManage(struct bench_measure &m, uint32_t iterations, uint32_t threshold)
+{
+    SessionTrackMap map;
+    vector<Packet *> flows;
+    buildFlows(flows, threshold + 1, false);
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        for (uint32_t j = 0; j <= threshold; ++j)
+            map.get(*flows[j]);
+
+        benchStart(m);
+        map.manage();
+        benchStop(m);
+
+        bench_sink += map.size();
+    }
+
+    deleteFlows(flows);
+}
+
+static void benchTTLFocusManage(struct bench_measure &m, uint32_t iterations, uint32_t threshold)
+{
+    TTLFocusMap map;
+    vector<Packet *> flows;
+    buildFlows(flows, threshold + 1, true);
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        for (uint32_t j = 0; j <= threshold; ++j)
+            map.get(*flows[j]);
+
+        benchStart(m);
+        map.manage();
+        benchStop(m);
+
+        bench_sink += map.size();
+    }
+
+    deleteFlows(flows);
+}
+
+/* one operation is the add of a filter and the check removing it */
+static void benchFilterAddCheck(struct bench_measure &m, uint32_t iterations, uint32_t population)
+{
+    FilterMultiset filter;
+
+    for (uint32_t i = 0; i < population; ++i)
+        filter.add(FilterEntry(i, 40, BENCH_LOCAL_ADDR, benchDaddr(i)));
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        const FilterEntry entry(population + (i % population), 40, BENCH_LOCAL_ADDR, benchDaddr(i % population));
+        filter.add(entry);
+        bench_sink += filter.check(entry);
+    }
+    benchStop(m);
+}
+
+static void benchFilterMiss(struct bench_measure &m, uint32_t iterations, uint32_t population)
+{
+    FilterMultiset filter;
+
+    for (uint32_t i = 0; i < population; ++i)
+        filter.add(FilterEntry(i, 40, BENCH_LOCAL_ADDR, benchDaddr(i)));
+
+    const FilterEntry missing(population, 40, BENCH_LOCAL_ADDR, benchDaddr(0));
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+        bench_sink += filter.check(missing);
+    benchStop(m);
+}
+
+/* a hit and a miss every two operations */
+static void benchIPListIsPresent(struct bench_measure &m, uint32_t iterations, uint32_t population)
+{
+    IPListMap list("bench-iplist.conf");
+
+    for (uint32_t i = 0; i < population; ++i)
+        list.add(benchDaddr(i * 2), 0, 0, 0);
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+        bench_sink += list.isPresent(benchDaddr(i % (population * 2)));
+    benchStop(m);
+}
+
+/* one operation is the life of a packet: YOUNG, then SEND, then extracted */
+static void benchQueueCycle(struct bench_measure &m, uint32_t iterations, uint32_t depth)
+{
+    PacketQueue queue;
+    vector<Packet *> flows;
+    buildFlows(flows, depth + 1, false);
+
+    for (uint32_t i = 0; i < depth; ++i)
+        queue.insert(*flows[i], KEEP);
+
+    Packet &pkt = *flows[depth];
+
+    benchStart(m);
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        queue.insert(pkt, YOUNG);
+        queue.insert(pkt, SEND);
+        queue.extract(pkt);
+    }
+    benchStop(m);
+
+    for (uint32_t i = 0; i < depth; ++i)
+        queue.extract(*flows[i]);
+
+    deleteFlows(flows);
+}
+
+/* one operation is a packet visited by select/get */
+static void benchQueueScan(struct bench_measure &m, uint32_t iterations, uint32_t depth)
+{
+    PacketQueue queue;
+    vector<Packet *> flows;
+    buildFlows(flows, depth, false);
+
+    for (uint32_t i = 0; i < depth; ++i)
+        queue.insert(*flows[i], YOUNG);
+
+    uint32_t visited = 0;
+    Packet *pkt;
+
+    benchStart(m);
+    while (visited < iterations)
+    {
+        queue.select(YOUNG);
+        while ((pkt = queue.get()) != NULL && visited < iterations)
+        {
+            bench_sink += pkt->SjPacketId;
+            ++visited;
+        }
+    }
+    benchStop(m);
+
+    for (uint32_t i = 0; i < depth; ++i)
+        queue.extract(*flows[i]);
+
+    deleteFlows(flows);
+}
+
+static const struct bench_case bench_cases[] = {
+    { "packet.construct", benchPacketConstruct, packet_sizes},
+    { "packet.parse", benchPacketParse, packet_sizes},
+    { "packet.fixSum", benchPacketFixSum, packet_sizes},
+    { "packet.corruptSum", benchPacketCorruptSum, packet_sizes},
+    { "packet.iphdrResize", benchPacketIphdrResize, packet_sizes},
+    { "packet.tcphdrResize", benchPacketTcphdrResize, packet_sizes},
+    { "packet.tcppayloadResize", benchPacketPayloadResize, packet_sizes},
+    { "utils.memset_random", benchMemsetRandom, packet_sizes},
+    { "hdroptions.ip.random", benchIPRandomOpts, packet_sizes},
+    { "hdroptions.ip.random_corrupt", benchIPRandomOptsCorrupt, packet_sizes},
+    { "hdroptions.tcp.random", benchTCPRandomOpts, packet_sizes},
+    { "hdroptions.tcp.random_corrupt", benchTCPRandomOptsCorrupt, packet_sizes},
+    { "sessiontrackmap.get", benchSessionTrackGet, populations},
+    { "sessiontrackmap.manage", benchSessionTrackManage, map_thresholds},
+    { "ttlfocusmap.get", benchTTLFocusGet, populations},
+    { "ttlfocusmap.manage", benchTTLFocusManage, map_thresholds},
+    { "filtermultiset.add_check", benchFilterAddCheck, populations},
+    { "filtermultiset.miss", benchFilterMiss, populations},
+    { "iplistmap.isPresent", benchIPListIsPresent, populations},
+    { "packetqueue.cycle", benchQueueCycle, queue_depths},
+    { "packetqueue.scan", benchQueueScan, queue_depths},
+    { NULL, NULL, NULL}
+};
+
+/* run the case doubling the iterations until it's measurable, then scale it to the target time */
+static void benchRun(const struct bench_case &bc, uint32_t param, uint64_t target_ns, uint32_t fixed_iterations, bool json)
+{
+    struct bench_measure m;
+    uint32_t iterations = fixed_iterations ? fixed_iterations : 1;
+
+    for (;;)
+    {
+        memset(&m, 0, sizeof (m));
+        bc.fn(m, iterations, param);
+
+        if (fixed_iterations || iterations >= BENCH_MAX_ITERATIONS)
+            break;
+
+        if (m.ns >= target_ns / 8)
+        {
+            const uint64_t scaled = (uint64_t) iterations * target_ns / (m.ns ? m.ns : 1);
+            iterations = (scaled > BENCH_MAX_ITERATIONS) ? BENCH_MAX_ITERATIONS : (scaled ? scaled : 1);
+
+            memset(&m, 0, sizeof (m));
+            bc.fn(m, iterations, param);
+            break;
+        }
+
+        iterations *= 2;
+    }
+
+    const double ns_op = (double) m.ns / iterations;
+    const double allocs_op = (double) m.allocations / iterations;
+
+    if (json)
+    {
+        printf("{\"version\":\"%s\",\"name\":\"%s\",\"param\":%u,\"iterations\":%u,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f}\n",
+               SW_VERSION, bc.name, param, iterations, ns_op, allocs_op);
+    }
+    else
+    {
+        char label[MEDIUMBUF];
+        snprintf(label, sizeof (label), "%s/%u", bc.name, param);
+        printf("%-36s %10u %12.1f ns/op %10.3f allocs/op\n", label, iterations, ns_op, allocs_op);
+    }
+
+    fflush(stdout);
+}
+
+/* the bench location is a temporary directory with the minimal configuration */
+static void benchLocationSetup(char *dir)
+{
+    char path[LARGEBUF];
+    FILE *f;
+
+    if (mkdtemp(dir) == NULL)
+        RUNTIME_EXCEPTION("unable to create %s: %s", dir, strerror(errno));
+
+    snprintf(path, sizeof (path), "%s/%s", dir, FILE_PLUGINSENABLER);
+    if ((f = fopen(path, "w")) == NULL)
+        RUNTIME_EXCEPTION("unable to write %s: %s", path, strerror(errno));
+    fprintf(f, "# sniffjoke-bench does not load plugins\n");
+    fclose(f);
+
+    /* every option ONESHOT, except the ones not corrupting (IP NOP, IP and TCP TIMESTAMP) */
+    snprintf(path, sizeof (path), "%s/%s", dir, FILE_IPTCPOPT_CONF);
+    if ((f = fopen(path, "w")) == NULL)
+        RUNTIME_EXCEPTION("unable to write %s: %s", path, strerror(errno));
+    for (uint8_t i = 0; i < SUPPORTED_OPTIONS; ++i)
+        fprintf(f, "%u,%u\n", i, (i == SJ_IPOPT_NOOP || i == SJ_IPOPT_TIMESTAMP || i == SJ_TCPOPT_TIMESTAMP) ? NOT_CORRUPT : ONESHOT);
+    fclose(f);
+}
+
+static void benchLocationCleanup(const char *dir)
+{
+    char path[LARGEBUF];
+    struct dirent *entry;
+    DIR *d;
+
+    if ((d = opendir(dir)) == NULL)
+        return;
+
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof (path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+    rmdir(dir);
+}
+
+/*
+ * the plugin harness: a single plugin is loaded by PluginPool (as with
+ * --only-plugin) and fed with a corpus; condition() and apply() see the
+ * outgoing packets, mangleIncoming() the incoming ones. the frequency of
+ * the plugin is ignored: every packet satisfying condition() is applied.
+ */
+
+#define PLUGINBENCH_FLOWS       256
+#define PLUGINBENCH_SEGMENTS    8
+
+struct corpus_packet
+{
+    source_t source;
+    vector<unsigned char> data;
+};
+
+struct plugin_bench
+{
+    uint64_t out_pkts;
+    uint64_t out_bytes;
+    uint64_t in_pkts;
+    uint64_t condition_hits;
+    uint64_t condition_ns;
+    uint64_t apply_calls;
+    uint64_t apply_ns;
+    uint64_t incoming_ns;
+    uint64_t generated_pkts;
+    uint64_t generated_bytes;
+    uint64_t integrity_failures;
+    uint64_t orig_removals;
+    uint64_t allocations;
+    uint64_t heap_peak;
+    uint32_t cache_start;
+    uint32_t cache_end;
+    uint32_t cache_peak;
+    uint32_t clock_overhead;
+};
+
+static void corpusAdd(vector<struct corpus_packet *> &corpus, source_t source, uint16_t totlen,
+                      uint32_t local, uint32_t remote, uint16_t lport, uint32_t seq, uint32_t ack, uint8_t flags)
+{
+    struct corpus_packet *cp = new struct corpus_packet;
+
+    cp->source = source;
+    if (source == TUNNEL)
+        buildSegment(cp->data, totlen, local, remote, lport, 80, seq, ack, flags);
+    else
+        buildSegment(cp->data, totlen, remote, local, 80, lport, seq, ack, flags);
+
+    corpus.push_back(cp);
+}
+
+/* complete http-like flows: handshake, data in both directions and the FIN closing */
+static void corpusSynthetic(vector<struct corpus_packet *> &corpus, uint32_t flows, uint32_t rounds)
+{
+    static const uint16_t sizes[] = {128, 576, 1500, 40};
+    const uint16_t hdrlen = sizeof (struct iphdr) + sizeof (struct tcphdr);
+
+    for (uint32_t r = 0; r < rounds; ++r)
+    {
+        for (uint32_t f = 0; f < flows; ++f)
+        {
+            const uint32_t remote = benchDaddr(f);
+            const uint16_t lport = 1024 + ((r * flows + f) % 60000);
+            uint32_t lseq = random(), rseq = random();
+
+            corpusAdd(corpus, TUNNEL, hdrlen, BENCH_LOCAL_ADDR, remote, lport, lseq++, 0, TH_SYN);
+            corpusAdd(corpus, NETWORK, hdrlen, BENCH_LOCAL_ADDR, remote, lport, rseq++, lseq, TH_SYN | TH_ACK);
+            corpusAdd(corpus, TUNNEL, hdrlen, BENCH_LOCAL_ADDR, remote, lport, lseq, rseq, TH_ACK);
+
+            for (uint32_t k = 0; k < PLUGINBENCH_SEGMENTS; ++k)
+            {
+                const uint16_t out_len = sizes[k % 4], in_len = sizes[(k + 1) % 4];
+
+                corpusAdd(corpus, TUNNEL, out_len, BENCH_LOCAL_ADDR, remote, lport, lseq, rseq, TH_ACK | TH_PUSH);
+                lseq += out_len - hdrlen;
+                corpusAdd(corpus, NETWORK, in_len, BENCH_LOCAL_ADDR, remote, lport, rseq, lseq, TH_ACK | TH_PUSH);
+                rseq += in_len - hdrlen;
+            }
+
+            corpusAdd(corpus, TUNNEL, hdrlen, BENCH_LOCAL_ADDR, remote, lport, lseq++, rseq, TH_FIN | TH_ACK);
+            corpusAdd(corpus, NETWORK, hdrlen, BENCH_LOCAL_ADDR, remote, lport, rseq++, lseq, TH_FIN | TH_ACK);
+            corpusAdd(corpus, TUNNEL, hdrlen, BENCH_LOCAL_ADDR, remote, lport, lseq, rseq, TH_ACK);
+        }
+    }
+}
+
+static void corpusCapture(vector<struct corpus_packet *> &corpus, const char *input, const char *localnet, uint32_t rounds)
+{
+    PcapReader reader(input, localnet);
+    const unsigned char *ip;
+    uint32_t iplen;
+    source_t source;
+
+    while ((ip = reader.next(iplen, source)) != NULL)
+    {
+        struct corpus_packet *cp = new struct corpus_packet;
+        cp->source = source;
+        cp->data.assign(ip, ip + iplen);
+        corpus.push_back(cp);
+    }
+
+    LOG_VERBOSE("corpus from %s: %lu records, %lu skipped, %lu not of the local network", input,
+                (unsigned long) reader.records, (unsigned long) reader.skipped, (unsigned long) reader.foreign);
+
+    /* the capture is replayed more times as it is */
+    const size_t once = corpus.size();
+    for (uint32_t r = 1; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < once; ++i)
+        {
+            struct corpus_packet *cp = new struct corpus_packet(*corpus[i]);
+            corpus.push_back(cp);
+        }
+    }
+}
+
+/* the cost of the two clock reads around every call, subtracted from the results */
+static uint32_t clockOverhead(void)
+{
+    const uint32_t samples = 100000;
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < samples; ++i)
+    {
+        const uint64_t start = sj_monotonic_ns();
+        total += sj_monotonic_ns() - start;
+    }
+
+    return total / samples;
+}
+
+static uint64_t netElapsed(uint64_t start, uint32_t overhead)
+{
+    const uint64_t elapsed = sj_monotonic_ns() - start;
+    return (elapsed > overhead) ? elapsed - overhead : 0;
+}
+
+static void pluginBenchRun(PluginTrack &pt, const vector<struct corpus_packet *> &corpus, struct plugin_bench &pb)
+{
+    Plugin &plugin = *pt.selfObj;
+    const uint8_t available = SCRAMBLE_INNOCENT | SCRAMBLE_CHECKSUM | SCRAMBLE_MALFORMED | SCRAMBLE_TTL;
+
+    memset(&pb, 0, sizeof (pb));
+    pb.clock_overhead = clockOverhead();
+    pb.cache_start = pb.cache_peak = PluginCache::live_records;
+
+    heap_peak_bytes = heap_live_bytes;
+    const uint64_t heap_start = heap_live_bytes;
+    const uint64_t allocations_start = heap_allocations;
+
+    for (vector<struct corpus_packet *>::const_iterator it = corpus.begin(); it != corpus.end(); ++it)
+    {
+        const struct corpus_packet &cp = **it;
+
+        sj_clock = time(NULL);
+
+        Packet pkt(&cp.data[0], cp.data.size());
+        pkt.source = cp.source;
+        pkt.wtf = INNOCENT;
+        pkt.choosableScramble = INNOCENT;
+
+        if (cp.source == NETWORK)
+        {
+            ++pb.in_pkts;
+
+            const uint64_t start = sj_monotonic_ns();
+            plugin.mangleIncoming(pkt);
+            pb.incoming_ns += netElapsed(start, pb.clock_overhead);
+            continue;
+        }
+
+        ++pb.out_pkts;
+        pb.out_bytes += cp.data.size();
+        sessiontrack_map->get(pkt).packet_number++;
+
+        uint64_t start = sj_monotonic_ns();
+        const bool applicable = plugin.condition(pkt, available);
+        pb.condition_ns += netElapsed(start, pb.clock_overhead);
+
+        if (!applicable)
+            continue;
+
+        ++pb.condition_hits;
+        ++pb.apply_calls;
+
+        start = sj_monotonic_ns();
+        plugin.apply(pkt, available);
+        pb.apply_ns += netElapsed(start, pb.clock_overhead);
+
+        for (vector<Packet *>::iterator hack_it = plugin.pktVector.begin(); hack_it != plugin.pktVector.end(); ++hack_it)
+        {
+            Packet *injpkt = *hack_it;
+
+            if (injpkt->selfIntegrityCheck(plugin.pluginName))
+            {
+                ++pb.generated_pkts;
+                pb.generated_bytes += injpkt->pbuf.size();
+            }
+            else
+                ++pb.integrity_failures;
+
+            delete injpkt;
+        }
+
+        if (plugin.removeOrigPkt)
+            ++pb.orig_removals;
+
+        plugin.reset();
+
+        if (PluginCache::live_records > pb.cache_peak)
+            pb.cache_peak = PluginCache::live_records;
+    }
+
+    pb.allocations = heap_allocations - allocations_start;
+    pb.heap_peak = heap_peak_bytes - heap_start;
+    pb.cache_end = PluginCache::live_records;
+}
+
+static double ratio(uint64_t num, uint64_t den)
+{
+    return den ? (double) num / den : 0.0;
+}
+
+static void pluginBenchReport(const PluginTrack &pt, const struct plugin_bench &pb, bool json)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    char scrambles[LARGEBUF] = {0};
+    snprintfScramblesList(scrambles, sizeof (scrambles), pt.declaredScramble);
+
+    if (json)
+    {
+        printf("{\"version\":\"%s\",\"plugin\":\"%s\",\"scrambles\":\"%s\",\"out_pkts\":%lu,\"in_pkts\":%lu,"
+               "\"condition_ns\":%.2f,\"condition_hits\":%lu,\"apply_ns\":%.2f,\"incoming_ns\":%.2f,"
+               "\"generated_pkts_per_pkt\":%.4f,\"generated_bytes_per_byte\":%.4f,\"integrity_failures\":%lu,"
+               "\"orig_removals\":%lu,\"allocs_per_pkt\":%.3f,\"cache_start\":%u,\"cache_end\":%u,\"cache_peak\":%u,"
+               "\"heap_peak_bytes\":%lu,\"maxrss_kb\":%ld}\n",
+               SW_VERSION, pt.selfObj->pluginName, scrambles,
+               (unsigned long) pb.out_pkts, (unsigned long) pb.in_pkts,
+               ratio(pb.condition_ns, pb.out_pkts), (unsigned long) pb.condition_hits,
+               ratio(pb.apply_ns, pb.apply_calls), ratio(pb.incoming_ns, pb.in_pkts),
+               ratio(pb.generated_pkts, pb.out_pkts), ratio(pb.generated_bytes, pb.out_bytes),
+               (unsigned long) pb.integrity_failures, (unsigned long) pb.orig_removals,
+               ratio(pb.allocations, pb.out_pkts + pb.in_pkts),
+               pb.cache_start, pb.cache_end, pb.cache_peak,
+               (unsigned long) pb.heap_peak, ru.ru_maxrss);
+        return;
+    }
+
+    printf("plugin               %s [%s]\n", pt.selfObj->pluginName, scrambles);
+    printf("corpus               %lu outgoing packets (%lu bytes), %lu incoming packets\n",
+           (unsigned long) pb.out_pkts, (unsigned long) pb.out_bytes, (unsigned long) pb.in_pkts);
+    printf("condition()          %.1f ns/call, %lu hits (%.1f%%)\n",
+           ratio(pb.condition_ns, pb.out_pkts), (unsigned long) pb.condition_hits, 100.0 * ratio(pb.condition_hits, pb.out_pkts));
+    printf("apply()              %.1f ns/call, %lu calls\n", ratio(pb.apply_ns, pb.apply_calls), (unsigned long) pb.apply_calls);
+    printf("mangleIncoming()     %.1f ns/call\n", ratio(pb.incoming_ns, pb.in_pkts));
+    printf("generated            %lu packets, %.4f per outgoing packet, %.4f bytes per outgoing byte\n",
+           (unsigned long) pb.generated_pkts, ratio(pb.generated_pkts, pb.out_pkts), ratio(pb.generated_bytes, pb.out_bytes));
+    printf("integrity failures   %lu, original packets removed %lu\n",
+           (unsigned long) pb.integrity_failures, (unsigned long) pb.orig_removals);
+    printf("allocations          %.3f per packet\n", ratio(pb.allocations, pb.out_pkts + pb.in_pkts));
+    printf("plugin cache         %u -> %u records (peak %u)\n", pb.cache_start, pb.cache_end, pb.cache_peak);
+    printf("memory               heap peak +%lu KB, max RSS %ld KB\n", (unsigned long) (pb.heap_peak / 1024), ru.ru_maxrss);
+    printf("clock overhead       %u ns, already subtracted\n", pb.clock_overhead);
+}
+
+#define BENCH_HELP_FORMAT \
+    "Usage: %s [OPTION]... :\n"\
+    " --filter <string>\trun only the cases containing string in the name\n"\
+    " --time <ms>\t\ttarget time of every case [default: %d]\n"\
+    " --iterations <n>\tfixed number of iterations, without calibration\n"\
+    " --json\t\t\tone json record per line, for the regression tracking\n"\
+    " --list\t\t\tlist the cases\n"\
+    " --debug <level %d-%d>\tset verbosity level [default: %d]\n"\
+    " --help\t\t\tshow this help\n"\
+    "\n plugin harness:\n"\
+    " --plugin <name,SCRAMBLE>\tbenchmark a single plugin, same syntax of --only-plugin\n"\
+    " --plugin-dir <dir>\t\tdirectory of the plugins [default: %s]\n"\
+    " --input <pcap>\t\tcorpus from a capture instead of synthetic flows\n"\
+    " --local <ip>[/bits]\t\tthe local host or network [default: source of the first packet]\n"\
+    " --flows <n>\t\t\tnumber of synthetic flows [default: %d]\n"\
+    " --rounds <n>\t\t\ttimes the corpus is repeated [default: 1]\n"
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL, *plugin = NULL, *plugindir = NULL, *input = NULL, *localnet = NULL;
+    uint32_t time_ms = BENCH_DEFAULT_TIME, fixed_iterations = 0, flows = PLUGINBENCH_FLOWS, rounds = 1;
+    uint16_t debug_level = SUPPRESS_LEVEL;
+    bool json = false, list = false;
+
+    struct option bench_option[] = {
+        { "filter", required_argument, NULL, 'f'},
+        { "time", required_argument, NULL, 't'},
+        { "iterations", required_argument, NULL, 'n'},
+        { "json", no_argument, NULL, 'j'},
+        { "list", no_argument, NULL, 'l'},
+        { "debug", required_argument, NULL, 'd'},
+        { "help", no_argument, NULL, 'h'},
+        { "plugin", required_argument, NULL, 'p'},
+        { "plugin-dir", required_argument, NULL, 'P'},
+        { "input", required_argument, NULL, 'i'},
+        { "local", required_argument, NULL, 'L'},
+        { "flows", required_argument, NULL, 'F'},
+        { "rounds", required_argument, NULL, 'r'},
+        { NULL, 0, NULL, 0}
+    };
+
+    int charopt;
+    while ((charopt = getopt_long(argc, argv, "f:t:n:jld:hp:P:i:L:F:r:", bench_option, NULL)) != -1)
+    {
+        switch (charopt)
+        {
+        case 'f':
+            filter = optarg;
+            break;
+        case 't':
+            time_ms = atoi(optarg);
+            if (!time_ms)
+                goto bench_help;
+            break;
+        case 'n':
+            fixed_iterations = atoi(optarg);
+            if (!fixed_iterations)
+                goto bench_help;
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'd':
+            debug_level = atoi(optarg);
+            if (debug_level > TESTING_LEVEL)
+                goto bench_help;
+            break;
+        case 'p':
+            plugin = optarg;
+            break;
+        case 'P':
+            plugindir = optarg;
+            break;
+        case 'i':
+            input = optarg;
+            break;
+        case 'L':
+            localnet = optarg;
+            break;
+        case 'F':
+            flows = atoi(optarg);
+            if (!flows)
+                goto bench_help;
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            if (!rounds)
+                goto bench_help;
+            break;
+bench_help:
+        case 'h':
+        default:
+            printf(BENCH_HELP_FORMAT, argv[0], BENCH_DEFAULT_TIME, SUPPRESS_LEVEL, PACKET_LEVEL, SUPPRESS_LEVEL,
+                   INSTALL_LIBDIR, PLUGINBENCH_FLOWS);
+            return -1;
+        }
+    }
+
+    if ((input != NULL || localnet != NULL) && (plugin == NULL || input == NULL))
+    {
+        printf("--input and --local are valid only with --plugin\n");
+        return -1;
+    }
+
+    if (list)
+    {
+        for (const struct bench_case *bc = bench_cases; bc->name != NULL; ++bc)
+            printf("%s\n", bc->name);
+        return 0;
+    }
+
+    char dir[] = "/tmp/sniffjoke-bench.XXXXXX";
+    vector<struct corpus_packet *> corpus;
+    debug.setLevel(debug_level);
+    init_random();
+
+    try
+    {
+        sj_clock = time(NULL);
+
+        benchLocationSetup(dir);
+
+        /*
+         * the corpus of the plugin harness is built before UserConf, which
+         * chdir in the location, and out of the heap peak of the plugin
+         */
+        if (plugin != NULL)
+        {
+            if (input != NULL)
+                corpusCapture(corpus, input, localnet, rounds);
+            else
+                corpusSynthetic(corpus, flows, rounds);
+        }
+
+        struct sj_cmdline_opts useropt;
+        memset(&useropt, 0x00, sizeof (useropt));
+        snprintf(useropt.basedir, sizeof (useropt.basedir), "/tmp/");
+        snprintf(useropt.location, sizeof (useropt.location), "%s", dir + strlen("/tmp/"));
+        useropt.debug_level = debug_level;
+        useropt.max_ttl_probe = DEFAULT_MAX_TTLPROBE;
+        if (plugin != NULL)
+            snprintf(useropt.onlyplugin, sizeof (useropt.onlyplugin), "%s", plugin);
+
+        userconf = auto_ptr<UserConf > (new UserConf(useropt));
+        userconf->runcfg.net_iface_mtu = BENCH_MTU;
+        opt_pool = auto_ptr<OptionPool > (new OptionPool);
+
+        if (plugin != NULL)
+        {
+            ttlfocus_map = auto_ptr<TTLFocusMap > (new TTLFocusMap);
+            sessiontrack_map = auto_ptr<SessionTrackMap > (new SessionTrackMap);
+            plugin_pool = auto_ptr<PluginPool > (new PluginPool(plugindir));
+            if (plugin_pool->pool.empty())
+                RUNTIME_EXCEPTION("no plugin loaded from %s", plugin);
+
+            /* the plugins of the harness run without the network side of the service */
+            struct sjEnviron sjenv;
+            memset(&sjenv, 0x00, sizeof (sjenv));
+            sjenv.instanced_ucfg = reinterpret_cast<void *> (userconf.get());
+            sjenv.instanced_ttl = reinterpret_cast<void *> (ttlfocus_map.get());
+            sjenv.instanced_sex = reinterpret_cast<void *> (sessiontrack_map.get());
+            sjenv.instanced_itopts = reinterpret_cast<void *> (opt_pool.get());
+            sjenv.instanced_plugins = reinterpret_cast<void *> (plugin_pool.get());
+            plugin_pool->initializeAll(&sjenv);
+
+            struct plugin_bench pb;
+            pluginBenchRun(*plugin_pool->pool[0], corpus, pb);
+            pluginBenchReport(*plugin_pool->pool[0], pb, json);
+
+            plugin_pool.reset();
+            sessiontrack_map.reset();
+            ttlfocus_map.reset();
+
+            for (vector<struct corpus_packet *>::iterator it = corpus.begin(); it != corpus.end(); ++it)
+                delete *it;
+        }
+
+        for (const struct bench_case *bc = bench_cases; plugin == NULL && bc->name != NULL; ++bc)
+        {
+            if (filter != NULL && strstr(bc->name, filter) == NULL)
+                continue;
+
+            for (const uint32_t *param = bc->params; *param; ++param)
+                benchRun(*bc, *param, (uint64_t) time_ms * 1000000, fixed_iterations, json);
+        }
+
+        opt_pool.reset();
+        userconf.reset();
+    }
+    catch (runtime_error &exception)
+    {
+        LOG_ALL("[runtime exception] bench aborted: %s", exception.what());
+        benchLocationCleanup(dir);
+        return 1;
+    }
+
+    benchLocationCleanup(dir);
+    return 0;
+}
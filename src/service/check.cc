@@ -0,0 +1,1365 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * sniffjoke-check runs the unit checks of the internal structures which
+ * don't need the network nor root: every case prints its name and its
+ * failed assertions, the exit status is 1 when an assertion fails.
+ * a case name (or a part of it) as argument runs only the matching cases.
+ * the conntrack cases run the packet path (TCPTrack) on crafted packets: they
+ * need the directory of a built fake_seq plugin, given with -P, and are
+ * skipped without it. it is run by ctest.
+ */
+
+#include "Utils.h"
+#include "SniffJoke.h"
+
+#include <dirent.h>
+
+extern auto_ptr<UserConf> userconf;
+extern auto_ptr<OptionPool> opt_pool;
+extern auto_ptr<PluginPool> plugin_pool;
+extern auto_ptr<SessionTrackMap> sessiontrack_map;
+extern auto_ptr<TTLFocusMap> ttlfocus_map;
+
+#define CHECK_LOCAL_ADDR        0x0200000a /* 10.0.0.2 in network order */
+#define CHECK_PORT_NONE         22      /* never hacked in the check location */
+#define CHECK_PORT_HANDSHAKE    25      /* hacked in the first packets only */
+
+static const char *check_plugindir;
+
+/* 93.0.<prefix>.<host>: the destinations of a case don't share a /24 unless wanted */
+static uint32_t checkRemote(uint8_t prefix, uint8_t host = 1)
+{
+    return htonl(0x5d000000 | (prefix << 8) | host);
+}
+
+/* defined here, is needed by SniffJoke.cc */
+void sigtrap(int signal)
+{
+}
+
+static uint32_t check_failures;
+static uint32_t case_failures; /* of the running case, only the first ones are printed */
+
+#define CHECK_MAXPRINT  8
+
+#define CHECK(expr) checkAssert((expr), #expr, __LINE__)
+
+static void checkAssert(bool result, const char *expr, int line)
+{
+    if (result)
+        return;
+
+    if (case_failures++ < CHECK_MAXPRINT)
+        printf("    line %d: %s\n", line, expr);
+    ++check_failures;
+}
+
+typedef void check_f(void);
+
+struct check_case
+{
+    const char *name;
+    check_f *fn;
+};
+
+/* the records of a snapshot are numbered, so a page shows where it starts */
+static void snapshotFill(SniffJoke::admin_stream &as, uint32_t records)
+{
+    as.snapshot.resize(records * sizeof (struct sex_record));
+    as.snapshot_type = INFOPAGE_COMMAND_TYPE;
+
+    for (uint32_t i = 0; i < records; ++i)
+    {
+        struct sex_record rec;
+        memset(&rec, 0x00, sizeof (rec));
+        rec.packet_number = i;
+        memcpy(&as.snapshot[i * sizeof (rec)], &rec, sizeof (rec));
+    }
+}
+
+/* serves a page, returns the cursor of the next one; first is the first record of the page */
+static uint32_t snapshotPage(uint8_t *buf, uint32_t buflen, SniffJoke::admin_stream &as, uint32_t cursor,
+                             uint32_t &count, uint32_t &first, uint32_t &total)
+{
+    struct command_ret retInfo;
+    struct page_ret pageInfo;
+    struct sex_record rec;
+
+    SniffJoke::writeSJSnapshotPage(buf, buflen, as, cursor);
+
+    memcpy(&retInfo, buf, sizeof (retInfo));
+    memcpy(&pageInfo, &buf[sizeof (retInfo)], sizeof (pageInfo));
+    CHECK(retInfo.cmd_type == INFOPAGE_COMMAND_TYPE);
+
+    count = (retInfo.cmd_len - sizeof (retInfo) - sizeof (pageInfo)) / sizeof (rec);
+    total = pageInfo.total;
+    first = 0;
+
+    if (count)
+    {
+        memcpy(&rec, &buf[sizeof (retInfo) + sizeof (pageInfo)], sizeof (rec));
+        first = rec.packet_number;
+    }
+
+    return pageInfo.cursor;
+}
+
+/* SniffJoke::writeSJSnapshotPage: the pages cover the snapshot once, the last one releases it */
+static void checkSnapshotPaging(void)
+{
+    const uint32_t perpage = 5;
+    uint8_t buf[sizeof (struct command_ret) + sizeof (struct page_ret) + perpage * sizeof (struct sex_record) + 1];
+    SniffJoke::admin_stream as;
+    uint32_t cursor, count, first, total, served;
+
+    /* 12 records: 5 + 5 + 2, the cursor is 0 after the last page */
+    snapshotFill(as, 12);
+    cursor = 0;
+    served = 0;
+    do
+    {
+        cursor = snapshotPage(buf, sizeof (buf), as, cursor, count, first, total);
+        CHECK(total == 12);
+        CHECK(count == (served < 10 ? perpage : 2));
+        CHECK(first == served);
+        served += count;
+        CHECK(cursor == (served < 12 ? served : 0));
+    }
+    while (cursor && served < 12 + perpage);
+
+    CHECK(served == 12);
+    CHECK(as.snapshot.empty());
+    CHECK(as.snapshot_type == 0);
+
+    /* a snapshot of exactly one page ends at the first one */
+    snapshotFill(as, perpage);
+    cursor = snapshotPage(buf, sizeof (buf), as, 0, count, first, total);
+    CHECK(count == perpage && cursor == 0);
+    CHECK(as.snapshot.empty());
+
+    /* a cursor beyond the snapshot is an empty last page */
+    snapshotFill(as, 7);
+    cursor = snapshotPage(buf, sizeof (buf), as, 100, count, first, total);
+    CHECK(count == 0 && cursor == 0 && total == 7);
+    CHECK(as.snapshot.empty());
+
+    /* an empty map is a single empty page */
+    snapshotFill(as, 0);
+    cursor = snapshotPage(buf, sizeof (buf), as, 0, count, first, total);
+    CHECK(count == 0 && cursor == 0 && total == 0);
+}
+
+/* OptionPool::getRecipe: the recipe fits and doesn't repeat a present option */
+static void checkRecipeSelection(void)
+{
+    const uint8_t protos[2] = { IPPROTO_IP, IPPROTO_TCP };
+
+    for (uint8_t p = 0; p < 2; ++p)
+    {
+        for (uint8_t c = 0; c < 2; ++c)
+        {
+            uint32_t found = 0;
+
+            CHECK(opt_pool->getRecipe(protos[p], c, 0, 0) == NULL);
+            CHECK(opt_pool->getRecipe(protos[p], c, OPTHDR_MAXLEN, 0xFFFFFFFF) == NULL);
+
+            for (uint8_t avail = 4; avail <= OPTHDR_MAXLEN; avail += 4)
+            {
+                for (uint32_t i = 0; i < 64; ++i)
+                {
+                    const uint32_t presentmask = (i % 2) ? (1 << (random() % SUPPORTED_OPTIONS)) : 0;
+                    const struct option_recipe *r = opt_pool->getRecipe(protos[p], c, avail, presentmask);
+
+                    if (r == NULL)
+                        continue;
+
+                    ++found;
+                    CHECK(r->len <= avail && r->len % 4 == 0);
+                    CHECK(r->occurrences > 0);
+                    CHECK(!(r->optmask & presentmask));
+
+                    /* the options of the protocol only */
+                    for (uint8_t o = 0; o < r->occurrences; ++o)
+                    {
+                        CHECK(r->optIndex[o] >= (p ? FIRST_TCPOPT : FIRST_IPOPT));
+                        CHECK(r->optIndex[o] <= (p ? LAST_TCPOPT : LAST_IPOPT));
+                        CHECK(r->occ[o].off + r->occ[o].len <= r->len);
+                    }
+                }
+            }
+
+            /* every option is enabled in the check configuration */
+            CHECK(found > 0);
+        }
+    }
+}
+
+/*
+ * OptionPool::markRandomBytes: out of the random ranges an option applied
+ * again writes the same bytes of the recipe, and the MD5SIG signature is random
+ * (memset_random leaves some bytes zero: only a part of it is checked)
+ */
+static void checkRecipeRandomBytes(void)
+{
+    const uint8_t protos[2] = { IPPROTO_IP, IPPROTO_TCP };
+    struct optHdrData oD;
+
+    for (uint8_t p = 0; p < 2; ++p)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            const struct option_recipe *r = opt_pool->getRecipe(protos[p], i % 2, OPTHDR_MAXLEN, 0);
+            bool random[OPTHDR_MAXLEN];
+
+            if (r == NULL)
+                continue;
+
+            memset(random, 0, sizeof (random));
+            for (uint8_t k = 0; k < r->randoms; ++k)
+            {
+                CHECK(r->random[k].len > 0 && r->random[k].off + r->random[k].len <= r->len);
+                CHECK(k == 0 || r->random[k].off >= r->random[k - 1].off + r->random[k - 1].len);
+
+                for (uint8_t j = 0; j < r->random[k].len; ++j)
+                    random[r->random[k].off + j] = true;
+            }
+
+            for (uint8_t o = 0; o < r->occurrences; ++o)
+            {
+                const struct option_occurrence &occ = r->occ[o];
+
+                memset(&oD, 0, sizeof (oD));
+                oD.actual_opts_len = OPTHDR_MAXLEN - occ.len;
+                CHECK(opt_pool->get(r->optIndex[o])->optApply(&oD) == occ.len);
+
+                for (uint8_t j = 0; j < occ.len; ++j)
+                {
+                    if (!random[occ.off + j])
+                        CHECK(oD.optshdr[oD.actual_opts_len + j] == r->bytes[occ.off + j]);
+                }
+
+                /* kind and length are fixed, the 16 bytes after are the signature */
+                if (r->optIndex[o] == SJ_TCPOPT_MD5SIG)
+                {
+                    uint8_t randoms = 0;
+                    for (uint8_t j = 2; j < TCPOPT_MD5SIG_SIZE; ++j)
+                        randoms += random[occ.off + j];
+
+                    CHECK(!random[occ.off] && !random[occ.off + 1]);
+                    CHECK(randoms >= (TCPOPT_MD5SIG_SIZE - 2) / 2);
+                }
+            }
+        }
+    }
+}
+
+/* a TCP/IPv4 segment without payload and with correct checksums */
+static void checkSegment(vector<unsigned char> &buf, uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport,
+                         uint32_t seq, uint32_t ack, uint8_t flags, uint8_t ttl)
+{
+    const uint16_t totlen = sizeof (struct iphdr) + sizeof (struct tcphdr);
+
+    buf.assign(totlen, 0);
+
+    struct iphdr *ip = (struct iphdr *) &buf[0];
+    struct tcphdr *tcp = (struct tcphdr *) &buf[sizeof (struct iphdr)];
+
+    ip->version = 4;
+    ip->ihl = sizeof (struct iphdr) / 4;
+    ip->tot_len = htons(totlen);
+    ip->id = htons(random());
+    ip->ttl = ttl;
+    ip->protocol = IPPROTO_TCP;
+    ip->saddr = saddr;
+    ip->daddr = daddr;
+
+    tcp->source = htons(sport);
+    tcp->dest = htons(dport);
+    tcp->seq = htonl(seq);
+    tcp->ack_seq = htonl(ack);
+    tcp->doff = sizeof (struct tcphdr) / 4;
+    tcp->syn = (flags & TH_SYN) != 0;
+    tcp->ack = (flags & TH_ACK) != 0;
+    tcp->window = htons(65535);
+
+    Packet pkt(&buf[0], totlen);
+    pkt.fixSum();
+    buf = pkt.pbuf;
+}
+
+/* packets of a local flow, written in the tunnel side */
+static void conntrackFlow(TCPTrack &conntrack, uint32_t daddr, uint16_t dport, uint32_t packets, uint8_t flags)
+{
+    vector<unsigned char> buf;
+    const uint32_t seq = random();
+
+    for (uint32_t i = 0; i < packets; ++i)
+    {
+        checkSegment(buf, CHECK_LOCAL_ADDR, daddr, 40000, dport, seq, random(), flags, 64);
+        conntrack.writepacket(TUNNEL, &buf[0], buf.size(), 0);
+    }
+}
+
+/* the conntrack cases start from empty maps; NULL when the plugin is not available */
+static TCPTrack *conntrackSetup(void)
+{
+    if (check_plugindir == NULL)
+    {
+        printf("    skipped: the plugin directory is required (-P)\n");
+        return NULL;
+    }
+
+    if (plugin_pool.get() == NULL)
+    {
+        plugin_pool = auto_ptr<PluginPool > (new PluginPool(check_plugindir));
+
+        /* fake_seq does not use the environment */
+        struct sjEnviron sjenv;
+        memset(&sjenv, 0x00, sizeof (sjenv));
+        sjenv.instanced_ucfg = reinterpret_cast<void *> (userconf.get());
+        sjenv.instanced_itopts = reinterpret_cast<void *> (opt_pool.get());
+        plugin_pool->initializeAll(&sjenv);
+    }
+
+    sessiontrack_map = auto_ptr<SessionTrackMap > (new SessionTrackMap);
+    ttlfocus_map = auto_ptr<TTLFocusMap > (new TTLFocusMap(false));
+
+    return new TCPTrack;
+}
+
+/* what the packet path has sent in a cycle for a destination */
+struct conntrack_sent
+{
+    uint32_t daddr; /* the destination watched */
+    uint32_t probes; /* ttl probes toward the network */
+    uint32_t tunnel; /* local packets toward the network */
+    uint32_t network; /* remote packets toward the tunnel */
+    bool ttls[256]; /* the ttl of every probe sent */
+};
+
+static void conntrackWatch(struct conntrack_sent &sent, uint32_t daddr)
+{
+    memset(&sent, 0, sizeof (sent));
+    sent.daddr = daddr;
+}
+
+static const TTLFocus *conntrackFocus(uint32_t daddr)
+{
+    TTLFocusMap::iterator it = ttlfocus_map->find(daddr);
+
+    return (it != ttlfocus_map->end()) ? it->second : NULL;
+}
+
+/* a cycle of the packet path, the ttl probes sent are checked against their markers;
+ * the packets of the other destinations are only discarded */
+static void conntrackCycle(TCPTrack &conntrack, struct conntrack_sent &sent)
+{
+    Packet *pkt;
+
+    sent.probes = sent.tunnel = sent.network = 0;
+
+    conntrack.analyzePacketQueue();
+
+    while ((pkt = conntrack.readpacket(TUNNEL)) != NULL)
+    {
+        if (pkt->ip->daddr != sent.daddr)
+        {
+            delete pkt;
+            continue;
+        }
+
+        if (pkt->source == TRACEROUTE)
+        {
+            const TTLFocus *ttlfocus = conntrackFocus(pkt->ip->daddr);
+            const uint8_t ttl = pkt->ip->ttl;
+
+            CHECK(ttlfocus != NULL);
+            if (ttlfocus != NULL)
+            {
+                CHECK(ntohs(pkt->ip->id) == (ttlfocus->rand_key % 64) + ttl);
+                CHECK(ntohl(pkt->tcp->seq) == (uint32_t) ttlfocus->rand_key + ttl);
+                CHECK(ntohs(pkt->tcp->source) == ttlfocus->puppet_port);
+            }
+
+            /* every ttl is probed once */
+            CHECK(!sent.ttls[ttl]);
+            sent.ttls[ttl] = true;
+            ++sent.probes;
+        }
+        else if (pkt->source == TUNNEL)
+        {
+            ++sent.tunnel;
+        }
+
+        delete pkt;
+    }
+
+    while ((pkt = conntrack.readpacket(NETWORK)) != NULL)
+    {
+        if (pkt->ip->saddr == sent.daddr)
+            ++sent.network;
+
+        delete pkt;
+    }
+}
+
+/* the SYN/ACK answering the ttl probe of a destination */
+static void conntrackProbeAnswer(TCPTrack &conntrack, uint32_t daddr, uint8_t ttl, uint8_t synack_ttl)
+{
+    const TTLFocus *ttlfocus = conntrackFocus(daddr);
+    vector<unsigned char> buf;
+
+    checkSegment(buf, daddr, CHECK_LOCAL_ADDR, 80, ttlfocus->puppet_port,
+                 random(), (uint32_t) ttlfocus->rand_key + ttl + 1, TH_SYN | TH_ACK, synack_ttl);
+    conntrack.writepacket(NETWORK, &buf[0], buf.size(), 0);
+}
+
+/* the ICMP time exceeded of a ttl probe, sent back by the hop before daddr */
+static void conntrackProbeExpired(TCPTrack &conntrack, uint32_t daddr, uint8_t ttl)
+{
+    const TTLFocus *ttlfocus = conntrackFocus(daddr);
+    const uint16_t totlen = 2 * sizeof (struct iphdr) + sizeof (struct icmphdr) + 8;
+    vector<unsigned char> buf(totlen, 0);
+
+    struct iphdr *ip = (struct iphdr *) &buf[0];
+    struct icmphdr *icmp = (struct icmphdr *) &buf[sizeof (struct iphdr)];
+    struct iphdr *badiph = (struct iphdr *) &buf[sizeof (struct iphdr) + sizeof (struct icmphdr)];
+    struct tcphdr *badtcph = (struct tcphdr *) ((unsigned char *) badiph + sizeof (struct iphdr));
+
+    ip->version = badiph->version = 4;
+    ip->ihl = badiph->ihl = sizeof (struct iphdr) / 4;
+    ip->tot_len = htons(totlen);
+    ip->ttl = 250;
+    ip->protocol = IPPROTO_ICMP;
+    ip->saddr = daddr ^ htonl(0xFF);
+    ip->daddr = CHECK_LOCAL_ADDR;
+
+    icmp->type = ICMP_TIME_EXCEEDED;
+
+    /* the header of the probe and the first 8 bytes of its tcp header */
+    badiph->tot_len = htons(sizeof (struct iphdr) + sizeof (struct tcphdr));
+    badiph->id = htons((ttlfocus->rand_key % 64) + ttl);
+    badiph->protocol = IPPROTO_TCP;
+    badiph->saddr = CHECK_LOCAL_ADDR;
+    badiph->daddr = daddr;
+    badtcph->source = htons(ttlfocus->puppet_port);
+    badtcph->dest = htons(80);
+    badtcph->seq = htonl(ttlfocus->rand_key + ttl);
+
+    Packet pkt(&buf[0], totlen);
+    pkt.fixSum();
+    conntrack.writepacket(NETWORK, &pkt.pbuf[0], totlen, 0);
+}
+
+/*
+ * TCPTrack::injectTTLProbe: the probes leave in bursts of TTLPROBE_BURST,
+ * the first SYN/ACK releases the kept packets and a late one can only lower
+ * the estimate; without answers the timeout starts after the last probe
+ */
+static void checkTTLProbeBurst(void)
+{
+    auto_ptr<TCPTrack> conntrack(conntrackSetup());
+    if (conntrack.get() == NULL)
+        return;
+
+    const uint8_t max_ttl_probe = userconf->runcfg.max_ttl_probe;
+    const uint32_t daddr = checkRemote(0);
+    const uint32_t silent = checkRemote(1);
+    struct conntrack_sent sent;
+
+    conntrackWatch(sent, daddr);
+
+    /* a connection not seen opening is admitted at TTLADMIT_PACKETS: that segment is kept */
+    conntrackFlow(*conntrack, daddr, 80, TTLADMIT_PACKETS, TH_ACK);
+
+    for (uint32_t total = 0; total < max_ttl_probe;)
+    {
+        conntrackCycle(*conntrack, sent);
+        CHECK(sent.probes == min((uint32_t) TTLPROBE_BURST, max_ttl_probe - total));
+        CHECK(sent.tunnel == (total ? 0 : TTLADMIT_PACKETS - 1));
+
+        if (!sent.probes)
+            break;
+
+        total += sent.probes;
+    }
+
+    for (uint32_t ttl = 1; ttl <= max_ttl_probe; ++ttl)
+        CHECK(sent.ttls[ttl]);
+
+    /* all of them are in flight: nothing more is sent waiting the answers */
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.probes == 0 && sent.tunnel == 0);
+
+    /* the first answer is consumed and releases the segment */
+    conntrackProbeAnswer(*conntrack, daddr, 9, 55);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 0 && sent.tunnel == 1);
+
+    const TTLFocus *ttlfocus = conntrackFocus(daddr);
+    CHECK(ttlfocus->status == TTL_KNOWN);
+    CHECK(ttlfocus->ttl_estimate == 9 && ttlfocus->ttl_synack == 55);
+
+    /* the late answers are consumed, only a lower ttl we sent is used */
+    conntrackProbeAnswer(*conntrack, daddr, 12, 52);
+    conntrackProbeAnswer(*conntrack, daddr, 6, 58);
+    conntrackProbeAnswer(*conntrack, daddr, max_ttl_probe + 1, 20);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 0 && sent.probes == 0);
+    CHECK(ttlfocus->ttl_estimate == 6 && ttlfocus->ttl_synack == 58);
+
+    /* a destination never answering: the 2 seconds start after the last burst */
+    conntrackWatch(sent, silent);
+    conntrackFlow(*conntrack, silent, 80, TTLADMIT_PACKETS, TH_ACK);
+
+    for (uint32_t cycle = 0; cycle <= max_ttl_probe / TTLPROBE_BURST; ++cycle)
+        conntrackCycle(*conntrack, sent);
+
+    conntrackCycle(*conntrack, sent);
+    sj_clock += 2;
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(silent)->status == TTL_BRUTEFORCE && sent.tunnel == 0);
+
+    /* the kept segment is released in the cycle after the timeout, without new probes */
+    sj_clock += 1;
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(silent)->status == TTL_UNKNOWN);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.tunnel == 1 && sent.probes == 0);
+
+    conntrack.reset();
+    ttlfocus_map.reset();
+    sessiontrack_map.reset();
+}
+
+/* the passive estimate of a SYN/ACK ttl against the initial 64, 128 and 255 */
+static void checkTTLPassiveEstimate(void)
+{
+    CHECK(TTLFocus::passiveEstimate(64) == 1);
+    CHECK(TTLFocus::passiveEstimate(50) == 15);
+    CHECK(TTLFocus::passiveEstimate(1) == 64);
+    CHECK(TTLFocus::passiveEstimate(128) == 1);
+    CHECK(TTLFocus::passiveEstimate(100) == 29);
+    CHECK(TTLFocus::passiveEstimate(255) == 1);
+    CHECK(TTLFocus::passiveEstimate(200) == 56);
+}
+
+/* a connection to a new destination: the local SYN and the SYN/ACK with its ttl */
+static void conntrackConnect(TCPTrack &conntrack, struct conntrack_sent &sent, uint32_t daddr, uint8_t synack_ttl)
+{
+    vector<unsigned char> buf;
+    const uint32_t isn = random();
+
+    conntrackWatch(sent, daddr);
+
+    checkSegment(buf, CHECK_LOCAL_ADDR, daddr, 40000, 80, isn, 0, TH_SYN, 64);
+    conntrack.writepacket(TUNNEL, &buf[0], buf.size(), 0);
+    conntrackCycle(conntrack, sent);
+    CHECK(sent.tunnel == 1 && sent.probes == 0);
+    CHECK(conntrackFocus(daddr)->status == TTL_PASSIVE);
+
+    if (!synack_ttl)
+        return;
+
+    checkSegment(buf, daddr, CHECK_LOCAL_ADDR, 80, 40000, random(), isn + 1, TH_SYN | TH_ACK, synack_ttl);
+    conntrack.writepacket(NETWORK, &buf[0], buf.size(), 0);
+}
+
+/*
+ * TTLFocus states after a SYN: PASSIVE until the SYN/ACK, PROVISIONAL with
+ * the two confirmation probes, KNOWN when confirmed or not contradicted,
+ * BRUTEFORCE when contradicted or when the SYN/ACK is not seen
+ */
+static void checkTTLPassive(void)
+{
+    auto_ptr<TCPTrack> conntrack(conntrackSetup());
+    if (conntrack.get() == NULL)
+        return;
+
+    const uint32_t confirmed = checkRemote(0);
+    const uint32_t nearer = checkRemote(1);
+    const uint32_t farther = checkRemote(2);
+    const uint32_t unanswered = checkRemote(3);
+    const uint32_t silent = checkRemote(4);
+    struct conntrack_sent sent;
+    vector<unsigned char> buf;
+
+    /* the SYN/ACK passes to the tunnel and the two probes leave in the same cycle */
+    conntrackConnect(*conntrack, sent, confirmed, 50);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 1 && sent.probes == 2);
+    CHECK(sent.ttls[14] && sent.ttls[15]);
+
+    const TTLFocus *ttlfocus = conntrackFocus(confirmed);
+    CHECK(ttlfocus->status == TTL_PROVISIONAL);
+    CHECK(ttlfocus->ttl_estimate == 15 && ttlfocus->ttl_synack == 50);
+
+    /* the answer at ttl_estimate confirms it */
+    conntrackProbeAnswer(*conntrack, confirmed, 15, 50);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 0 && sent.probes == 0);
+    CHECK(ttlfocus->status == TTL_KNOWN && ttlfocus->ttl_estimate == 15);
+
+    /* an answer below the estimate restarts the bruteforce in the same cycle */
+    conntrackConnect(*conntrack, sent, nearer, 50);
+    conntrackCycle(*conntrack, sent);
+
+    const uint8_t provisional_key = conntrackFocus(nearer)->rand_key;
+    const uint16_t puppet_port = conntrackFocus(nearer)->puppet_port;
+
+    conntrackProbeAnswer(*conntrack, nearer, 10, 54);
+    conntrackWatch(sent, nearer);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(nearer)->status == TTL_BRUTEFORCE);
+    CHECK(sent.probes == TTLPROBE_BURST);
+
+    /* the answer at ttl_estimate arriving after the bursts doesn't match them */
+    conntrackCycle(*conntrack, sent);
+    checkSegment(buf, nearer, CHECK_LOCAL_ADDR, 80, puppet_port,
+                 random(), (uint32_t) provisional_key + 15 + 1, TH_SYN | TH_ACK, 50);
+    conntrack->writepacket(NETWORK, &buf[0], buf.size(), 0);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 0);
+    CHECK(conntrackFocus(nearer)->status == TTL_BRUTEFORCE);
+
+    /* an expired at ttl_estimate means a destination farther */
+    conntrackConnect(*conntrack, sent, farther, 50);
+    conntrackCycle(*conntrack, sent);
+    conntrackProbeExpired(*conntrack, farther, 14);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 0);
+    CHECK(conntrackFocus(farther)->status == TTL_PROVISIONAL);
+    conntrackProbeExpired(*conntrack, farther, 15);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 0);
+    CHECK(conntrackFocus(farther)->status == TTL_BRUTEFORCE);
+
+    /* the confirmation probes not answered leave the estimate accepted */
+    conntrackConnect(*conntrack, sent, unanswered, 110);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.probes == 2 && sent.ttls[18] && sent.ttls[19]);
+    sj_clock += 3;
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(unanswered)->status == TTL_KNOWN);
+    CHECK(conntrackFocus(unanswered)->ttl_estimate == 19);
+
+    /* without the SYN/ACK the bruteforce starts after TTLPASSIVE_TIMEOUT */
+    conntrackConnect(*conntrack, sent, silent, 0);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(silent)->status == TTL_PASSIVE);
+    sj_clock += TTLPASSIVE_TIMEOUT + 1;
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(silent)->status == TTL_BRUTEFORCE);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.probes == TTLPROBE_BURST);
+
+    conntrack.reset();
+    ttlfocus_map.reset();
+    sessiontrack_map.reset();
+}
+
+/* the destination of a SYN admitted in a map, with the estimate confirmed when given */
+static TTLFocus &prefixFocus(TTLFocusMap &map, uint32_t daddr, uint8_t confirmed_estimate)
+{
+    vector<unsigned char> buf;
+
+    checkSegment(buf, CHECK_LOCAL_ADDR, daddr, 40000, 80, random(), 0, TH_SYN, 64);
+
+    Packet pkt(&buf[0], buf.size());
+    TTLFocus &ttlfocus = map.get(pkt);
+
+    if (ttlfocus.status == TTL_UNADMITTED)
+        map.admit(ttlfocus, pkt);
+
+    if (confirmed_estimate)
+    {
+        ttlfocus.ttl_estimate = confirmed_estimate;
+        ttlfocus.status = TTL_KNOWN;
+        map.learnPrefix(ttlfocus);
+    }
+
+    return ttlfocus;
+}
+
+/*
+ * TTLFocusMap::learnPrefix and inheritPrefix: a single destination is replaced,
+ * the agreeing ones make the estimate KNOWN, a disagreement disables the prefix
+ */
+static void checkTTLPrefix(void)
+{
+    TTLFocusMap map(false);
+
+    /* the first destination of a /24 has nothing to inherit */
+    TTLFocus &first = prefixFocus(map, checkRemote(0, 1), 0);
+    CHECK(first.status == TTL_PASSIVE);
+    first.ttl_estimate = 10;
+    first.status = TTL_KNOWN;
+    map.learnPrefix(first);
+
+    TTLFocus &second = prefixFocus(map, checkRemote(0, 2), 0);
+    CHECK(second.status == TTL_PROVISIONAL);
+    CHECK(second.ttl_estimate == 10 && second.ttl_synack == 0 && second.sent_probe == 0);
+
+    /* another /24 is not affected */
+    CHECK(prefixFocus(map, checkRemote(1, 2), 0).status == TTL_PASSIVE);
+
+    /* a model of a single destination is replaced by the next one */
+    second.ttl_estimate = 12;
+    map.learnPrefix(second);
+    CHECK(prefixFocus(map, checkRemote(0, 3), 0).ttl_estimate == 12);
+
+    /* TTLPREFIX_TRUSTED_HOSTS agreeing destinations: KNOWN without probes */
+    for (uint8_t host = 1; host < TTLPREFIX_TRUSTED_HOSTS; ++host)
+    {
+        TTLFocus &ttlfocus = prefixFocus(map, checkRemote(0, 10 + host), 12);
+        CHECK(ttlfocus.ttl_estimate == 12);
+    }
+
+    TTLFocus &trusted = prefixFocus(map, checkRemote(0, 20), 0);
+    CHECK(trusted.status == TTL_KNOWN && trusted.ttl_estimate == 12);
+
+    /* a disagreement disables the prefix: the new destinations are searched again */
+    prefixFocus(map, checkRemote(0, 21), 14);
+    CHECK(prefixFocus(map, checkRemote(0, 22), 0).status == TTL_PASSIVE);
+    prefixFocus(map, checkRemote(0, 23), 12);
+    CHECK(prefixFocus(map, checkRemote(0, 24), 0).status == TTL_PASSIVE);
+
+    /* the models over TTLPREFIX_MEMORY_THRESHOLD are dropped by manage */
+    prefixFocus(map, checkRemote(2, 1), 8);
+    CHECK(prefixFocus(map, checkRemote(2, 2), 0).status == TTL_PROVISIONAL);
+
+    struct ttlfocus_cache_record record;
+    memset(&record, 0, sizeof (record));
+    record.ttl_estimate = 8;
+
+    for (uint32_t prefix = 0; prefix < TTLPREFIX_MEMORY_THRESHOLD; ++prefix)
+    {
+        record.daddr = htonl(0x0a000000 | (prefix << 8));
+        TTLFocus ttlfocus(record, &map);
+        map.learnPrefix(ttlfocus);
+    }
+
+    map.manage();
+    CHECK(prefixFocus(map, checkRemote(2, 3), 0).status == TTL_PASSIVE);
+}
+
+/* on the packet path an inherited estimate doesn't keep the packets */
+static void checkTTLPrefixInherited(void)
+{
+    auto_ptr<TCPTrack> conntrack(conntrackSetup());
+    if (conntrack.get() == NULL)
+        return;
+
+    const uint32_t trusted = checkRemote(0, 100);
+    const uint32_t provisional = checkRemote(1, 100);
+    struct conntrack_sent sent;
+    vector<unsigned char> buf;
+
+    for (uint8_t host = 1; host <= TTLPREFIX_TRUSTED_HOSTS; ++host)
+        prefixFocus(*ttlfocus_map, checkRemote(0, host), 12);
+
+    prefixFocus(*ttlfocus_map, checkRemote(1, 1), 12);
+
+    /* trusted: KNOWN at once, the synack ttl is taken from the host's own SYN/ACK */
+    conntrackWatch(sent, trusted);
+    checkSegment(buf, CHECK_LOCAL_ADDR, trusted, 40000, 80, 1000, 0, TH_SYN, 64);
+    conntrack->writepacket(TUNNEL, &buf[0], buf.size(), 0);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.tunnel == 1 && sent.probes == 0);
+    CHECK(conntrackFocus(trusted)->status == TTL_KNOWN && conntrackFocus(trusted)->ttl_estimate == 12);
+
+    checkSegment(buf, trusted, CHECK_LOCAL_ADDR, 80, 40000, random(), 1001, TH_SYN | TH_ACK, 52);
+    conntrack->writepacket(NETWORK, &buf[0], buf.size(), 0);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 1 && sent.probes == 0);
+    CHECK(conntrackFocus(trusted)->ttl_synack == 52);
+
+    /* provisional: the two confirmation probes leave with the SYN */
+    conntrackWatch(sent, provisional);
+    checkSegment(buf, CHECK_LOCAL_ADDR, provisional, 40000, 80, 1000, 0, TH_SYN, 64);
+    conntrack->writepacket(TUNNEL, &buf[0], buf.size(), 0);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.tunnel == 1 && sent.probes == 2);
+    CHECK(sent.ttls[11] && sent.ttls[12]);
+    CHECK(conntrackFocus(provisional)->status == TTL_PROVISIONAL);
+
+    conntrack.reset();
+    ttlfocus_map.reset();
+    sessiontrack_map.reset();
+}
+
+/*
+ * TCPTrack::admitTTLFocus: a SYN is admitted at once, the other packets at
+ * TTLADMIT_PACKETS of their flow, never where the port is not hacked; the
+ * probes of a second are TTLPROBE_BUDGET at most
+ */
+static void checkTTLAdmission(void)
+{
+    auto_ptr<TCPTrack> conntrack(conntrackSetup());
+    if (conntrack.get() == NULL)
+        return;
+
+    const uint32_t none = checkRemote(0);
+    const uint32_t handshake = checkRemote(1);
+    const uint32_t flow = checkRemote(2);
+    const uint32_t late = checkRemote(3);
+    struct conntrack_sent sent;
+
+    /* a port never hacked: the SYN passes and no search starts */
+    conntrackWatch(sent, none);
+    conntrackFlow(*conntrack, none, CHECK_PORT_NONE, 1, TH_SYN);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.tunnel == 1 && sent.probes == 0);
+    CHECK(conntrackFocus(none)->status == TTL_UNADMITTED);
+    CHECK(conntrack->getStats().ttl_unadmitted == 1);
+
+    /* a HANDSHAKE port is not hacked anymore when the flow would be admitted */
+    conntrackWatch(sent, handshake);
+    conntrackFlow(*conntrack, handshake, CHECK_PORT_HANDSHAKE, TTLADMIT_PACKETS + 2, TH_ACK);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.tunnel == TTLADMIT_PACKETS + 2 && sent.probes == 0);
+    CHECK(conntrackFocus(handshake)->status == TTL_UNADMITTED);
+
+    /* TTLADMIT_PACKETS packets of a flow: the last one starts the bruteforce and is kept */
+    conntrackWatch(sent, flow);
+    conntrackFlow(*conntrack, flow, 80, TTLADMIT_PACKETS - 1, TH_ACK);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(flow)->status == TTL_UNADMITTED);
+    conntrackFlow(*conntrack, flow, 80, 1, TH_ACK);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(flow)->status == TTL_BRUTEFORCE);
+    CHECK(sent.tunnel == 0 && sent.probes == TTLPROBE_BURST);
+
+    /* more bursts than the budget of a second */
+    sj_clock += 1;
+    const uint64_t start = conntrack->getStats().ttl_probes;
+    const uint32_t destinations = TTLPROBE_BUDGET / TTLPROBE_BURST + 4;
+
+    for (uint32_t i = 0; i < destinations; ++i)
+        conntrackFlow(*conntrack, checkRemote(10 + i), 80, TTLADMIT_PACKETS, TH_ACK);
+
+    conntrackWatch(sent, late);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrack->getStats().ttl_probes - start == TTLPROBE_BUDGET);
+
+    /* exhausted: a flow is not admitted, and nothing more is sent in this second */
+    conntrackFlow(*conntrack, late, 80, TTLADMIT_PACKETS, TH_ACK);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(late)->status == TTL_UNADMITTED);
+    CHECK(conntrack->getStats().ttl_probes - start == TTLPROBE_BUDGET);
+
+    /* the next second the bursts continue and the next packet admits the flow */
+    sj_clock += 1;
+    conntrackFlow(*conntrack, late, 80, 1, TH_ACK);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(late)->status == TTL_BRUTEFORCE);
+    CHECK(conntrack->getStats().ttl_probes - start > TTLPROBE_BUDGET);
+    CHECK(conntrack->getStats().ttl_probes - start <= 2 * TTLPROBE_BUDGET);
+
+    conntrack.reset();
+    ttlfocus_map.reset();
+    sessiontrack_map.reset();
+}
+
+/*
+ * TTLFocusMap::schedule and dueProbes: the events are popped in time order, an
+ * earlier schedule replaces the pending event, a later one or a deleted
+ * destination leaves a stale entry which is skipped
+ */
+static void checkProbeSchedule(void)
+{
+    TTLFocusMap map(false);
+    vector<TTLFocus *> due;
+    const time_t now = sj_clock;
+    const uint8_t offsets[] = {5, 1, 3, 2, 4, 7, 6};
+    const uint8_t events = sizeof (offsets) / sizeof (offsets[0]);
+    TTLFocus *ttlfocus[sizeof (offsets) / sizeof (offsets[0])];
+
+    for (uint8_t i = 0; i < events; ++i)
+    {
+        ttlfocus[i] = &prefixFocus(map, checkRemote(i), 0);
+        map.schedule(*ttlfocus[i], now + offsets[i]);
+        CHECK(ttlfocus[i]->probe_event == now + offsets[i]);
+    }
+
+    map.dueProbes(due);
+    CHECK(due.empty());
+
+    /* one second at time: the destination due and no other */
+    for (uint8_t t = 1; t <= 5; ++t)
+    {
+        sj_clock = now + t;
+        due.clear();
+        map.dueProbes(due);
+        CHECK(due.size() == 1);
+        if (due.size() == 1)
+        {
+            CHECK(due[0]->daddr == checkRemote(find(offsets, offsets + events, t) - offsets));
+            CHECK(due[0]->probe_event == 0);
+        }
+    }
+
+    /* an earlier event replaces the pending one, the stale entry is not returned */
+    map.schedule(*ttlfocus[6], now + 10);
+    CHECK(ttlfocus[6]->probe_event == now + 6);
+    map.schedule(*ttlfocus[5], now + 5);
+    CHECK(ttlfocus[5]->probe_event == now + 5);
+
+    /* a deleted destination is skipped */
+    map.schedule(*ttlfocus[0], now + 6);
+    map.erase(ttlfocus[0]->daddr);
+    delete ttlfocus[0];
+
+    /* more events due together are popped in time order */
+    sj_clock = now + 20;
+    due.clear();
+    map.dueProbes(due);
+    CHECK(due.size() == 2);
+    if (due.size() == 2)
+        CHECK(due[0] == ttlfocus[5] && due[1] == ttlfocus[6]);
+
+    /* the stale entries are consumed with them */
+    due.clear();
+    map.dueProbes(due);
+    CHECK(due.empty());
+}
+
+/* a destination KNOWN through the passive estimate: ttl_estimate 15, ttl_synack 50 */
+static void conntrackKnown(TCPTrack &conntrack, struct conntrack_sent &sent, uint32_t daddr)
+{
+    conntrackConnect(conntrack, sent, daddr, 50);
+    conntrackCycle(conntrack, sent);
+    conntrackProbeAnswer(conntrack, daddr, 15, 50);
+    conntrackCycle(conntrack, sent);
+    CHECK(conntrackFocus(daddr)->status == TTL_KNOWN);
+}
+
+/* the destination is used when its revalidation is due */
+static void conntrackRevalidate(TCPTrack &conntrack, struct conntrack_sent &sent, uint32_t daddr)
+{
+    if (sj_clock < conntrackFocus(daddr)->next_probe_time)
+        sj_clock = conntrackFocus(daddr)->next_probe_time;
+
+    conntrackWatch(sent, daddr);
+    conntrackFlow(conntrack, daddr, 80, 1, TH_ACK);
+    conntrackCycle(conntrack, sent);
+    CHECK(sent.tunnel == 1 && sent.probes == 2 && sent.ttls[14] && sent.ttls[15]);
+    CHECK(conntrackFocus(daddr)->status == TTL_KNOWN && conntrackFocus(daddr)->revalidating);
+}
+
+/*
+ * the revalidation of a KNOWN estimate: the two probes after
+ * TTLREVALIDATE_INTERVAL, or TTLREVALIDATE_DRIFT after a change of the
+ * SYN/ACK ttl, or at the first use of a cached estimate; only a
+ * disagreement restarts the bruteforce
+ */
+static void checkTTLRevalidation(void)
+{
+    auto_ptr<TCPTrack> conntrack(conntrackSetup());
+    if (conntrack.get() == NULL)
+        return;
+
+    const uint32_t confirmed = checkRemote(0);
+    const uint32_t nearer = checkRemote(1);
+    const uint32_t farther = checkRemote(2);
+    const uint32_t drifted = checkRemote(3);
+    const uint32_t cached = checkRemote(4);
+    struct conntrack_sent sent;
+    vector<unsigned char> buf;
+
+    /* confirmed: the next check is TTLREVALIDATE_INTERVAL later */
+    conntrackKnown(*conntrack, sent, confirmed);
+    CHECK(conntrackFocus(confirmed)->next_probe_time == sj_clock + TTLREVALIDATE_INTERVAL);
+
+    conntrackRevalidate(*conntrack, sent, confirmed);
+    conntrackProbeAnswer(*conntrack, confirmed, 15, 50);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(confirmed)->status == TTL_KNOWN && !conntrackFocus(confirmed)->revalidating);
+    CHECK(conntrackFocus(confirmed)->next_probe_time == sj_clock + TTLREVALIDATE_INTERVAL);
+
+    /* not answered: the estimate is kept */
+    conntrackRevalidate(*conntrack, sent, confirmed);
+    sj_clock += 3;
+    conntrackFlow(*conntrack, confirmed, 80, 1, TH_ACK);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(confirmed)->status == TTL_KNOWN && !conntrackFocus(confirmed)->revalidating);
+    CHECK(conntrackFocus(confirmed)->ttl_estimate == 15);
+
+    /* an answer below the estimate restarts the bruteforce */
+    conntrackKnown(*conntrack, sent, nearer);
+    conntrackRevalidate(*conntrack, sent, nearer);
+    conntrackProbeAnswer(*conntrack, nearer, 12, 53);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(nearer)->status == TTL_BRUTEFORCE);
+
+    /* as an expired at the estimate */
+    conntrackKnown(*conntrack, sent, farther);
+    conntrackRevalidate(*conntrack, sent, farther);
+    conntrackProbeExpired(*conntrack, farther, 15);
+    conntrackCycle(*conntrack, sent);
+    CHECK(conntrackFocus(farther)->status == TTL_BRUTEFORCE);
+
+    /* a different SYN/ACK ttl anticipates the check to TTLREVALIDATE_DRIFT */
+    conntrackKnown(*conntrack, sent, drifted);
+    checkSegment(buf, drifted, CHECK_LOCAL_ADDR, 80, 40000, random(), random(), TH_ACK, 47);
+    conntrack->writepacket(NETWORK, &buf[0], buf.size(), 0);
+    conntrackCycle(*conntrack, sent);
+    CHECK(sent.network == 1);
+    CHECK(conntrackFocus(drifted)->next_probe_time == sj_clock + TTLREVALIDATE_DRIFT);
+    conntrackRevalidate(*conntrack, sent, drifted);
+
+    /* a cached estimate is checked at its first use */
+    struct ttlfocus_cache_record record;
+    memset(&record, 0, sizeof (record));
+    memcpy(record.probe_dummy, conntrackFocus(drifted)->probe_dummy, sizeof (record.probe_dummy));
+    ((struct iphdr *) record.probe_dummy)->daddr = cached;
+    record.daddr = cached;
+    record.access_timestamp = sj_clock;
+    record.ttl_estimate = 15;
+    record.ttl_synack = 50;
+    ttlfocus_map->insert(pair<uint32_t, TTLFocus *>(cached, new TTLFocus(record, ttlfocus_map.get())));
+
+    sj_clock += 1;
+    conntrackRevalidate(*conntrack, sent, cached);
+
+    conntrack.reset();
+    ttlfocus_map.reset();
+    sessiontrack_map.reset();
+}
+
+/* records the seconds of its expirations, and is armed again at the given delay */
+class check_timer : public TimerEntry
+{
+public:
+    time_t fired;
+    uint32_t count;
+    time_t rearm;
+
+    check_timer(void) :
+    fired(0),
+    count(0),
+    rearm(0)
+    {
+    }
+
+    time_t expired(void)
+    {
+        const time_t later = rearm ? sj_clock + rearm : 0;
+
+        fired = sj_clock;
+        ++count;
+        rearm = 0;
+
+        return later;
+    }
+};
+
+/*
+ * the timing wheel on its own: the deadlines on every level are cascaded down
+ * and expire exactly at their second, the ones already in the past (armed from
+ * outside or again inside expired) at the next one
+ */
+static void checkTimerWheel(void)
+{
+    const time_t saved_clock = sj_clock;
+    const time_t start = 1 << 20; /* a turn of the second wheel: level 1 slot 0 */
+    const time_t delays[] = {1, 63, 64, 100, 4095, 4096, 5000, 262143, 262144, 300000};
+    const uint32_t count = sizeof (delays) / sizeof (delays[0]);
+    check_timer timers[sizeof (delays) / sizeof (delays[0])];
+    check_timer past, rehooked;
+    /* declared after the entries: destroyed first, it detaches them */
+    TimerWheel wheel;
+    uint32_t i;
+
+    sj_clock = start;
+    wheel.advance(start - 1);
+
+    for (i = 0; i < count; ++i)
+        wheel.arm(timers[i], start + delays[i]);
+    CHECK(wheel.size() == count);
+
+    /* re-armed within a cascade: the last arm wins */
+    wheel.arm(timers[1], start + 4000);
+    wheel.arm(timers[1], start + delays[1]);
+    CHECK(wheel.size() == count);
+
+    for (sj_clock = start; sj_clock <= start + delays[count - 1]; ++sj_clock)
+    {
+        wheel.advance(sj_clock);
+
+        /* a deadline in the past is expired in the next second */
+        if (sj_clock == start + 70)
+            wheel.arm(past, start + 10);
+
+        /* a deadline re-armed at the current second inside expired */
+        if (sj_clock == start + 200)
+        {
+            wheel.arm(rehooked, start + 201);
+            rehooked.rearm = -1;
+        }
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        CHECK(timers[i].count == 1);
+        CHECK(timers[i].fired == start + delays[i]);
+    }
+
+    CHECK(past.count == 1 && past.fired == start + 71);
+    CHECK(rehooked.count == 2 && rehooked.fired == start + 202);
+    CHECK(wheel.size() == 0);
+
+    /* an entry disarmed is never expired */
+    wheel.arm(past, sj_clock + 100);
+    wheel.disarm(past);
+    CHECK(!past.armed() && wheel.size() == 0);
+    wheel.arm(past, sj_clock + 101);
+    wheel.disarm(past);
+    wheel.advance(sj_clock + 200);
+    CHECK(past.count == 1);
+
+    sj_clock = saved_clock;
+}
+
+/*
+ * the offload requests of a cycle are a batch over KPOLICY_CTNL_BATCH on a
+ * real ctnetlink socket: the flows are not connections of the kernel, so
+ * every request must be answered by its own ENOENT, in both directions for
+ * the flows without a known opener, and no flow is offloaded
+ */
+static void checkOffloadBatch(void)
+{
+    if (getuid() || geteuid())
+    {
+        printf("    skipped: ctnetlink requires root\n");
+        return;
+    }
+
+    const bool saved_offload = userconf->runcfg.offload;
+    userconf->runcfg.offload = true;
+    auto_ptr<KernelPolicy> policy(new KernelPolicy);
+    userconf->runcfg.offload = saved_offload;
+
+    const uint8_t flags[] = {TH_SYN, TH_SYN | TH_ACK, TH_ACK};
+    const uint32_t flows = KPOLICY_CTNL_BATCH + 6;
+    vector<unsigned char> buf;
+    vector<SessionTrack *> queued;
+    uint32_t i;
+
+    sessiontrack_map = auto_ptr<SessionTrackMap > (new SessionTrackMap);
+    sessiontrack_map->prepareOffload(policy.get());
+
+    for (i = 0; i < flows; ++i)
+    {
+        checkSegment(buf, CHECK_LOCAL_ADDR, checkRemote(i / 256, i % 256), 40000, CHECK_PORT_NONE, random(), 0, flags[i % 3], 64);
+        Packet pkt(&buf[0], buf.size());
+        SessionTrack &sessiontrack = sessiontrack_map->get(pkt);
+        sessiontrack_map->offload(sessiontrack);
+        queued.push_back(&sessiontrack);
+    }
+
+    CHECK(queued[0]->opener == SESSIONTRACK_OPENER_LOCAL);
+    CHECK(queued[1]->opener == SESSIONTRACK_OPENER_REMOTE);
+    CHECK(queued[2]->opener == SESSIONTRACK_OPENER_UNKNOWN);
+
+    vector<int> errors;
+    policy->offloadFlows(queued, errors);
+    if (errors.size() == flows && errors[0] == ENOTCONN)
+    {
+        printf("    skipped: ctnetlink is not usable\n");
+        sessiontrack_map.reset();
+        return;
+    }
+
+    CHECK(errors.size() == flows);
+    CHECK((uint32_t) count(errors.begin(), errors.end(), ENOENT) == flows);
+
+    /* the same through the queue of the cycle, and the queue is consumed */
+    CHECK(sessiontrack_map->flushOffloads() == 0);
+    CHECK(sessiontrack_map->flushOffloads() == 0);
+
+    for (i = 0; i < flows; ++i)
+    {
+        CHECK(queued[i]->finished && !queued[i]->offloaded);
+        CHECK(queued[i]->opener == (i % 3 == 0 ? SESSIONTRACK_OPENER_LOCAL :
+                                    i % 3 == 1 ? SESSIONTRACK_OPENER_REMOTE : SESSIONTRACK_OPENER_UNKNOWN));
+    }
+
+    CHECK(!policy->flowOffloaded(*queued[0]) && !policy->flowOffloaded(*queued[1]));
+
+    sessiontrack_map.reset();
+}
+
+static const struct check_case check_cases[] = {
+    { "snapshot-paging", checkSnapshotPaging},
+    { "optionpool-recipe-selection", checkRecipeSelection},
+    { "optionpool-recipe-random-bytes", checkRecipeRandomBytes},
+    { "ttlprobe-burst", checkTTLProbeBurst},
+    { "ttlfocus-passive-estimate", checkTTLPassiveEstimate},
+    { "ttlfocus-passive", checkTTLPassive},
+    { "ttlfocus-prefix", checkTTLPrefix},
+    { "ttlfocus-prefix-inherited", checkTTLPrefixInherited},
+    { "ttlfocus-admission", checkTTLAdmission},
+    { "ttlfocus-probe-schedule", checkProbeSchedule},
+    { "ttlfocus-revalidation", checkTTLRevalidation},
+    { "timerwheel", checkTimerWheel},
+    { "offload-batch", checkOffloadBatch},
+    { NULL, NULL}
+};
+
+/* the check location is a temporary directory with the minimal configuration */
+static void checkLocationSetup(char *dir)
+{
+    char path[LARGEBUF];
+    FILE *f;
+
+    if (mkdtemp(dir) == NULL)
+        RUNTIME_EXCEPTION("unable to create %s: %s", dir, strerror(errno));
+
+    /* the plugin of the conntrack cases, loaded from -P */
+    snprintf(path, sizeof (path), "%s/%s", dir, FILE_PLUGINSENABLER);
+    if ((f = fopen(path, "w")) == NULL)
+        RUNTIME_EXCEPTION("unable to write %s: %s", path, strerror(errno));
+    fprintf(f, "fake_seq,PRESCRIPTION,GUILTY\n");
+    fclose(f);
+
+    /* every port is hacked, but the ones checking the ttl search admission */
+    snprintf(path, sizeof (path), "%s/%s", dir, FILE_AGGRESSIVITY);
+    if ((f = fopen(path, "w")) == NULL)
+        RUNTIME_EXCEPTION("unable to write %s: %s", path, strerror(errno));
+    fprintf(f, "0:65535 %s\n%u %s\n%u %s\n", AGG_N_ALWAYS, CHECK_PORT_NONE, AGG_N_NONE, CHECK_PORT_HANDSHAKE, AGG_N_HANDSHAKE);
+    fclose(f);
+
+    /* every option is enabled, ONESHOT except the NOPs and the timestamps */
+    snprintf(path, sizeof (path), "%s/%s", dir, FILE_IPTCPOPT_CONF);
+    if ((f = fopen(path, "w")) == NULL)
+        RUNTIME_EXCEPTION("unable to write %s: %s", path, strerror(errno));
+    for (uint8_t i = 0; i < SUPPORTED_OPTIONS; ++i)
+        fprintf(f, "%u,%u\n", i, (i == SJ_IPOPT_NOOP || i == SJ_IPOPT_TIMESTAMP || i == SJ_TCPOPT_NOP || i == SJ_TCPOPT_TIMESTAMP) ?
+                NOT_CORRUPT : ONESHOT);
+    fclose(f);
+}
+
+static void checkLocationCleanup(const char *dir)
+{
+    char path[LARGEBUF];
+    struct dirent *entry;
+    DIR *d;
+
+    if ((d = opendir(dir)) == NULL)
+        return;
+
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof (path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    char dir[] = "/tmp/sniffjoke-check.XXXXXX";
+    uint32_t failed = 0;
+
+    int charopt;
+    while ((charopt = getopt(argc, argv, "P:")) != -1)
+    {
+        if (charopt != 'P')
+        {
+            printf("usage: %s [-P plugin directory] [case]\n", argv[0]);
+            return 1;
+        }
+
+        check_plugindir = optarg;
+    }
+
+    if (optind < argc)
+        filter = argv[optind];
+
+    debug.setLevel(SUPPRESS_LEVEL);
+    init_random();
+    sj_clock = time(NULL);
+
+    try
+    {
+        checkLocationSetup(dir);
+
+        struct sj_cmdline_opts useropt;
+        memset(&useropt, 0x00, sizeof (useropt));
+        snprintf(useropt.basedir, sizeof (useropt.basedir), "/tmp/");
+        snprintf(useropt.location, sizeof (useropt.location), "%s", dir + strlen("/tmp/"));
+        useropt.debug_level = SUPPRESS_LEVEL;
+        useropt.max_ttl_probe = DEFAULT_MAX_TTLPROBE;
+        useropt.active = true;
+
+        userconf = auto_ptr<UserConf > (new UserConf(useropt));
+        opt_pool = auto_ptr<OptionPool > (new OptionPool);
+    }
+    catch (runtime_error &exception)
+    {
+        printf("unable to setup the check location: %s\n", exception.what());
+        checkLocationCleanup(dir);
+        return 1;
+    }
+
+    for (const struct check_case *cc = check_cases; cc->name != NULL; ++cc)
+    {
+        if (filter != NULL && strstr(cc->name, filter) == NULL)
+            continue;
+
+        const uint32_t before = check_failures;
+        case_failures = 0;
+
+        try
+        {
+            cc->fn();
+        }
+        catch (runtime_error &exception)
+        {
+            printf("    runtime exception: %s\n", exception.what());
+            ++check_failures;
+        }
+
+        if (case_failures > CHECK_MAXPRINT)
+            printf("    ... %u more\n", case_failures - CHECK_MAXPRINT);
+
+        printf("%-32s %s\n", cc->name, (check_failures == before) ? "ok" : "FAILED");
+        if (check_failures != before)
+            ++failed;
+    }
+
+    plugin_pool.reset();
+    opt_pool.reset();
+    userconf.reset();
+    checkLocationCleanup(dir);
+
+    return failed ? 1 : 0;
+}
@@ -53,6 +53,8 @@
 #define DEFAULT_DEBUG_LEVEL     2
 #define DEFAULT_MAX_TTLPROBE    35
 #define DEFAULT_GW_MAC_ADDR     ""
+#define DEFAULT_IO_BACKEND      "poll"  /* poll, uring: PF_PACKET, xdp, xdp-generic: AF_XDP, nfqueue: inline */
+#define DEFAULT_OFFLOAD         false
 
 /* this is not configurabile anyway in some (wrong) local network the
  * class 1.0.0.0/8 is used and should be require change this puppet-IP */
@@ -70,6 +72,7 @@
 #define FILE_LOG                "sniffjoke.log"
 #define FILE_LOG_SESSION        "sniffjoke.log.sessions"
 #define FILE_LOG_PACKET         "sniffjoke.log.packets"
+#define FILE_ADMINSOCKET        "sniffjoke.sock"
 #define FILE_IPTCPOPT_CONF      "iptcp-options.conf"
 #define IPTCPOPT_TEST_PLUGIN    "HDRoptions_probe"
 #define GENERIC_MARKER_FILE     "THIS_IS_GENERIC"
@@ -188,15 +191,28 @@
 #define SUPPORTED_OPTIONS           (LAST_TCPOPT + 1)
 
 #define NETIOBURSTSIZE                          10      /* 10 CYCLES OF I/O (10 in + 10 out pkts max) */
-#define SESSIONTRACKMAP_MANAGE_ROUTINE_TIMER    300     /* (5 MINUTES */
-#define TTLFOCUSMAP_MANAGE_ROUTINE_TIMER        3600    /* (1 HOUR) */
 #define SESSIONTRACK_EXPIRYTIME                 200     /* access expire time in seconds (5 MINUTES) */
+#define SESSIONTRACK_OFFLOAD_GRACE              1000000000 /* ns of packets still in flight after an offload (1 SECOND) */
 #define TTLFOCUS_EXPIRYTIME                     604800  /* access expire time in seconds (1 WEEK) */
 #define PLUGINHASH_EXPIRYTIME                   10      /* hash expire time in seconds since creation (10 SECONDS)*/
 #define PLUGINCACHE_EXPIRYTIME                  200     /* access expire time in seconds (5 MINUTES) */
 #define TTLFOCUSMAP_MEMORY_THRESHOLD            1024    /* 1024 DESTINATIONS */
 #define SESSIONTRACKMAP_MEMORY_THRESHOLD        1024    /* 1024 TCP SESSIONS */
 #define TTLPROBE_RETRY_ON_UNKNOWN               600     /* schedule time on UNKNOWN TTL status (10 MINUTES) */
+#define TTLPROBE_BURST                          12      /* ttl probes sent in a single cycle */
+#define TTLADMIT_PACKETS                        4       /* packets of a flow admitting its destination to the ttl search */
+#define TTLPROBE_BUDGET                         256     /* ttl and option probes sent every second, for all the destinations */
+#define TTLPASSIVE_TIMEOUT                      2       /* seconds waited for the SYN/ACK of a new destination */
+#define TTLREVALIDATE_INTERVAL                  600     /* seconds between two checks of a KNOWN estimate (10 MINUTES) */
+#define TTLREVALIDATE_DRIFT                     60      /* check delay after a change of the SYN/ACK ttl */
+#define TTLPREFIX_NETMASK                       0xFFFFFF00 /* destinations aggregated in the same hop count model (/24) */
+#define TTLPREFIX_TRUSTED_HOSTS                 3       /* agreeing destinations making an inherited estimate KNOWN */
+#define TTLPREFIX_MEMORY_THRESHOLD              4096    /* 4096 PREFIXES */
+#define OPTPROBE_TIMEOUT                        2       /* seconds waited for the answers to an option probe */
+#define OPTPROBE_SEQ_BASE                       0x100   /* tcp->seq of the option probes: rand_key + base + index */
+
+/* log2 buckets of the performance histograms: bucket N count the samples in [2^N, 2^(N+1)) */
+#define HISTOGRAM_BUCKETS                       32
 
 /* enable the intensive debug: DEVELOPERS AND TESTER ONLY! */
 #if 0
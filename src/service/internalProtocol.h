@@ -36,6 +36,10 @@
 #define SHOWPORT_COMMAND_TYPE       8
 #define INFO_COMMAND_TYPE           9
 #define TTLMAP_COMMAND_TYPE        10
+#define PLUGINSTAT_COMMAND_TYPE    11
+#define LATENCY_COMMAND_TYPE       12
+#define INFOPAGE_COMMAND_TYPE      13
+#define TTLMAPPAGE_COMMAND_TYPE    14
 #define COMMAND_ERROR_MSG         100
 
 /* this contain the description of the entire block */
@@ -46,6 +50,65 @@ struct command_ret
     /* follow in non error MSG the data dump */
 };
 
+/*
+ * the stream admin protocol (unix socket FILE_ADMINSOCKET): every request is a
+ * uint32_t length, the length field included, followed by the command string;
+ * the answers are the same blocks of the datagram protocol, that are already
+ * prefixed by command_ret.cmd_len.
+ *
+ * on the stream "info" and "ttlmap" are paginated: "info" takes a snapshot of
+ * the map and return the first page, "info <cursor>" the following ones.
+ */
+#define ADMIN_STREAM_CLIENTS    8
+#define ADMIN_STREAM_MAXCMD     256
+
+struct page_ret
+{
+    uint32_t cursor; /* cursor of the next page, 0 when the snapshot is over */
+    uint32_t total; /* records in the snapshot */
+};
+
+/*
+ * the live statistics segment: POSIX shared memory SJ_STATS_SHM, written by the
+ * service once every loop and mapped read only by "sniffjokectl top". the
+ * reader retries the copy while seq is odd or changed during the copy (seqlock).
+ */
+#define SJ_STATS_SHM            "/sniffjoke.stats"
+#define SJ_STATS_MAGIC          0x534a5354 /* SJST */
+#define SJ_STATS_VERSION        3
+
+struct sj_stats
+{
+    time_t clock;
+    uint64_t loops;
+    uint64_t tunnel_rx_pkts; /* read from the tunnel: the local outgoing traffic */
+    uint64_t tunnel_rx_bytes;
+    uint64_t tunnel_tx_pkts;
+    uint64_t tunnel_tx_bytes;
+    uint64_t network_rx_pkts; /* read from the network: the incoming traffic */
+    uint64_t network_rx_bytes;
+    uint64_t network_tx_pkts;
+    uint64_t network_tx_bytes;
+    uint32_t queue_depth[4]; /* YOUNG, KEEP, HACK, SEND */
+    uint32_t sessions;
+    uint32_t ttlfocus;
+    uint64_t injected[4]; /* INNOCENT, PRESCRIPTION, GUILTY, MALFORMED */
+    uint64_t drops; /* packets removed from the queues */
+    uint64_t malformed; /* packets not parsed, flushed bypassing the queues */
+    uint64_t filter_matches; /* incoming copies of our injections removed by PacketFilter */
+    uint64_t ttl_probes; /* ttl and option probes sent */
+    uint64_t ttl_unadmitted; /* packets to destinations not admitted to the ttl search */
+    uint64_t offloaded_flows; /* finished tcp flows moved to the kernel, see --offload */
+};
+
+struct sj_stats_segment
+{
+    uint32_t magic;
+    uint32_t version;
+    volatile uint32_t seq;
+    struct sj_stats stats;
+};
+
 /* this is the WHO value in SJStatus */
 #define STAT_ACTIVE         1
 #define STAT_DEBUGL         2
@@ -111,4 +174,39 @@ struct ttl_record
     uint8_t ttlestimate;
 };
 
+/* this struct is used for pluginstat command handling, one for every
+ * loaded plugin; the histograms are in cycles (HISTOGRAM_BUCKETS, log2) */
+#define PLUGINSTAT_NAMELEN  64
+
+struct plugin_record
+{
+    char name[PLUGINSTAT_NAMELEN];
+    uint64_t condition_calls;
+    uint64_t condition_hits;
+    uint64_t apply_calls;
+    uint64_t injected_pkts;
+    uint64_t injected_bytes;
+    uint64_t integrity_failures;
+    uint64_t orig_removals;
+    uint64_t fix_drops;
+    uint64_t condition_cycles;
+    uint64_t apply_cycles;
+    uint32_t condition_hist[HISTOGRAM_BUCKETS];
+    uint32_t apply_hist[HISTOGRAM_BUCKETS];
+};
+
+/* this struct is used for latency command handling: a record for every
+ * queue (residence time) and for every packet source (forwarding latency,
+ * from the kernel to the dequeue for the write). the values are in ns */
+#define LATENCY_NAMELEN     32
+
+struct latency_record
+{
+    char name[LATENCY_NAMELEN];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t hist[HISTOGRAM_BUCKETS];
+};
+
 #endif /* SJ_INTERNALPROTOCOL_H */
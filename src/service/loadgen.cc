@@ -0,0 +1,800 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * sniffjoke-loadgen is the traffic generator of sniffjoke-loadtest: the
+ * server side (--server) runs in the namespace behind the gateway with a
+ * TCP sink, a TCP echo and an UDP echo; the client side keeps a number of
+ * concurrent flows open for --duration seconds, through the TUN of a
+ * sniffjoke running in its namespace:
+ *
+ *  handshake   connect and close, the connect time is the latency sample
+ *  bulk        --bulk-size bytes to the sink, for the goodput
+ *  rpc         --rpc-size bytes echoed over a kept connection, the rtt is sampled
+ *  udp         --rpc-size datagrams echoed, the rtt is sampled and the timeouts lost
+ *
+ * with --churn every handshake and bulk connection goes to a new destination
+ * of the /16 of --target, so every connection is also a new TTL bruteforce.
+ * --iface and --pid add the packets per second seen on the interface and the
+ * cpu spent by the sniffjoke process for every packet.
+ */
+
+#include "Utils.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define LOADGEN_PORT_ECHO           7
+#define LOADGEN_PORT_SINK           9
+#define LOADGEN_DEFAULT_TARGET      "10.200.0.1"
+#define LOADGEN_DEFAULT_DURATION    10
+#define LOADGEN_DEFAULT_BULK        1048576
+#define LOADGEN_DEFAULT_RPC         128
+#define LOADGEN_MAX_EVENTS          256
+#define LOADGEN_CHUNK               16384
+#define LOADGEN_CHURN_SPAN          65000       /* destinations used by --churn */
+#define LOADGEN_UDP_TIMEOUT         1000000000  /* ns before a datagram is considered lost */
+#define LOADGEN_TICK_MS             100
+
+static volatile bool loadgen_alive = true;
+
+/* defined here, is needed by SniffJoke.cc */
+void sigtrap(int signal)
+{
+    loadgen_alive = false;
+}
+
+enum flow_kind_t
+{
+    FLOW_HANDSHAKE = 0, FLOW_BULK = 1, FLOW_RPC = 2, FLOW_UDP = 3, FLOW_KINDS = 4
+};
+
+static const char * const flow_names[FLOW_KINDS] = {"handshake", "bulk", "rpc", "udp"};
+
+struct flow
+{
+    flow_kind_t kind;
+    int fd;
+    bool connected;
+    uint64_t left; /* bulk: bytes still to send; rpc and udp: bytes of the reply still expected */
+    uint64_t start_ns; /* connect or request time */
+};
+
+struct flow_stats
+{
+    uint64_t completed; /* handshakes, transfers or exchanges */
+    uint64_t bytes; /* payload sent */
+    uint64_t errors; /* refused, reset or, for udp, lost */
+    vector<uint32_t> latency_us;
+};
+
+struct loadgen_conf
+{
+    struct in_addr target;
+    uint32_t flows[FLOW_KINDS];
+    uint32_t bulk_size;
+    uint32_t rpc_size;
+    uint32_t duration;
+    bool churn;
+};
+
+static int epfd = -1;
+static struct loadgen_conf conf;
+static struct flow_stats stats[FLOW_KINDS];
+static uint32_t churn_next;
+static char payload[LOADGEN_CHUNK];
+
+static void setNonblocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL);
+
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        RUNTIME_EXCEPTION("unable to set O_NONBLOCK: %s", strerror(errno));
+}
+
+static void pollSet(int fd, uint32_t events, void *ptr, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof (ev));
+    ev.events = events;
+    ev.data.ptr = ptr;
+
+    if (epoll_ctl(epfd, op, fd, &ev) == -1)
+        RUNTIME_EXCEPTION("epoll_ctl on fd %d: %s", fd, strerror(errno));
+}
+
+static uint32_t latencyUs(uint64_t start_ns)
+{
+    return (sj_monotonic_ns() - start_ns) / 1000;
+}
+
+/* -------------------------------------------------------------------------- client */
+
+static void flowStart(struct flow &f)
+{
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr = conf.target;
+    sin.sin_port = htons((f.kind == FLOW_HANDSHAKE || f.kind == FLOW_BULK) ? LOADGEN_PORT_SINK : LOADGEN_PORT_ECHO);
+
+    if (conf.churn && (f.kind == FLOW_HANDSHAKE || f.kind == FLOW_BULK))
+        sin.sin_addr.s_addr = htonl(ntohl(conf.target.s_addr) + (churn_next++ % LOADGEN_CHURN_SPAN));
+
+    if ((f.fd = socket(AF_INET, f.kind == FLOW_UDP ? SOCK_DGRAM : SOCK_STREAM, 0)) == -1)
+        RUNTIME_EXCEPTION("unable to open a %s socket: %s", flow_names[f.kind], strerror(errno));
+
+    setNonblocking(f.fd);
+
+    f.connected = false;
+    f.left = (f.kind == FLOW_BULK) ? conf.bulk_size : 0;
+    f.start_ns = sj_monotonic_ns();
+
+    if (connect(f.fd, (struct sockaddr *) &sin, sizeof (sin)) == -1 && errno != EINPROGRESS)
+        RUNTIME_EXCEPTION("unable to connect the %s flow: %s", flow_names[f.kind], strerror(errno));
+
+    pollSet(f.fd, EPOLLOUT, &f, EPOLL_CTL_ADD);
+}
+
+static void flowRestart(struct flow &f, bool failed)
+{
+    if (failed)
+        ++stats[f.kind].errors;
+
+    close(f.fd);
+    flowStart(f);
+}
+
+/* rpc and udp: a request of rpc_size bytes, the flow waits the same amount back */
+static bool flowRequest(struct flow &f)
+{
+    if (send(f.fd, payload, conf.rpc_size, MSG_NOSIGNAL) != (ssize_t) conf.rpc_size)
+        return false;
+
+    stats[f.kind].bytes += conf.rpc_size;
+    f.left = conf.rpc_size;
+    f.start_ns = sj_monotonic_ns();
+
+    pollSet(f.fd, EPOLLIN, &f, EPOLL_CTL_MOD);
+    return true;
+}
+
+static void flowEvent(struct flow &f, uint32_t events)
+{
+    struct flow_stats &fs = stats[f.kind];
+
+    if (!f.connected)
+    {
+        int err = 0;
+        socklen_t errlen = sizeof (err);
+
+        if (getsockopt(f.fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1 || err)
+        {
+            flowRestart(f, true);
+            return;
+        }
+
+        f.connected = true;
+
+        switch (f.kind)
+        {
+        case FLOW_HANDSHAKE:
+            fs.latency_us.push_back(latencyUs(f.start_ns));
+            ++fs.completed;
+            flowRestart(f, false);
+            return;
+        case FLOW_RPC:
+        case FLOW_UDP:
+            if (!flowRequest(f))
+                flowRestart(f, true);
+            return;
+        default:
+            break;
+        }
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        flowRestart(f, true);
+        return;
+    }
+
+    if (f.kind == FLOW_BULK)
+    {
+        while (f.left)
+        {
+            const size_t len = f.left < sizeof (payload) ? f.left : sizeof (payload);
+            const ssize_t ret = send(f.fd, payload, len, MSG_NOSIGNAL);
+
+            if (ret == -1)
+            {
+                if (errno != EAGAIN)
+                    flowRestart(f, true);
+                return;
+            }
+
+            f.left -= ret;
+            fs.bytes += ret;
+        }
+
+        ++fs.completed;
+        flowRestart(f, false);
+        return;
+    }
+
+    /* rpc and udp replies */
+    char buf[LOADGEN_CHUNK];
+    const ssize_t ret = recv(f.fd, buf, sizeof (buf), 0);
+
+    if (ret <= 0)
+    {
+        if (ret == -1 && errno == EAGAIN)
+            return;
+
+        flowRestart(f, true);
+        return;
+    }
+
+    f.left = ((uint64_t) ret < f.left) ? f.left - ret : 0;
+    if (f.left)
+        return;
+
+    fs.latency_us.push_back(latencyUs(f.start_ns));
+    ++fs.completed;
+
+    if (!flowRequest(f))
+        flowRestart(f, true);
+}
+
+/* a datagram without reply is lost: the flow sends the next one */
+static void udpTimeouts(vector<struct flow> &flows)
+{
+    const uint64_t now = sj_monotonic_ns();
+
+    for (vector<struct flow>::iterator it = flows.begin(); it != flows.end(); ++it)
+    {
+        if (it->kind != FLOW_UDP || !it->connected || now - it->start_ns < LOADGEN_UDP_TIMEOUT)
+            continue;
+
+        ++stats[FLOW_UDP].errors;
+        if (!flowRequest(*it))
+            flowRestart(*it, true);
+    }
+}
+
+/* -------------------------------------------------------------------------- measures */
+
+static bool ifacePackets(const char *iface, uint64_t &packets)
+{
+    const char * const counters[] = {"tx_packets", "rx_packets"};
+    char path[MEDIUMBUF];
+
+    packets = 0;
+
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        unsigned long value;
+
+        snprintf(path, sizeof (path), "/sys/class/net/%s/statistics/%s", iface, counters[i]);
+
+        FILE *stream = fopen(path, "r");
+        if (stream == NULL)
+            return false;
+
+        const bool read = (fscanf(stream, "%lu", &value) == 1);
+        fclose(stream);
+
+        if (!read)
+            return false;
+
+        packets += value;
+    }
+
+    return true;
+}
+
+/* utime + stime of a process, in clock ticks */
+static bool processTicks(pid_t pid, uint64_t &ticks)
+{
+    char path[MEDIUMBUF], line[LARGEBUF];
+    unsigned long utime, stime;
+
+    snprintf(path, sizeof (path), "/proc/%d/stat", pid);
+
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL)
+        return false;
+
+    const bool read = (fgets(line, sizeof (line), stream) != NULL);
+    fclose(stream);
+
+    /* the command name can contain spaces: the fields are counted after its ')' */
+    const char *p = read ? strrchr(line, ')') : NULL;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return false;
+
+    ticks = utime + stime;
+    return true;
+}
+
+static uint32_t percentile(vector<uint32_t> &samples, uint32_t pct)
+{
+    if (samples.empty())
+        return 0;
+
+    const size_t idx = (samples.size() * pct) / 100;
+    nth_element(samples.begin(), samples.begin() + idx, samples.end());
+
+    return samples[idx < samples.size() ? idx : samples.size() - 1];
+}
+
+struct loadgen_result
+{
+    double elapsed;
+    uint64_t packets;
+    bool have_packets;
+    double cpu_s;
+    bool have_cpu;
+};
+
+static void loadgenReport(const struct loadgen_result &r, bool json)
+{
+    uint32_t p50[FLOW_KINDS], p99[FLOW_KINDS];
+
+    for (uint8_t k = 0; k < FLOW_KINDS; ++k)
+    {
+        p50[k] = percentile(stats[k].latency_us, 50);
+        p99[k] = percentile(stats[k].latency_us, 99);
+    }
+
+    const double pps = r.have_packets ? r.packets / r.elapsed : 0.0;
+    const double cpu_ns = (r.have_cpu && r.packets) ? r.cpu_s * 1000000000.0 / r.packets : 0.0;
+    const double goodput = stats[FLOW_BULK].bytes * 8 / r.elapsed / 1000000.0;
+
+    if (json)
+    {
+        printf("{\"version\":\"%s\",\"duration_s\":%.3f", SW_VERSION, r.elapsed);
+        for (uint8_t k = 0; k < FLOW_KINDS; ++k)
+        {
+            printf(",\"%s_flows\":%u,\"%s_per_s\":%.1f,\"%s_p50_us\":%u,\"%s_p99_us\":%u,\"%s_errors\":%lu",
+                   flow_names[k], conf.flows[k], flow_names[k], stats[k].completed / r.elapsed,
+                   flow_names[k], p50[k], flow_names[k], p99[k], flow_names[k], (unsigned long) stats[k].errors);
+        }
+        printf(",\"goodput_mbit_s\":%.3f,\"pps\":%.0f,\"cpu_ns_per_pkt\":%.1f,\"cpu_percent\":%.1f}\n",
+               goodput, pps, cpu_ns, r.have_cpu ? 100.0 * r.cpu_s / r.elapsed : 0.0);
+        return;
+    }
+
+    printf("duration             %.2f s, target %s%s\n", r.elapsed, inet_ntoa(conf.target), conf.churn ? " with churn" : "");
+
+    for (uint8_t k = 0; k < FLOW_KINDS; ++k)
+    {
+        if (!conf.flows[k])
+            continue;
+
+        printf("%-9s %4u flows %lu completed (%.1f/s), %lu errors", flow_names[k], conf.flows[k],
+               (unsigned long) stats[k].completed, stats[k].completed / r.elapsed, (unsigned long) stats[k].errors);
+
+        if (k == FLOW_BULK)
+            printf(", goodput %.2f Mbit/s\n", goodput);
+        else
+            printf(", %s p50 %u us p99 %u us\n", k == FLOW_HANDSHAKE ? "connect" : "rtt", p50[k], p99[k]);
+    }
+
+    if (r.have_packets)
+        printf("interface            %.0f pkts/s (%lu packets)\n", pps, (unsigned long) r.packets);
+
+    if (r.have_cpu)
+        printf("sniffjoke cpu        %.1f%%, %.0f ns per packet\n", 100.0 * r.cpu_s / r.elapsed, cpu_ns);
+}
+
+static void runClient(const char *iface, pid_t pid, bool json)
+{
+    vector<struct flow> flows;
+    struct loadgen_result r;
+    uint64_t packets_start = 0, ticks_start = 0, ticks_end = 0;
+
+    memset(&r, 0, sizeof (r));
+    memset_random(payload, sizeof (payload));
+
+    for (uint8_t k = 0; k < FLOW_KINDS; ++k)
+    {
+        for (uint32_t i = 0; i < conf.flows[k]; ++i)
+        {
+            struct flow f;
+            memset(&f, 0, sizeof (f));
+            f.kind = (flow_kind_t) k;
+            flows.push_back(f);
+        }
+    }
+
+    if (flows.empty())
+        RUNTIME_EXCEPTION("no flows requested");
+
+    /* the vector is not resized anymore: the flows can be referenced by epoll */
+    for (vector<struct flow>::iterator it = flows.begin(); it != flows.end(); ++it)
+        flowStart(*it);
+
+    r.have_packets = (iface != NULL && ifacePackets(iface, packets_start));
+    r.have_cpu = (pid && processTicks(pid, ticks_start));
+
+    const uint64_t start = sj_monotonic_ns();
+    const uint64_t end = start + (uint64_t) conf.duration * 1000000000;
+    struct epoll_event events[LOADGEN_MAX_EVENTS];
+
+    while (loadgen_alive && sj_monotonic_ns() < end)
+    {
+        const int nfds = epoll_wait(epfd, events, LOADGEN_MAX_EVENTS, LOADGEN_TICK_MS);
+
+        if (nfds == -1 && errno != EINTR)
+            RUNTIME_EXCEPTION("epoll_wait: %s", strerror(errno));
+
+        for (int i = 0; i < nfds; ++i)
+            flowEvent(*(struct flow *) events[i].data.ptr, events[i].events);
+
+        udpTimeouts(flows);
+    }
+
+    r.elapsed = (sj_monotonic_ns() - start) / 1000000000.0;
+
+    if (r.have_packets)
+    {
+        uint64_t packets_end;
+        r.have_packets = ifacePackets(iface, packets_end);
+        r.packets = packets_end - packets_start;
+    }
+
+    if (r.have_cpu && (r.have_cpu = processTicks(pid, ticks_end)))
+        r.cpu_s = (double) (ticks_end - ticks_start) / sysconf(_SC_CLK_TCK);
+
+    for (vector<struct flow>::iterator it = flows.begin(); it != flows.end(); ++it)
+        close(it->fd);
+
+    loadgenReport(r, json);
+}
+
+/* -------------------------------------------------------------------------- server */
+
+enum endpoint_t
+{
+    LISTEN_SINK, LISTEN_ECHO, UDP_ECHO, CONN_SINK, CONN_ECHO
+};
+
+struct server_conn
+{
+    endpoint_t type;
+    int fd;
+    vector<char> pending; /* echo data not yet written back */
+};
+
+static struct server_conn *serverSocket(endpoint_t type, struct in_addr addr, uint16_t port)
+{
+    struct server_conn *sc = new struct server_conn;
+    struct sockaddr_in sin;
+    int on = 1;
+
+    sc->type = type;
+    if ((sc->fd = socket(AF_INET, type == UDP_ECHO ? SOCK_DGRAM : SOCK_STREAM, 0)) == -1)
+        RUNTIME_EXCEPTION("unable to open the server socket: %s", strerror(errno));
+
+    setsockopt(sc->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+    if (type == UDP_ECHO)
+        setsockopt(sc->fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof (on));
+    setNonblocking(sc->fd);
+
+    memset(&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr = addr;
+    sin.sin_port = htons(port);
+
+    if (bind(sc->fd, (struct sockaddr *) &sin, sizeof (sin)) == -1)
+        RUNTIME_EXCEPTION("unable to bind %s:%u: %s", inet_ntoa(addr), port, strerror(errno));
+
+    if (type != UDP_ECHO && listen(sc->fd, SOMAXCONN) == -1)
+        RUNTIME_EXCEPTION("unable to listen on %s:%u: %s", inet_ntoa(addr), port, strerror(errno));
+
+    pollSet(sc->fd, EPOLLIN, sc, EPOLL_CTL_ADD);
+    return sc;
+}
+
+static void serverClose(struct server_conn *sc)
+{
+    close(sc->fd);
+    delete sc;
+}
+
+static void serverEvent(struct server_conn *sc)
+{
+    char buf[LOADGEN_CHUNK];
+    ssize_t ret;
+
+    switch (sc->type)
+    {
+    case LISTEN_SINK:
+    case LISTEN_ECHO:
+        while ((ret = accept(sc->fd, NULL, NULL)) != -1)
+        {
+            struct server_conn *conn = new struct server_conn;
+            conn->type = (sc->type == LISTEN_SINK) ? CONN_SINK : CONN_ECHO;
+            conn->fd = ret;
+            setNonblocking(conn->fd);
+            pollSet(conn->fd, EPOLLIN, conn, EPOLL_CTL_ADD);
+        }
+        return;
+    case UDP_ECHO:
+        {
+            /* with AnyIP the reply must leave from the address the datagram was sent to */
+            struct sockaddr_in from;
+            struct iovec iov;
+            struct msghdr msg;
+            char control[CMSG_SPACE(sizeof (struct in_pktinfo))];
+
+            for (;;)
+            {
+                iov.iov_base = buf;
+                iov.iov_len = sizeof (buf);
+                memset(&msg, 0, sizeof (msg));
+                msg.msg_name = &from;
+                msg.msg_namelen = sizeof (from);
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof (control);
+
+                if ((ret = recvmsg(sc->fd, &msg, 0)) <= 0)
+                    break;
+
+                iov.iov_len = ret;
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+                {
+                    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+                        ((struct in_pktinfo *) CMSG_DATA(cmsg))->ipi_ifindex = 0;
+                }
+
+                sendmsg(sc->fd, &msg, 0);
+            }
+        }
+        return;
+    case CONN_SINK:
+    case CONN_ECHO:
+        break;
+    }
+
+    /* the echo data is written back before reading more */
+    if (!sc->pending.empty())
+    {
+        if ((ret = send(sc->fd, &sc->pending[0], sc->pending.size(), MSG_NOSIGNAL)) == -1)
+        {
+            if (errno != EAGAIN)
+                serverClose(sc);
+            return;
+        }
+
+        sc->pending.erase(sc->pending.begin(), sc->pending.begin() + ret);
+        if (sc->pending.empty())
+            pollSet(sc->fd, EPOLLIN, sc, EPOLL_CTL_MOD);
+        return;
+    }
+
+    while ((ret = recv(sc->fd, buf, sizeof (buf), 0)) > 0)
+    {
+        if (sc->type == CONN_SINK)
+            continue;
+
+        const ssize_t sent = send(sc->fd, buf, ret, MSG_NOSIGNAL);
+        if (sent == ret)
+            continue;
+
+        sc->pending.assign(buf + (sent > 0 ? sent : 0), buf + ret);
+        pollSet(sc->fd, EPOLLOUT, sc, EPOLL_CTL_MOD);
+        return;
+    }
+
+    if (ret == 0 || errno != EAGAIN)
+        serverClose(sc);
+}
+
+static void runServer(struct in_addr addr)
+{
+    vector<struct server_conn *> listeners;
+    struct epoll_event events[LOADGEN_MAX_EVENTS];
+
+    listeners.push_back(serverSocket(LISTEN_SINK, addr, LOADGEN_PORT_SINK));
+    listeners.push_back(serverSocket(LISTEN_ECHO, addr, LOADGEN_PORT_ECHO));
+    listeners.push_back(serverSocket(UDP_ECHO, addr, LOADGEN_PORT_ECHO));
+
+    LOG_ALL("sink on tcp/%u, echo on tcp/%u and udp/%u of %s", LOADGEN_PORT_SINK,
+            LOADGEN_PORT_ECHO, LOADGEN_PORT_ECHO, inet_ntoa(addr));
+
+    while (loadgen_alive)
+    {
+        const int nfds = epoll_wait(epfd, events, LOADGEN_MAX_EVENTS, LOADGEN_TICK_MS);
+
+        if (nfds == -1 && errno != EINTR)
+            RUNTIME_EXCEPTION("epoll_wait: %s", strerror(errno));
+
+        for (int i = 0; i < nfds; ++i)
+            serverEvent((struct server_conn *) events[i].data.ptr);
+    }
+
+    /* the accepted connections die with the process */
+    for (vector<struct server_conn *>::iterator it = listeners.begin(); it != listeners.end(); ++it)
+        serverClose(*it);
+}
+
+/* -------------------------------------------------------------------------- main */
+
+#define LOADGEN_HELP_FORMAT \
+    "Usage: %s --server [--listen <ip>] | [OPTION]... :\n"\
+    " --server\t\trun the sink and the echo responder\n"\
+    " --listen <ip>\t\taddress of the responder [default: any]\n"\
+    " --target <ip>\t\tdestination of the flows [default: %s]\n"\
+    " --handshake <n>\tconcurrent connect/close flows\n"\
+    " --bulk <n>\t\tconcurrent bulk transfers\n"\
+    " --rpc <n>\t\tconcurrent request/response connections\n"\
+    " --udp <n>\t\tconcurrent udp request/response flows\n"\
+    " --bulk-size <bytes>\tbytes of every bulk transfer [default: %d]\n"\
+    " --rpc-size <bytes>\tbytes of every request and response [default: %d]\n"\
+    " --churn\t\tevery handshake and bulk connection to a new destination\n"\
+    " --duration <s>\t\tlength of the test [default: %d]\n"\
+    " --iface <name>\t\tinterface counted for the packets per second\n"\
+    " --pid <pid>\t\tsniffjoke process measured for the cpu per packet\n"\
+    " --json\t\t\tsingle json record\n"\
+    " --debug <level %d-%d>\tset verbosity level [default: %d]\n"\
+    " --help\t\t\tshow this help\n"
+
+int main(int argc, char **argv)
+{
+    const char *iface = NULL;
+    struct in_addr listen_addr;
+    bool server = false, json = false;
+    uint16_t debug_level = ALL_LEVEL;
+    pid_t pid = 0;
+
+    memset(&conf, 0, sizeof (conf));
+    inet_aton(LOADGEN_DEFAULT_TARGET, &conf.target);
+    listen_addr.s_addr = INADDR_ANY;
+    conf.bulk_size = LOADGEN_DEFAULT_BULK;
+    conf.rpc_size = LOADGEN_DEFAULT_RPC;
+    conf.duration = LOADGEN_DEFAULT_DURATION;
+
+    struct option loadgen_option[] = {
+        { "server", no_argument, NULL, 'S'},
+        { "listen", required_argument, NULL, 'L'},
+        { "target", required_argument, NULL, 'T'},
+        { "handshake", required_argument, NULL, 'H'},
+        { "bulk", required_argument, NULL, 'B'},
+        { "rpc", required_argument, NULL, 'R'},
+        { "udp", required_argument, NULL, 'U'},
+        { "bulk-size", required_argument, NULL, 'b'},
+        { "rpc-size", required_argument, NULL, 'r'},
+        { "churn", no_argument, NULL, 'c'},
+        { "duration", required_argument, NULL, 't'},
+        { "iface", required_argument, NULL, 'i'},
+        { "pid", required_argument, NULL, 'p'},
+        { "json", no_argument, NULL, 'j'},
+        { "debug", required_argument, NULL, 'd'},
+        { "help", no_argument, NULL, 'h'},
+        { NULL, 0, NULL, 0}
+    };
+
+    int charopt;
+    while ((charopt = getopt_long(argc, argv, "SL:T:H:B:R:U:b:r:ct:i:p:jd:h", loadgen_option, NULL)) != -1)
+    {
+        switch (charopt)
+        {
+        case 'S':
+            server = true;
+            break;
+        case 'L':
+            if (!inet_aton(optarg, &listen_addr))
+                goto loadgen_help;
+            break;
+        case 'T':
+            if (!inet_aton(optarg, &conf.target))
+                goto loadgen_help;
+            break;
+        case 'H':
+            conf.flows[FLOW_HANDSHAKE] = atoi(optarg);
+            break;
+        case 'B':
+            conf.flows[FLOW_BULK] = atoi(optarg);
+            break;
+        case 'R':
+            conf.flows[FLOW_RPC] = atoi(optarg);
+            break;
+        case 'U':
+            conf.flows[FLOW_UDP] = atoi(optarg);
+            break;
+        case 'b':
+            conf.bulk_size = atoi(optarg);
+            if (!conf.bulk_size)
+                goto loadgen_help;
+            break;
+        case 'r':
+            conf.rpc_size = atoi(optarg);
+            if (!conf.rpc_size || conf.rpc_size > LOADGEN_CHUNK)
+                goto loadgen_help;
+            break;
+        case 'c':
+            conf.churn = true;
+            break;
+        case 't':
+            conf.duration = atoi(optarg);
+            if (!conf.duration)
+                goto loadgen_help;
+            break;
+        case 'i':
+            iface = optarg;
+            break;
+        case 'p':
+            pid = atoi(optarg);
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'd':
+            debug_level = atoi(optarg);
+            if (debug_level > TESTING_LEVEL)
+                goto loadgen_help;
+            break;
+loadgen_help:
+        case 'h':
+        default:
+            printf(LOADGEN_HELP_FORMAT, argv[0], LOADGEN_DEFAULT_TARGET, LOADGEN_DEFAULT_BULK, LOADGEN_DEFAULT_RPC,
+                   LOADGEN_DEFAULT_DURATION, SUPPRESS_LEVEL, PACKET_LEVEL, ALL_LEVEL);
+            return -1;
+        }
+    }
+
+    debug.setLevel(debug_level);
+    init_random();
+    signal(SIGINT, sigtrap);
+    signal(SIGTERM, sigtrap);
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        if ((epfd = epoll_create(LOADGEN_MAX_EVENTS)) == -1)
+            RUNTIME_EXCEPTION("epoll_create: %s", strerror(errno));
+
+        if (server)
+            runServer(listen_addr);
+        else
+            runClient(iface, pid, json);
+    }
+    catch (runtime_error &exception)
+    {
+        LOG_ALL("[runtime exception] loadgen aborted: %s", exception.what());
+        return 1;
+    }
+
+    close(epfd);
+    return 0;
+}
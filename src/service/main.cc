@@ -59,6 +59,13 @@ static void sj_version(const char *pname)
     " --admin <ip>[:port]\tspecify administration IP address [default: %s:%d]\n"\
     " --force\t\tforce restart (usable when another sniffjoke service is running)\n"\
     " --gw-mac-addr\t\tspecify default gateway mac address [default: is autodetected]\n"\
+    " --io-backend <name>\tpacket I/O: poll or uring (io_uring) on the PF_PACKET socket,\n"\
+    "\t\t\txdp or xdp-generic (AF_XDP, native with fallback to generic,\n"\
+    "\t\t\tor generic only), nfqueue (inline with netfilter queues,\n"\
+    "\t\t\twithout TUN and default route change) [default: %s]\n"\
+    " --offload\t\tmove to the kernel the tcp flows that no hack will touch\n"\
+    "\t\t\tanymore (ports NONE, HANDSHAKE after the handshake),\n"\
+    "\t\t\tnot with the xdp backends [default: %s]\n"\
     " --version\t\tshow sniffjoke version\n"\
     " --help\t\t\tshow this help\n\n"\
     "\t\t\thttp://www.delirandom.net/sniffjoke\n"
@@ -76,7 +83,9 @@ static void sj_help(const char *pname)
            DEFAULT_CHAINING ? "enabled" : "disabled",
            SUPPRESS_LEVEL, PACKET_LEVEL, DEFAULT_DEBUG_LEVEL,
            SUPPRESS_LEVEL, ALL_LEVEL, VERBOSE_LEVEL, DEBUG_LEVEL, SESSION_LEVEL, PACKET_LEVEL,
-           DEFAULT_ADMIN_ADDRESS, DEFAULT_ADMIN_PORT
+           DEFAULT_ADMIN_ADDRESS, DEFAULT_ADMIN_PORT,
+           DEFAULT_IO_BACKEND,
+           DEFAULT_OFFLOAD ? "enabled" : "disabled"
            );
 }
 
@@ -106,6 +115,7 @@ int main(int argc, char **argv)
     useropt.go_foreground = DEFAULT_GO_FOREGROUND;
     useropt.debug_level = DEFAULT_DEBUG_LEVEL;
     useropt.max_ttl_probe = DEFAULT_MAX_TTLPROBE;
+    useropt.offload = DEFAULT_OFFLOAD;
     useropt.force_restart = false;
 
     /*
@@ -131,6 +141,8 @@ int main(int argc, char **argv)
         { "only-plugin", required_argument, NULL, 'p'}, /* not documented in --help */
         { "max-ttl-probe", required_argument, NULL, 'm'}, /* not documented too */
         { "gw-mac-addr", required_argument, NULL, 'e'},
+        { "io-backend", required_argument, NULL, 'n'},
+        { "offload", no_argument, NULL, 'f'},
         { "version", no_argument, NULL, 'v'},
         { "help", no_argument, NULL, 'h'},
         { NULL, 0, NULL, 0}
@@ -207,6 +219,12 @@ int main(int argc, char **argv)
         case 'm':
             useropt.max_ttl_probe = atoi(optarg);
             break;
+        case 'n':
+            snprintf(useropt.io_backend, sizeof (useropt.io_backend), "%s", optarg);
+            break;
+        case 'f':
+            useropt.offload = true;
+            break;
         case 'v':
             sj_version(argv[0]);
             return 0;
@@ -0,0 +1,335 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2011 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * sniffjoke-replay runs the packet path of the service (TCPTrack, the plugins,
+ * the TTL bruteforce and the queues) over a pcap capture, without TUN, root
+ * privileges or network changes, and reports how fast the capture has been
+ * processed: it's the tool to measure a change of the hot path in a repeatable way.
+ *
+ * with --seed the run is a deterministic simulation: sj_clock follows the
+ * timestamps of the capture, the random pool is seeded once and the TTL cache
+ * of the location is not used, so two runs write byte-identical captures.
+ */
+
+#include "Utils.h"
+#include "UserConf.h"
+#include "NetIOReplay.h"
+#include "TCPTrack.h"
+#include "TTLFocus.h"
+#include "SessionTrack.h"
+#include "OptionPool.h"
+#include "PluginPool.h"
+#include "PacketTrace.h"
+#include "HeapCounter.h"
+
+#include <getopt.h>
+
+#define REPLAY_DRAIN_TIMEOUT    5       /* seconds without progress before giving up the queues */
+#define REPLAY_DEFAULT_MTU      1500
+
+extern auto_ptr<UserConf> userconf;
+extern auto_ptr<TTLFocusMap> ttlfocus_map;
+extern auto_ptr<SessionTrackMap> sessiontrack_map;
+extern auto_ptr<OptionPool> opt_pool;
+extern auto_ptr<PluginPool> plugin_pool;
+
+static volatile bool replay_alive = true;
+
+/* defined here, is needed by SniffJoke.cc */
+void sigtrap(int signal)
+{
+    replay_alive = false;
+}
+
+#define REPLAY_HELP_FORMAT \
+    "Usage: %s --input <capture> [OPTION]... :\n"\
+    " --input <file>\t\tpcap or pcapng capture to replay\n"\
+    " --output <prefix>\twrite <prefix>-network.pcap and <prefix>-tunnel.pcap\n"\
+    " --local <ip>[/bits]\tthe local host or network [default: source of the first packet]\n"\
+    " --location <name>\tspecify the network environment [default: %s]\n"\
+    " --dir <name>\t\tspecify the base directory where the location reside [default: %s]\n"\
+    " --only-plugin <name,SCRAMBLE>\tuse only this plugin instead of the location plugins\n"\
+    " --plugin-dir <dir>\tdirectory of the plugins [default: %s]\n"\
+    " --mtu <bytes>\t\tmtu of the replayed network interface [default: %d]\n"\
+    " --no-tcp\t\tdisable tcp mangling\n"\
+    " --no-udp\t\tdisable udp mangling\n"\
+    " --chain\t\tenable chained hacking\n"\
+    " --seed <n>\t\tdeterministic simulation: virtual clock from the capture and seeded randomness\n"\
+    " --debug <level %d-%d>\tset verbosity level [default: %d]\n"\
+    " --help\t\t\tshow this help\n"
+
+static void replay_help(const char *pname)
+{
+    printf(REPLAY_HELP_FORMAT,
+           pname, DEFAULT_LOCATION, WORK_DIR, INSTALL_LIBDIR, REPLAY_DEFAULT_MTU,
+           SUPPRESS_LEVEL, PACKET_LEVEL, DEFAULT_DEBUG_LEVEL);
+}
+
+static uint32_t queuedPackets(TCPTrack &conntrack)
+{
+    const struct sj_stats &stats = conntrack.getStats();
+    uint32_t queued = 0;
+
+    for (uint8_t i = 0; i < sizeof (stats.queue_depth) / sizeof (stats.queue_depth[0]); ++i)
+        queued += stats.queue_depth[i];
+
+    return queued;
+}
+
+static void replayReport(const NetIOReplay &replay, uint64_t elapsed_ns, uint64_t allocations, uint32_t queued)
+{
+    const struct replay_counters &c = replay.counters;
+    const uint64_t in_pkts = c.in_pkts[0] + c.in_pkts[1];
+    const uint64_t in_bytes = c.in_bytes[0] + c.in_bytes[1];
+    const uint64_t out_pkts = c.out_pkts[0] + c.out_pkts[1];
+    const uint64_t out_bytes = c.out_bytes[0] + c.out_bytes[1];
+
+    printf("records read         %lu (%lu not IPv4 or truncated, %lu not of the local network)\n",
+           (unsigned long) c.records, (unsigned long) c.skipped, (unsigned long) c.foreign);
+    printf("packets replayed     %lu from the tunnel, %lu from the network\n",
+           (unsigned long) c.in_pkts[0], (unsigned long) c.in_pkts[1]);
+    printf("packets written      %lu in the network, %lu in the tunnel, %u left in the queues\n",
+           (unsigned long) c.out_pkts[0], (unsigned long) c.out_pkts[1], queued);
+
+    if (!in_pkts)
+        return;
+
+    printf("elapsed              %.3f ms\n", elapsed_ns / 1000000.0);
+    printf("throughput           %.0f pkts/s, %.1f ns/pkt\n",
+           elapsed_ns ? in_pkts * 1000000000.0 / elapsed_ns : 0.0, (double) elapsed_ns / in_pkts);
+    printf("injection overhead   %.3f pkts out/in, %.3f bytes out/in\n",
+           (double) out_pkts / in_pkts, in_bytes ? (double) out_bytes / in_bytes : 0.0);
+    printf("allocations          %lu, %.2f per packet\n", (unsigned long) allocations, (double) allocations / in_pkts);
+}
+
+int main(int argc, char **argv)
+{
+    struct sj_cmdline_opts useropt;
+    const char *input = NULL, *output = NULL, *localnet = NULL, *plugindir = NULL;
+    uint16_t mtu = REPLAY_DEFAULT_MTU;
+    uint32_t seed = 0;
+
+    memset(&useropt, 0x00, sizeof (useropt));
+
+    useropt.admin_port = DEFAULT_ADMIN_PORT;
+    useropt.chaining = DEFAULT_CHAINING;
+    useropt.no_tcp = DEFAULT_NO_TCP;
+    useropt.no_udp = DEFAULT_NO_UDP;
+    useropt.use_whitelist = DEFAULT_USE_WHITELIST;
+    useropt.use_blacklist = DEFAULT_USE_BLACKLIST;
+    useropt.debug_level = DEFAULT_DEBUG_LEVEL;
+    useropt.max_ttl_probe = DEFAULT_MAX_TTLPROBE;
+
+    /* a replay is always active and in foreground */
+    useropt.active = true;
+    useropt.go_foreground = true;
+
+    struct option replay_option[] = {
+        { "input", required_argument, NULL, 'I'},
+        { "output", required_argument, NULL, 'O'},
+        { "local", required_argument, NULL, 'L'},
+        { "dir", required_argument, NULL, 'i'},
+        { "location", required_argument, NULL, 'o'},
+        { "only-plugin", required_argument, NULL, 'p'},
+        { "plugin-dir", required_argument, NULL, 'P'},
+        { "mtu", required_argument, NULL, 'M'},
+        { "chain", no_argument, NULL, 'c'},
+        { "no-tcp", no_argument, NULL, 't'},
+        { "no-udp", no_argument, NULL, 'l'},
+        { "seed", required_argument, NULL, 's'},
+        { "debug", required_argument, NULL, 'd'},
+        { "help", no_argument, NULL, 'h'},
+        { NULL, 0, NULL, 0}
+    };
+
+    int charopt;
+    while ((charopt = getopt_long(argc, argv, "I:O:L:i:o:p:P:M:ctls:d:h", replay_option, NULL)) != -1)
+    {
+        switch (charopt)
+        {
+        case 'I':
+            input = optarg;
+            break;
+        case 'O':
+            output = optarg;
+            break;
+        case 'L':
+            localnet = optarg;
+            break;
+        case 'i':
+            snprintf(useropt.basedir, sizeof (useropt.basedir) - 1, "%s", optarg);
+            if (useropt.basedir[strlen(useropt.basedir) - 1] != '/')
+                useropt.basedir[strlen(useropt.basedir)] = '/';
+            break;
+        case 'o':
+            snprintf(useropt.location, sizeof (useropt.location), "%s", optarg);
+            break;
+        case 'p':
+            snprintf(useropt.onlyplugin, sizeof (useropt.onlyplugin), "%s", optarg);
+            break;
+        case 'P':
+            plugindir = optarg;
+            break;
+        case 'M':
+            mtu = atoi(optarg);
+            if (mtu < 68)
+                goto replay_help;
+            break;
+        case 'c':
+            useropt.chaining = true;
+            break;
+        case 't':
+            useropt.no_tcp = true;
+            break;
+        case 'l':
+            useropt.no_udp = true;
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            if (!seed)
+                goto replay_help;
+            break;
+        case 'd':
+            useropt.debug_level = atoi(optarg);
+            if (useropt.debug_level > TESTING_LEVEL)
+                goto replay_help;
+            break;
+replay_help:
+        case 'h':
+        default:
+            replay_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if (input == NULL)
+    {
+        replay_help(argv[0]);
+        return -1;
+    }
+
+    init_random(seed);
+    signal(SIGINT, sigtrap);
+    signal(SIGTERM, sigtrap);
+
+    try
+    {
+        const bool simulated = (seed != 0);
+
+        if (!simulated)
+        {
+            sj_clock = time(NULL);
+            strftime(sj_clock_str, sizeof (sj_clock_str), "%Y-%m-%d %H:%M:%S", localtime(&sj_clock));
+        }
+
+        /* the captures are opened before UserConf, that chdir in the location */
+        auto_ptr<NetIOReplay> replay(new NetIOReplay(input, output, localnet, simulated));
+
+        userconf = auto_ptr<UserConf > (new UserConf(useropt));
+        userconf->runcfg.net_iface_mtu = mtu;
+
+        /* without log files everything goes to stderr */
+        debug.setLevel(userconf->runcfg.debug_level);
+        if (debug.level() >= PACKET_LEVEL)
+            pkttrace.start(stderr);
+
+        plugin_pool = auto_ptr<PluginPool > (new PluginPool(plugindir));
+        opt_pool = auto_ptr<OptionPool > (new OptionPool);
+        sessiontrack_map = auto_ptr<SessionTrackMap > (new SessionTrackMap);
+        ttlfocus_map = auto_ptr<TTLFocusMap > (new TTLFocusMap(!simulated));
+        auto_ptr<TCPTrack> conntrack(new TCPTrack);
+
+        replay->prepareConntrack(conntrack.get());
+
+        struct sjEnviron environ;
+        environ.instanced_proc = NULL;
+        environ.instanced_mitm = reinterpret_cast<void *> (replay.get());
+        environ.instanced_ct = reinterpret_cast<void *> (conntrack.get());
+        environ.instanced_ucfg = reinterpret_cast<void *> (userconf.get());
+        environ.instanced_ttl = reinterpret_cast<void *> (ttlfocus_map.get());
+        environ.instanced_sex = reinterpret_cast<void *> (sessiontrack_map.get());
+        environ.instanced_itopts = reinterpret_cast<void *> (opt_pool.get());
+        environ.instanced_plugins = reinterpret_cast<void *> (plugin_pool.get());
+
+        plugin_pool->initializeAll(&environ);
+
+        const uint64_t allocations_start = heap_allocations;
+        const uint64_t start = sj_monotonic_ns();
+
+        while (replay_alive && !replay->inputEnded())
+        {
+            if (!simulated)
+                sj_clock = time(NULL);
+            replay->networkIO();
+        }
+
+        const uint64_t elapsed = sj_monotonic_ns() - start;
+        const uint64_t allocations = heap_allocations - allocations_start;
+
+        /* the packets kept by the TTL bruteforce wait its timeout: they are
+         * drained out of the measure, until the queues are empty or stalled;
+         * a simulation moves the virtual clock a second for every pass */
+        uint32_t queued = queuedPackets(*conntrack);
+        time_t progress = sj_clock;
+
+        while (replay_alive && queued && sj_clock - progress < REPLAY_DRAIN_TIMEOUT)
+        {
+            if (simulated)
+                replay->advanceClock(1);
+            else
+                sj_clock = time(NULL);
+
+            replay->networkIO();
+
+            const uint32_t now_queued = queuedPackets(*conntrack);
+            if (now_queued != queued)
+            {
+                queued = now_queued;
+                progress = sj_clock;
+            }
+            else if (!simulated)
+                usleep(1000);
+        }
+
+        replayReport(*replay, elapsed, allocations, queued);
+
+        pkttrace.stop();
+
+        /* the plugins must be destroyed before the structures they refer */
+        conntrack.reset();
+        plugin_pool.reset();
+        ttlfocus_map.reset();
+        sessiontrack_map.reset();
+        opt_pool.reset();
+        replay.reset();
+        userconf.reset();
+    }
+    catch (runtime_error &exception)
+    {
+        LOG_ALL("[runtime exception] replay aborted: %s", exception.what());
+        pkttrace.stop();
+        return 1;
+    }
+
+    return 0;
+}